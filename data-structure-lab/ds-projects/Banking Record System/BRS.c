@@ -1,6 +1,51 @@
+#ifndef _WIN32
+#define _DEFAULT_SOURCE     // localtime_r, flock
+#endif
+
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#else
+#include <direct.h>
+#endif
+
+// Built with -DLAB_INSTRUMENT, the accounts.dat accesses and ledger writes
+// are timed and counted, and the figures are written to brs.instr.json on exit.
+#include "../Instrumentation/lab_instrument.h"
+#include "../Record Store/record_store.h"
+
+// Sanitizer run over every file path (see selfTestFiles()):
+//   gcc -g -O1 -fsanitize=address,undefined -fno-omit-frame-pointer BRS.c -o brs_asan
+//   ./brs_asan --selftest-files
+// (or "cmake --build build --target asan" with ../CMakeLists.txt)
+// Built with -DLAB_FUZZ, the program is instead a fuzz target for one of its
+// file readers (LAB_FUZZ_TARGET=accounts, ledger, names, journal or backup);
+// see ../Fuzzing/lab_fuzz.h for the libFuzzer and AFL builds.
+#define LAB_FUZZ_TARGETS "accounts ledger names journal backup"
+#include "../Fuzzing/lab_fuzz.h"
+
+#define ACCOUNTS_FILE "accounts.dat"
+#define ACCOUNTS_INDEX_FILE "accounts.idx"
+#define LEDGER_FILE "ledger.dat"
+#define LEDGER_INDEX_FILE "ledger.idx"
+#define LEDGER_INDEX_MIN_CAPACITY 1024
+#define LEDGER_LOCK_FILE "ledger.lock"
+#define NAME_INDEX_FILE "names.idx"
+#define NAME_LOG_FILE "names.log"
+#define NAME_LOG_LIMIT 4096         // pending changes before they are merged into names.idx
+#define NAME_LOCK_FILE "names.lock"
+#define ACCOUNTS_LOCK_FILE "accounts.lock"
+#define JOURNAL_FILE "accounts.jnl"
+#define BACKUP_STATE_FILE "backup.state"
+#define SELFTEST_DIR "brs_selftest"
 
 struct Account {
     int accountNumber;
@@ -9,6 +54,117 @@ struct Account {
     float balance;
 };
 
+// One entry of the append-only ledger. Entries of the same account are
+// chained backwards through prevOffset, so a statement never reads another
+// account's entries.
+struct Transaction {
+    int accountNumber;
+    char type;              // 'O'pen, 'D'eposit, 'W'ithdraw, 'M'odify, 'C'lose
+    float amount;
+    float balance;          // balance after the transaction
+    long long timestamp;
+    long long prevOffset;   // previous entry of this account, -1 if none
+};
+
+// ledger.idx: header followed by an open-addressing hash table that maps an
+// account number to its newest ledger entry.
+struct LedgerIndexHeader {
+    char magic[4];
+    int capacity;
+    int used;
+    long long indexedSize;  // ledger bytes reflected in the table
+};
+
+struct LedgerIndexSlot {
+    int accountNumber;
+    int inUse;
+    long long lastOffset;
+    long long count;
+};
+
+// names.idx: header followed by entries sorted by (key, accountNumber).
+// Changes since the last merge sit in names.log as '+'/'-' records and are
+// applied on top of the sorted file when searching.
+struct NameIndexEntry {
+    char key[100];          // normalized: lower case, single spaces
+    char name[100];         // as entered
+    int accountNumber;
+};
+
+struct NameIndexHeader {
+    char magic[4];
+    int count;
+};
+
+struct NameLogRecord {
+    char op;                // '+' add, '-' remove
+    struct NameIndexEntry entry;
+};
+
+// accounts.jnl: every change written to accounts.dat, in order, after a small
+// header. Writers append under the accounts lock, so a position in the
+// journal is a point in time. Each full snapshot starts a new generation.
+struct JournalHeader {
+    char magic[4];
+    int generation;
+};
+
+struct JournalRecord {
+    char op;                // 'U' account written, 'D' account closed
+    struct Account acc;
+};
+
+// A backup file is this header followed by `count` journal records: every
+// account for a full snapshot, the changed ones for an incremental backup.
+struct BackupHeader {
+    char magic[4];
+    char kind;              // 'F' full, 'I' incremental
+    int generation;
+    long long startPos;     // journal span the backup covers
+    long long endPos;
+    long long createdAt;
+    int count;
+};
+
+// backup.state: where the last backup ended, for the next incremental one.
+struct BackupState {
+    int generation;
+    long long position;
+};
+
+// accounts.dat is an array of struct Account kept by the record store:
+// accounts.idx maps account numbers to slots, and a closed account's slot is
+// zeroed (accountType '\0') until the next new account reuses it.
+static int accountSlotFree(const void *record) {
+    return ((const struct Account *)record)->accountType == '\0';
+}
+
+static void clearAccountSlot(void *record) {
+    memset(record, 0, sizeof(struct Account));
+}
+
+static const RsLayout ACCOUNT_LAYOUT = {
+    .record_size = sizeof(struct Account),
+    .key_offset = offsetof(struct Account, accountNumber),
+    .key_size = sizeof(int),
+    .records_per_page = 4096 / sizeof(struct Account),
+    .is_free = accountSlotFree,
+    .clear = clearAccountSlot
+};
+
+// RS_WRITE only with the accounts lock held. The layout has no lock hooks:
+// snapshots read under that lock, which a second flock would deadlock on, so
+// a reader scans past a stale index and the next writer rebuilds it.
+static RecordStore *openAccounts(int flags) {
+    return rs_open(ACCOUNTS_FILE, ACCOUNTS_INDEX_FILE, &ACCOUNT_LAYOUT, flags);
+}
+
+// A record read back from any file is printed and copied with %s and
+// strcpy(), so its name must end inside the field whatever the file holds.
+static void sanitizeAccount(struct Account *acc) {
+    acc->name[sizeof(acc->name) - 1] = '\0';
+}
+
 // Function declarations
 void newAccount();
 void depositAccount();
@@ -17,10 +173,45 @@ void balanceAccount();
 void allAccountHoldList();
 void closeAnAccount();
 void modifyAnAccount();
+void accountStatement();
+void ledgerAppend(int accountNumber, char type, float amount, float balance);
+int bulkStatements(const char *fromDate, const char *toDate, const char *outPath);
+void searchByName();
+void nameIndexUpdate(char op, const char *name, int accountNumber);
+int lockFile(const char *path);
+void unlockFile(int lock);
+int lockAccounts();
+void unlockAccounts(int lock);
+int findAccount(RecordStore *rs, int acn, struct Account *acc);
+RecordStore *lockAccount(int acn, struct Account *acc, int *lock);
+int saveAccount(RecordStore *rs, const struct Account *changed, char type, float amount);
+void releaseAccount(RecordStore *rs, const struct Account *changed, int lock, char type, float amount);
+void journalRecord(char op, const struct Account *acc);
+int snapshotAccounts(const char *path);
+int incrementalBackup(const char *path);
+int restoreAccounts(const char *outPath, char **backups, int count);
+int selfTestFiles(long rounds);
 
-int main() {
+#ifndef LAB_FUZZ            // the fuzz build's main() is in lab_fuzz.h
+int main(int argc, char *argv[]) {
     int option;
 
+    INSTR_INIT("brs");
+
+    // BRS --statements FROM TO [output]: statements for every account
+    if (argc >= 4 && strcmp(argv[1], "--statements") == 0)
+        return bulkStatements(argv[2], argv[3], argc > 4 ? argv[4] : NULL);
+    // BRS --snapshot FILE | --incremental FILE | --restore OUTPUT FULL [INCREMENTAL...]
+    if (argc == 3 && strcmp(argv[1], "--snapshot") == 0)
+        return snapshotAccounts(argv[2]);
+    if (argc == 3 && strcmp(argv[1], "--incremental") == 0)
+        return incrementalBackup(argv[2]);
+    if (argc >= 4 && strcmp(argv[1], "--restore") == 0)
+        return restoreAccounts(argv[2], argv + 3, argc - 3);
+    // BRS --selftest-files [rounds]: every file path against an in-memory model
+    if (argc >= 2 && strcmp(argv[1], "--selftest-files") == 0)
+        return selfTestFiles(argc >= 3 && atol(argv[2]) > 0 ? atol(argv[2]) : 200);
+
     do {
         printf("\n\n\t\t\t\tBANKING RECORD SYSTEM\n");
         printf("\t\t\t\t---------------------\n");
@@ -33,8 +224,10 @@ int main() {
         printf("\n05. ALL ACCOUNT HOLDER LIST");
         printf("\n06. CLOSE AN ACCOUNT");
         printf("\n07. MODIFY AN ACCOUNT");
-        printf("\n08. EXIT");
-        printf("\n\nSelect Your Option <1-8>: ");
+        printf("\n08. ACCOUNT STATEMENT");
+        printf("\n09. SEARCH BY NAME");
+        printf("\n10. EXIT");
+        printf("\n\nSelect Your Option <1-10>: ");
         scanf("%d", &option);
 
         switch(option) {
@@ -45,24 +238,23 @@ int main() {
             case 5: allAccountHoldList(); break;
             case 6: closeAnAccount(); break;
             case 7: modifyAnAccount(); break;
-            case 8: printf("Exiting the system. Goodbye!\n"); break;
-            default: printf("Enter a valid option (1-8).\n");
+            case 8: accountStatement(); break;
+            case 9: searchByName(); break;
+            case 10: printf("Exiting the system. Goodbye!\n"); break;
+            default: printf("Enter a valid option (1-10).\n");
         }
 
-    } while(option != 8);
+    } while(option != 10);
 
     return 0;
 }
+#endif
 
 // Create a new account
 void newAccount() {
-    struct Account acc;
-    FILE *fp = fopen("accounts.dat", "ab");
-
-    if (!fp) {
-        printf("Error opening file.\n");
-        return;
-    }
+    struct Account acc, existing;
+    int lock, ok;
+    RecordStore *rs;
 
     printf("Enter Account Number: ");
     scanf("%d", &acc.accountNumber);
@@ -75,21 +267,43 @@ void newAccount() {
     printf("Enter Initial Deposit: ");
     scanf("%f", &acc.balance);
 
-    fwrite(&acc, sizeof(acc), 1, fp);
-    fclose(fp);
+    lock = lockAccounts();
+    rs = openAccounts(RS_WRITE);
+    if (!rs) {
+        unlockAccounts(lock);
+        printf("Error opening file.\n");
+        return;
+    }
+    if (findAccount(rs, acc.accountNumber, &existing)) {
+        rs_close(rs);
+        unlockAccounts(lock);
+        printf("Account number already exists.\n");
+        return;
+    }
+    ok = rs_put(rs, &acc) == 0;         // into a closed account's slot if there is one
+    if (rs_close(rs) != 0 || !ok) {
+        unlockAccounts(lock);
+        printf("Error writing file.\n");
+        return;
+    }
+    journalRecord('U', &acc);
+    ledgerAppend(acc.accountNumber, 'O', acc.balance, acc.balance);
+    nameIndexUpdate('+', acc.name, acc.accountNumber);
+    unlockAccounts(lock);
 
     printf("Account created successfully.\n");
 }
 
 // Deposit amount to account
 void depositAccount() {
-    int acn;
+    int acn, lock;
+    RecordStore *cur;
     float amount;
     int found = 0;
     struct Account acc;
-    FILE *fp = fopen("accounts.dat", "rb+");
+    RecordStore *rs = openAccounts(0);
 
-    if (!fp) {
+    if (!rs) {
         printf("File not found.\n");
         return;
     }
@@ -97,34 +311,36 @@ void depositAccount() {
     printf("Enter Account Number: ");
     scanf("%d", &acn);
 
-    while (fread(&acc, sizeof(acc), 1, fp)) {
-        if (acc.accountNumber == acn) {
-            printf("Enter amount to deposit: ");
-            scanf("%f", &amount);
+    if (findAccount(rs, acn, &acc)) {
+        rs_close(rs);
+        rs = NULL;
+        printf("Enter amount to deposit: ");
+        scanf("%f", &amount);
+        cur = lockAccount(acn, &acc, &lock);    // current balance, not the one read above
+        if (cur) {
             acc.balance += amount;
-            fseek(fp, -(long)sizeof(acc), SEEK_CUR);
-            fwrite(&acc, sizeof(acc), 1, fp);
+            releaseAccount(cur, &acc, lock, 'D', amount);
             printf("Amount deposited successfully. New Balance: %.2f\n", acc.balance);
             found = 1;
-            break;
         }
     }
 
     if (!found)
         printf("Account not found.\n");
 
-    fclose(fp);
+    rs_close(rs);
 }
 
 // Withdraw amount from account
 void withdrawAccount() {
-    int acn;
+    int acn, lock;
+    RecordStore *cur;
     float amount;
     int found = 0;
     struct Account acc;
-    FILE *fp = fopen("accounts.dat", "rb+");
+    RecordStore *rs = openAccounts(0);
 
-    if (!fp) {
+    if (!rs) {
         printf("File not found.\n");
         return;
     }
@@ -132,37 +348,38 @@ void withdrawAccount() {
     printf("Enter Account Number: ");
     scanf("%d", &acn);
 
-    while (fread(&acc, sizeof(acc), 1, fp)) {
-        if (acc.accountNumber == acn) {
-            printf("Enter amount to withdraw: ");
-            scanf("%f", &amount);
+    if (findAccount(rs, acn, &acc)) {
+        rs_close(rs);
+        rs = NULL;
+        printf("Enter amount to withdraw: ");
+        scanf("%f", &amount);
+        cur = lockAccount(acn, &acc, &lock);    // current balance, not the one read above
+        if (cur) {
             if (acc.balance >= amount) {
                 acc.balance -= amount;
-                fseek(fp, -(long)sizeof(acc), SEEK_CUR);
-                fwrite(&acc, sizeof(acc), 1, fp);
+                releaseAccount(cur, &acc, lock, 'W', amount);
                 printf("Amount withdrawn successfully. New Balance: %.2f\n", acc.balance);
             } else {
+                releaseAccount(cur, NULL, lock, 0, 0);
                 printf("Insufficient balance.\n");
             }
             found = 1;
-            break;
         }
     }
 
     if (!found)
         printf("Account not found.\n");
 
-    fclose(fp);
+    rs_close(rs);
 }
 
 // Check balance of an account
 void balanceAccount() {
     int acn;
-    int found = 0;
     struct Account acc;
-    FILE *fp = fopen("accounts.dat", "rb");
+    RecordStore *rs = openAccounts(0);
 
-    if (!fp) {
+    if (!rs) {
         printf("File not found.\n");
         return;
     }
@@ -170,27 +387,22 @@ void balanceAccount() {
     printf("Enter Account Number: ");
     scanf("%d", &acn);
 
-    while (fread(&acc, sizeof(acc), 1, fp)) {
-        if (acc.accountNumber == acn) {
-            printf("\nAccount Number: %d\nName: %s\nAccount Type: %c\nBalance: %.2f\n",
-                    acc.accountNumber, acc.name, acc.accountType, acc.balance);
-            found = 1;
-            break;
-        }
-    }
-
-    if (!found)
+    if (findAccount(rs, acn, &acc))
+        printf("\nAccount Number: %d\nName: %s\nAccount Type: %c\nBalance: %.2f\n",
+                acc.accountNumber, acc.name, acc.accountType, acc.balance);
+    else
         printf("Account not found.\n");
 
-    fclose(fp);
+    rs_close(rs);
 }
 
 // List all accounts
 void allAccountHoldList() {
     struct Account acc;
-    FILE *fp = fopen("accounts.dat", "rb");
+    RsIter it;
+    RecordStore *rs = openAccounts(0);
 
-    if (!fp) {
+    if (!rs) {
         printf("File not found.\n");
         return;
     }
@@ -198,56 +410,66 @@ void allAccountHoldList() {
     printf("\n%-15s %-25s %-15s %-10s\n", "Account No", "Name", "Type", "Balance");
     printf("---------------------------------------------------------------------\n");
 
-    while (fread(&acc, sizeof(acc), 1, fp)) {
+    INSTR_BEGIN(scan, "allAccountHoldList.scan");    // includes printing each row
+    rs_iter_init(rs, &it);
+    while (rs_iter_next(&it, &acc) == 1) {
+        sanitizeAccount(&acc);
         printf("%-15d %-25s %-15c %-10.2f\n",
                acc.accountNumber, acc.name, acc.accountType, acc.balance);
     }
+    INSTR_BYTES_READ(scan, rs->bytes_read);
+    INSTR_END(scan);
 
-    fclose(fp);
+    rs_close(rs);
 }
 
 // Close an account
 void closeAnAccount() {
-    int acn, found = 0;
-    struct Account acc;
-    FILE *fp = fopen("accounts.dat", "rb");
-    FILE *temp = fopen("temp.dat", "wb");
-
-    if (!fp || !temp) {
-        printf("Error opening file.\n");
-        return;
-    }
+    int acn, found, lock;
+    struct Account closed;
+    RecordStore *rs;
 
     printf("Enter Account Number to close: ");
     scanf("%d", &acn);
 
-    while (fread(&acc, sizeof(acc), 1, fp)) {
-        if (acc.accountNumber == acn) {
-            found = 1;
-            continue; // skip writing this record
-        }
-        fwrite(&acc, sizeof(acc), 1, temp);
+    lock = lockAccounts();
+    rs = openAccounts(RS_WRITE);
+    if (!rs) {
+        unlockAccounts(lock);
+        printf("Error opening file.\n");
+        return;
     }
 
-    fclose(fp);
-    fclose(temp);
+    // the slot is cleared in place and goes on the free list
+    INSTR_BEGIN(span, "closeAnAccount.delete");
+    found = findAccount(rs, acn, &closed) && rs_delete(rs, &acn) == 1;
+    INSTR_BYTES_WRITTEN(span, rs->bytes_written);
+    if (rs_close(rs) != 0)
+        found = 0;
+    INSTR_END(span);
 
-    remove("accounts.dat");
-    rename("temp.dat", "accounts.dat");
+    if (found) {
+        journalRecord('D', &closed);
+        ledgerAppend(acn, 'C', closed.balance, 0);
+        nameIndexUpdate('-', closed.name, acn);
+    }
+    unlockAccounts(lock);
 
-    if (found)
+    if (found) {
         printf("Account closed successfully.\n");
-    else
+    } else {
         printf("Account not found.\n");
+    }
 }
 
 // Modify account details
 void modifyAnAccount() {
-    int acn, found = 0;
-    struct Account acc;
-    FILE *fp = fopen("accounts.dat", "rb+");
+    int acn, found = 0, lock;
+    struct Account acc, edited;
+    RecordStore *cur;
+    RecordStore *rs = openAccounts(0);
 
-    if (!fp) {
+    if (!rs) {
         printf("File not found.\n");
         return;
     }
@@ -255,27 +477,1743 @@ void modifyAnAccount() {
     printf("Enter Account Number to modify: ");
     scanf("%d", &acn);
 
-    while (fread(&acc, sizeof(acc), 1, fp)) {
-        if (acc.accountNumber == acn) {
-            printf("Enter New Name: ");
-            getchar(); // clear buffer
-            fgets(acc.name, sizeof(acc.name), stdin);
-            acc.name[strcspn(acc.name, "\n")] = '\0';
-            printf("Enter New Account Type (S/C): ");
-            scanf(" %c", &acc.accountType);
-            printf("Enter New Balance: ");
-            scanf("%f", &acc.balance);
-
-            fseek(fp, -(long)sizeof(acc), SEEK_CUR);
-            fwrite(&acc, sizeof(acc), 1, fp);
+    if (findAccount(rs, acn, &acc)) {
+        float oldBalance;
+        char oldName[100];
+        rs_close(rs);
+        rs = NULL;
+        edited = acc;
+        printf("Enter New Name: ");
+        getchar(); // clear buffer
+        fgets(edited.name, sizeof(edited.name), stdin);
+        edited.name[strcspn(edited.name, "\n")] = '\0';
+        printf("Enter New Account Type (S/C): ");
+        scanf(" %c", &edited.accountType);
+        printf("Enter New Balance: ");
+        scanf("%f", &edited.balance);
+
+        cur = lockAccount(acn, &acc, &lock);
+        if (cur) {
+            oldBalance = acc.balance;
+            strcpy(oldName, acc.name);
+            strcpy(acc.name, edited.name);
+            acc.accountType = edited.accountType;
+            acc.balance = edited.balance;
+            if (saveAccount(cur, &acc, acc.balance != oldBalance ? 'M' : 0, acc.balance - oldBalance) &&
+                strcmp(acc.name, oldName) != 0) {
+                nameIndexUpdate('-', oldName, acn);
+                nameIndexUpdate('+', acc.name, acn);
+            }
+            unlockAccounts(lock);
             printf("Account modified successfully.\n");
             found = 1;
-            break;
         }
     }
 
     if (!found)
         printf("Account not found.\n");
 
+    rs_close(rs);
+}
+
+// ---------------- Transaction ledger ----------------
+
+static unsigned int hashAccountNumber(int acn) {
+    unsigned int h = (unsigned int)acn * 2654435761u;
+    return h ^ (h >> 15);
+}
+
+static int writeIndexHeader(FILE *index, const struct LedgerIndexHeader *hdr) {
+    return fseek(index, 0, SEEK_SET) == 0 && fwrite(hdr, sizeof(*hdr), 1, index) == 1;
+}
+
+static int readSlot(FILE *index, int i, struct LedgerIndexSlot *slot) {
+    fseek(index, (long)(sizeof(struct LedgerIndexHeader) + (size_t)i * sizeof(*slot)), SEEK_SET);
+    return fread(slot, sizeof(*slot), 1, index) == 1;
+}
+
+static int writeSlot(FILE *index, int i, const struct LedgerIndexSlot *slot) {
+    return fseek(index, (long)(sizeof(struct LedgerIndexHeader) + (size_t)i * sizeof(*slot)), SEEK_SET) == 0 &&
+           fwrite(slot, sizeof(*slot), 1, index) == 1;
+}
+
+// Slot of an account, or the free slot where it belongs (slot->inUse == 0).
+// A damaged table with no free slot gives -1 (and slot->inUse == 0).
+static int findSlot(FILE *index, const struct LedgerIndexHeader *hdr, int acn,
+                    struct LedgerIndexSlot *slot) {
+    int i = (int)(hashAccountNumber(acn) % (unsigned int)hdr->capacity);
+
+    for (int probes = 0; probes < hdr->capacity; probes++) {
+        if (!readSlot(index, i, slot) || !slot->inUse || slot->accountNumber == acn)
+            return i;
+        i = (i + 1) % hdr->capacity;
+    }
+    slot->inUse = 0;
+    return -1;
+}
+
+// Write an empty table of the given capacity.
+static FILE *createIndex(const char *path, struct LedgerIndexHeader *hdr, int capacity) {
+    struct LedgerIndexSlot empty;
+    FILE *index = fopen(path, "wb+");
+    int ok;
+
+    if (!index)
+        return NULL;
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, "BRSX", 4);
+    hdr->capacity = capacity;
+    memset(&empty, 0, sizeof(empty));
+    ok = writeIndexHeader(index, hdr);
+    for (int i = 0; ok && i < capacity; i++)
+        ok = fwrite(&empty, sizeof(empty), 1, index) == 1;
+    if (!ok || fflush(index) != 0) {
+        fclose(index);
+        return NULL;
+    }
+    return index;
+}
+
+// Rehash into a table twice the size once it is 70% full. If the new table
+// cannot be written the old one stays in place; *index is NULL only if the
+// index file could not be reopened.
+static int growIndex(FILE **index, struct LedgerIndexHeader *hdr) {
+    struct LedgerIndexHeader newHdr;
+    struct LedgerIndexSlot slot, probe;
+    FILE *grown = createIndex(LEDGER_INDEX_FILE ".tmp", &newHdr, hdr->capacity * 2);
+    int ok = grown != NULL;
+
+    newHdr.used = hdr->used;
+    newHdr.indexedSize = hdr->indexedSize;
+    for (int i = 0; ok && i < hdr->capacity; i++) {
+        if (readSlot(*index, i, &slot) && slot.inUse)
+            ok = writeSlot(grown, findSlot(grown, &newHdr, slot.accountNumber, &probe), &slot);
+    }
+    ok = ok && writeIndexHeader(grown, &newHdr);
+    if (grown && fclose(grown) != 0)
+        ok = 0;
+    if (!ok) {
+        remove(LEDGER_INDEX_FILE ".tmp");
+        return 0;
+    }
+    fclose(*index);
+#ifdef _WIN32
+    remove(LEDGER_INDEX_FILE);              // rename() does not replace on Windows
+#endif
+    if (rename(LEDGER_INDEX_FILE ".tmp", LEDGER_INDEX_FILE) != 0) {
+        remove(LEDGER_INDEX_FILE ".tmp");
+        *index = fopen(LEDGER_INDEX_FILE, "rb+");
+        return 0;
+    }
+    *index = fopen(LEDGER_INDEX_FILE, "rb+");
+    *hdr = newHdr;
+    return *index != NULL;
+}
+
+// Point an account's slot at the ledger entry at `offset`. Replaying an entry
+// that is already indexed changes nothing.
+static int indexEntry(FILE **index, struct LedgerIndexHeader *hdr, int acn, long long offset) {
+    struct LedgerIndexSlot slot;
+    int i = findSlot(*index, hdr, acn, &slot);
+
+    if (i < 0)
+        return 0;
+    if (slot.inUse && slot.lastOffset >= offset)
+        return 1;
+    if (!slot.inUse) {
+        memset(&slot, 0, sizeof(slot));
+        slot.accountNumber = acn;
+        slot.inUse = 1;
+        hdr->used++;
+    }
+    slot.lastOffset = offset;
+    slot.count++;
+    if (!writeSlot(*index, i, &slot))
+        return 0;
+    // a table that could not grow still works until it is full
+    if (hdr->used * 10 >= hdr->capacity * 7 && !growIndex(index, hdr))
+        return *index != NULL;
+    return 1;
+}
+
+// Open the ledger and its index for update. The index is created on first use
+// and caught up with entries that a crash left unindexed; a torn entry at the
+// end of the ledger is dropped and overwritten by the next append.
+// On success ledger.lock is held, so no other teller appends until the
+// caller is done with the index and passes *lock to unlockFile().
+static int openLedger(FILE **ledger, FILE **index, struct LedgerIndexHeader *hdr, int *lock) {
+    struct Transaction t;
+    long long size, indexSize = 0;
+
+    *lock = lockFile(LEDGER_LOCK_FILE);
+    *ledger = fopen(LEDGER_FILE, "rb+");
+    if (!*ledger)
+        *ledger = fopen(LEDGER_FILE, "wb+");
+    *index = fopen(LEDGER_INDEX_FILE, "rb+");
+    if (!*ledger) {
+        if (*index)
+            fclose(*index);
+        unlockFile(*lock);
+        return 0;
+    }
+    if (*index) {
+        fseek(*index, 0, SEEK_END);
+        indexSize = ftell(*index);
+        rewind(*index);
+    }
+    // anything but a whole table is rebuilt from the ledger
+    if (!*index || fread(hdr, sizeof(*hdr), 1, *index) != 1 || memcmp(hdr->magic, "BRSX", 4) != 0 ||
+        hdr->capacity < LEDGER_INDEX_MIN_CAPACITY ||
+        (indexSize - (long long)sizeof(*hdr)) / (long long)sizeof(struct LedgerIndexSlot) != hdr->capacity ||
+        hdr->used < 0 || hdr->used > hdr->capacity ||
+        hdr->indexedSize < 0 || hdr->indexedSize % (long long)sizeof(t) != 0) {
+        if (*index)
+            fclose(*index);
+        *index = createIndex(LEDGER_INDEX_FILE, hdr, LEDGER_INDEX_MIN_CAPACITY);
+        if (!*index) {
+            fclose(*ledger);
+            unlockFile(*lock);
+            return 0;
+        }
+    }
+
+    fseek(*ledger, 0, SEEK_END);
+    size = ftell(*ledger);
+    size -= size % (long long)sizeof(t);
+    if (hdr->indexedSize > size) {
+        // ledger was replaced: its slots point past the end, rebuild from scratch
+        fclose(*index);
+        *index = createIndex(LEDGER_INDEX_FILE, hdr, LEDGER_INDEX_MIN_CAPACITY);
+        if (!*index) {
+            fclose(*ledger);
+            unlockFile(*lock);
+            return 0;
+        }
+    }
+    if (hdr->indexedSize != size) {
+        for (long long off = hdr->indexedSize; off < size; off += sizeof(t)) {
+            fseek(*ledger, (long)off, SEEK_SET);
+            if (fread(&t, sizeof(t), 1, *ledger) != 1 || !indexEntry(index, hdr, t.accountNumber, off))
+                break;
+            hdr->indexedSize = off + sizeof(t);
+        }
+        // a failed grow leaves no index to read from
+        if (!*index || !writeIndexHeader(*index, hdr) || fflush(*index) != 0) {
+            if (*index)
+                fclose(*index);
+            fclose(*ledger);
+            unlockFile(*lock);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Record one transaction: append it to the ledger, then index it. Callers
+// that change an account hold the accounts lock, so entries are in the same
+// order as the balance changes.
+void ledgerAppend(int accountNumber, char type, float amount, float balance) {
+    FILE *ledger, *index;
+    struct LedgerIndexHeader hdr;
+    struct LedgerIndexSlot slot;
+    struct Transaction t;
+    int lock;
+
+    INSTR_BEGIN(span, "ledgerAppend");
+    if (!openLedger(&ledger, &index, &hdr, &lock)) {
+        printf("Warning: transaction could not be written to the ledger.\n");
+        INSTR_END(span);
+        return;
+    }
+    findSlot(index, &hdr, accountNumber, &slot);
+    memset(&t, 0, sizeof(t));
+    t.accountNumber = accountNumber;
+    t.type = type;
+    t.amount = amount;
+    t.balance = balance;
+    t.timestamp = (long long)time(NULL);
+    t.prevOffset = slot.inUse ? slot.lastOffset : -1;
+
+    fseek(ledger, (long)hdr.indexedSize, SEEK_SET);
+    if (fwrite(&t, sizeof(t), 1, ledger) != 1 || fflush(ledger) != 0) {
+        printf("Warning: transaction could not be written to the ledger.\n");
+    } else if (indexEntry(&index, &hdr, accountNumber, hdr.indexedSize)) {
+        hdr.indexedSize += sizeof(t);
+        writeIndexHeader(index, &hdr);
+        INSTR_BYTES_WRITTEN(span, sizeof(t));
+    }
+    fclose(ledger);
+    if (index)
+        fclose(index);
+    unlockFile(lock);
+    INSTR_END(span);
+}
+
+static const char *transactionTypeName(char type) {
+    switch (type) {
+        case 'O': return "OPENING";
+        case 'D': return "DEPOSIT";
+        case 'W': return "WITHDRAWAL";
+        case 'M': return "ADJUSTMENT";
+        case 'C': return "CLOSING";
+        default: return "UNKNOWN";
+    }
+}
+
+// localtime() re-reads the zone settings on every call; statements print
+// millions of dates, so use the reentrant variants.
+static void formatTimestamp(long long timestamp, char *buf, size_t size) {
+    time_t ts = (time_t)timestamp;
+    struct tm tm;
+#ifdef _WIN32
+    int ok = localtime_s(&tm, &ts) == 0;
+#else
+    int ok = localtime_r(&ts, &tm) != NULL;
+#endif
+    if (!ok || strftime(buf, size, "%Y-%m-%d %H:%M:%S", &tm) == 0)
+        snprintf(buf, size, "(bad date)");
+}
+
+// "YYYY-MM-DD" to a timestamp at the start (or end) of that local day.
+static int parseDate(const char *text, int endOfDay, long long *out) {
+    struct tm tm;
+
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(text, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3)
+        return 0;
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    if (endOfDay) {
+        tm.tm_hour = 23;
+        tm.tm_min = 59;
+        tm.tm_sec = 59;
+    }
+    tm.tm_isdst = -1;
+    *out = (long long)mktime(&tm);
+    return *out != -1;
+}
+
+// Print the entries of one account between from and to (inclusive), oldest
+// first. The chain is walked from the newest entry and stops at the first
+// one older than `from`, so the cost depends only on that account's recent
+// activity. Returns the number of entries printed.
+static int writeStatement(FILE *out, FILE *ledger, int acn, long long lastOffset,
+                          long long from, long long to) {
+    static struct Transaction *entries = NULL;      // reused across a bulk run
+    static int capacity = 0;
+    struct Transaction t;
+    char when[32];
+    int n = 0;
+
+    INSTR_BEGIN(walk, "writeStatement.chain");
+    // every link points further back, so a damaged ledger cannot loop
+    for (long long off = lastOffset; off >= 0; off = t.prevOffset) {
+        fseek(ledger, (long)off, SEEK_SET);
+        if (fread(&t, sizeof(t), 1, ledger) != 1 || t.accountNumber != acn || t.timestamp < from)
+            break;
+        if (t.prevOffset >= off)
+            t.prevOffset = -1;
+        INSTR_BYTES_READ(walk, sizeof(t));
+        if (t.timestamp > to)
+            continue;
+        if (n == capacity) {
+            int newCapacity = capacity ? capacity * 2 : 64;
+            struct Transaction *grown = realloc(entries, (size_t)newCapacity * sizeof(*entries));
+            if (!grown)
+                break;
+            entries = grown;
+            capacity = newCapacity;
+        }
+        entries[n++] = t;
+    }
+    INSTR_END(walk);
+
+    fprintf(out, "\nStatement for Account No %d\n", acn);
+    fprintf(out, "%-20s %-12s %12s %12s\n", "Date", "Type", "Amount", "Balance");
+    fprintf(out, "---------------------------------------------------------\n");
+    for (int i = n - 1; i >= 0; i--) {
+        formatTimestamp(entries[i].timestamp, when, sizeof(when));
+        fprintf(out, "%-20s %-12s %12.2f %12.2f\n", when, transactionTypeName(entries[i].type),
+                entries[i].amount, entries[i].balance);
+    }
+    fprintf(out, "%d transaction(s)\n", n);
+    return n;
+}
+
+// Statement of one account over a date range
+void accountStatement() {
+    int acn;
+    char fromDate[16], toDate[16];
+    long long from, to;
+    FILE *ledger, *index;
+    struct LedgerIndexHeader hdr;
+    struct LedgerIndexSlot slot;
+    int lock;
+
+    printf("Enter Account Number: ");
+    scanf("%d", &acn);
+    printf("From Date (YYYY-MM-DD): ");
+    scanf("%15s", fromDate);
+    printf("To Date (YYYY-MM-DD): ");
+    scanf("%15s", toDate);
+    if (!parseDate(fromDate, 0, &from) || !parseDate(toDate, 1, &to)) {
+        printf("Enter dates as YYYY-MM-DD.\n");
+        return;
+    }
+
+    if (!openLedger(&ledger, &index, &hdr, &lock)) {
+        printf("Ledger not available.\n");
+        return;
+    }
+    findSlot(index, &hdr, acn, &slot);
+    unlockFile(lock);       // entries already written never change
+    if (slot.inUse)
+        writeStatement(stdout, ledger, acn, slot.lastOffset, from, to);
+    else
+        printf("No transactions found for this account.\n");
+    fclose(ledger);
+    fclose(index);
+}
+
+static int compareSlots(const void *a, const void *b) {
+    int x = ((const struct LedgerIndexSlot *)a)->accountNumber;
+    int y = ((const struct LedgerIndexSlot *)b)->accountNumber;
+    return (x > y) - (x < y);
+}
+
+// Statements for every account in the index, in account number order. The
+// index is read once sequentially; each account then costs only its own
+// chain, never a pass over the whole ledger.
+int bulkStatements(const char *fromDate, const char *toDate, const char *outPath) {
+    long long from, to, total = 0;
+    FILE *ledger, *index, *out = stdout;
+    struct LedgerIndexHeader hdr;
+    struct LedgerIndexSlot *slots;
+    int n = 0, lock;
+
+    if (!parseDate(fromDate, 0, &from) || !parseDate(toDate, 1, &to)) {
+        fprintf(stderr, "Enter dates as YYYY-MM-DD.\n");
+        return 2;
+    }
+    if (!openLedger(&ledger, &index, &hdr, &lock)) {
+        fprintf(stderr, "Ledger not available.\n");
+        return 1;
+    }
+    slots = malloc((size_t)hdr.capacity * sizeof(*slots));
+    fseek(index, (long)sizeof(hdr), SEEK_SET);
+    if (slots && fread(slots, sizeof(*slots), (size_t)hdr.capacity, index) != (size_t)hdr.capacity) {
+        free(slots);
+        slots = NULL;
+    }
+    unlockFile(lock);       // tellers go on appending while the statements are written
+    if (!slots) {
+        fprintf(stderr, "Could not read the ledger index.\n");
+        fclose(ledger);
+        fclose(index);
+        return 1;
+    }
+    for (int i = 0; i < hdr.capacity; i++) {
+        if (slots[i].inUse)
+            slots[n++] = slots[i];
+    }
+    qsort(slots, (size_t)n, sizeof(*slots), compareSlots);
+
+    if (outPath && !(out = fopen(outPath, "w"))) {
+        perror(outPath);
+        free(slots);
+        fclose(ledger);
+        fclose(index);
+        return 1;
+    }
+    // chains are read entry by entry: skip stdio's read-ahead, batch the output
+    setvbuf(ledger, NULL, _IONBF, 0);
+    setvbuf(out, NULL, _IOFBF, 1 << 20);
+    for (int i = 0; i < n; i++)
+        total += writeStatement(out, ledger, slots[i].accountNumber, slots[i].lastOffset, from, to);
+    fprintf(stderr, "%d statements, %lld transactions.\n", n, total);
+
+    if (out != stdout)
+        fclose(out);
+    free(slots);
+    fclose(ledger);
+    fclose(index);
+    return 0;
+}
+
+// ---------------- Name index ----------------
+
+// Lower case, surrounding blanks dropped, inner runs of blanks made one space,
+// so "  ALICE   smith" and "Alice Smith" share a key.
+static void normalizeName(const char *name, char *key, size_t size) {
+    size_t n = 0;
+    int pendingSpace = 0;
+
+    for (; *name && n + 1 < size; name++) {
+        unsigned char c = (unsigned char)*name;
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            pendingSpace = n > 0;
+            continue;
+        }
+        if (pendingSpace && n + 2 < size)
+            key[n++] = ' ';
+        pendingSpace = 0;
+        key[n++] = (char)(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+    }
+    key[n] = '\0';
+}
+
+static int compareNameEntries(const struct NameIndexEntry *a, const struct NameIndexEntry *b) {
+    int c = strcmp(a->key, b->key);
+    if (c != 0)
+        return c;
+    return (a->accountNumber > b->accountNumber) - (a->accountNumber < b->accountNumber);
+}
+
+static int compareEntrySort(const void *a, const void *b) {
+    return compareNameEntries(a, b);
+}
+
+// Sort by entry; among records for the same entry, the later one wins, so a
+// stable order is kept through the original position.
+struct PendingName {
+    struct NameLogRecord rec;
+    int seq;
+};
+
+static int comparePending(const void *a, const void *b) {
+    const struct PendingName *x = a, *y = b;
+    int c = compareNameEntries(&x->rec.entry, &y->rec.entry);
+    return c != 0 ? c : (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+// Entries read from names.idx or names.log go to strcmp() and printf(), so
+// their strings must end inside their fields whatever the file holds.
+static void sanitizeNameEntry(struct NameIndexEntry *e) {
+    e->key[sizeof(e->key) - 1] = '\0';
+    e->name[sizeof(e->name) - 1] = '\0';
+}
+
+static int readNextNameEntry(FILE *index, struct NameIndexEntry *e) {
+    if (fread(e, sizeof(*e), 1, index) != 1)
+        return 0;
+    sanitizeNameEntry(e);
+    return 1;
+}
+
+// Load names.log as a sorted table holding the final change for each entry.
+static struct PendingName *loadNameLog(int *count) {
+    struct PendingName *pending = NULL;
+    struct NameLogRecord rec;
+    int n = 0, capacity = 0, kept = 0;
+    FILE *log = fopen(NAME_LOG_FILE, "rb");
+
+    INSTR_BEGIN(scan, "loadNameLog.scan");
+    while (log && fread(&rec, sizeof(rec), 1, log) == 1) {
+        INSTR_BYTES_READ(scan, sizeof(rec));
+        if (n == capacity) {
+            int newCapacity = capacity ? capacity * 2 : 64;
+            struct PendingName *grown = realloc(pending, (size_t)newCapacity * sizeof(*pending));
+            if (!grown)
+                break;
+            pending = grown;
+            capacity = newCapacity;
+        }
+        sanitizeNameEntry(&rec.entry);
+        pending[n].rec = rec;
+        pending[n].seq = n;
+        n++;
+    }
+    INSTR_END(scan);
+    if (log)
+        fclose(log);
+
+    if (n > 0)                              // an empty or unreadable log leaves pending NULL
+        qsort(pending, (size_t)n, sizeof(*pending), comparePending);
+    for (int i = 0; i < n; i++) {
+        if (i + 1 < n && compareNameEntries(&pending[i].rec.entry, &pending[i + 1].rec.entry) == 0)
+            continue;                       // superseded by a later change
+        pending[kept++] = pending[i];
+    }
+    *count = kept;
+    return pending;
+}
+
+static int readNameEntry(FILE *index, long i, struct NameIndexEntry *e) {
+    fseek(index, (long)sizeof(struct NameIndexHeader) + i * (long)sizeof(*e), SEEK_SET);
+    return readNextNameEntry(index, e);
+}
+
+// Install names.idx.tmp (if it was written in full) as names.idx and start a
+// new log. rename() replaces the old index in one step, so a reader always
+// finds one. Called with names.lock held. Returns ok.
+static int replaceNameIndex(int ok) {
+#ifdef _WIN32
+    if (ok)
+        remove(NAME_INDEX_FILE);            // rename() does not replace on Windows
+#endif
+    if (!ok || rename(NAME_INDEX_FILE ".tmp", NAME_INDEX_FILE) != 0) {
+        remove(NAME_INDEX_FILE ".tmp");
+        return 0;
+    }
+    remove(NAME_LOG_FILE);
+    return 1;
+}
+
+// Build names.idx from accounts.dat (first use, or after the index was lost).
+// Called with names.lock held.
+static int buildNameIndex() {
+    struct Account acc;
+    struct NameIndexEntry *entries = NULL;
+    struct NameIndexHeader hdr;
+    int n = 0, capacity = 0, ok;
+    RsIter it;
+    RecordStore *rs = openAccounts(0);
+    FILE *index;
+
+    INSTR_BEGIN(scan, "buildNameIndex.scan");
+    if (rs)
+        rs_iter_init(rs, &it);
+    while (rs && rs_iter_next(&it, &acc) == 1) {
+        if (n == capacity) {
+            int newCapacity = capacity ? capacity * 2 : 1024;
+            struct NameIndexEntry *grown = realloc(entries, (size_t)newCapacity * sizeof(*entries));
+            if (!grown) {
+                rs_close(rs);
+                free(entries);
+                return 0;
+            }
+            entries = grown;
+            capacity = newCapacity;
+        }
+        memset(&entries[n], 0, sizeof(entries[n]));
+        sanitizeAccount(&acc);
+        normalizeName(acc.name, entries[n].key, sizeof(entries[n].key));
+        strcpy(entries[n].name, acc.name);
+        entries[n].accountNumber = acc.accountNumber;
+        n++;
+    }
+    if (rs)
+        INSTR_BYTES_READ(scan, rs->bytes_read);
+    INSTR_END(scan);
+    rs_close(rs);
+    if (n > 0)
+        qsort(entries, (size_t)n, sizeof(*entries), compareEntrySort);
+
+    index = fopen(NAME_INDEX_FILE ".tmp", "wb");
+    if (!index) {
+        free(entries);
+        return 0;
+    }
+    memcpy(hdr.magic, "BRSN", 4);
+    hdr.count = n;
+    ok = fwrite(&hdr, sizeof(hdr), 1, index) == 1;
+    if (n > 0)                              // entries is NULL when there are no accounts
+        ok = ok && fwrite(entries, sizeof(*entries), (size_t)n, index) == (size_t)n;
+    if (fclose(index) != 0)
+        ok = 0;
+    free(entries);
+    return replaceNameIndex(ok);            // the rebuild already reflects every change
+}
+
+static FILE *openNameIndex(struct NameIndexHeader *hdr) {
+    FILE *index = fopen(NAME_INDEX_FILE, "rb");
+
+    if (!index || fread(hdr, sizeof(*hdr), 1, index) != 1 || memcmp(hdr->magic, "BRSN", 4) != 0) {
+        if (index)
+            fclose(index);
+        if (!buildNameIndex())
+            return NULL;
+        index = fopen(NAME_INDEX_FILE, "rb");
+        if (!index || fread(hdr, sizeof(*hdr), 1, index) != 1) {
+            if (index)
+                fclose(index);
+            return NULL;
+        }
+    }
+    return index;
+}
+
+// Merge names.log into names.idx in one sequential pass and start a new log.
+// Holds names.lock, so no teller's change lands in the log being replaced.
+static void compactNameIndex() {
+    struct NameIndexHeader hdr, newHdr;
+    struct NameIndexEntry e;
+    struct PendingName *pending;
+    int count, p = 0, ok, lock = lockFile(NAME_LOCK_FILE);
+    FILE *index = openNameIndex(&hdr);
+    FILE *out = fopen(NAME_INDEX_FILE ".tmp", "wb");
+
+    if (!index || !out) {
+        if (index)
+            fclose(index);
+        if (out)
+            fclose(out);
+        unlockFile(lock);
+        return;
+    }
+    pending = loadNameLog(&count);
+    memcpy(newHdr.magic, "BRSN", 4);
+    newHdr.count = 0;
+    ok = fwrite(&newHdr, sizeof(newHdr), 1, out) == 1;
+
+    fseek(index, (long)sizeof(hdr), SEEK_SET);
+    for (int i = 0; i <= hdr.count; i++) {
+        int haveBase = i < hdr.count && readNextNameEntry(index, &e);
+        // pending changes that sort before this base entry (or all that remain)
+        while (p < count && (!haveBase || compareNameEntries(&pending[p].rec.entry, &e) < 0)) {
+            if (pending[p].rec.op == '+') {
+                ok = ok && fwrite(&pending[p].rec.entry, sizeof(e), 1, out) == 1;
+                newHdr.count++;
+            }
+            p++;
+        }
+        if (!haveBase)
+            break;
+        if (p < count && compareNameEntries(&pending[p].rec.entry, &e) == 0) {
+            if (pending[p].rec.op == '+') {
+                ok = ok && fwrite(&pending[p].rec.entry, sizeof(e), 1, out) == 1;
+                newHdr.count++;
+            }
+            p++;
+        } else {
+            ok = ok && fwrite(&e, sizeof(e), 1, out) == 1;
+            newHdr.count++;
+        }
+    }
+    fseek(out, 0, SEEK_SET);
+    ok = ok && fwrite(&newHdr, sizeof(newHdr), 1, out) == 1;
+    if (fclose(out) != 0)
+        ok = 0;
+    fclose(index);
+    free(pending);
+
+    if (!replaceNameIndex(ok))
+        printf("Warning: name index could not be compacted; changes stay in %s.\n", NAME_LOG_FILE);
+    unlockFile(lock);
+}
+
+// Record that an account now has (op '+') or no longer has (op '-') a name.
+// Callers hold the accounts lock, so changes reach the log in account order.
+void nameIndexUpdate(char op, const char *name, int accountNumber) {
+    struct NameIndexHeader hdr;
+    struct NameLogRecord rec;
+    int lock = lockFile(NAME_LOCK_FILE);
+    FILE *index = openNameIndex(&hdr);         // builds the index on first use
+    FILE *log;
+    long records;
+    int ok;
+
+    if (index)
+        fclose(index);
+    memset(&rec, 0, sizeof(rec));
+    rec.op = op;
+    normalizeName(name, rec.entry.key, sizeof(rec.entry.key));
+    strncpy(rec.entry.name, name, sizeof(rec.entry.name) - 1);
+    rec.entry.accountNumber = accountNumber;
+
+    log = fopen(NAME_LOG_FILE, "ab");
+    if (!log) {
+        unlockFile(lock);
+        printf("Warning: name index could not be updated.\n");
+        return;
+    }
+    ok = fwrite(&rec, sizeof(rec), 1, log) == 1;
+    records = ftell(log) / (long)sizeof(rec);
+    if (fclose(log) != 0 || !ok)
+        printf("Warning: name index could not be updated.\n");
+    unlockFile(lock);
+    if (records >= NAME_LOG_LIMIT)
+        compactNameIndex();
+}
+
+// Entries whose key equals `key` (or starts with it, for a prefix search),
+// in key order. Binary search in names.idx finds the first candidate, and
+// pending changes from names.log are merged in on the way.
+static struct NameIndexEntry *nameIndexLookup(const char *key, int prefix, int *found) {
+    struct NameIndexHeader hdr;
+    struct NameIndexEntry e, *results = NULL;
+    struct PendingName *pending;
+    int count, p, n = 0, capacity = 0;
+    size_t keyLen = strlen(key);
+    long lo = 0, hi;
+    int lock = lockFile(NAME_LOCK_FILE);      // the index and log must be of the same generation
+    FILE *index = openNameIndex(&hdr);
+
+    *found = 0;
+    if (!index) {
+        unlockFile(lock);
+        return NULL;
+    }
+    hi = hdr.count;
+    while (lo < hi) {                       // first entry with entry.key >= key
+        long mid = lo + (hi - lo) / 2;
+        if (!readNameEntry(index, mid, &e))
+            break;
+        if (strcmp(e.key, key) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    pending = loadNameLog(&count);
+    for (p = 0; p < count && strcmp(pending[p].rec.entry.key, key) < 0; p++)
+        ;
+    fseek(index, (long)sizeof(hdr) + lo * (long)sizeof(e), SEEK_SET);
+    for (;;) {
+        int haveBase = lo < hdr.count && readNextNameEntry(index, &e);
+        int baseMatches = haveBase && (prefix ? strncmp(e.key, key, keyLen) == 0 : strcmp(e.key, key) == 0);
+        const struct NameIndexEntry *take = NULL;
+        struct NameIndexEntry *pe = p < count ? &pending[p].rec.entry : NULL;
+        int pendingMatches = pe && (prefix ? strncmp(pe->key, key, keyLen) == 0 : strcmp(pe->key, key) == 0);
+
+        if (!baseMatches && !pendingMatches)
+            break;
+        if (pendingMatches && (!baseMatches || compareNameEntries(pe, &e) <= 0)) {
+            if (baseMatches && compareNameEntries(pe, &e) == 0)
+                lo++;                       // the change replaces this base entry
+            else if (haveBase)
+                fseek(index, -(long)sizeof(e), SEEK_CUR);   // read it again next time
+            if (pending[p].rec.op == '+')
+                take = pe;
+            p++;
+        } else {
+            take = &e;
+            lo++;
+        }
+        if (take) {
+            if (n == capacity) {
+                int newCapacity = capacity ? capacity * 2 : 16;
+                struct NameIndexEntry *grown = realloc(results, (size_t)newCapacity * sizeof(*results));
+                if (!grown)
+                    break;
+                results = grown;
+                capacity = newCapacity;
+            }
+            results[n++] = *take;
+        }
+    }
+    fclose(index);
+    unlockFile(lock);
+    free(pending);
+    *found = n;
+    return results;
+}
+
+// Find accounts by holder name
+void searchByName() {
+    char query[100], key[100];
+    int found, prefix;
+    size_t len;
+    struct NameIndexEntry *results;
+
+    printf("Enter Name (end with * to match the beginning of names): ");
+    getchar(); // clear newline from buffer
+    fgets(query, sizeof(query), stdin);
+    query[strcspn(query, "\n")] = '\0';
+    len = strlen(query);
+    prefix = len > 0 && query[len - 1] == '*';
+    if (prefix)
+        query[len - 1] = '\0';
+    normalizeName(query, key, sizeof(key));
+
+    results = nameIndexLookup(key, prefix, &found);
+    if (found == 0) {
+        printf("No matching account holder.\n");
+        free(results);
+        return;
+    }
+    printf("\n%-15s %-25s\n", "Account No", "Name");
+    printf("----------------------------------------\n");
+    for (int i = 0; i < found; i++)
+        printf("%-15d %-25s\n", results[i].accountNumber, results[i].name);
+    free(results);
+}
+
+// ---------------- Snapshots and backups ----------------
+
+// Take an exclusive flock on a lock file, waiting for other processes.
+// Returns a handle for unlockFile().
+int lockFile(const char *path) {
+#ifdef _WIN32
+    (void)path;
+    return -1;              // no flock(): locking is best effort on Windows
+#else
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0)
+        flock(fd, LOCK_EX);
+    return fd;
+#endif
+}
+
+void unlockFile(int lock) {
+#ifndef _WIN32
+    if (lock >= 0) {
+        flock(lock, LOCK_UN);
+        close(lock);
+    }
+#else
+    (void)lock;
+#endif
+}
+
+// Writers hold the accounts lock while they change accounts.dat and journal
+// and ledger the change. Snapshots take it only for a moment at their start
+// and end, so tellers are never held up by a backup. Returns a handle for
+// unlockAccounts().
+int lockAccounts() {
+    return lockFile(ACCOUNTS_LOCK_FILE);
+}
+
+void unlockAccounts(int lock) {
+    unlockFile(lock);
+}
+
+// Look an account up through accounts.idx: one index probe and one page of
+// accounts.dat instead of a pass over the file. Returns 1 if found.
+int findAccount(RecordStore *rs, int acn, struct Account *acc) {
+    int found;
+
+    INSTR_BEGIN(span, "findAccount");
+    found = rs_get(rs, &acn, acc) == 1;
+    if (found)
+        sanitizeAccount(acc);
+    INSTR_BYTES_READ(span, rs->bytes_read);
+    INSTR_END(span);
+    return found;
+}
+
+// Find an account again with the accounts lock held, since another teller
+// may have changed or closed it after the caller read it. On success the
+// lock stays held and the store is open for update; hand both to
+// releaseAccount().
+RecordStore *lockAccount(int acn, struct Account *acc, int *lock) {
+    RecordStore *rs;
+
+    *lock = lockAccounts();
+    rs = openAccounts(RS_WRITE);
+    if (rs && findAccount(rs, acn, acc))
+        return rs;
+    rs_close(rs);
+    unlockAccounts(*lock);
+    return NULL;
+}
+
+// Write back and journal the record from lockAccount() (unless `changed` is
+// NULL) and add a ledger entry of `type` for `amount` (unless type is 0).
+// The accounts lock stays held. Returns 1 if the change was written.
+int saveAccount(RecordStore *rs, const struct Account *changed, char type, float amount) {
+    int ok = 1;
+
+    if (changed)
+        ok = rs_put(rs, changed) == 0;
+    if (rs_close(rs) != 0)
+        ok = 0;
+    if (changed && ok) {
+        journalRecord('U', changed);
+        if (type)
+            ledgerAppend(changed->accountNumber, type, amount, changed->balance);
+    } else if (changed) {
+        printf("Warning: the change could not be written to %s.\n", ACCOUNTS_FILE);
+    }
+    return changed && ok;
+}
+
+// saveAccount(), then drop the lock.
+void releaseAccount(RecordStore *rs, const struct Account *changed, int lock, char type, float amount) {
+    saveAccount(rs, changed, type, amount);
+    unlockAccounts(lock);
+}
+
+// Open the journal for update, creating generation 1 on first use. *end is
+// the position after the last whole record (a torn record from a crash is
+// overwritten by the next append).
+static FILE *openJournal(struct JournalHeader *hdr, long long *end) {
+    FILE *jnl = fopen(JOURNAL_FILE, "rb+");
+    long long size;
+
+    if (!jnl || fread(hdr, sizeof(*hdr), 1, jnl) != 1 || memcmp(hdr->magic, "BRSJ", 4) != 0) {
+        if (jnl)
+            fclose(jnl);
+        jnl = fopen(JOURNAL_FILE, "wb+");
+        if (!jnl)
+            return NULL;
+        memcpy(hdr->magic, "BRSJ", 4);
+        hdr->generation = 1;
+        fwrite(hdr, sizeof(*hdr), 1, jnl);
+        fflush(jnl);
+    }
+    fseek(jnl, 0, SEEK_END);
+    size = ftell(jnl) - (long long)sizeof(*hdr);
+    *end = (long long)sizeof(*hdr) + size - size % (long long)sizeof(struct JournalRecord);
+    return jnl;
+}
+
+// Append one change; the caller holds the accounts lock. A change that
+// misses the journal would be missing from every later incremental backup,
+// so the backup state is dropped and the next incremental backup refuses
+// to run until a full snapshot is taken.
+void journalRecord(char op, const struct Account *acc) {
+    struct JournalHeader hdr;
+    struct JournalRecord rec;
+    long long end;
+    FILE *jnl = openJournal(&hdr, &end);
+    int ok = jnl != NULL;
+
+    if (jnl) {
+        memset(&rec, 0, sizeof(rec));
+        rec.op = op;
+        rec.acc = *acc;
+        ok = fseek(jnl, (long)end, SEEK_SET) == 0 && fwrite(&rec, sizeof(rec), 1, jnl) == 1;
+        ok = fclose(jnl) == 0 && ok;
+    }
+    if (!ok) {
+        remove(BACKUP_STATE_FILE);
+        printf("Warning: change could not be journaled; take a full snapshot.\n");
+    }
+}
+
+// Records [from, to) of the journal.
+static struct JournalRecord *readJournal(FILE *jnl, long long from, long long to, int *count) {
+    int n = (int)((to - from) / (long long)sizeof(struct JournalRecord));
+    struct JournalRecord *recs = malloc((size_t)(n > 0 ? n : 1) * sizeof(*recs));
+
+    fseek(jnl, (long)from, SEEK_SET);
+    if (!recs || (n > 0 && fread(recs, sizeof(*recs), (size_t)n, jnl) != (size_t)n)) {
+        free(recs);
+        return NULL;
+    }
+    for (int i = 0; i < n; i++)
+        sanitizeAccount(&recs[i].acc);
+    *count = n;
+    return recs;
+}
+
+static int compareAccountNumbers(const void *a, const void *b) {
+    int x = ((const struct Account *)a)->accountNumber;
+    int y = ((const struct Account *)b)->accountNumber;
+    return (x > y) - (x < y);
+}
+
+// Image of accounts.dat kept sorted by account number, so changes can be
+// applied with a binary search.
+struct AccountImage {
+    struct Account *recs;
+    int count;
+    int capacity;
+};
+
+static int findInImage(const struct AccountImage *img, int acn, int *pos) {
+    int lo = 0, hi = img->count;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (img->recs[mid].accountNumber < acn)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *pos = lo;
+    return lo < img->count && img->recs[lo].accountNumber == acn;
+}
+
+static int applyToImage(struct AccountImage *img, const struct JournalRecord *rec) {
+    int pos;
+    int present = findInImage(img, rec->acc.accountNumber, &pos);
+
+    if (rec->op == 'D') {
+        if (present) {
+            memmove(&img->recs[pos], &img->recs[pos + 1], (size_t)(img->count - pos - 1) * sizeof(*img->recs));
+            img->count--;
+        }
+        return 1;
+    }
+    if (present) {
+        img->recs[pos] = rec->acc;
+        return 1;
+    }
+    if (img->count == img->capacity) {
+        int newCapacity = img->capacity ? img->capacity * 2 : 1024;
+        struct Account *grown = realloc(img->recs, (size_t)newCapacity * sizeof(*grown));
+        if (!grown)
+            return 0;
+        img->recs = grown;
+        img->capacity = newCapacity;
+    }
+    memmove(&img->recs[pos + 1], &img->recs[pos], (size_t)(img->count - pos) * sizeof(*img->recs));
+    img->recs[pos] = rec->acc;
+    img->count++;
+    return 1;
+}
+
+// Write a backup file next to its final name, then move it into place.
+static int writeBackup(const char *path, struct BackupHeader *hdr, const struct JournalRecord *recs) {
+    char tmpPath[512];
+    FILE *out;
+    int ok;
+
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+    out = fopen(tmpPath, "wb");
+    if (!out) {
+        perror(tmpPath);
+        return 0;
+    }
+    memcpy(hdr->magic, "BRSB", 4);
+    hdr->createdAt = (long long)time(NULL);
+    ok = fwrite(hdr, sizeof(*hdr), 1, out) == 1 &&
+         fwrite(recs, sizeof(*recs), (size_t)hdr->count, out) == (size_t)hdr->count;
+    ok = fclose(out) == 0 && ok;
+    if (!ok) {
+        fprintf(stderr, "Could not write %s.\n", path);
+        remove(tmpPath);
+        return 0;
+    }
+    remove(path);
+    return rename(tmpPath, path) == 0;
+}
+
+// Start the next journal generation with the changes in `carried`, written
+// to a new file and moved into place. Called with the accounts lock held.
+static int restartJournal(const struct JournalHeader *hdr, const struct JournalRecord *carried, int n) {
+    struct JournalHeader next = *hdr;
+    FILE *out = fopen(JOURNAL_FILE ".tmp", "wb");
+    int ok;
+
+    if (!out)
+        return 0;
+    next.generation++;
+    ok = fwrite(&next, sizeof(next), 1, out) == 1 &&
+         fwrite(carried, sizeof(*carried), (size_t)n, out) == (size_t)n;
+    ok = fclose(out) == 0 && ok;
+#ifdef _WIN32
+    if (ok)
+        remove(JOURNAL_FILE);               // rename() does not replace on Windows
+#endif
+    if (!ok || rename(JOURNAL_FILE ".tmp", JOURNAL_FILE) != 0) {
+        remove(JOURNAL_FILE ".tmp");
+        return 0;
+    }
+    return 1;
+}
+
+static void saveBackupState(int generation, long long position) {
+    struct BackupState state;
+    FILE *fp = fopen(BACKUP_STATE_FILE, "wb");
+
+    if (!fp)
+        return;
+    state.generation = generation;
+    state.position = position;
+    fwrite(&state, sizeof(state), 1, fp);
+    fclose(fp);
+}
+
+// Point-in-time image of accounts.dat, taken while tellers keep working.
+// The file is copied without the lock; every change made during the copy is
+// in the journal between the start and end positions, and replaying those
+// changes over the copy repairs any record that was read mid-update. The
+// image is therefore exactly the state at the end position. Once the backup
+// is written the journal starts a new generation, holding the changes made
+// since the end position, that later incremental backups build on.
+int snapshotAccounts(const char *path) {
+    struct JournalHeader hdr;
+    struct BackupHeader backup;
+    struct AccountImage img = { NULL, 0, 0 };
+    struct JournalRecord *changes, *recs, *carried;
+    struct Account acc;
+    long long start, end, now;
+    int lock, changed, moved, generation, ok = 1;
+    RsIter it;
+    RecordStore *rs;
+    FILE *jnl;
+
+    lock = lockAccounts();
+    jnl = openJournal(&hdr, &start);
+    rs = openAccounts(0);                       // opened under the lock: its record count matches `start`
+    unlockAccounts(lock);
+    if (!jnl) {
+        fprintf(stderr, "Journal not available.\n");
+        rs_close(rs);
+        return 1;
+    }
+    generation = hdr.generation;
+
+    INSTR_BEGIN(scan, "snapshotAccounts.scan");
+    if (rs)
+        rs_iter_init(rs, &it);
+    while (rs && ok && rs_iter_next(&it, &acc) == 1) {
+        if (img.count == img.capacity) {
+            int newCapacity = img.capacity ? img.capacity * 2 : 1024;
+            struct Account *grown = realloc(img.recs, (size_t)newCapacity * sizeof(*grown));
+            if (!grown) {
+                ok = 0;
+                break;
+            }
+            img.recs = grown;
+            img.capacity = newCapacity;
+        }
+        sanitizeAccount(&acc);
+        img.recs[img.count++] = acc;
+    }
+    if (rs)
+        INSTR_BYTES_READ(scan, rs->bytes_read);
+    INSTR_END(scan);
+    rs_close(rs);
+    fclose(jnl);
+    if (img.count > 0)
+        qsort(img.recs, (size_t)img.count, sizeof(*img.recs), compareAccountNumbers);
+
+    // end of the snapshot window: collect the changes made during the copy.
+    // A journal restarted meanwhile (another snapshot, or a damaged header)
+    // no longer holds them.
+    lock = lockAccounts();
+    jnl = openJournal(&hdr, &end);
+    if (jnl && (hdr.generation != generation || end < start)) {
+        fclose(jnl);
+        unlockAccounts(lock);
+        fprintf(stderr, "The journal was restarted during the snapshot: take it again.\n");
+        free(img.recs);
+        return 1;
+    }
+    changes = jnl ? readJournal(jnl, start, end, &changed) : NULL;
+    if (jnl)
+        fclose(jnl);
+    unlockAccounts(lock);
+    if (!ok || !changes) {
+        fprintf(stderr, "Snapshot failed.\n");
+        free(changes);
+        free(img.recs);
+        return 1;
+    }
+
+    for (int i = 0; i < changed && ok; i++)
+        ok = applyToImage(&img, &changes[i]);
+    recs = malloc((size_t)(img.count > 0 ? img.count : 1) * sizeof(*recs));
+    if (!ok || !recs) {
+        fprintf(stderr, "Out of memory.\n");
+        free(changes);
+        free(img.recs);
+        free(recs);
+        return 1;
+    }
+    memset(recs, 0, (size_t)img.count * sizeof(*recs));
+    for (int i = 0; i < img.count; i++) {
+        recs[i].op = 'U';
+        recs[i].acc = img.recs[i];
+    }
+
+    memset(&backup, 0, sizeof(backup));
+    backup.kind = 'F';
+    backup.generation = generation + 1;
+    backup.startPos = backup.endPos = sizeof(struct JournalHeader);
+    backup.count = img.count;
+    ok = writeBackup(path, &backup, recs);
+
+    // only now is it safe to start the new generation: a failed backup
+    // leaves the journal, and the incremental backups built on it, as they were
+    if (ok) {
+        lock = lockAccounts();
+        jnl = openJournal(&hdr, &now);
+        carried = jnl && hdr.generation == generation && now >= end ? readJournal(jnl, end, now, &moved) : NULL;
+        if (jnl)
+            fclose(jnl);
+        ok = carried && restartJournal(&hdr, carried, moved);
+        if (ok)
+            saveBackupState(backup.generation, backup.endPos);
+        unlockAccounts(lock);
+        free(carried);
+        if (!ok)
+            fprintf(stderr, "The journal could not be restarted: incremental backups still build on the previous snapshot.\n");
+    }
+    if (ok)
+        printf("Snapshot of %d accounts written to %s (%d changes during the copy).\n",
+               img.count, path, changed);
+    free(changes);
+    free(img.recs);
+    free(recs);
+    return ok ? 0 : 1;
+}
+
+struct NumberedRecord {
+    struct JournalRecord rec;
+    int seq;
+};
+
+static int compareNumberedRecords(const void *a, const void *b) {
+    const struct NumberedRecord *x = a, *y = b;
+    int c = compareAccountNumbers(&x->rec.acc, &y->rec.acc);
+    return c != 0 ? c : (x->seq > y->seq) - (x->seq < y->seq);
+}
+
+// Accounts changed since the last snapshot or incremental backup, in their
+// state at this moment. Only the journal is read, never accounts.dat, so the
+// cost follows the day's activity rather than the size of the bank.
+int incrementalBackup(const char *path) {
+    struct BackupState state;
+    struct JournalHeader hdr;
+    struct BackupHeader backup;
+    struct JournalRecord *changes, *recs;
+    struct NumberedRecord *numbered;
+    long long end;
+    int lock, changed, n = 0, ok;
+    FILE *jnl, *fp = fopen(BACKUP_STATE_FILE, "rb");
+
+    if (!fp || fread(&state, sizeof(state), 1, fp) != 1) {
+        if (fp)
+            fclose(fp);
+        fprintf(stderr, "No previous backup: take a full snapshot first.\n");
+        return 1;
+    }
     fclose(fp);
+
+    // records before `end` never change again, so the lock is only needed
+    // to fix the end of the backup window
+    lock = lockAccounts();
+    jnl = openJournal(&hdr, &end);
+    unlockAccounts(lock);
+    if (!jnl || hdr.generation != state.generation || end < state.position ||
+        state.position < (long long)sizeof(hdr) ||
+        (state.position - (long long)sizeof(hdr)) % (long long)sizeof(struct JournalRecord) != 0) {
+        if (jnl)
+            fclose(jnl);
+        fprintf(stderr, "The journal was restarted since the last backup: take a full snapshot.\n");
+        return 1;
+    }
+    changes = readJournal(jnl, state.position, end, &changed);
+    fclose(jnl);
+    numbered = malloc((size_t)(changed > 0 ? changed : 1) * sizeof(*numbered));
+    recs = malloc((size_t)(changed > 0 ? changed : 1) * sizeof(*recs));
+    if (!changes || !numbered || !recs) {
+        fprintf(stderr, "Could not read the journal.\n");
+        free(changes);
+        free(numbered);
+        free(recs);
+        return 1;
+    }
+
+    // keep only the latest change of each account
+    for (int i = 0; i < changed; i++) {
+        numbered[i].rec = changes[i];
+        numbered[i].seq = i;
+    }
+    qsort(numbered, (size_t)changed, sizeof(*numbered), compareNumberedRecords);
+    for (int i = 0; i < changed; i++) {
+        if (i + 1 < changed && numbered[i + 1].rec.acc.accountNumber == numbered[i].rec.acc.accountNumber)
+            continue;
+        recs[n++] = numbered[i].rec;
+    }
+
+    memset(&backup, 0, sizeof(backup));
+    backup.kind = 'I';
+    backup.generation = state.generation;
+    backup.startPos = state.position;
+    backup.endPos = end;
+    backup.count = n;
+    ok = writeBackup(path, &backup, recs);
+    if (ok) {
+        saveBackupState(backup.generation, backup.endPos);
+        printf("Incremental backup of %d changed accounts written to %s.\n", n, path);
+    }
+    free(changes);
+    free(numbered);
+    free(recs);
+    return ok ? 0 : 1;
 }
+
+// Rebuild accounts.dat from a full snapshot and the incremental backups taken
+// after it, in order. The result is written to outPath (sorted by account
+// number); the live accounts.dat is not touched.
+int restoreAccounts(const char *outPath, char **backups, int count) {
+    struct AccountImage img = { NULL, 0, 0 };
+    struct BackupHeader hdr, prev;
+    struct JournalRecord rec;
+    FILE *fp, *out;
+    int ok = 1;
+
+    for (int b = 0; b < count && ok; b++) {
+        fp = fopen(backups[b], "rb");
+        if (!fp || fread(&hdr, sizeof(hdr), 1, fp) != 1 || memcmp(hdr.magic, "BRSB", 4) != 0) {
+            fprintf(stderr, "%s is not a backup file.\n", backups[b]);
+            if (fp)
+                fclose(fp);
+            ok = 0;
+            break;
+        }
+        if (b == 0 ? hdr.kind != 'F' :
+            hdr.kind != 'I' || hdr.generation != prev.generation || hdr.startPos != prev.endPos) {
+            if (b == 0)
+                fprintf(stderr, "%s is not a full snapshot.\n", backups[b]);
+            else
+                fprintf(stderr, "%s does not follow %s.\n", backups[b], backups[b - 1]);
+            fclose(fp);
+            ok = 0;
+            break;
+        }
+        for (int i = 0; i < hdr.count && ok; i++) {
+            if (fread(&rec, sizeof(rec), 1, fp) != 1) {
+                fprintf(stderr, "%s is truncated.\n", backups[b]);
+                ok = 0;
+            } else {
+                sanitizeAccount(&rec.acc);
+                ok = applyToImage(&img, &rec);
+            }
+        }
+        fclose(fp);
+        prev = hdr;
+    }
+
+    if (ok && !(out = fopen(outPath, "wb"))) {
+        perror(outPath);
+        ok = 0;
+    }
+    if (ok) {
+        ok = img.count == 0 || fwrite(img.recs, sizeof(*img.recs), (size_t)img.count, out) == (size_t)img.count;
+        ok = fclose(out) == 0 && ok;
+        if (ok)
+            printf("Restored %d accounts to %s.\n", img.count, outPath);
+    }
+    free(img.recs);
+    return ok ? 0 : 1;
+}
+
+// ---------------- File self-test ----------------
+
+#ifdef _WIN32
+#define makeDir(path) _mkdir(path)
+#define changeDir(path) _chdir(path)
+#define removeDir(path) _rmdir(path)
+#else
+#define makeDir(path) mkdir(path, 0755)
+#define changeDir(path) chdir(path)
+#define removeDir(path) rmdir(path)
+#endif
+
+#define SELFTEST_ACCOUNTS 300
+#define SELFTEST_LEDGER_ACCOUNTS 2000   // enough to make the ledger index grow
+
+// Every file the program writes, so the self-test and fuzz runs start clean.
+static const char *SCRATCH_FILES[] = {
+    ACCOUNTS_FILE, ACCOUNTS_INDEX_FILE, ACCOUNTS_LOCK_FILE, LEDGER_FILE, LEDGER_INDEX_FILE,
+    LEDGER_INDEX_FILE ".tmp", LEDGER_LOCK_FILE, NAME_INDEX_FILE, NAME_INDEX_FILE ".tmp", NAME_LOG_FILE,
+    NAME_LOCK_FILE, JOURNAL_FILE, BACKUP_STATE_FILE, "full.bak", "inc.bak", "inc2.bak", "restored.dat", "statements.txt"
+};
+
+static void removeScratchFiles() {
+    for (size_t i = 0; i < sizeof(SCRATCH_FILES) / sizeof(SCRATCH_FILES[0]); i++)
+        remove(SCRATCH_FILES[i]);
+}
+
+static unsigned long long selfTestRandom(unsigned long long *rng) {
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 7;
+    *rng ^= *rng << 17;
+    return *rng;
+}
+
+static int sameAccount(const struct Account *a, const struct Account *b) {
+    return a->accountNumber == b->accountNumber && strcmp(a->name, b->name) == 0 &&
+           a->accountType == b->accountType && a->balance == b->balance;
+}
+
+// Opens, changes and closes through the record store, journaled as the
+// tellers do. A full snapshot and two incremental backups taken along the way
+// must restore to exactly the final accounts.
+static long selfTestAccounts(unsigned long long *rng, long ops) {
+    static struct Account model[SELFTEST_ACCOUNTS + 1];    // accountType '\0': no account
+    char *backups[] = { "full.bak", "inc.bak", "inc2.bak" };
+    struct Account acc, *restored;
+    long errors = 0, live = 0, seen = 0;
+    RsIter it;
+    RecordStore *rs;
+    FILE *fp;
+    int acn, n;
+
+    memset(model, 0, sizeof(model));
+    rs = openAccounts(RS_WRITE);
+    for (long i = 0; rs && i < ops; i++) {
+        unsigned long long r = selfTestRandom(rng);
+        acn = 1 + (int)(r % SELFTEST_ACCOUNTS);
+        if ((r >> 32) & 1) {
+            memset(&acc, 0, sizeof(acc));
+            acc.accountNumber = acn;
+            snprintf(acc.name, sizeof(acc.name), "Holder %d-%llu", acn, r >> 40);
+            acc.accountType = (r >> 33) & 1 ? 'S' : 'C';
+            acc.balance = (float)(r >> 44);
+            if (rs_put(rs, &acc) != 0)
+                errors++;
+            journalRecord('U', &acc);
+            live += model[acn].accountType == '\0';
+            model[acn] = acc;
+        } else if ((r >> 34) & 1) {
+            if (rs_delete(rs, &acn) != (model[acn].accountType != '\0'))
+                errors++;
+            if (model[acn].accountType != '\0') {
+                journalRecord('D', &model[acn]);
+                model[acn].accountType = '\0';
+                live--;
+            }
+        } else if (findAccount(rs, acn, &acc) != (model[acn].accountType != '\0') ||
+                   (model[acn].accountType != '\0' && !sameAccount(&acc, &model[acn]))) {
+            errors++;
+        }
+        // backups read the files, so the store is closed around them
+        if (i == ops / 3 || i == 2 * ops / 3 || i % 256 == 255) {
+            if (rs_close(rs) != 0)
+                errors++;
+            if (i == ops / 3 && snapshotAccounts(backups[0]) != 0)
+                errors++;
+            if (i == 2 * ops / 3 && incrementalBackup(backups[1]) != 0)
+                errors++;
+            rs = openAccounts(RS_WRITE);
+        }
+    }
+    if (!rs)
+        return errors + 1;
+    rs_iter_init(rs, &it);
+    while (rs_iter_next(&it, &acc) == 1) {
+        seen++;
+        if (acc.accountNumber < 1 || acc.accountNumber > SELFTEST_ACCOUNTS ||
+            !sameAccount(&acc, &model[acc.accountNumber]))
+            errors++;
+    }
+    if (rs_close(rs) != 0 || seen != live)
+        errors++;
+
+    if (incrementalBackup(backups[2]) != 0 || restoreAccounts("restored.dat", backups, 3) != 0)
+        return errors + 1;
+    restored = malloc((size_t)(live + 1) * sizeof(*restored));
+    fp = fopen("restored.dat", "rb");
+    n = restored && fp ? (int)fread(restored, sizeof(*restored), (size_t)live + 1, fp) : -1;
+    if (n != live)
+        errors++;
+    for (acn = 1, n = 0; acn <= SELFTEST_ACCOUNTS && n < live; acn++) {
+        if (model[acn].accountType != '\0' && !sameAccount(&restored[n++], &model[acn]))
+            errors++;
+    }
+    if (fp)
+        fclose(fp);
+    free(restored);
+    return errors;
+}
+
+// Appends for random accounts: every account's chain must hold exactly its
+// own entries, newest first, and its index slot must count them.
+static long selfTestLedger(unsigned long long *rng, long ops) {
+    long long *counts = calloc(SELFTEST_LEDGER_ACCOUNTS + 1, sizeof(*counts));
+    float *newest = calloc(SELFTEST_LEDGER_ACCOUNTS + 1, sizeof(*newest));
+    struct LedgerIndexHeader hdr;
+    struct LedgerIndexSlot slot;
+    struct Transaction t;
+    FILE *ledger, *index;
+    long errors = 0;
+    int lock;
+
+    if (!counts || !newest) {
+        free(counts);
+        free(newest);
+        return 1;
+    }
+    for (long i = 0; i < ops; i++) {
+        int acn = 1 + (int)(selfTestRandom(rng) % SELFTEST_LEDGER_ACCOUNTS);
+        ledgerAppend(acn, 'D', 1.0f, (float)i);
+        counts[acn]++;
+        newest[acn] = (float)i;
+    }
+    if (!openLedger(&ledger, &index, &hdr, &lock)) {
+        free(counts);
+        free(newest);
+        return 1;
+    }
+    unlockFile(lock);
+    for (int acn = 1; acn <= SELFTEST_LEDGER_ACCOUNTS; acn++) {
+        long long n = 0;
+        float balance = newest[acn] + 1.0f;
+        findSlot(index, &hdr, acn, &slot);
+        if (slot.inUse != (counts[acn] > 0) || (slot.inUse && slot.count != counts[acn])) {
+            errors++;
+            continue;
+        }
+        for (long long off = slot.inUse ? slot.lastOffset : -1; off >= 0; off = t.prevOffset, n++) {
+            fseek(ledger, (long)off, SEEK_SET);
+            if (fread(&t, sizeof(t), 1, ledger) != 1 || t.accountNumber != acn ||
+                (n == 0 && t.balance != newest[acn]) || t.balance >= balance || t.prevOffset >= off) {
+                errors++;
+                break;
+            }
+            balance = t.balance;
+        }
+        if (n != counts[acn])
+            errors++;
+    }
+    fclose(ledger);
+    fclose(index);
+    free(counts);
+    free(newest);
+    return errors;
+}
+
+// nameIndexUpdate() and compaction against a table of (key, account) pairs;
+// each exact and prefix lookup must return exactly the live pairs.
+static long selfTestNames(unsigned long long *rng, long ops) {
+    static const char *names[] = { "Ann Lee", "  ann   LEE ", "Bob", "BOB", "Bobby Tables", "Zoe", "Ann" };
+    static const int keyOf[] = { 0, 0, 1, 1, 2, 3, 4 };     // names with the same normalized key
+    static const char *keys[] = { "ann lee", "bob", "bobby tables", "zoe", "ann" };
+    int model[5][51];               // index into names[] + 1 of the live entry, 0 = none
+    struct NameIndexEntry *results;
+    long errors = 0;
+    int found;
+
+    memset(model, 0, sizeof(model));
+    for (long i = 0; i < ops; i++) {
+        unsigned long long r = selfTestRandom(rng);
+        int name = (int)(r % 7), acn = 1 + (int)((r >> 8) % 50);
+        int add = ((r >> 16) & 3) != 0;
+        nameIndexUpdate(add ? '+' : '-', names[name], acn);
+        model[keyOf[name]][acn] = add ? name + 1 : 0;
+        if ((r >> 20) % 64 == 0)
+            compactNameIndex();
+        if (i % 50 != 49)
+            continue;
+        for (int k = 0; k < 5; k++) {
+            int want = 0, prefixWant = 0;
+            for (int a = 1; a <= 50; a++)
+                want += model[k][a] != 0;
+            // prefix "bob" also finds "bobby tables", prefix "ann" also finds "ann lee"
+            for (int kk = 0; kk < 5; kk++)
+                if (strncmp(keys[kk], keys[k], strlen(keys[k])) == 0)
+                    for (int a = 1; a <= 50; a++)
+                        prefixWant += model[kk][a] != 0;
+            results = nameIndexLookup(keys[k], 0, &found);
+            if (found != want)
+                errors++;
+            for (int j = 0; j < found; j++) {
+                int a = results[j].accountNumber;
+                if (a < 1 || a > 50 || model[k][a] == 0 || strcmp(results[j].name, names[model[k][a] - 1]) != 0 ||
+                    (j > 0 && results[j - 1].accountNumber >= a))
+                    errors++;
+            }
+            free(results);
+            results = nameIndexLookup(keys[k], 1, &found);
+            if (found != prefixWant)
+                errors++;
+            free(results);
+        }
+    }
+    return errors;
+}
+
+// Keys are lower case with single inner spaces, and normalizing a key again
+// changes nothing.
+static long selfTestNormalize(unsigned long long *rng) {
+    static const char alphabet[] = " \tAbZz-\n";
+    char name[130], key[100], again[100];
+    size_t len = (size_t)(selfTestRandom(rng) % sizeof(name));
+
+    for (size_t i = 0; i < len; i++)
+        name[i] = alphabet[selfTestRandom(rng) % (sizeof(alphabet) - 1)];
+    name[len] = '\0';
+    normalizeName(name, key, sizeof(key));
+    normalizeName(key, again, sizeof(again));
+    len = strlen(key);
+    return strcmp(key, again) != 0 || (len > 0 && (key[0] == ' ' || key[len - 1] == ' ')) ||
+           strstr(key, "  ") != NULL || strpbrk(key, "\tAZ\n") != NULL;
+}
+
+// Property checks of every file the program reads, run in a scratch
+// directory (brs_selftest) so real accounts are never touched: the accounts
+// store with its journal and backups, the ledger and its index, the name
+// index and name normalization. Returns 0 if every check passed.
+int selfTestFiles(long rounds) {
+    unsigned long long rng = 0x2545F4914F6CDD1Dull;
+    long errors = 0;
+
+    makeDir(SELFTEST_DIR);          // fails harmlessly if an interrupted run left it
+    if (changeDir(SELFTEST_DIR) != 0) {
+        printf("file self-test: cannot use directory %s\n", SELFTEST_DIR);
+        return 1;
+    }
+    removeScratchFiles();
+    errors += selfTestAccounts(&rng, rounds * 20);
+    removeScratchFiles();
+    errors += selfTestLedger(&rng, rounds * 20);
+    removeScratchFiles();
+    errors += selfTestNames(&rng, rounds * 10);
+    for (long i = 0; i < rounds * 50; i++)
+        errors += selfTestNormalize(&rng);
+    removeScratchFiles();
+    if (changeDir("..") == 0)
+        removeDir(SELFTEST_DIR);
+    printf("file self-test: %ld rounds, %s\n", rounds, errors ? "FAILED" : "ok");
+    return errors ? 1 : 0;
+}
+
+// ---------------- Fuzz targets ----------------
+
+#ifdef LAB_FUZZ
+
+// Targets with two files take them as lab_fuzz_split() cuts the input.
+int lab_fuzz_one(const char *target, const uint8_t *data, size_t size) {
+    const uint8_t *first, *second;
+    size_t firstSize, secondSize;
+    int found;
+
+    removeScratchFiles();
+    lab_fuzz_split(data, size, &first, &firstSize, &second, &secondSize);
+    if (strcmp(target, "accounts") == 0) {
+        struct Account acc;
+        RsIter it;
+        RecordStore *rs;
+        int numbers[64], n = 0;
+
+        lab_fuzz_write(ACCOUNTS_FILE, data, size);
+        allAccountHoldList();
+        rs = openAccounts(0);
+        if (rs) {
+            rs_iter_init(rs, &it);
+            while (n < 64 && rs_iter_next(&it, &acc) == 1)
+                numbers[n++] = acc.accountNumber;
+            for (int i = 0; i < n; i++)
+                findAccount(rs, numbers[i], &acc);
+            rs_close(rs);
+        }
+        rs = openAccounts(RS_WRITE);
+        if (rs) {
+            memset(&acc, 0, sizeof(acc));
+            acc.accountNumber = n > 0 ? numbers[0] : 1;
+            strcpy(acc.name, "Fuzz Holder");
+            acc.accountType = 'S';
+            rs_put(rs, &acc);
+            acc.accountNumber = acc.accountNumber == INT_MAX ? 1 : acc.accountNumber + 1;
+            rs_put(rs, &acc);
+            rs_delete(rs, &acc.accountNumber);
+            rs_close(rs);
+        }
+        free(nameIndexLookup("", 1, &found));       // builds names.idx from accounts.dat
+    } else if (strcmp(target, "ledger") == 0) {
+        lab_fuzz_write(LEDGER_FILE, first, firstSize);
+        lab_fuzz_write(LEDGER_INDEX_FILE, second, secondSize);
+        bulkStatements("1970-01-01", "2100-12-31", "statements.txt");
+        ledgerAppend(7, 'D', 1.0f, 1.0f);
+    } else if (strcmp(target, "names") == 0) {
+        lab_fuzz_write(NAME_INDEX_FILE, first, firstSize);
+        lab_fuzz_write(NAME_LOG_FILE, second, secondSize);
+        free(nameIndexLookup("ann", 0, &found));
+        free(nameIndexLookup("", 1, &found));
+        compactNameIndex();
+        free(nameIndexLookup("", 1, &found));
+    } else if (strcmp(target, "journal") == 0) {
+        lab_fuzz_write(BACKUP_STATE_FILE, first, firstSize);
+        lab_fuzz_write(JOURNAL_FILE, second, secondSize);
+        incrementalBackup("inc.bak");
+        snapshotAccounts("full.bak");
+    } else if (strcmp(target, "backup") == 0) {
+        char *backups[] = { "full.bak", "inc.bak" };
+        lab_fuzz_write(backups[0], first, firstSize);
+        lab_fuzz_write(backups[1], second, secondSize);
+        restoreAccounts("restored.dat", backups, 2);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+#endif // LAB_FUZZ
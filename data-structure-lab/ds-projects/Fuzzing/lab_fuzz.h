@@ -0,0 +1,145 @@
+/**
+ * Lab fuzzing driver: runs one of a program's file-loader fuzz targets under
+ * libFuzzer or AFL (header only).
+ *
+ * Nothing is compiled in unless the program is built with -DLAB_FUZZ. The
+ * program then leaves out its own main() and defines
+ *   int lab_fuzz_one(const char *target, const uint8_t *data, size_t size);
+ * which writes `data` to the data file(s) of `target`, runs the loaders and
+ * the code that consumes what they return, and returns -1 for an unknown
+ * target name. LAB_FUZZ_TARGETS (defined before this header is included)
+ * lists the names for error messages.
+ *
+ * libFuzzer (clang):
+ *   clang -g -O1 -fsanitize=fuzzer,address,undefined -DLAB_FUZZ BRS.c -o brs_fuzz
+ *   LAB_FUZZ_TARGET=ledger ./brs_fuzz corpus/
+ * AFL++ (also builds with plain gcc to replay crash files):
+ *   afl-clang-fast -g -fsanitize=address,undefined -DLAB_FUZZ -DLAB_FUZZ_MAIN BRS.c -o brs_afl
+ *   LAB_FUZZ_TARGET=ledger afl-fuzz -i seeds -o findings ./brs_afl @@
+ *   LAB_FUZZ_TARGET=ledger ./brs_afl findings/default/crashes/id:000000*
+ * The "fuzz" target of ../CMakeLists.txt builds brs_afl and rms_afl this way
+ * with the configured compiler.
+ *
+ * Each process works in its own scratch directory ($LAB_FUZZ_DIR, or a new
+ * /tmp/lab_fuzz.XXXXXX), so the programs' fixed file names never touch real
+ * data. The programs' console output goes to /dev/null unless
+ * $LAB_FUZZ_VERBOSE is set. Targets that need two files take the first two
+ * input bytes (little-endian) as the length of the first file; see
+ * lab_fuzz_split().
+ */
+
+#ifndef LAB_FUZZ_H
+#define LAB_FUZZ_H
+
+#ifdef LAB_FUZZ
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifndef LAB_FUZZ_TARGETS
+#define LAB_FUZZ_TARGETS "(none listed)"
+#endif
+
+int lab_fuzz_one(const char *target, const uint8_t *data, size_t size);
+
+static const char *lab_fuzz_target = NULL;
+
+static void lab_fuzz_setup(void) {
+    static char dir_template[] = "/tmp/lab_fuzz.XXXXXX";
+    if (lab_fuzz_target) return;
+    const char *target = getenv("LAB_FUZZ_TARGET");
+    if (!target || !*target) {
+        fprintf(stderr, "Set LAB_FUZZ_TARGET to one of: %s\n", LAB_FUZZ_TARGETS);
+        exit(2);
+    }
+    const char *dir = getenv("LAB_FUZZ_DIR");
+    if (!dir) dir = mkdtemp(dir_template);
+    if (!dir || chdir(dir) != 0) {
+        perror("lab_fuzz: scratch directory");
+        exit(2);
+    }
+    if (!getenv("LAB_FUZZ_VERBOSE")) {
+        int fd = open("/dev/null", O_WRONLY);
+        if (fd >= 0) {
+            fflush(stdout);
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+    }
+    lab_fuzz_target = target;
+}
+
+/* replace `path` with exactly `size` bytes (an empty input leaves an empty file) */
+static void lab_fuzz_write(const char *path, const uint8_t *data, size_t size) {
+    FILE *f = fopen(path, "wb");
+    if (!f) return;
+    if (size) fwrite(data, 1, size, f);
+    fclose(f);
+}
+
+/* two files from one input: a 2-byte length, the first file, then the second */
+static void lab_fuzz_split(const uint8_t *data, size_t size, const uint8_t **first, size_t *first_size,
+                           const uint8_t **second, size_t *second_size) {
+    size_t n = size >= 2 ? (size_t)data[0] | (size_t)data[1] << 8 : 0;
+    data += size >= 2 ? 2 : size;
+    size -= size >= 2 ? 2 : size;
+    if (n > size) n = size;
+    *first = data;
+    *first_size = n;
+    *second = data + n;
+    *second_size = size - n;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    lab_fuzz_setup();
+    if (lab_fuzz_one(lab_fuzz_target, data, size) < 0) {
+        fprintf(stderr, "Unknown LAB_FUZZ_TARGET '%s'; targets: %s\n", lab_fuzz_target, LAB_FUZZ_TARGETS);
+        exit(2);
+    }
+    return 0;
+}
+
+#ifdef LAB_FUZZ_MAIN
+
+#define LAB_FUZZ_MAX_INPUT (1 << 20)
+
+static size_t lab_fuzz_read(FILE *f, uint8_t *buf) {
+    size_t n = 0, got;
+    while (n < LAB_FUZZ_MAX_INPUT && (got = fread(buf + n, 1, LAB_FUZZ_MAX_INPUT - n, f)) > 0) n += got;
+    return n;
+}
+
+/* AFL and crash replay: each file argument is one input, or stdin if there are none */
+int main(int argc, char **argv) {
+    static uint8_t buf[LAB_FUZZ_MAX_INPUT];
+    char cwd[4096], path[4096 + 256];
+    if (!getcwd(cwd, sizeof(cwd))) cwd[0] = '\0';
+    if (argc < 2) {
+        size_t n = lab_fuzz_read(stdin, buf);
+        return LLVMFuzzerTestOneInput(buf, n);
+    }
+    for (int i = 1; i < argc; ++i) {
+        /* relative names are from where we started, not the scratch directory */
+        snprintf(path, sizeof(path), "%s%s%s", argv[i][0] == '/' ? "" : cwd, argv[i][0] == '/' ? "" : "/", argv[i]);
+        FILE *f = fopen(path, "rb");
+        if (!f) {
+            perror(argv[i]);
+            return 2;
+        }
+        size_t n = lab_fuzz_read(f, buf);
+        fclose(f);
+        fprintf(stderr, "lab_fuzz: %s (%zu bytes)\n", argv[i], n);
+        LLVMFuzzerTestOneInput(buf, n);
+    }
+    return 0;
+}
+
+#endif /* LAB_FUZZ_MAIN */
+
+#endif /* LAB_FUZZ */
+
+#endif /* LAB_FUZZ_H */
@@ -0,0 +1,356 @@
+/**
+ * Lab instrumentation: per-call-site counters, byte totals and latency
+ * histograms for the ds-projects programs (header only).
+ *
+ * Nothing is compiled in unless the program is built with -DLAB_INSTRUMENT;
+ * otherwise every macro below expands to an empty statement. For example:
+ *   gcc -O2 -DLAB_INSTRUMENT BRS.c -o BRS
+ *
+ * Usage:
+ *   INSTR_INIT("brs");                          once, first thing in main()
+ *   INSTR_BEGIN(scan, "depositAccount.scan");   starts timing one call site
+ *   INSTR_BYTES_READ(scan, n);                  adds to the call's byte counts
+ *   INSTR_BYTES_WRITTEN(scan, n);
+ *   INSTR_END(scan);                            records the call; later ENDs of
+ *                                               the same span are ignored
+ *
+ * Every INSTR_BEGIN is its own site with its own counters; the span name is
+ * a local variable, so it must be unique within the function. Counters are
+ * updated with relaxed atomics, so threads can share a site.
+ *
+ * The report is written when the program exits, on SIGINT, SIGTERM and
+ * SIGHUP (the signal is then re-raised) and on SIGUSR1 (the program carries
+ * on). It goes to $LAB_INSTRUMENT_OUT, or <program>.instr.json in the working
+ * directory, and is formatted without stdio so a signal handler may write it.
+ *
+ * Report format (JSON, one site per line):
+ *   {"program": "brs", "pid": 123, "uptime_ns": 456, "sites": [
+ *   {"site": "...", "file": "...", "line": 7, "calls": 2,
+ *    "bytes_read": 0, "bytes_written": 0, "total_ns": 0, "min_ns": 0,
+ *    "max_ns": 0, "p50_ns": 0, "p90_ns": 0, "p99_ns": 0, "p999_ns": 0,
+ *    "histogram": [[lower_ns, count], ...]}
+ *   ]}
+ *
+ * Histograms are log-linear, as in HdrHistogram: below 128 ns each
+ * nanosecond has a bucket, above that every power of two is split into 64
+ * buckets, so a bucket's lower bound is within 1.6% of any latency in it.
+ * Percentiles are reported as bucket lower bounds.
+ */
+
+#ifndef LAB_INSTRUMENT_H
+#define LAB_INSTRUMENT_H
+
+#ifdef LAB_INSTRUMENT
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <fcntl.h>
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define INSTR_SUB_BITS 7
+#define INSTR_SUB_HALF (1u << (INSTR_SUB_BITS - 1))
+#define INSTR_MAX_SHIFT 41                      /* latencies clamp at 2^48 ns (~3 days) */
+#define INSTR_BUCKETS ((INSTR_MAX_SHIFT + 2) * INSTR_SUB_HALF)
+
+typedef struct InstrSite {
+    const char *name;
+    const char *file;
+    int line;
+    int registered;
+    struct InstrSite *next;
+    uint64_t calls;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t total_ns;
+    uint64_t min_ns_plus1;                      /* 0 = nothing recorded yet */
+    uint64_t max_ns;
+    uint64_t buckets[INSTR_BUCKETS];
+} InstrSite;
+
+typedef struct {
+    InstrSite *site;                            /* NULL once the span is recorded */
+    uint64_t start;
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+} InstrSpan;
+
+static InstrSite *instr_sites = NULL;
+static uint64_t instr_epoch = 0;
+static const char *instr_program = "program";
+static char instr_path[512];
+
+static uint64_t instr_now(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER t;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&t);
+    return (uint64_t)((double)t.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static unsigned instr_bucket(uint64_t ns) {
+    if (ns < 2 * INSTR_SUB_HALF) return (unsigned)ns;
+    unsigned shift = (unsigned)(63 - __builtin_clzll(ns)) - INSTR_SUB_BITS + 1;
+    if (shift > INSTR_MAX_SHIFT) return INSTR_BUCKETS - 1;
+    return shift * INSTR_SUB_HALF + (unsigned)(ns >> shift);
+}
+
+static uint64_t instr_bucket_low(unsigned i) {
+    if (i < 2 * INSTR_SUB_HALF) return i;
+    unsigned shift = i / INSTR_SUB_HALF - 1;
+    return (uint64_t)(i - shift * INSTR_SUB_HALF) << shift;
+}
+
+static InstrSpan instr_begin(InstrSite *site) {
+    InstrSpan span;
+    span.site = site;
+    span.bytes_read = 0;
+    span.bytes_written = 0;
+    span.start = instr_now();
+    return span;
+}
+
+/* a site joins the report the first time one of its spans ends */
+static void instr_register(InstrSite *site) {
+    if (__atomic_exchange_n(&site->registered, 1, __ATOMIC_ACQ_REL)) return;
+    InstrSite *head = __atomic_load_n(&instr_sites, __ATOMIC_ACQUIRE);
+    do {
+        site->next = head;
+    } while (!__atomic_compare_exchange_n(&instr_sites, &head, site, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+static void instr_end(InstrSpan *span) {
+    InstrSite *site = span->site;
+    if (!site) return;
+    uint64_t ns = instr_now() - span->start;
+    span->site = NULL;
+    instr_register(site);
+    __atomic_fetch_add(&site->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->bytes_read, span->bytes_read, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->bytes_written, span->bytes_written, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&site->buckets[instr_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+    uint64_t cur = __atomic_load_n(&site->min_ns_plus1, __ATOMIC_RELAXED);
+    while ((cur == 0 || ns + 1 < cur) &&
+           !__atomic_compare_exchange_n(&site->min_ns_plus1, &cur, ns + 1, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+    cur = __atomic_load_n(&site->max_ns, __ATOMIC_RELAXED);
+    while (ns > cur &&
+           !__atomic_compare_exchange_n(&site->max_ns, &cur, ns, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+/* ---------- Report writer (async-signal-safe: no stdio, no malloc) ---------- */
+
+typedef struct {
+    int fd;
+    size_t len;
+    char buf[4096];
+} InstrOut;
+
+static void instr_flush(InstrOut *o) {
+    size_t done = 0;
+    while (done < o->len) {
+#ifdef _WIN32
+        int n = _write(o->fd, o->buf + done, (unsigned)(o->len - done));
+#else
+        ssize_t n = write(o->fd, o->buf + done, o->len - done);
+#endif
+        if (n <= 0) break;
+        done += (size_t)n;
+    }
+    o->len = 0;
+}
+
+static void instr_put(InstrOut *o, const char *s) {
+    for (; *s; ++s) {
+        if (o->len == sizeof(o->buf)) instr_flush(o);
+        o->buf[o->len++] = *s;
+    }
+}
+
+static void instr_put_u64(InstrOut *o, uint64_t v) {
+    char digits[21];
+    int n = 20;
+    digits[n] = '\0';
+    do {
+        digits[--n] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    instr_put(o, digits + n);
+}
+
+static void instr_put_string(InstrOut *o, const char *s) {
+    char c[3] = { '\\', 0, 0 };
+    instr_put(o, "\"");
+    for (; *s; ++s) {
+        c[1] = *s;
+        instr_put(o, (*s == '"' || *s == '\\') ? c : c + 1);
+    }
+    instr_put(o, "\"");
+}
+
+static void instr_put_field(InstrOut *o, const char *key, uint64_t v) {
+    instr_put(o, ", \"");
+    instr_put(o, key);
+    instr_put(o, "\": ");
+    instr_put_u64(o, v);
+}
+
+static uint64_t instr_percentile(const InstrSite *site, uint64_t calls, unsigned per_mille) {
+    uint64_t rank = (calls * per_mille + 999) / 1000, seen = 0;
+    for (unsigned i = 0; i < INSTR_BUCKETS; ++i) {
+        seen += __atomic_load_n(&site->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= rank && seen > 0) return instr_bucket_low(i);
+    }
+    return 0;
+}
+
+static void instr_dump(void) {
+#ifdef _WIN32
+    int fd = _open(instr_path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+#else
+    int fd = open(instr_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0) return;
+    static InstrOut out;                        /* static: too big for a signal stack */
+    InstrOut *o = &out;
+    o->fd = fd;
+    o->len = 0;
+
+    instr_put(o, "{\"program\": ");
+    instr_put_string(o, instr_program);
+#ifdef _WIN32
+    instr_put_field(o, "pid", (uint64_t)_getpid());
+#else
+    instr_put_field(o, "pid", (uint64_t)getpid());
+#endif
+    instr_put_field(o, "uptime_ns", instr_now() - instr_epoch);
+    instr_put(o, ", \"sites\": [");
+    const char *sep = "\n";
+    for (InstrSite *s = __atomic_load_n(&instr_sites, __ATOMIC_ACQUIRE); s; s = s->next) {
+        uint64_t calls = __atomic_load_n(&s->calls, __ATOMIC_RELAXED);
+        uint64_t min_plus1 = __atomic_load_n(&s->min_ns_plus1, __ATOMIC_RELAXED);
+        instr_put(o, sep);
+        sep = ",\n";
+        instr_put(o, "{\"site\": ");
+        instr_put_string(o, s->name);
+        instr_put(o, ", \"file\": ");
+        instr_put_string(o, s->file);
+        instr_put_field(o, "line", (uint64_t)s->line);
+        instr_put_field(o, "calls", calls);
+        instr_put_field(o, "bytes_read", __atomic_load_n(&s->bytes_read, __ATOMIC_RELAXED));
+        instr_put_field(o, "bytes_written", __atomic_load_n(&s->bytes_written, __ATOMIC_RELAXED));
+        instr_put_field(o, "total_ns", __atomic_load_n(&s->total_ns, __ATOMIC_RELAXED));
+        instr_put_field(o, "min_ns", min_plus1 ? min_plus1 - 1 : 0);
+        instr_put_field(o, "max_ns", __atomic_load_n(&s->max_ns, __ATOMIC_RELAXED));
+        instr_put_field(o, "p50_ns", instr_percentile(s, calls, 500));
+        instr_put_field(o, "p90_ns", instr_percentile(s, calls, 900));
+        instr_put_field(o, "p99_ns", instr_percentile(s, calls, 990));
+        instr_put_field(o, "p999_ns", instr_percentile(s, calls, 999));
+        instr_put(o, ", \"histogram\": [");
+        const char *bsep = "";
+        for (unsigned i = 0; i < INSTR_BUCKETS; ++i) {
+            uint64_t n = __atomic_load_n(&s->buckets[i], __ATOMIC_RELAXED);
+            if (!n) continue;
+            instr_put(o, bsep);
+            bsep = ", ";
+            instr_put(o, "[");
+            instr_put_u64(o, instr_bucket_low(i));
+            instr_put(o, ", ");
+            instr_put_u64(o, n);
+            instr_put(o, "]");
+        }
+        instr_put(o, "]}");
+    }
+    instr_put(o, "\n]}\n");
+    instr_flush(o);
+#ifdef _WIN32
+    _close(fd);
+#else
+    close(fd);
+#endif
+}
+
+static void instr_on_signal(int sig) {
+    instr_dump();
+#ifdef SIGUSR1
+    if (sig == SIGUSR1) return;
+#endif
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+static void instr_init(const char *program) {
+    const char *path = getenv("LAB_INSTRUMENT_OUT");
+    size_t len = 0;
+    instr_program = program;
+    instr_epoch = instr_now();
+    if (path && *path) {
+        len = strlen(path);
+        if (len >= sizeof(instr_path)) len = sizeof(instr_path) - 1;
+        memcpy(instr_path, path, len);
+    } else {
+        const char *suffix = ".instr.json";
+        size_t plen = strlen(program), slen = strlen(suffix);
+        if (plen + slen >= sizeof(instr_path)) plen = sizeof(instr_path) - 1 - slen;
+        memcpy(instr_path, program, plen);
+        memcpy(instr_path + plen, suffix, slen);
+        len = plen + slen;
+    }
+    instr_path[len] = '\0';
+
+    atexit(instr_dump);
+#ifdef _WIN32
+    signal(SIGINT, instr_on_signal);
+    signal(SIGTERM, instr_on_signal);
+#else
+    int sigs[] = { SIGINT, SIGTERM, SIGHUP, SIGUSR1 };
+    for (size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); ++i) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = instr_on_signal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;               /* a blocked scanf() just carries on after SIGUSR1 */
+        sigaction(sigs[i], &sa, NULL);
+    }
+#endif
+}
+
+#define INSTR_INIT(program) instr_init(program)
+#define INSTR_BEGIN(span, label) \
+    static InstrSite span##_site = { .name = (label), .file = __FILE__, .line = __LINE__ }; \
+    InstrSpan span = instr_begin(&span##_site)
+#define INSTR_BYTES_READ(span, n) ((span).bytes_read += (uint64_t)(n))
+#define INSTR_BYTES_WRITTEN(span, n) ((span).bytes_written += (uint64_t)(n))
+#define INSTR_END(span) instr_end(&(span))
+
+#else
+
+#define INSTR_INIT(program) ((void)0)
+#define INSTR_BEGIN(span, label) ((void)0)
+#define INSTR_BYTES_READ(span, n) ((void)0)
+#define INSTR_BYTES_WRITTEN(span, n) ((void)0)
+#define INSTR_END(span) ((void)0)
+
+#endif /* LAB_INSTRUMENT */
+
+#endif /* LAB_INSTRUMENT_H */
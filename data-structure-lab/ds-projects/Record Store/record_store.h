@@ -0,0 +1,716 @@
+/**
+ * Record store: fixed-size records in a paged file, with a page cache,
+ * batched write-back, a persistent primary-key hash index and reuse of
+ * deleted slots (header only).
+ *
+ * File layout: [data_offset bytes][page 0][page 1]..., where a page is
+ * page_header bytes followed by records_per_page records and only the last
+ * page may be shorter. With data_offset = page_header = 0 this is a plain
+ * array of structs (BRS's accounts.dat). The framing hooks let the store
+ * keep a file header and per-page checksums up to date as well, so the
+ * restaurant system's CRC-checked block files stay readable by code that
+ * does not go through the store.
+ *
+ * The primary key is key_size (at most 8) bytes at key_offset. The index
+ * is a sidecar file: an RsIndexHeader, an open-addressing table of
+ * {hash, slot + 1} entries and then the stack of free (deleted) slots that
+ * inserts reuse before growing the file. The header stamps the data file's
+ * size and mtime; if the file was changed behind the store's back (or a
+ * writer died mid-session) the index is rebuilt with one scan. Since the
+ * rebuilt sidecar is renamed over the old one, a reader only rebuilds
+ * while holding the writers' lock (the layout's lock hook); without one,
+ * or while a writer's session is open, it scans and leaves the rebuild to
+ * the next writer.
+ *
+ * Usage:
+ *   RecordStore *rs = rs_open("accounts.dat", "accounts.idx", &layout, RS_WRITE);
+ *   rs_get(rs, &key, &rec);     1 found, 0 not found, -1 error
+ *   rs_put(rs, &rec);           insert or replace by key
+ *   rs_delete(rs, &key);        1 deleted, 0 not found, -1 error
+ *   RsIter it;
+ *   rs_iter_init(rs, &it);
+ *   while (rs_iter_next(&it, &rec) == 1) ...     live records in file order
+ *   rs_close(rs);               writes dirty pages in file order, then the index
+ *
+ * A lookup costs one read of the sidecar's probe run (RS_PROBE_BATCH
+ * entries) plus one page. Pages stay cached (RS_CACHE_PAGES, least
+ * recently used is evicted) only while the store is open, so callers that
+ * look up many keys should keep one store open for all of them. Writers
+ * must be serialised by the caller; readers take no lock and fall back to
+ * a scan while the index is being rewritten.
+ *
+ * rs_test.c runs rs_selftest() on its own and rs_bench.c times lookups;
+ * both are targets of ../CMakeLists.txt (ctest runs rs_test).
+ */
+
+#ifndef RECORD_STORE_H
+#define RECORD_STORE_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define RS_WRITE 1                      /* open for update, creating the file if needed */
+#define RS_CACHE_PAGES 64
+#define RS_INDEX_MIN_SLOTS 1024         /* power of two */
+#define RS_PROBE_BATCH 16               /* index entries read at once; runs are short at 3/4 load */
+#define RS_SLOT_EMPTY 0
+#define RS_SLOT_DELETED UINT64_MAX
+#define RS_STAMP_WRITING UINT64_MAX     /* stamp_size while a writer has the index open */
+
+typedef struct {
+    size_t record_size;
+    size_t key_offset;
+    size_t key_size;                    /* 1..8 bytes */
+    size_t data_offset;                 /* bytes before page 0 */
+    size_t page_header;                 /* bytes before each page's records */
+    size_t records_per_page;
+    int (*is_free)(const void *record); /* deleted slot? */
+    void (*clear)(void *record);        /* turn a record into a deleted slot (rs_delete only) */
+    /* framing hooks, all NULL for a plain array of records */
+    int (*read_count)(FILE *f, uint64_t *count, const void *ctx);
+    int (*write_count)(FILE *f, uint64_t count, const void *ctx);
+    int (*check_page)(const void *header, const void *records, size_t n, const void *ctx);
+    void (*seal_page)(void *header, const void *records, size_t n, const void *ctx);
+    const void *ctx;
+    /* the lock writers hold (a handle, or -1), so a reader may rebuild a stale index; NULL: readers scan */
+    int (*lock)(const void *ctx);
+    void (*unlock)(int lock, const void *ctx);
+} RsLayout;
+
+/* Sidecar index header (64 bytes) */
+typedef struct {
+    char magic[4];                      /* "RSX1" */
+    uint32_t key_size;
+    uint64_t capacity;                  /* table entries, a power of two */
+    uint64_t used;                      /* live + deleted entries */
+    uint64_t live;
+    uint64_t free_count;                /* slots on the free stack */
+    uint64_t record_count;              /* data file slots the index describes */
+    uint64_t stamp_size;                /* data file size and mtime (ns) it was written for */
+    uint64_t stamp_mtime;
+} RsIndexHeader;
+
+typedef struct {
+    uint64_t hash;
+    uint64_t slot;                      /* record slot + 1, or RS_SLOT_EMPTY / RS_SLOT_DELETED */
+} RsIndexEntry;
+
+typedef struct {
+    uint64_t page;                      /* UINT64_MAX = frame not holding a page */
+    uint64_t last_use;
+    size_t count;                       /* records present in the page */
+    size_t dirty_lo, dirty_hi;          /* records to write back, dirty_lo == dirty_hi if clean */
+    unsigned char *buf;                 /* page header + records */
+} RsFrame;
+
+typedef struct {
+    RsLayout layout;
+    char path[256];
+    char index_path[256];
+    FILE *data;
+    FILE *index;
+    int writable;
+    int index_state;                    /* 0 not opened yet, 1 usable, -1 scan instead */
+    int index_dirty;                    /* header must be rewritten on flush */
+    uint64_t count;                     /* record slots, including ones still in the cache */
+    uint64_t file_count;                /* slots the file's framing currently records */
+    uint64_t disk_count;                /* slots actually present in the file */
+    size_t page_bytes;
+    uint64_t clock;
+    uint64_t bytes_read;                /* data file I/O, for instrumentation */
+    uint64_t bytes_written;
+    RsIndexHeader ih;
+    RsFrame frames[RS_CACHE_PAGES];
+} RecordStore;
+
+typedef struct {
+    RecordStore *rs;
+    uint64_t next;
+    uint64_t slot;                      /* slot of the record last returned */
+} RsIter;
+
+/* ---------- Pages ---------- */
+
+static inline long rs_page_pos(const RecordStore *rs, uint64_t page) {
+    return (long)(rs->layout.data_offset + page * (uint64_t)rs->page_bytes);
+}
+
+/* records first, then the page header: a page's header only ever describes records on disk */
+static inline int rs_write_frame(RecordStore *rs, RsFrame *fr) {
+    const RsLayout *l = &rs->layout;
+    unsigned char *records = fr->buf + l->page_header;
+    long pos = rs_page_pos(rs, fr->page);
+    size_t bytes = (fr->dirty_hi - fr->dirty_lo) * l->record_size;
+    int ok = fseek(rs->data, pos + (long)(l->page_header + fr->dirty_lo * l->record_size), SEEK_SET) == 0 &&
+             fwrite(records + fr->dirty_lo * l->record_size, 1, bytes, rs->data) == bytes;
+    rs->bytes_written += bytes;
+    if (l->page_header) {
+        if (l->seal_page) l->seal_page(fr->buf, records, fr->count, l->ctx);
+        ok = ok && fseek(rs->data, pos, SEEK_SET) == 0 &&
+             fwrite(fr->buf, 1, l->page_header, rs->data) == l->page_header;
+        rs->bytes_written += l->page_header;
+    }
+    if (fr->page * l->records_per_page + fr->count > rs->disk_count)
+        rs->disk_count = fr->page * l->records_per_page + fr->count;
+    fr->dirty_lo = fr->dirty_hi = 0;
+    return ok ? 0 : -1;
+}
+
+/* the cached frame holding `page`, reading it in (and evicting) as needed */
+static inline RsFrame *rs_frame(RecordStore *rs, uint64_t page) {
+    const RsLayout *l = &rs->layout;
+    RsFrame *victim = NULL;
+    for (int i = 0; i < RS_CACHE_PAGES; ++i) {
+        RsFrame *fr = &rs->frames[i];
+        if (fr->buf && fr->page == page) {
+            fr->last_use = ++rs->clock;
+            return fr;
+        }
+        if (!victim || (victim->buf && (!fr->buf || fr->last_use < victim->last_use))) victim = fr;
+    }
+    if (!victim->buf) {
+        victim->buf = malloc(rs->page_bytes);
+        if (!victim->buf) return NULL;
+    } else if (victim->dirty_hi > victim->dirty_lo && rs_write_frame(rs, victim) != 0) {
+        return NULL;
+    }
+    victim->page = UINT64_MAX;
+
+    /* appended records only leave the cache by being written, so a page
+       that is not cached is complete in the file */
+    uint64_t first = page * l->records_per_page;
+    uint64_t left = rs->disk_count > first ? rs->disk_count - first : 0;
+    size_t n = left < l->records_per_page ? (size_t)left : l->records_per_page;
+    if (n > 0) {
+        size_t bytes = l->page_header + n * l->record_size;
+        if (fseek(rs->data, rs_page_pos(rs, page), SEEK_SET) != 0 ||
+            fread(victim->buf, 1, bytes, rs->data) != bytes)
+            return NULL;
+        rs->bytes_read += bytes;
+        if (l->check_page && l->check_page(victim->buf, victim->buf + l->page_header, n, l->ctx) != 0)
+            return NULL;
+    } else {
+        memset(victim->buf, 0, l->page_header);
+    }
+    victim->page = page;
+    victim->count = n;
+    victim->dirty_lo = victim->dirty_hi = 0;
+    victim->last_use = ++rs->clock;
+    return victim;
+}
+
+/* pointer to a record in the cache; valid until the next call into the store */
+static inline unsigned char *rs_slot(RecordStore *rs, uint64_t slot, int writing) {
+    const RsLayout *l = &rs->layout;
+    RsFrame *fr = rs_frame(rs, slot / l->records_per_page);
+    if (!fr) return NULL;
+    size_t i = (size_t)(slot % l->records_per_page);
+    if (writing) {
+        if (i >= fr->count) fr->count = i + 1;
+        if (fr->dirty_hi == fr->dirty_lo) {
+            fr->dirty_lo = i;
+            fr->dirty_hi = i + 1;
+        } else {
+            if (i < fr->dirty_lo) fr->dirty_lo = i;
+            if (i + 1 > fr->dirty_hi) fr->dirty_hi = i + 1;
+        }
+    }
+    return fr->buf + l->page_header + i * l->record_size;
+}
+
+/* write dirty pages in file order, then the framing's record count */
+static inline int rs_flush_data(RecordStore *rs) {
+    int ok = 1;
+    for (;;) {
+        RsFrame *next = NULL;
+        for (int i = 0; i < RS_CACHE_PAGES; ++i) {
+            RsFrame *fr = &rs->frames[i];
+            if (fr->buf && fr->dirty_hi > fr->dirty_lo && (!next || fr->page < next->page)) next = fr;
+        }
+        if (!next) break;
+        if (rs_write_frame(rs, next) != 0) ok = 0;
+    }
+    if (ok && rs->count != rs->file_count && rs->layout.write_count) {
+        ok = rs->layout.write_count(rs->data, rs->count, rs->layout.ctx) == 0;
+    }
+    if (ok) rs->file_count = rs->count;
+    if (fflush(rs->data) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* ---------- Index ---------- */
+
+static inline uint64_t rs_hash(const void *key, size_t len) {
+    const unsigned char *p = key;
+    uint64_t h = 14695981039346656037ull;           /* FNV-1a */
+    for (size_t i = 0; i < len; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static inline int rs_stamp(const char *path, uint64_t *size, uint64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0) return -1;
+    *size = (uint64_t)st.st_size;
+#if defined(_WIN32) || defined(__APPLE__)
+    *mtime = (uint64_t)st.st_mtime * 1000000000u;
+#else
+    *mtime = (uint64_t)st.st_mtim.tv_sec * 1000000000u + (uint64_t)st.st_mtim.tv_nsec;
+#endif
+    return 0;
+}
+
+static inline long rs_entry_pos(uint64_t i) {
+    return (long)(sizeof(RsIndexHeader) + i * sizeof(RsIndexEntry));
+}
+
+static inline long rs_free_pos(const RecordStore *rs, uint64_t i) {
+    return (long)(sizeof(RsIndexHeader) + rs->ih.capacity * sizeof(RsIndexEntry) + i * sizeof(uint64_t));
+}
+
+static inline int rs_index_io(RecordStore *rs, long pos, void *buf, size_t len, int writing) {
+    if (fseek(rs->index, pos, SEEK_SET) != 0) return -1;
+    size_t done = writing ? fwrite(buf, 1, len, rs->index) : fread(buf, 1, len, rs->index);
+    return done == len ? 0 : -1;
+}
+
+/*
+ * Write a fresh sidecar from one scan of the data file: every live record
+ * is indexed (the first of any duplicate keys wins, as a linear search
+ * would find it) and every free slot goes on the free stack.
+ */
+static inline int rs_index_rebuild(RecordStore *rs) {
+    const RsLayout *l = &rs->layout;
+    RsIndexHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "RSX1", 4);
+    h.key_size = (uint32_t)l->key_size;
+    if (rs->writable && rs_flush_data(rs) != 0) return -1;
+    if (rs_stamp(rs->path, &h.stamp_size, &h.stamp_mtime) != 0) return -1;
+    h.record_count = rs->count;
+
+    size_t nfree = 0, nlive = 0, cap_free = 0, cap_live = 0;
+    uint64_t *free_slots = NULL, *live_slots = NULL;
+    int ok = 1;
+    for (uint64_t s = 0; ok && s < rs->count; ++s) {
+        const unsigned char *rec = rs_slot(rs, s, 0);
+        if (!rec) { ok = 0; break; }
+        int is_free = l->is_free && l->is_free(rec);
+        uint64_t **arr = is_free ? &free_slots : &live_slots;
+        size_t *n = is_free ? &nfree : &nlive, *cap = is_free ? &cap_free : &cap_live;
+        if (*n == *cap) {
+            size_t grown_cap = *cap ? *cap * 2 : 1024;
+            uint64_t *grown = realloc(*arr, grown_cap * sizeof(uint64_t));
+            if (!grown) { ok = 0; break; }
+            *arr = grown;
+            *cap = grown_cap;
+        }
+        (*arr)[(*n)++] = s;
+    }
+
+    h.capacity = RS_INDEX_MIN_SLOTS;
+    while (h.capacity < 2 * (uint64_t)nlive) h.capacity *= 2;
+    RsIndexEntry *table = ok ? calloc((size_t)h.capacity, sizeof(RsIndexEntry)) : NULL;
+    uint64_t *keys = ok ? calloc((size_t)h.capacity, sizeof(uint64_t)) : NULL;
+    ok = ok && table && keys;
+    for (size_t i = 0; ok && i < nlive; ++i) {
+        const unsigned char *rec = rs_slot(rs, live_slots[i], 0);
+        if (!rec) { ok = 0; break; }
+        uint64_t key = 0, hash = rs_hash(rec + l->key_offset, l->key_size);
+        memcpy(&key, rec + l->key_offset, l->key_size);
+        uint64_t j = hash & (h.capacity - 1);
+        while (table[j].slot != RS_SLOT_EMPTY && keys[j] != key) j = (j + 1) & (h.capacity - 1);
+        if (table[j].slot != RS_SLOT_EMPTY) continue;
+        table[j].hash = hash;
+        table[j].slot = live_slots[i] + 1;
+        keys[j] = key;
+        h.used++;
+        h.live++;
+    }
+    h.free_count = nfree;
+
+    char tmp[sizeof(rs->index_path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", rs->index_path);
+    FILE *f = ok ? fopen(tmp, "wb") : NULL;
+    if (f) {
+        ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+             fwrite(table, sizeof(RsIndexEntry), (size_t)h.capacity, f) == (size_t)h.capacity &&
+             (nfree == 0 || fwrite(free_slots, sizeof(uint64_t), nfree, f) == nfree);
+        if (fclose(f) != 0) ok = 0;
+        if (rs->index) fclose(rs->index);
+        rs->index = NULL;
+#ifdef _WIN32
+        if (ok) remove(rs->index_path);             /* rename() does not replace on Windows */
+#endif
+        ok = ok && rename(tmp, rs->index_path) == 0;
+        if (!ok) remove(tmp);
+    } else {
+        ok = 0;
+    }
+    free(table);
+    free(keys);
+    free(free_slots);
+    free(live_slots);
+    if (ok) rs->index = fopen(rs->index_path, rs->writable ? "rb+" : "rb");
+    if (!ok || !rs->index) return -1;
+    rs->ih = h;
+    rs->index_dirty = 0;
+    return 0;
+}
+
+/* record slots the data file holds right now */
+static inline int rs_read_count(RecordStore *rs, uint64_t *count) {
+    const RsLayout *l = &rs->layout;
+    if (l->read_count) return l->read_count(rs->data, count, l->ctx) == 0 ? 0 : -1;
+    if (fseek(rs->data, 0, SEEK_END) != 0) return -1;
+    long size = ftell(rs->data);
+    if (size < 0) return -1;
+    /* a torn record at the end (crash mid-append) is not counted */
+    *count = size > (long)l->data_offset ? (uint64_t)(size - (long)l->data_offset) / l->record_size : 0;
+    return 0;
+}
+
+/* (re)open the sidecar: 1 if it matches the data, 0 if not, -1 if a writer's session is open on it */
+static inline int rs_index_open(RecordStore *rs, RsIndexHeader *h) {
+    uint64_t size, mtime;
+    if (rs->index) fclose(rs->index);
+    rs->index = fopen(rs->index_path, rs->writable ? "rb+" : "rb");
+    if (!rs->index || fread(h, sizeof(*h), 1, rs->index) != 1) return 0;
+    if (h->stamp_size == RS_STAMP_WRITING) return -1;
+    return memcmp(h->magic, "RSX1", 4) == 0 && h->key_size == rs->layout.key_size &&
+           h->capacity >= RS_INDEX_MIN_SLOTS && (h->capacity & (h->capacity - 1)) == 0 &&
+           h->record_count == rs->count &&
+           rs_stamp(rs->path, &size, &mtime) == 0 &&
+           h->stamp_size == size && h->stamp_mtime == mtime;
+}
+
+/*
+ * Open the sidecar on first use; rebuild it if it does not match the data.
+ * Writers hold the lock already. A reader takes it for the rebuild, since
+ * a writer may have the old sidecar open, and leaves a sidecar that is
+ * marked as being written alone (its writer may be this very process).
+ */
+static inline int rs_index_ready(RecordStore *rs) {
+    if (rs->index_state) return rs->index_state;
+    const RsLayout *l = &rs->layout;
+    RsIndexHeader h;
+    int valid = rs_index_open(rs, &h);
+    if (valid == 1) {
+        rs->ih = h;
+        rs->index_state = 1;
+    } else if (rs->writable) {
+        rs->index_state = rs_index_rebuild(rs) == 0 ? 1 : -1;
+    } else {
+        rs->index_state = -1;                       /* scan */
+        int lock = valid == 0 && l->lock ? l->lock(l->ctx) : -1;
+        if (lock >= 0) {
+            uint64_t count;
+            /* a writer that ran before we got the lock leaves our view stale: scan it as it is */
+            if (rs_read_count(rs, &count) == 0 && count == rs->count) {
+                for (int i = 0; i < RS_CACHE_PAGES; ++i) rs->frames[i].page = UINT64_MAX;
+                valid = rs_index_open(rs, &h);      /* another reader may have rebuilt it meanwhile */
+                if (valid == 1) {
+                    rs->ih = h;
+                    rs->index_state = 1;
+                } else if (valid == 0) {
+                    rs->index_state = rs_index_rebuild(rs) == 0 ? 1 : -1;
+                }
+            }
+            l->unlock(lock, l->ctx);
+        }
+    }
+    return rs->index_state;
+}
+
+/* the first change of a session marks the index as being written */
+static inline int rs_index_touch(RecordStore *rs) {
+    if (rs->index_dirty) return 0;
+    RsIndexHeader h = rs->ih;
+    h.stamp_size = RS_STAMP_WRITING;
+    rs->index_dirty = 1;
+    if (rs_index_io(rs, 0, &h, sizeof(h), 1) != 0 || fflush(rs->index) != 0) return -1;
+    return 0;
+}
+
+/*
+ * Probe for `key`. Returns 1 with *pos and *entry on its entry, 0 with *pos on
+ * the entry an insert should use (*entry says whether it was empty or
+ * deleted), -1 on error.
+ */
+static inline int rs_find(RecordStore *rs, const void *key, uint64_t *pos, RsIndexEntry *entry) {
+    const RsLayout *l = &rs->layout;
+    uint64_t hash = rs_hash(key, l->key_size), mask = rs->ih.capacity - 1;
+    int have_spot = 0;
+    RsIndexEntry run[RS_PROBE_BATCH];
+    size_t have = 0, next = 0;
+    for (uint64_t n = 0, i = hash & mask; n < rs->ih.capacity; ++n, i = (i + 1) & mask) {
+        if (next == have) {                         /* read on from i, up to the end of the table */
+            have = rs->ih.capacity - i < RS_PROBE_BATCH ? (size_t)(rs->ih.capacity - i) : RS_PROBE_BATCH;
+            next = 0;
+            if (rs_index_io(rs, rs_entry_pos(i), run, have * sizeof(RsIndexEntry), 0) != 0) return -1;
+        }
+        RsIndexEntry e = run[next++];
+        if (e.slot == RS_SLOT_EMPTY || e.slot == RS_SLOT_DELETED) {
+            if (!have_spot) {
+                *pos = i;
+                *entry = e;
+                have_spot = 1;
+            }
+            if (e.slot == RS_SLOT_EMPTY) return 0;
+            continue;
+        }
+        if (e.hash != hash || e.slot > rs->count) continue;
+        const unsigned char *rec = rs_slot(rs, e.slot - 1, 0);
+        if (!rec) return -1;
+        if (memcmp(rec + l->key_offset, key, l->key_size) == 0) {
+            *pos = i;
+            *entry = e;
+            return 1;
+        }
+    }
+    return have_spot ? 0 : -1;
+}
+
+/* ---------- Public API ---------- */
+
+/* NULL if the file cannot be opened (or, without RS_WRITE, does not exist) */
+static inline RecordStore *rs_open(const char *path, const char *index_path, const RsLayout *layout, int flags) {
+    RecordStore *rs = calloc(1, sizeof(*rs));
+    if (!rs) return NULL;
+    rs->layout = *layout;
+    rs->writable = (flags & RS_WRITE) != 0;
+    snprintf(rs->path, sizeof(rs->path), "%s", path);
+    snprintf(rs->index_path, sizeof(rs->index_path), "%s", index_path);
+    rs->page_bytes = layout->page_header + layout->records_per_page * layout->record_size;
+    for (int i = 0; i < RS_CACHE_PAGES; ++i) rs->frames[i].page = UINT64_MAX;
+
+    rs->data = fopen(path, rs->writable ? "rb+" : "rb");
+    if (!rs->data && rs->writable) rs->data = fopen(path, "wb+");
+    if (!rs->data) {
+        free(rs);
+        return NULL;
+    }
+    if (rs_read_count(rs, &rs->count) != 0) {
+        fclose(rs->data);
+        free(rs);
+        return NULL;
+    }
+    rs->file_count = rs->disk_count = rs->count;
+    return rs;
+}
+
+static inline int rs_flush(RecordStore *rs) {
+    if (!rs->writable) return 0;
+    int ok = rs_flush_data(rs) == 0;
+    if (ok && rs->index_dirty) {
+        rs->ih.record_count = rs->count;
+        ok = rs_stamp(rs->path, &rs->ih.stamp_size, &rs->ih.stamp_mtime) == 0 &&
+             rs_index_io(rs, 0, &rs->ih, sizeof(rs->ih), 1) == 0 && fflush(rs->index) == 0;
+        if (ok) rs->index_dirty = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+/* flush and free the store; returns -1 if anything failed to reach the files */
+static inline int rs_close(RecordStore *rs) {
+    if (!rs) return 0;
+    int rc = rs_flush(rs);
+    if (fclose(rs->data) != 0) rc = -1;
+    if (rs->index && fclose(rs->index) != 0) rc = -1;
+    for (int i = 0; i < RS_CACHE_PAGES; ++i) free(rs->frames[i].buf);
+    free(rs);
+    return rc;
+}
+
+static inline void rs_iter_init(RecordStore *rs, RsIter *it) {
+    it->rs = rs;
+    it->next = 0;
+    it->slot = 0;
+}
+
+/* copy the next live record into `out`: 1, or 0 at the end, -1 on error */
+static inline int rs_iter_next(RsIter *it, void *out) {
+    const RsLayout *l = &it->rs->layout;
+    while (it->next < it->rs->count) {
+        const unsigned char *rec = rs_slot(it->rs, it->next, 0);
+        if (!rec) return -1;
+        it->slot = it->next++;
+        if (l->is_free && l->is_free(rec)) continue;
+        memcpy(out, rec, l->record_size);
+        return 1;
+    }
+    return 0;
+}
+
+static inline int rs_get(RecordStore *rs, const void *key, void *out) {
+    const RsLayout *l = &rs->layout;
+    if (rs_index_ready(rs) > 0) {
+        uint64_t pos;
+        RsIndexEntry e;
+        int found = rs_find(rs, key, &pos, &e);
+        if (found <= 0) return found;
+        memcpy(out, rs_slot(rs, e.slot - 1, 0), l->record_size);   /* still cached by rs_find */
+        return 1;
+    }
+    RsIter it;
+    int rc;
+    rs_iter_init(rs, &it);
+    while ((rc = rs_iter_next(&it, out)) == 1)
+        if (memcmp((const unsigned char *)out + l->key_offset, key, l->key_size) == 0) return 1;
+    return rc;
+}
+
+/* insert, or replace the record with the same key; 0 on success */
+static inline int rs_put(RecordStore *rs, const void *record) {
+    const RsLayout *l = &rs->layout;
+    const unsigned char *key = (const unsigned char *)record + l->key_offset;
+    uint64_t pos, slot;
+    RsIndexEntry e;
+    if (!rs->writable || rs_index_ready(rs) <= 0 || rs_index_touch(rs) != 0) return -1;
+    int found = rs_find(rs, key, &pos, &e);
+    if (found < 0) return -1;
+    if (found) {
+        slot = e.slot - 1;
+    } else {
+        if (rs->ih.free_count > 0) {
+            if (rs_index_io(rs, rs_free_pos(rs, rs->ih.free_count - 1), &slot, sizeof(slot), 0) != 0)
+                return -1;
+            rs->ih.free_count--;
+        } else {
+            slot = rs->count++;
+        }
+        if (e.slot == RS_SLOT_EMPTY) rs->ih.used++;
+        rs->ih.live++;
+        e.hash = rs_hash(key, l->key_size);
+        e.slot = slot + 1;
+        if (rs_index_io(rs, rs_entry_pos(pos), &e, sizeof(e), 1) != 0) return -1;
+    }
+    unsigned char *dst = rs_slot(rs, slot, 1);
+    if (!dst) return -1;
+    memcpy(dst, record, l->record_size);
+    if (rs->ih.used * 4 > rs->ih.capacity * 3) return rs_index_rebuild(rs);
+    return 0;
+}
+
+/* clear the record and put its slot on the free stack */
+static inline int rs_delete(RecordStore *rs, const void *key) {
+    const RsLayout *l = &rs->layout;
+    uint64_t pos;
+    RsIndexEntry e;
+    if (!rs->writable || !l->clear || rs_index_ready(rs) <= 0 || rs_index_touch(rs) != 0) return -1;
+    int found = rs_find(rs, key, &pos, &e);
+    if (found <= 0) return found;
+    uint64_t slot = e.slot - 1;
+    unsigned char *rec = rs_slot(rs, slot, 1);
+    if (!rec) return -1;
+    l->clear(rec);
+    e.slot = RS_SLOT_DELETED;
+    if (rs_index_io(rs, rs_entry_pos(pos), &e, sizeof(e), 1) != 0 ||
+        rs_index_io(rs, rs_free_pos(rs, rs->ih.free_count), &slot, sizeof(slot), 1) != 0)
+        return -1;
+    rs->ih.free_count++;
+    rs->ih.live--;
+    return 1;
+}
+
+/* ---------- Self-test ---------- */
+
+typedef struct {
+    int32_t key;
+    int32_t in_use;
+    uint64_t value;
+    char pad[48];
+} RsTestRecord;
+
+static inline int rs_test_is_free(const void *record) {
+    return !((const RsTestRecord *)record)->in_use;
+}
+
+static inline void rs_test_clear(void *record) {
+    memset(record, 0, sizeof(RsTestRecord));
+}
+
+/*
+ * Run `n` random puts, deletes and gets against an in-memory model, closing
+ * and reopening the store now and then, and check every answer plus a full
+ * iteration at the end. Uses rs_selftest.dat/.idx in the working
+ * directory. Returns 0 if everything matched.
+ */
+static inline int rs_selftest(long n) {
+    const RsLayout layout = {
+        .record_size = sizeof(RsTestRecord), .key_offset = offsetof(RsTestRecord, key),
+        .key_size = sizeof(int32_t), .records_per_page = 4096 / sizeof(RsTestRecord),
+        .is_free = rs_test_is_free, .clear = rs_test_clear
+    };
+    long keys = n / 4 > 16 ? n / 4 : 16;
+    uint64_t *model = calloc((size_t)keys + 1, sizeof(uint64_t));   /* value + 1, 0 = absent */
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    long errors = 0, gets = 0;
+    double get_seconds = 0;
+    remove("rs_selftest.dat");
+    remove("rs_selftest.idx");
+    RecordStore *rs = model ? rs_open("rs_selftest.dat", "rs_selftest.idx", &layout, RS_WRITE) : NULL;
+    if (!rs) {
+        free(model);
+        printf("record store self-test: cannot create rs_selftest.dat\n");
+        return 1;
+    }
+    for (long i = 0; i < n && errors < 10; ++i) {
+        rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+        int32_t key = (int32_t)(rng % (uint64_t)keys) + 1;
+        unsigned op = (unsigned)(rng >> 40) % 10;
+        RsTestRecord rec;
+        if (op < 4) {
+            memset(&rec, 0, sizeof(rec));
+            rec.key = key;
+            rec.in_use = 1;
+            rec.value = rng;
+            if (rs_put(rs, &rec) != 0) errors++;
+            model[key] = rng + 1;
+        } else if (op < 6) {
+            int rc = rs_delete(rs, &key);
+            if (rc != (model[key] != 0)) errors++;
+            model[key] = 0;
+        } else {
+            clock_t start = clock();
+            int rc = rs_get(rs, &key, &rec);
+            get_seconds += (double)(clock() - start) / CLOCKS_PER_SEC;
+            gets++;
+            if (rc != (model[key] != 0) || (rc == 1 && rec.value + 1 != model[key])) errors++;
+        }
+        if (i % 4096 == 4095) {
+            if (rs_close(rs) != 0) errors++;
+            rs = rs_open("rs_selftest.dat", "rs_selftest.idx", &layout, RS_WRITE);
+            if (!rs) { errors++; break; }
+        }
+    }
+    long live = 0, seen = 0;
+    for (long k = 1; k <= keys; ++k) live += model[k] != 0;
+    if (rs) {
+        RsIter it;
+        RsTestRecord rec;
+        rs_iter_init(rs, &it);
+        while (rs_iter_next(&it, &rec) == 1) {
+            seen++;
+            if (rec.key < 1 || rec.key > keys || model[rec.key] != rec.value + 1) errors++;
+        }
+        if (seen != live) errors++;
+        printf("record store self-test: %ld ops, %ld live records in %llu slots, "
+               "%.2f us per get, %s\n", n, live, (unsigned long long)rs->count,
+               gets ? get_seconds * 1e6 / (double)gets : 0.0, errors ? "FAILED" : "ok");
+        rs_close(rs);
+    }
+    free(model);
+    remove("rs_selftest.dat");
+    remove("rs_selftest.idx");
+    return errors ? 1 : 0;
+}
+
+#endif /* RECORD_STORE_H */
@@ -0,0 +1,109 @@
+/*
+ * Lookup benchmark for record_store.h. Fills a store with `records` keys,
+ * then times random gets three ways:
+ *   open      one store kept open for every get (pages and probes cached)
+ *   reopen    rs_open/rs_get/rs_close per get, as a one-off lookup pays
+ *   scan      rs_iter over the file per get, what a missing index costs
+ * Works in the current directory (rs_bench.dat/.idx, removed afterwards).
+ *
+ *   rs_bench [records] [gets]      defaults 200000 and 200000
+ */
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE                  /* st_mtim under -std=c99 */
+#endif
+
+#include "record_store.h"
+
+static uint64_t bench_next(uint64_t *rng) {
+    *rng ^= *rng << 13; *rng ^= *rng >> 7; *rng ^= *rng << 17;
+    return *rng;
+}
+
+static void bench_report(const char *how, long gets, long found, double seconds, uint64_t bytes) {
+    printf("%-7s %8ld gets, %8ld found, %9.3f us per get, %8.1f data bytes read per get\n",
+           how, gets, found, gets ? seconds * 1e6 / (double)gets : 0.0,
+           gets ? (double)bytes / (double)gets : 0.0);
+}
+
+int main(int argc, char **argv) {
+    const RsLayout layout = {
+        .record_size = sizeof(RsTestRecord), .key_offset = offsetof(RsTestRecord, key),
+        .key_size = sizeof(int32_t), .records_per_page = 4096 / sizeof(RsTestRecord),
+        .is_free = rs_test_is_free, .clear = rs_test_clear
+    };
+    long records = argc > 1 ? atol(argv[1]) : 200000;
+    long gets = argc > 2 ? atol(argv[2]) : 200000;
+    uint64_t rng = 0x9E3779B97F4A7C15ull, bytes = 0;
+    RsTestRecord rec;
+    long found = 0;
+    clock_t start;
+    if (records <= 0) records = 200000;
+    if (gets <= 0) gets = 200000;
+
+    remove("rs_bench.dat");
+    remove("rs_bench.idx");
+    RecordStore *rs = rs_open("rs_bench.dat", "rs_bench.idx", &layout, RS_WRITE);
+    start = clock();
+    for (long k = 1; rs && k <= records; ++k) {
+        memset(&rec, 0, sizeof(rec));
+        rec.key = (int32_t)k;
+        rec.in_use = 1;
+        rec.value = (uint64_t)k;
+        if (rs_put(rs, &rec) != 0) {
+            rs_close(rs);
+            rs = NULL;
+        }
+    }
+    if (!rs || rs_close(rs) != 0) {
+        printf("record store bench: cannot build rs_bench.dat\n");
+        return 1;
+    }
+    printf("record store bench: %ld records of %zu bytes, built in %.2f s\n",
+           records, sizeof(RsTestRecord), (double)(clock() - start) / CLOCKS_PER_SEC);
+
+    rs = rs_open("rs_bench.dat", "rs_bench.idx", &layout, 0);
+    start = clock();
+    for (long i = 0; rs && i < gets; ++i) {
+        int32_t key = (int32_t)(bench_next(&rng) % (uint64_t)records) + 1;
+        found += rs_get(rs, &key, &rec) == 1 && rec.value == (uint64_t)key;
+    }
+    if (rs) bytes = rs->bytes_read;
+    bench_report("open", gets, found, (double)(clock() - start) / CLOCKS_PER_SEC, bytes);
+    rs_close(rs);
+
+    long reopen_gets = gets / 10 > 0 ? gets / 10 : 1;
+    found = 0;
+    bytes = 0;
+    start = clock();
+    for (long i = 0; i < reopen_gets; ++i) {
+        int32_t key = (int32_t)(bench_next(&rng) % (uint64_t)records) + 1;
+        rs = rs_open("rs_bench.dat", "rs_bench.idx", &layout, 0);
+        found += rs && rs_get(rs, &key, &rec) == 1 && rec.value == (uint64_t)key;
+        if (rs) bytes += rs->bytes_read;
+        rs_close(rs);
+    }
+    bench_report("reopen", reopen_gets, found, (double)(clock() - start) / CLOCKS_PER_SEC, bytes);
+
+    long scan_gets = 20;
+    found = 0;
+    rs = rs_open("rs_bench.dat", "rs_bench.idx", &layout, 0);
+    start = clock();
+    for (long i = 0; rs && i < scan_gets; ++i) {
+        int32_t key = (int32_t)(bench_next(&rng) % (uint64_t)records) + 1;
+        RsIter it;
+        rs_iter_init(rs, &it);
+        while (rs_iter_next(&it, &rec) == 1)
+            if (rec.key == key) {
+                found++;
+                break;
+            }
+    }
+    bytes = rs ? rs->bytes_read : 0;
+    bench_report("scan", scan_gets, found, (double)(clock() - start) / CLOCKS_PER_SEC, bytes);
+    rs_close(rs);
+
+    remove("rs_bench.dat");
+    remove("rs_bench.idx");
+    return 0;
+}
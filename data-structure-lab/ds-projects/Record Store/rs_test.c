@@ -0,0 +1,19 @@
+/*
+ * Unit test for record_store.h on its own: rs_selftest() runs random puts,
+ * deletes and gets against an in-memory model, reopening the store now and
+ * then, and checks a full iteration at the end. It works in the current
+ * directory (rs_selftest.dat/.idx, removed afterwards).
+ *
+ *   rs_test [ops]      default 200000; exit status 0 if every answer matched
+ */
+
+#ifndef _WIN32
+#define _DEFAULT_SOURCE                  /* st_mtim under -std=c99 */
+#endif
+
+#include "record_store.h"
+
+int main(int argc, char **argv) {
+    long ops = argc > 1 ? atol(argv[1]) : 200000;
+    return rs_selftest(ops > 0 ? ops : 200000);
+}
@@ -6,9 +6,30 @@
  *
  * Features:
  *  - Admin: add menu item, update item, view menu, view orders, change password
- *  - Customer: view menu, place order (multiple items), get invoice
+ *  - Customer: view menu, place order (multiple items), get invoice, list
+ *    their last orders with lifetime totals, reorder a previous order
+ *  - Stock: per-item and per-ingredient counts shared by all terminals through
+ *    a memory-mapped stock.dat; order lines reserve stock atomically, items
+ *    show as sold out at zero, and low-stock levels raise alerts. Reserved
+ *    stock is recorded under the terminal's lease, so stock held by a
+ *    terminal that crashed is put back on hand
  *  - Persistent storage using binary files: menu.dat, orders.dat
- *  - Simple admin password stored in admin.dat (binary)
+ *  - Admin password stored in admin.dat as a salted scrypt hash, checked in
+ *    constant time, with persistent exponential backoff after failed logins
+ *  - Every data file carries a versioned header and CRC32C-checked blocks
+ *  - Customer order index: customers.idx maps a normalized customer name to
+ *    the customer's latest order and customer_orders.dat links every order
+ *    to that customer's previous one, so a customer's history costs a few
+ *    block reads however long orders.dat grows
+ *  - Menu items and orders are looked up, added and updated through the
+ *    record store (../Record Store/record_store.h): menu.idx and orders.idx
+ *    map ids to records, so a lookup reads one block instead of the file
+ *  - Server mode (Linux): one process serves many POS terminals over a UNIX
+ *    socket with epoll, sharing one in-memory menu and writing the orders
+ *    of all connections in batches
+ *  - Pricing in whole cents: per-category tax rates, combo discounts and
+ *    happy-hour windows kept in pricing.dat (Admin > Pricing Rules); quotes
+ *    for a basket already priced under the same rules come from a cache
  *
  * Compile:
  *   gcc Restaurant_management_system.c -o Restaurant_management_system
@@ -16,27 +37,219 @@
  * Run:
  *   ./Restaurant_management_system   (Linux/macOS)
  *   Restaurant_management_system.exe (Windows)
+ *   ./Restaurant_management_system --bench-kdf [target_ms]
+ *       times the password KDF at increasing cost and suggests the largest
+ *       -DADMIN_KDF_LOG2_N=<n> that keeps one login under target_ms (default 250)
+ *   ./Restaurant_management_system --selftest-store [ops]
+ *       checks the record store against an in-memory model with random
+ *       puts, deletes and gets (default 200000) and reports the lookup time
+ *   ./Restaurant_management_system --selftest-files [rounds]
+ *       round-trips random records through every data file path (save,
+ *       append, block and record rewrites, the cents migration, the record
+ *       store) and checks money parsing and pricing invariants (default 200)
+ *   ./Restaurant_management_system --serve [socket]
+ *       serves terminals on a UNIX socket (default restaurant.sock) until
+ *       Ctrl+C; Linux only
+ *   ./Restaurant_management_system --load-test CLIENTS ORDERS [IDLE] [socket]
+ *       places ORDERS random orders through CLIENTS busy connections while
+ *       IDLE more stay open, and reports orders/s and latency percentiles
+ *   ./Restaurant_management_system --bench-pricing [baskets]
+ *       prices lunch-rush baskets (default 1000000) with and without the
+ *       quote cache and checks that both give the same totals
+ *
+ * Server protocol (one request per line, replies end in '\n'):
+ *   M                      menu, one "id|name|category|price|available"
+ *                          line per item, then "."
+ *   O name|id:qty,id:qty   place an order: "OK <order id> <total>" once it
+ *                          is on disk, or "ERR <reason>"
+ *   H [n]                  the newest n orders (default 10, at most 50),
+ *                          "id|customer|time|items|total" lines, then "."
+ *   Q                      close the connection
+ *   Requests may be pipelined; replies come back in request order.
+ *
+ * Instrumentation:
+ *   gcc -DLAB_INSTRUMENT Restaurant_management_system.c -o Restaurant_management_system
+ *       counts calls, bytes and latency of the data file helpers and writes
+ *       them to restaurant.instr.json (see ../Instrumentation/lab_instrument.h)
+ *
+ * Sanitizers (run after any change to the data file code):
+ *   gcc -g -O1 -fsanitize=address,undefined -fno-omit-frame-pointer \
+ *       Restaurant_management_system.c -o rms_asan && ./rms_asan --selftest-files
+ *   (or "cmake --build build --target asan" with ../CMakeLists.txt)
+ *
+ * Fuzzing (targets: menu, orders, pricing, customers, admin):
+ *   clang -g -O1 -fsanitize=fuzzer,address,undefined -DLAB_FUZZ Restaurant_management_system.c -o rms_fuzz
+ *   LAB_FUZZ_TARGET=orders ./rms_fuzz corpus/
+ *       feeds generated files to the loaders in a scratch directory; the
+ *       -DLAB_FUZZ_MAIN build (rms_afl, the CMake "fuzz" target) replays
+ *       files or runs under AFL (see ../Fuzzing/lab_fuzz.h). Everything
+ *       read back from a data file is sanitized before use, so a damaged
+ *       file is an error, never a crash.
  *
  * Notes:
- *  - Tax rate defined by TAX_RATE constant (currently 5%)
+ *  - Prices are stored as integer cents; items in a category without a tax
+ *    rule are taxed at TAX_RATE_BP (currently 5%)
  *  - IDs auto-incremented for new menu items and orders
  *  - All file operations checked for errors
+ *  - Items without a stock entry are untracked (unlimited); stock tracking
+ *    needs mmap() and is disabled on Windows
+ *  - A terminal's stock lease lasts STOCK_LEASE_SECONDS from its last
+ *    reservation; holds of a dead or expired terminal are handed back, and
+ *    an order whose holds were handed back takes the stock again at
+ *    checkout. stock.dat version 1 files are upgraded in place
+ *
+ * Data file format (menu.dat, orders.dat, admin.dat, recipes.dat, pricing.dat,
+ * customers.idx, customer_orders.dat):
+ *   [DataFileHeader][block 0][block 1]...
+ *   Each block is a DataBlockHeader {count, crc} followed by `count` raw
+ *   records. Every block except the last holds exactly records_per_block
+ *   records. The CRC32C of each block's records is checked on load
+ *   (SSE4.2 crc32 instruction when available, table lookup otherwise).
+ *   Headerless files written by older versions are detected by their
+ *   missing magic and rewritten in the new format on first load.
+ *   Appends write the records, then the last block header, then the file
+ *   header. A file found longer than its header says is left from an
+ *   append that never finished; under the file's lock it is cut back.
+ *   menu.dat and orders.dat from before prices were kept in cents are
+ *   converted once at startup; customers.idx is then rebuilt.
+ *   The record store updates menu.dat and orders.dat in place in this same
+ *   format; menu.idx and orders.idx are its indexes and are rebuilt from
+ *   the data file whenever they are missing or out of date.
  */
 
+#ifdef _WIN32
+#define _CRT_RAND_S                      /* rand_s() for password salts */
+#else
+#define _DEFAULT_SOURCE                  /* mmap/flock/ftruncate under -std=c99 */
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <time.h>
+#include <ctype.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#else
+#include <io.h>                          /* _chsize_s() */
+#endif
+
+#ifdef __linux__
+#include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#define HAVE_EPOLL_SERVER 1
+#endif
+
+#include "../Instrumentation/lab_instrument.h"
+#include "../Record Store/record_store.h"
+
+/* targets of the -DLAB_FUZZ build; see "Fuzzing" above */
+#define LAB_FUZZ_TARGETS "menu orders pricing customers admin"
+#include "../Fuzzing/lab_fuzz.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define HAVE_SSE42_CRC 1
+#endif
 
 #define MENU_FILE "menu.dat"
 #define ORDER_FILE "orders.dat"
 #define ADMIN_FILE "admin.dat"
+#define STOCK_FILE "stock.dat"
+#define RECIPE_FILE "recipes.dat"
+#define CUSTOMER_INDEX_FILE "customers.idx"
+#define CUSTOMER_LINK_FILE "customer_orders.dat"
+#define ORDER_LOCK_FILE "orders.lock"
+#define MENU_INDEX_FILE "menu.idx"
+#define ORDER_INDEX_FILE "orders.idx"
+#define MENU_LOCK_FILE "menu.lock"
+#define PRICING_FILE "pricing.dat"
+#define SERVER_SOCKET "restaurant.sock"
+#define SERVER_LINE_MAX 2048             /* longest request line */
+#define SERVER_BATCH_MAX 256             /* orders written by one append_orders() call */
+#define SERVER_MAX_EVENTS 256
 
 #define MAX_NAME_LEN 50
 #define MAX_CATEGORY_LEN 30
 #define MAX_ITEMS_PER_ORDER 50
 #define ADMIN_DEFAULT_PASS "admin123"    /* default admin password, changeable */
-#define TAX_RATE 0.05                    /* 5% tax */
+#define TAX_RATE_BP 500                  /* 5% tax unless a pricing rule says otherwise */
+
+#define DATAFILE_MAGIC 0x444D5352u       /* "RSMD" as little-endian bytes */
+#define DATAFILE_MAGIC_SWAPPED 0x52534D44u
+#define DATAFILE_VERSION 1
+#define DATAFILE_BLOCK_BYTES 65536       /* target payload size of one block */
+#define DATAFILE_KIND_MENU 1
+#define DATAFILE_KIND_ORDERS 2
+#define DATAFILE_KIND_ADMIN 3             /* legacy plaintext password */
+#define DATAFILE_KIND_ADMIN_HASH 4        /* salted scrypt hash + login throttle */
+
+/* scrypt cost for admin passwords: N = 2^ADMIN_KDF_LOG2_N, memory = 128 * r * N bytes */
+#ifndef ADMIN_KDF_LOG2_N
+#define ADMIN_KDF_LOG2_N 15
+#endif
+#ifndef ADMIN_KDF_R
+#define ADMIN_KDF_R 8
+#endif
+#ifndef ADMIN_KDF_P
+#define ADMIN_KDF_P 1
+#endif
+#define ADMIN_SALT_LEN 16
+#define ADMIN_HASH_LEN 32
+#define ADMIN_FREE_ATTEMPTS 3             /* failures allowed before backoff starts */
+#define ADMIN_MAX_BACKOFF 900             /* seconds; backoff doubles up to this cap */
+
+#define DATAFILE_KIND_RECIPE 5
+#define DATAFILE_KIND_CUSTOMER_INDEX 6
+#define DATAFILE_KIND_CUSTOMER_LINK 7
+/* kinds 1, 2 and 6 stored prices as double; these store integer cents */
+#define DATAFILE_KIND_MENU_CENTS 8
+#define DATAFILE_KIND_ORDERS_CENTS 9
+#define DATAFILE_KIND_CUSTOMER_INDEX_CENTS 10
+#define DATAFILE_KIND_PRICE_RULE 11
+
+#define CUSTOMER_INDEX_MIN_SLOTS 1024    /* power of two; the table doubles when crowded */
+#define CUSTOMER_MAX_PROBE 32            /* longer probe runs trigger a resize */
+#define CUSTOMER_INDEX_MAX_SLOTS (1u << 26)  /* past this, runs that stay long are hash collisions */
+#define CUSTOMER_SYNC_BATCH 64           /* unindexed orders added one by one before a rebuild */
+#define CUSTOMER_RECENT_ORDERS 10
+
+#define STOCK_MAGIC 0x4B545352u          /* "RSTK" */
+#define STOCK_VERSION 2                  /* 1 had no terminal leases */
+#define STOCK_MAX_SLOTS 4096             /* fixed so the mapping never moves */
+#define STOCK_MAX_TERMINALS 64           /* processes holding stock at the same time */
+#define STOCK_LEASE_SECONDS 900          /* a terminal silent this long may have its holds handed back */
+#define STOCK_EPOCH_SOLD UINT32_MAX      /* hold already counted as sold by stock_commit() */
+#define STOCK_KIND_ITEM 1
+#define STOCK_KIND_INGREDIENT 2
+#define STOCK_SLOT_CLAIMED -1            /* slot being initialised by some terminal */
+#define MAX_RECIPE_LINES 16              /* ingredients per menu item */
+
+/* limits that keep every intermediate of a quote well inside int64_t */
+#define PRICE_MAX_CENTS 100000000        /* 1,000,000.00 per item or combo discount */
+#define PRICE_MAX_QTY 999                /* per order line */
+#define PRICE_COMBO_MAX 4                /* distinct items in one combo */
+#define PRICE_COMBO_MAX_QTY 99           /* units of one item in one combo */
+#define PRICE_MAX_RULES 64               /* one bit each in a happy-hour mask */
+#define PRICE_RULE_TAX 1
+#define PRICE_RULE_COMBO 2
+#define PRICE_RULE_HAPPY_HOUR 3
+#define QUOTE_CACHE_SLOTS 4096           /* power of two; direct-mapped */
+#define QUOTE_CACHE_LINES 8              /* larger baskets are always priced afresh */
 
 /* Structures */
 
@@ -44,14 +257,16 @@ typedef struct {
     int id;                             /* unique id */
     char name[MAX_NAME_LEN];
     char category[MAX_CATEGORY_LEN];
-    double price;
     int available;                      /* 1 = available, 0 = not available */
+    int64_t price_cents;
 } MenuItem;
 
 typedef struct {
     int item_id;
     int qty;
-    double item_price;                  /* price at time of ordering (unit price) */
+    int64_t list_cents;                 /* menu price at time of ordering */
+    int64_t unit_cents;                 /* price charged per unit (after any happy hour) */
+    int64_t discount_cents;             /* share of combo discounts on this line */
     char item_name[MAX_NAME_LEN];
 } OrderItem;
 
@@ -60,17 +275,193 @@ typedef struct {
     char customer_name[MAX_NAME_LEN];
     int num_items;
     OrderItem items[MAX_ITEMS_PER_ORDER];
+    int64_t subtotal_cents;             /* sum of unit price x qty */
+    int64_t discount_cents;             /* combo discounts */
+    int64_t tax_cents;
+    int64_t total_cents;                /* subtotal - discount + tax */
+    time_t timestamp;
+} Order;
+
+/* menu.dat / orders.dat records before prices moved to integer cents */
+typedef struct {
+    int id;
+    char name[MAX_NAME_LEN];
+    char category[MAX_CATEGORY_LEN];
+    double price;
+    int available;
+} LegacyMenuItem;
+
+typedef struct {
+    int item_id;
+    int qty;
+    double item_price;
+    char item_name[MAX_NAME_LEN];
+} LegacyOrderItem;
+
+typedef struct {
+    int order_id;
+    char customer_name[MAX_NAME_LEN];
+    int num_items;
+    LegacyOrderItem items[MAX_ITEMS_PER_ORDER];
     double subtotal;
     double tax;
     double total;
     time_t timestamp;
-} Order;
+} LegacyOrder;
+
+/* pricing.dat entry: a category tax rate, a combo discount or a happy-hour window */
+typedef struct {
+    int id;
+    int kind;                           /* PRICE_RULE_* */
+    char name[MAX_NAME_LEN];            /* combo name shown on invoices */
+    char category[MAX_CATEGORY_LEN];    /* tax / happy hour: category, "" = every item */
+    int item_id;                        /* happy hour: one item instead of a category */
+    int combo_item[PRICE_COMBO_MAX];    /* combo: menu item ids, 0 = unused */
+    int combo_qty[PRICE_COMBO_MAX];
+    int32_t rate_bp;                    /* tax rate or happy-hour discount, 1/100 of a percent */
+    int16_t start_minute, end_minute;   /* happy hour: local time [start, end), may wrap midnight */
+    int32_t days;                       /* happy hour: bit 0 = Sunday ... bit 6 = Saturday */
+    int64_t amount_cents;               /* combo: discount per combo */
+} PriceRule;
 
-/* Admin password storage structure (simple) */
+/* Pre-hashing admin.dat record: plaintext password (upgraded on first login) */
 typedef struct {
     char password[50];
+} LegacyAdminCred;
+
+/* Admin credential: scrypt parameters, salt, derived key and throttle state */
+typedef struct {
+    uint32_t kdf_log2_n;
+    uint32_t kdf_r;
+    uint32_t kdf_p;
+    uint32_t failed_attempts;           /* consecutive failures since last success */
+    int64_t locked_until;               /* no attempts accepted before this time */
+    unsigned char salt[ADMIN_SALT_LEN];
+    unsigned char hash[ADMIN_HASH_LEN];
 } AdminCred;
 
+/* On-disk header at offset 0 of every data file (32 bytes, no padding) */
+typedef struct {
+    uint32_t magic;                     /* DATAFILE_MAGIC */
+    uint16_t version;                   /* DATAFILE_VERSION */
+    uint16_t kind;                      /* DATAFILE_KIND_* */
+    uint32_t record_size;               /* sizeof the record struct that wrote the file */
+    uint32_t records_per_block;
+    uint64_t record_count;
+    uint32_t reserved;
+    uint32_t header_crc;                /* CRC32C of the fields above */
+} DataFileHeader;
+
+typedef struct {
+    uint32_t count;                     /* records stored in this block */
+    uint32_t crc;                       /* CRC32C of those records */
+} DataBlockHeader;
+
+/* Header of the shared, memory-mapped stock.dat */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;                  /* number of StockSlot entries */
+    uint32_t reserved;
+} StockFileHeader;
+
+/*
+ * One stock counter. on_hand is only ever changed with atomic operations,
+ * so several order terminals can share the mapping without a file lock.
+ */
+typedef struct {
+    int32_t kind;                       /* STOCK_KIND_*, 0 = free slot */
+    int32_t id;                         /* menu item id or ingredient id */
+    int64_t on_hand;                    /* units not yet reserved by any order */
+    int64_t low_mark;                   /* alert when on_hand drops to this */
+    char name[MAX_NAME_LEN];            /* ingredient name (unused for items) */
+    char pad[6];
+} StockSlot;
+
+/* menu item -> ingredient usage, stored in recipes.dat */
+typedef struct {
+    int item_id;
+    int ingredient_id;
+    int qty;                            /* ingredient units per item sold */
+} RecipeLine;
+
+/* customers.idx entry: open addressing on the normalized customer name */
+typedef struct {
+    char key[MAX_NAME_LEN];             /* normalize_customer_name() of the name */
+    char pad[2];
+    uint32_t order_count;
+    uint64_t last_order;                /* record index in orders.dat + 1, 0 = free slot */
+    int64_t total_spent_cents;
+} CustomerSlot;
+
+/* customer_orders.dat entry i belongs to order i of orders.dat */
+typedef struct {
+    uint64_t prev_order;                /* same customer's previous order + 1, 0 = first */
+} CustomerOrderLink;
+
+/*
+ * A terminal's lease on stock.dat. Every unit a terminal holds is also
+ * counted in its row of the held table that follows the leases, so when
+ * the terminal dies (or stays silent past its lease) another terminal can
+ * put that stock back on hand.
+ */
+typedef struct {
+    uint64_t lease;                     /* pid << 32 | lease expiry (Unix seconds), 0 = free */
+    uint64_t pad;
+} StockTerminal;
+
+/* stock taken for the order in progress, given back if it is cancelled */
+typedef struct {
+    int count;
+    struct {
+        StockSlot *slot;
+        int64_t qty;
+        uint32_t epoch;                 /* lease it was taken under, or STOCK_EPOCH_SOLD */
+    } holds[MAX_ITEMS_PER_ORDER * (MAX_RECIPE_LINES + 1)];
+} StockReservation;
+
+/* Describes one data file: where it lives and what it stores */
+typedef struct {
+    const char *path;
+    const char *label;                  /* used in error messages */
+    uint16_t kind;
+    size_t record_size;
+    void (*normalize)(void *record);    /* cleans up a legacy record before migration */
+    const char *lock_path;              /* held by whoever updates it in place; NULL if only saved whole */
+} DataFileSpec;
+
+/* a menu item as the pricing engine sees it: its rules resolved once per load */
+typedef struct {
+    MenuItem item;
+    int32_t tax_bp;
+    uint64_t happy_rules;               /* happy-hour rules that cover this item */
+} PricedItem;
+
+/* one memoized quote, keyed by the basket sorted by (item, qty) */
+typedef struct {
+    uint64_t hash;
+    uint32_t generation;                /* of the engine that computed it; 0 = empty */
+    int lines;
+    uint64_t happy_active;              /* happy-hour rules in force when it was quoted */
+    int item_id[QUOTE_CACHE_LINES];
+    int qty[QUOTE_CACHE_LINES];
+    int64_t list[QUOTE_CACHE_LINES], unit[QUOTE_CACHE_LINES], discount[QUOTE_CACHE_LINES];
+    int64_t subtotal, discount_total, tax, total;
+} QuoteCacheEntry;
+
+typedef struct {
+    PricedItem *items;                  /* sorted by id */
+    size_t item_count;
+    PriceRule rules[PRICE_MAX_RULES];
+    size_t rule_count;
+    uint32_t generation;                /* bumped by every load, so old quotes never match */
+    QuoteCacheEntry *cache;             /* NULL = no memoization */
+    int64_t happy_minute;               /* minute the happy_active mask was computed for */
+    uint64_t happy_active;
+    uint64_t hits, misses;
+    uint64_t menu_size, menu_mtime, rules_size, rules_mtime;  /* pricing_shared() reload check */
+} PricingEngine;
+
 /* Helper declarations */
 int admin_menu(void);
 int customer_menu(void);
@@ -78,27 +469,174 @@ void admin_add_menu_item(void);
 void admin_view_menu(void);
 void admin_update_menu_item(void);
 void admin_view_orders(void);
+void admin_find_order(void);
 void admin_change_password(void);
+void admin_manage_stock(void);
+void admin_view_stock(void);
 
 void customer_view_menu(void);
 void customer_place_order(void);
+void customer_order_history(void);
+void customer_reorder(void);
+void customer_checkout(Order *order, StockReservation *res);
+int price_order(Order *order);
+int run_server(const char *path);
+int run_load_test(const char *path, int clients, long orders, int idle);
 
 int get_next_menu_id(void);
 int get_next_order_id(void);
 void pause_and_clear(void);
 void safe_input(char *buffer, size_t size);
 MenuItem* load_all_menu_items(size_t *count);
-int save_all_menu_items(MenuItem *items, size_t count);
+int save_menu_item(MenuItem *item, int is_new);
 Order* load_all_orders(size_t *count);
-int append_order(const Order *order);
+int append_order(Order *order);
+size_t append_orders(Order *orders, size_t n);
 MenuItem* find_menu_item_by_id(int id);
+static MenuItem* menu_store_get(RecordStore *rs, int id);
+static int lock_file(const char *path);
+static void unlock_file(int fd);
 
 int admin_login(void);
 int ensure_admin_file(void);
+int load_admin_cred(AdminCred *cred, LegacyAdminCred *legacy, int *is_legacy);
+int save_admin_cred(const AdminCred *cred);
+int admin_set_password(AdminCred *cred, const char *password);
+int admin_check_password(const AdminCred *cred, const char *password);
+void bench_kdf(double target_ms);
+void bench_pricing(long baskets);
+
+double money(int64_t cents);
+int parse_money(const char *text, int64_t *cents);
+int pricing_load(PricingEngine *pe, const MenuItem *menu, size_t n, const PriceRule *rules, size_t n_rules);
+void pricing_free(PricingEngine *pe);
+int pricing_quote(PricingEngine *pe, Order *order, time_t when);
+PricingEngine* pricing_shared(void);
+PriceRule* load_price_rules(size_t *count);
+int migrate_price_files(void);
+void admin_manage_pricing(void);
+
+int scrypt_kdf(const unsigned char *pass, size_t passlen, const unsigned char *salt, size_t saltlen,
+               uint32_t log2_n, uint32_t r, uint32_t p, unsigned char *out, size_t outlen);
+int ct_equal(const void *a, const void *b, size_t len);
+void secure_zero(void *p, size_t len);
+int random_bytes(unsigned char *buf, size_t len);
+
+StockSlot* stock_table(size_t *capacity);
+StockSlot* stock_find(int kind, int id);
+StockSlot* stock_get_or_create(int kind, int id);
+int stock_reserve_item(int item_id, int qty, StockReservation *res);
+int stock_commit(StockReservation *res);
+void stock_release(StockReservation *res);
+void stock_reclaim(void);
+int stock_item_available(int item_id, const RecipeLine *recipes, size_t n_recipes);
+RecipeLine* load_recipe(int item_id, size_t *count);
+RecipeLine* load_all_recipes(size_t *count);
+
+void normalize_customer_name(const char *name, char key[MAX_NAME_LEN]);
+int customer_recent_orders(const char *name, Order *out, int max, CustomerSlot *info);
+
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len);
+void* datafile_load(const DataFileSpec *spec, size_t *count);
+int datafile_save(const DataFileSpec *spec, const void *records, size_t count);
+int datafile_append(const DataFileSpec *spec, const void *records, size_t n);
+int64_t datafile_record_count(const DataFileSpec *spec);
+int datafile_peek_kind(const char *path);
+void* datafile_read_block(const DataFileSpec *spec, uint64_t index, uint64_t *first, size_t *count);
+int datafile_read_record(const DataFileSpec *spec, uint64_t index, void *record);
+int datafile_write_record(const DataFileSpec *spec, uint64_t index, const void *record);
+int datafile_write_block(const DataFileSpec *spec, uint64_t first, const void *records, size_t count);
+RecordStore* datafile_store_open(const DataFileSpec *spec, const char *index_path,
+                                 size_t key_offset, int flags);
+int datafile_selftest(long rounds);
+void normalize_legacy_menu_item(void *record);
+void normalize_legacy_order(void *record);
+void normalize_cents_record(void *record);
+void normalize_admin_cred(void *record);
+void normalize_legacy_admin_cred(void *record);
+void normalize_recipe_line(void *record);
+void normalize_customer_record(void *record);
+void sanitize_menu_item(MenuItem *item);
+void sanitize_order(Order *order);
+
+static const DataFileSpec MENU_SPEC = {
+    MENU_FILE, "menu", DATAFILE_KIND_MENU_CENTS, sizeof(MenuItem), normalize_cents_record, MENU_LOCK_FILE
+};
+static const DataFileSpec ORDER_SPEC = {
+    ORDER_FILE, "orders", DATAFILE_KIND_ORDERS_CENTS, sizeof(Order), normalize_cents_record, ORDER_LOCK_FILE
+};
+static const DataFileSpec LEGACY_MENU_SPEC = {
+    MENU_FILE, "menu", DATAFILE_KIND_MENU, sizeof(LegacyMenuItem), normalize_legacy_menu_item, MENU_LOCK_FILE
+};
+static const DataFileSpec LEGACY_ORDER_SPEC = {
+    ORDER_FILE, "orders", DATAFILE_KIND_ORDERS, sizeof(LegacyOrder), normalize_legacy_order, ORDER_LOCK_FILE
+};
+static const DataFileSpec PRICE_RULE_SPEC = {
+    PRICING_FILE, "pricing rules", DATAFILE_KIND_PRICE_RULE, sizeof(PriceRule), normalize_cents_record, NULL
+};
+static const DataFileSpec ADMIN_SPEC = {
+    ADMIN_FILE, "admin", DATAFILE_KIND_ADMIN_HASH, sizeof(AdminCred), normalize_admin_cred, NULL
+};
+static const DataFileSpec LEGACY_ADMIN_SPEC = {
+    ADMIN_FILE, "admin", DATAFILE_KIND_ADMIN, sizeof(LegacyAdminCred), normalize_legacy_admin_cred, NULL
+};
+static const DataFileSpec RECIPE_SPEC = {
+    RECIPE_FILE, "recipes", DATAFILE_KIND_RECIPE, sizeof(RecipeLine), normalize_recipe_line, NULL
+};
+static const DataFileSpec CUSTOMER_INDEX_SPEC = {
+    CUSTOMER_INDEX_FILE, "customer index", DATAFILE_KIND_CUSTOMER_INDEX_CENTS, sizeof(CustomerSlot),
+    normalize_customer_record, ORDER_LOCK_FILE
+};
+static const DataFileSpec CUSTOMER_LINK_SPEC = {
+    CUSTOMER_LINK_FILE, "customer orders", DATAFILE_KIND_CUSTOMER_LINK, sizeof(CustomerOrderLink),
+    normalize_customer_record, ORDER_LOCK_FILE
+};
 
 /* Implementation */
 
-int main(void) {
+#ifndef LAB_FUZZ                        /* the fuzz driver brings its own main() */
+int main(int argc, char **argv) {
+    INSTR_INIT("restaurant");
+    if (argc >= 2 && strcmp(argv[1], "--bench-kdf") == 0) {
+        bench_kdf(argc >= 3 ? atof(argv[2]) : 250.0);
+        return 0;
+    }
+    if (argc >= 2 && strcmp(argv[1], "--selftest-store") == 0)
+        return rs_selftest(argc >= 3 ? atol(argv[2]) : 200000);
+    if (argc >= 2 && strcmp(argv[1], "--selftest-files") == 0) {
+        long rounds = argc >= 3 ? atol(argv[2]) : 200;
+        return datafile_selftest(rounds > 0 ? rounds : 200);
+    }
+    if (argc >= 2 && strcmp(argv[1], "--bench-pricing") == 0) {
+        long baskets = argc >= 3 ? atol(argv[2]) : 1000000;
+        bench_pricing(baskets > 0 ? baskets : 1000000);
+        return 0;
+    }
+    if (migrate_price_files() != 0) {
+        printf("Error: could not convert menu/order prices to cents; files left unchanged.\n");
+        return 1;
+    }
+    if (argc >= 2 && (strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--load-test") == 0)) {
+#ifdef HAVE_EPOLL_SERVER
+        if (strcmp(argv[1], "--serve") == 0) return run_server(argc >= 3 ? argv[2] : SERVER_SOCKET);
+        if (argc < 4) {
+            printf("Usage: %s --load-test CLIENTS ORDERS [IDLE] [socket]\n", argv[0]);
+            return 1;
+        }
+        int clients = atoi(argv[2]);
+        long orders = atol(argv[3]);
+        if (clients <= 0 || orders <= 0) {
+            printf("CLIENTS and ORDERS must be positive.\n");
+            return 1;
+        }
+        return run_load_test(argc >= 6 ? argv[5] : SERVER_SOCKET, clients, orders,
+                             argc >= 5 ? atoi(argv[4]) : 0);
+#else
+        printf("Server mode needs Linux (epoll).\n");
+        return 1;
+#endif
+    }
+
     /* Ensure admin credentials exist */
     ensure_admin_file();
 
@@ -135,35 +673,78 @@ int main(void) {
 
     return 0;
 }
+#endif
 
 /* ---------- Admin functions ---------- */
 
 int admin_login(void) {
     char entered[50];
     AdminCred cred;
-    FILE *f = fopen(ADMIN_FILE, "rb");
-    if (!f) {
-        /* if admin file missing, create with default */
-        strncpy(cred.password, ADMIN_DEFAULT_PASS, sizeof(cred.password));
-        f = fopen(ADMIN_FILE, "wb");
-        if (!f) {
-            printf("Unable to create admin credential file.\n");
-            return 0;
-        }
-        fwrite(&cred, sizeof(AdminCred), 1, f);
-        fclose(f);
-    } else {
-        fread(&cred, sizeof(AdminCred), 1, f);
-        fclose(f);
+    LegacyAdminCred legacy;
+    int is_legacy;
+    if (load_admin_cred(&cred, &legacy, &is_legacy) != 0) {
+        printf("Unable to read admin credential file.\n");
+        return 0;
+    }
+
+    time_t now = time(NULL);
+    if (!is_legacy && (int64_t)now < cred.locked_until) {
+        printf("Too many failed attempts. Try again in %lld seconds.\n",
+               (long long)(cred.locked_until - (int64_t)now));
+        return 0;
     }
 
     printf("Enter admin password: ");
     safe_input(entered, sizeof(entered));
 
-    if (strcmp(entered, cred.password) == 0) {
-        return 1;
+    int ok;
+    if (is_legacy) {
+        /* compare the whole zero-padded buffer so timing does not leak the length */
+        char padded[sizeof(legacy.password)];
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, entered, strlen(entered));
+        ok = ct_equal(padded, legacy.password, sizeof(padded));
+        secure_zero(padded, sizeof(padded));
+        if (ok) {
+            /* first successful login on a plaintext file: replace it with a hash */
+            memset(&cred, 0, sizeof(cred));
+            if (admin_set_password(&cred, entered) != 0 || save_admin_cred(&cred) != 0)
+                printf("Warning: could not upgrade admin.dat to hashed storage.\n");
+        }
+        secure_zero(&legacy, sizeof(legacy));
+    } else {
+        ok = admin_check_password(&cred, entered);
+        if (ok) {
+            /* reset throttle; rehash if the configured KDF cost has changed */
+            int stale = cred.kdf_log2_n != ADMIN_KDF_LOG2_N || cred.kdf_r != ADMIN_KDF_R ||
+                        cred.kdf_p != ADMIN_KDF_P;
+            if (stale) {
+                /* keep the old hash unless the new one is complete (e.g. scrypt ran out of memory) */
+                AdminCred fresh = cred;
+                stale = admin_set_password(&fresh, entered) == 0;
+                if (stale) cred = fresh;
+                else printf("Warning: could not rehash the admin password at the new cost.\n");
+                secure_zero(&fresh, sizeof(fresh));
+            }
+            if (stale || cred.failed_attempts != 0) {
+                cred.failed_attempts = 0;
+                cred.locked_until = 0;
+                save_admin_cred(&cred);
+            }
+        } else {
+            cred.failed_attempts++;
+            if (cred.failed_attempts >= ADMIN_FREE_ATTEMPTS) {
+                uint32_t shift = cred.failed_attempts - ADMIN_FREE_ATTEMPTS;
+                int64_t delay = shift >= 10 ? ADMIN_MAX_BACKOFF : (int64_t)1 << shift;
+                if (delay > ADMIN_MAX_BACKOFF) delay = ADMIN_MAX_BACKOFF;
+                cred.locked_until = (int64_t)time(NULL) + delay;
+                printf("Login locked for %lld seconds.\n", (long long)delay);
+            }
+            save_admin_cred(&cred);
+        }
     }
-    return 0;
+    secure_zero(entered, sizeof(entered));
+    return ok;
 }
 
 int admin_menu(void) {
@@ -174,6 +755,9 @@ int admin_menu(void) {
         printf("3. View Menu Items\n");
         printf("4. View Orders (Order History)\n");
         printf("5. Change Admin Password\n");
+        printf("6. Manage Stock\n");
+        printf("7. Find Order by ID\n");
+        printf("8. Pricing Rules\n");
         printf("0. Logout\n");
         printf("Choice: ");
 
@@ -190,6 +774,9 @@ int admin_menu(void) {
         else if (choice == 3) admin_view_menu();
         else if (choice == 4) admin_view_orders();
         else if (choice == 5) admin_change_password();
+        else if (choice == 6) admin_manage_stock();
+        else if (choice == 7) admin_find_order();
+        else if (choice == 8) admin_manage_pricing();
         else if (choice == 0) {
             printf("Logging out of admin.\n");
             break;
@@ -202,27 +789,26 @@ int admin_menu(void) {
 
 void admin_add_menu_item(void) {
     MenuItem item;
-    item.id = get_next_menu_id();
+    memset(&item, 0, sizeof(item));     /* no stack garbage in padding bytes */
     printf("\n--- Add Menu Item ---\n");
     printf("Item name: ");
     safe_input(item.name, sizeof(item.name));
     printf("Category: ");
     safe_input(item.category, sizeof(item.category));
     printf("Price (e.g., 99.50): ");
-    while (scanf("%lf", &item.price) != 1) {
-        while (getchar() != '\n');
+    char buffer[32];
+    safe_input(buffer, sizeof(buffer));
+    while (parse_money(buffer, &item.price_cents) != 0 || item.price_cents > PRICE_MAX_CENTS) {
+        if (feof(stdin)) return;
         printf("Invalid price. Enter again: ");
+        safe_input(buffer, sizeof(buffer));
     }
-    while (getchar() != '\n');
     item.available = 1;
 
-    FILE *f = fopen(MENU_FILE, "ab");
-    if (!f) {
-        printf("Error opening menu file to append.\n");
+    if (save_menu_item(&item, 1) != 0) {
+        printf("Error appending to menu file.\n");
         return;
     }
-    fwrite(&item, sizeof(MenuItem), 1, f);
-    fclose(f);
     printf("Added menu item with ID %d.\n", item.id);
 }
 
@@ -233,6 +819,8 @@ void admin_view_menu(void) {
         printf("No menu items found.\n");
         return;
     }
+    size_t n_recipes;
+    RecipeLine *recipes = load_all_recipes(&n_recipes);
     printf("\n--- MENU ITEMS (%zu) ---\n", count);
     printf("%-5s %-25s %-12s %-8s %-10s\n", "ID", "Name", "Category", "Price", "Available");
     for (size_t i = 0; i < count; ++i) {
@@ -240,9 +828,11 @@ void admin_view_menu(void) {
                items[i].id,
                items[i].name,
                items[i].category,
-               items[i].price,
-               items[i].available ? "Yes" : "No");
+               money(items[i].price_cents),
+               !items[i].available ? "No" :
+               stock_item_available(items[i].id, recipes, n_recipes) ? "Yes" : "Sold out");
     }
+    free(recipes);
     free(items);
 }
 
@@ -257,64 +847,271 @@ void admin_update_menu_item(void) {
     }
     while (getchar() != '\n');
 
-    size_t count;
-    MenuItem *items = load_all_menu_items(&count);
-    if (!items) {
-        printf("Menu is empty.\n");
-        return;
-    }
-
-    size_t idx = (size_t)-1;
-    for (size_t i = 0; i < count; ++i) {
-        if (items[i].id == id) {
-            idx = i;
-            break;
-        }
-    }
-    if (idx == (size_t)-1) {
+    MenuItem *item = find_menu_item_by_id(id);
+    if (!item) {
         printf("Item with ID %d not found.\n", id);
-        free(items);
         return;
     }
 
     printf("Found: %s | Category: %s | Price: %.2f | Available: %s\n",
-           items[idx].name, items[idx].category, items[idx].price,
-           items[idx].available ? "Yes" : "No");
+           item->name, item->category, money(item->price_cents),
+           item->available ? "Yes" : "No");
 
     printf("Enter new name (or press enter to keep): ");
     char buffer[MAX_NAME_LEN];
     safe_input(buffer, sizeof(buffer));
-    if (strlen(buffer) > 0) strncpy(items[idx].name, buffer, MAX_NAME_LEN);
+    if (strlen(buffer) > 0) strncpy(item->name, buffer, MAX_NAME_LEN);
 
     printf("Enter new category (or press enter to keep): ");
     safe_input(buffer, sizeof(buffer));
-    if (strlen(buffer) > 0) strncpy(items[idx].category, buffer, MAX_CATEGORY_LEN);
+    if (strlen(buffer) > 0) strncpy(item->category, buffer, MAX_CATEGORY_LEN);
 
-    printf("Enter new price (enter -1 to keep): ");
-    double newprice;
-    if (scanf("%lf", &newprice) == 1) {
-        if (newprice >= 0.0) items[idx].price = newprice;
-        while (getchar() != '\n');
-    } else {
-        while (getchar() != '\n');
-    }
+    printf("Enter new price (or press enter to keep): ");
+    int64_t newprice;
+    safe_input(buffer, sizeof(buffer));
+    if (parse_money(buffer, &newprice) == 0 && newprice <= PRICE_MAX_CENTS) item->price_cents = newprice;
+    else if (buffer[0] != '\0' && strcmp(buffer, "-1") != 0) printf("Invalid price; keeping %.2f.\n", money(item->price_cents));
 
     printf("Set availability? (1 = available, 0 = not) (enter -1 to keep): ");
     int avail;
     if (scanf("%d", &avail) == 1) {
-        if (avail == 0 || avail == 1) items[idx].available = avail;
+        if (avail == 0 || avail == 1) item->available = avail;
         while (getchar() != '\n');
     } else {
         while (getchar() != '\n');
     }
 
-    if (save_all_menu_items(items, count) == 0) {
+    if (save_menu_item(item, 0) == 0) {
         printf("Menu item updated.\n");
     } else {
         printf("Failed to save updates.\n");
     }
 
-    free(items);
+    free(item);
+}
+
+static void admin_list_price_rules(const PriceRule *rules, size_t n) {
+    static const char *day_names = "SMTWTFS";
+    if (n == 0) {
+        printf("No pricing rules; every item is taxed at %.2f%%.\n", TAX_RATE_BP / 100.0);
+        return;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        const PriceRule *r = &rules[i];
+        if (r->kind == PRICE_RULE_TAX) {
+            printf("%3d  Tax %.2f%% on %s\n", r->id, r->rate_bp / 100.0,
+                   r->category[0] ? r->category : "every category");
+        } else if (r->kind == PRICE_RULE_COMBO) {
+            printf("%3d  Combo '%s': %.2f off", r->id, r->name, money(r->amount_cents));
+            for (int c = 0; c < PRICE_COMBO_MAX; ++c)
+                if (r->combo_item[c]) printf(" %s%d x item %d", c ? "+ " : "", r->combo_qty[c], r->combo_item[c]);
+            printf("\n");
+        } else if (r->kind == PRICE_RULE_HAPPY_HOUR) {
+            char days[8];
+            for (int d = 0; d < 7; ++d) days[d] = (r->days & (1 << d)) ? day_names[d] : '-';
+            days[7] = '\0';
+            printf("%3d  Happy hour %.2f%% off ", r->id, r->rate_bp / 100.0);
+            if (r->item_id) printf("item %d", r->item_id);
+            else printf("%s", r->category[0] ? r->category : "everything");
+            printf(", %02d:%02d-%02d:%02d %s\n", r->start_minute / 60, r->start_minute % 60,
+                   r->end_minute / 60, r->end_minute % 60, days);
+        }
+    }
+}
+
+/* "8.25" -> 825 basis points, at most 100% */
+static int admin_read_percent(const char *prompt, int32_t *bp) {
+    char buffer[32];
+    int64_t v;
+    printf("%s", prompt);
+    safe_input(buffer, sizeof(buffer));
+    if (parse_money(buffer, &v) != 0 || v > 10000) {
+        printf("Invalid percentage.\n");
+        return -1;
+    }
+    *bp = (int32_t)v;
+    return 0;
+}
+
+/* "HH:MM" -> minutes after midnight ("24:00" allowed as an end time) */
+static int admin_read_time(const char *prompt, int16_t *minute) {
+    char buffer[16];
+    int h, m;
+    char extra;
+    printf("%s", prompt);
+    safe_input(buffer, sizeof(buffer));
+    if (sscanf(buffer, "%d:%d %c", &h, &m, &extra) != 2 || h < 0 || m < 0 || m > 59 ||
+        h * 60 + m > 24 * 60) {
+        printf("Invalid time.\n");
+        return -1;
+    }
+    *minute = (int16_t)(h * 60 + m);
+    return 0;
+}
+
+static int admin_read_rule(PriceRule *r, int kind) {
+    char buffer[64];
+    r->kind = kind;
+    if (kind == PRICE_RULE_TAX) {
+        printf("Category (enter for every category without its own rate): ");
+        safe_input(r->category, sizeof(r->category));
+        return admin_read_percent("Tax rate in percent (e.g. 8.25): ", &r->rate_bp);
+    }
+    if (kind == PRICE_RULE_COMBO) {
+        int comps = 0;
+        printf("Combo name: ");
+        safe_input(r->name, sizeof(r->name));
+        printf("Enter menu item ID and quantity, one pair per line (0 0 to finish):\n");
+        while (comps < PRICE_COMBO_MAX) {
+            int id, qty;
+            safe_input(buffer, sizeof(buffer));
+            if (sscanf(buffer, "%d %d", &id, &qty) != 2 || id <= 0) break;
+            MenuItem *mi = find_menu_item_by_id(id);
+            if (!mi || qty <= 0 || qty > PRICE_COMBO_MAX_QTY) {
+                printf(mi ? "Quantity must be 1-%d.\n" : "Unknown menu item.\n", PRICE_COMBO_MAX_QTY);
+                free(mi);
+                continue;
+            }
+            free(mi);
+            int c = 0;
+            while (c < comps && r->combo_item[c] != id) c++;
+            if (c == comps) comps++;
+            r->combo_item[c] = id;
+            r->combo_qty[c] = qty;
+        }
+        if (comps == 0) {
+            printf("A combo needs at least one item.\n");
+            return -1;
+        }
+        printf("Discount per combo (e.g., 2.50): ");
+        safe_input(buffer, sizeof(buffer));
+        if (parse_money(buffer, &r->amount_cents) != 0 || r->amount_cents > PRICE_MAX_CENTS) {
+            printf("Invalid amount.\n");
+            return -1;
+        }
+        return 0;
+    }
+
+    printf("Menu item ID (enter to use a category instead): ");
+    safe_input(buffer, sizeof(buffer));
+    if (buffer[0] != '\0') {
+        if (sscanf(buffer, "%d", &r->item_id) != 1 || r->item_id <= 0) {
+            printf("Invalid ID.\n");
+            return -1;
+        }
+    } else {
+        printf("Category (enter for every item): ");
+        safe_input(r->category, sizeof(r->category));
+    }
+    printf("Days, 0 = Sunday ... 6 = Saturday (e.g. 12345, enter for every day): ");
+    safe_input(buffer, sizeof(buffer));
+    r->days = buffer[0] ? 0 : 0x7f;
+    for (const char *p = buffer; *p; ++p) {
+        if (*p < '0' || *p > '6') {
+            printf("Invalid days.\n");
+            return -1;
+        }
+        r->days |= 1 << (*p - '0');
+    }
+    if (admin_read_time("Starts at (HH:MM): ", &r->start_minute) != 0 ||
+        admin_read_time("Ends at (HH:MM): ", &r->end_minute) != 0)
+        return -1;
+    return admin_read_percent("Discount in percent: ", &r->rate_bp);
+}
+
+void admin_manage_pricing(void) {
+    while (1) {
+        printf("\n--- PRICING RULES ---\n");
+        printf("1. View Rules\n");
+        printf("2. Add Tax Rate\n");
+        printf("3. Add Combo Discount\n");
+        printf("4. Add Happy Hour\n");
+        printf("5. Delete Rule\n");
+        printf("0. Back\n");
+        printf("Choice: ");
+
+        int choice;
+        if (scanf("%d", &choice) != 1) {
+            while (getchar() != '\n');
+            printf("Invalid input.\n");
+            continue;
+        }
+        while (getchar() != '\n');
+        if (choice == 0) break;
+        if (choice < 1 || choice > 5) {
+            printf("Invalid choice.\n");
+            continue;
+        }
+
+        /* the whole read-modify-write runs under the menu lock */
+        int lock = lock_file(MENU_LOCK_FILE);
+        size_t n;
+        PriceRule *rules = load_price_rules(&n);
+        PriceRule *all = n != (size_t)-1 ? calloc(PRICE_MAX_RULES, sizeof(PriceRule)) : NULL;
+        if (!all) {
+            printf("Pricing rules unavailable.\n");
+            free(rules);
+            unlock_file(lock);
+            continue;
+        }
+        if (n > PRICE_MAX_RULES) n = PRICE_MAX_RULES;
+        if (n) memcpy(all, rules, n * sizeof(PriceRule));
+        free(rules);
+
+        int changed = 0;
+        if (choice == 1) {
+            admin_list_price_rules(all, n);
+        } else if (choice == 5) {
+            int id;
+            printf("Rule ID to delete: ");
+            if (scanf("%d", &id) != 1) id = 0;
+            while (getchar() != '\n');
+            size_t kept = 0;
+            for (size_t i = 0; i < n; ++i) if (all[i].id != id) all[kept++] = all[i];
+            if (kept == n) printf("No rule with ID %d.\n", id);
+            changed = kept != n;
+            n = kept;
+        } else if (n >= PRICE_MAX_RULES) {
+            printf("At most %d pricing rules; delete one first.\n", PRICE_MAX_RULES);
+        } else {
+            PriceRule *r = &all[n];
+            memset(r, 0, sizeof(*r));
+            for (size_t i = 0; i < n; ++i) if (all[i].id > r->id) r->id = all[i].id;
+            r->id++;
+            int kind = choice == 2 ? PRICE_RULE_TAX : choice == 3 ? PRICE_RULE_COMBO : PRICE_RULE_HAPPY_HOUR;
+            if (admin_read_rule(r, kind) == 0) {
+                n++;
+                changed = 1;
+            }
+        }
+        if (changed) {
+            if (datafile_save(&PRICE_RULE_SPEC, all, n) == 0) printf("Pricing rules saved.\n");
+            else printf("Failed to save pricing rules.\n");
+        }
+        free(all);
+        unlock_file(lock);
+    }
+}
+
+static void print_order_details(const Order *order) {
+    char tbuf[64] = "(bad date)";
+    struct tm *tm_info = localtime(&order->timestamp);
+    if (tm_info) strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", tm_info);
+    printf("\nOrder ID: %d | Customer: %s | Date: %s\n",
+           order->order_id, order->customer_name, tbuf);
+    printf("Items:\n");
+    for (int j = 0; j < order->num_items; ++j) {
+        const OrderItem *oi = &order->items[j];
+        printf("  - %s (ID %d) x%d @ %.2f each", oi->item_name, oi->item_id, oi->qty, money(oi->unit_cents));
+        if (oi->unit_cents != oi->list_cents) printf(" (list %.2f)", money(oi->list_cents));
+        printf("  => %.2f\n", money(oi->unit_cents) * oi->qty);      /* no int64 overflow on a damaged record */
+    }
+    if (order->discount_cents != 0)
+        printf("Subtotal: %.2f | Combo discounts: -%.2f | Tax: %.2f | Total: %.2f\n", money(order->subtotal_cents),
+               money(order->discount_cents), money(order->tax_cents), money(order->total_cents));
+    else
+        printf("Subtotal: %.2f | Tax: %.2f | Total: %.2f\n",
+               money(order->subtotal_cents), money(order->tax_cents), money(order->total_cents));
 }
 
 void admin_view_orders(void) {
@@ -325,62 +1122,68 @@ void admin_view_orders(void) {
         return;
     }
     printf("\n--- ORDER HISTORY (%zu) ---\n", count);
-    for (size_t i = 0; i < count; ++i) {
-        char tbuf[64];
-        struct tm *tm_info = localtime(&orders[i].timestamp);
-        strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", tm_info);
-        printf("\nOrder ID: %d | Customer: %s | Date: %s\n",
-               orders[i].order_id, orders[i].customer_name, tbuf);
-        printf("Items:\n");
-        for (int j = 0; j < orders[i].num_items; ++j) {
-            printf("  - %s (ID %d) x%d @ %.2f each  => %.2f\n",
-                   orders[i].items[j].item_name,
-                   orders[i].items[j].item_id,
-                   orders[i].items[j].qty,
-                   orders[i].items[j].item_price,
-                   orders[i].items[j].item_price * orders[i].items[j].qty);
-        }
-        printf("Subtotal: %.2f | Tax: %.2f | Total: %.2f\n",
-               orders[i].subtotal, orders[i].tax, orders[i].total);
-    }
+    for (size_t i = 0; i < count; ++i) print_order_details(&orders[i]);
     free(orders);
 }
 
-void admin_change_password(void) {
-    AdminCred cred;
-    FILE *f = fopen(ADMIN_FILE, "rb+");
-    if (!f) {
-        printf("Unable to open admin file.\n");
+void admin_find_order(void) {
+    printf("\n--- Find Order ---\n");
+    int id;
+    printf("Enter order ID: ");
+    if (scanf("%d", &id) != 1) {
+        while (getchar() != '\n');
+        printf("Invalid ID.\n");
         return;
     }
-    if (fread(&cred, sizeof(AdminCred), 1, f) != 1) {
+    while (getchar() != '\n');
+
+    INSTR_BEGIN(span, "admin_find_order");
+    Order order;
+    RecordStore *rs = datafile_store_open(&ORDER_SPEC, ORDER_INDEX_FILE, offsetof(Order, order_id), 0);
+    int found = rs ? rs_get(rs, &id, &order) : 0;
+    if (found == 1) sanitize_order(&order);
+    if (rs) INSTR_BYTES_READ(span, rs->bytes_read);
+    rs_close(rs);
+    INSTR_END(span);
+    if (found == 1) print_order_details(&order);
+    else if (found == 0) printf("Order %d not found.\n", id);
+    else printf("Error reading orders file.\n");
+}
+
+void admin_change_password(void) {
+    AdminCred cred;
+    LegacyAdminCred legacy;
+    int is_legacy;
+    if (load_admin_cred(&cred, &legacy, &is_legacy) != 0) {
         printf("Unable to read admin credentials.\n");
-        fclose(f);
         return;
     }
+    secure_zero(&legacy, sizeof(legacy));
 
     char newpass[50];
     printf("Enter new admin password: ");
     safe_input(newpass, sizeof(newpass));
     if (strlen(newpass) == 0) {
         printf("Password not changed (empty).\n");
-        fclose(f);
         return;
     }
-    strncpy(cred.password, newpass, sizeof(cred.password));
-    rewind(f);
-    fwrite(&cred, sizeof(AdminCred), 1, f);
-    fclose(f);
+    memset(&cred, 0, sizeof(cred));
+    int rc = admin_set_password(&cred, newpass);
+    secure_zero(newpass, sizeof(newpass));
+    if (rc != 0 || save_admin_cred(&cred) != 0) {
+        printf("Failed to save admin password.\n");
+        return;
+    }
     printf("Admin password updated.\n");
 }
 
-/* ---------- Customer functions ---------- */
-
-int customer_menu(void) {
+void admin_manage_stock(void) {
     while (1) {
-        printf("\n--- CUSTOMER MENU ---\n");
-        printf("1. View Menu\n");
-        printf("2. Place Order\n");
+        printf("\n--- STOCK ---\n");
+        printf("1. View Stock Levels\n");
+        printf("2. Set Menu Item Stock\n");
+        printf("3. Add / Restock Ingredient\n");
+        printf("4. Set Item Recipe\n");
         printf("0. Back\n");
         printf("Choice: ");
 
@@ -391,13 +1194,151 @@ int customer_menu(void) {
             continue;
         }
         while (getchar() != '\n');
+        if (choice == 0) break;
+        if (choice == 1) {
+            admin_view_stock();
+            continue;
+        }
+        if (choice < 1 || choice > 4) {
+            printf("Invalid choice.\n");
+            continue;
+        }
 
-        if (choice == 1) customer_view_menu();
-        else if (choice == 2) customer_place_order();
-        else if (choice == 0) break;
-        else printf("Invalid choice.\n");
+        int id;
+        printf(choice == 3 ? "Ingredient ID: " : "Menu item ID: ");
+        if (scanf("%d", &id) != 1 || id <= 0) {
+            while (getchar() != '\n');
+            printf("Invalid ID.\n");
+            continue;
+        }
+        while (getchar() != '\n');
+
+        if (choice == 4) {
+            /* replace all recipe lines of this item */
+            size_t count;
+            RecipeLine *all = datafile_load(&RECIPE_SPEC, &count);
+            RecipeLine *kept = malloc((count + MAX_RECIPE_LINES) * sizeof(RecipeLine));
+            if (!kept) { free(all); continue; }
+            size_t n = 0;
+            for (size_t i = 0; i < count; ++i) if (all[i].item_id != id) kept[n++] = all[i];
+            free(all);
+            printf("Enter ingredient ID and units per item, one pair per line (0 0 to finish):\n");
+            for (int lines = 0; lines < MAX_RECIPE_LINES; ++lines) {
+                RecipeLine rl;
+                memset(&rl, 0, sizeof(rl));
+                rl.item_id = id;
+                if (scanf("%d %d", &rl.ingredient_id, &rl.qty) != 2) {
+                    while (getchar() != '\n');
+                    break;
+                }
+                while (getchar() != '\n');
+                if (rl.ingredient_id <= 0 || rl.qty <= 0) break;
+                if (!stock_find(STOCK_KIND_INGREDIENT, rl.ingredient_id)) {
+                    printf("Unknown ingredient %d (add it first).\n", rl.ingredient_id);
+                    continue;
+                }
+                kept[n++] = rl;
+            }
+            printf(datafile_save(&RECIPE_SPEC, kept, n) == 0 ? "Recipe saved.\n"
+                                                             : "Failed to save recipe.\n");
+            free(kept);
+            continue;
+        }
+
+        int kind = choice == 2 ? STOCK_KIND_ITEM : STOCK_KIND_INGREDIENT;
+        StockSlot *slot = stock_get_or_create(kind, id);
+        if (!slot) {
+            printf("Stock file unavailable.\n");
+            continue;
+        }
+        if (kind == STOCK_KIND_INGREDIENT) {
+            printf("Ingredient name (enter to keep '%s'): ", slot->name);
+            char buffer[MAX_NAME_LEN];
+            safe_input(buffer, sizeof(buffer));
+            if (strlen(buffer) > 0) {
+                memset(slot->name, 0, sizeof(slot->name));
+                memcpy(slot->name, buffer, strlen(buffer));
+            }
+        }
+        long long delta, low;
+        printf("Units to add (negative to remove): ");
+        if (scanf("%lld", &delta) != 1) {
+            while (getchar() != '\n');
+            printf("Invalid number.\n");
+            continue;
+        }
+        while (getchar() != '\n');
+        printf("Low-stock alert level (-1 to keep %lld): ",
+               (long long)__atomic_load_n(&slot->low_mark, __ATOMIC_ACQUIRE));
+        if (scanf("%lld", &low) == 1 && low >= 0)
+            __atomic_store_n(&slot->low_mark, (int64_t)low, __ATOMIC_RELEASE);
+        while (getchar() != '\n');
+
+        /* relative update so concurrent sales are never overwritten */
+        int64_t now = __atomic_add_fetch(&slot->on_hand, (int64_t)delta, __ATOMIC_SEQ_CST);
+        if (now < 0) {
+            __atomic_sub_fetch(&slot->on_hand, now, __ATOMIC_SEQ_CST);
+            now = 0;
+        }
+        printf("On hand: %lld\n", (long long)now);
     }
-    return 0;
+}
+
+void admin_view_stock(void) {
+    size_t capacity;
+    StockSlot *slots = stock_table(&capacity);
+    if (!slots) {
+        printf("Stock file unavailable.\n");
+        return;
+    }
+    stock_reclaim();    /* so stock held by crashed terminals shows as on hand */
+    size_t count;
+    MenuItem *items = load_all_menu_items(&count);
+    printf("\n--- STOCK LEVELS ---\n");
+    printf("%-12s %-5s %-25s %-10s %-10s\n", "Kind", "ID", "Name", "On hand", "Alert at");
+    for (size_t s = 0; s < capacity; ++s) {
+        int kind = __atomic_load_n(&slots[s].kind, __ATOMIC_ACQUIRE);
+        if (kind != STOCK_KIND_ITEM && kind != STOCK_KIND_INGREDIENT) continue;
+        const char *name = slots[s].name;
+        for (size_t i = 0; kind == STOCK_KIND_ITEM && items && i < count; ++i)
+            if (items[i].id == slots[s].id) name = items[i].name;
+        int64_t on_hand = __atomic_load_n(&slots[s].on_hand, __ATOMIC_ACQUIRE);
+        int64_t low_mark = __atomic_load_n(&slots[s].low_mark, __ATOMIC_ACQUIRE);
+        printf("%-12s %-5d %-25s %-10lld %-10lld%s\n",
+               kind == STOCK_KIND_ITEM ? "Menu item" : "Ingredient", slots[s].id, name,
+               (long long)on_hand, (long long)low_mark, on_hand <= low_mark ? "  LOW" : "");
+    }
+    free(items);
+}
+
+/* ---------- Customer functions ---------- */
+
+int customer_menu(void) {
+    while (1) {
+        printf("\n--- CUSTOMER MENU ---\n");
+        printf("1. View Menu\n");
+        printf("2. Place Order\n");
+        printf("3. My Past Orders\n");
+        printf("4. Reorder a Previous Order\n");
+        printf("0. Back\n");
+        printf("Choice: ");
+
+        int choice;
+        if (scanf("%d", &choice) != 1) {
+            while (getchar() != '\n');
+            printf("Invalid input.\n");
+            continue;
+        }
+        while (getchar() != '\n');
+
+        if (choice == 1) customer_view_menu();
+        else if (choice == 2) customer_place_order();
+        else if (choice == 3) customer_order_history();
+        else if (choice == 4) customer_reorder();
+        else if (choice == 0) break;
+        else printf("Invalid choice.\n");
+    }
+    return 0;
 }
 
 void customer_view_menu(void) {
@@ -424,11 +1365,17 @@ void customer_place_order(void) {
 
     printf("\nAvailable Menu:\n");
     printf("%-5s %-25s %-12s %-8s\n", "ID", "Name", "Category", "Price");
+    size_t n_recipes;
+    RecipeLine *recipes = load_all_recipes(&n_recipes);
     for (size_t i = 0; i < count; ++i) {
-        if (items[i].available)
+        if (items[i].available && stock_item_available(items[i].id, recipes, n_recipes))
             printf("%-5d %-25s %-12s %-8.2f\n",
-                   items[i].id, items[i].name, items[i].category, items[i].price);
+                   items[i].id, items[i].name, items[i].category, money(items[i].price_cents));
     }
+    free(recipes);
+
+    StockReservation res;
+    res.count = 0;
 
     int adding = 1;
     while (adding) {
@@ -454,24 +1401,34 @@ void customer_place_order(void) {
         }
         if (!mi->available) {
             printf("Item '%s' is currently not available.\n", mi->name);
+            free(mi);
             continue;
         }
 
         int qty;
         printf("Quantity: ");
-        if (scanf("%d", &qty) != 1 || qty <= 0) {
+        if (scanf("%d", &qty) != 1 || qty <= 0 || qty > PRICE_MAX_QTY) {
             while (getchar() != '\n');
             printf("Invalid quantity.\n");
+            free(mi);
             continue;
         }
         while (getchar() != '\n');
 
+        /* take the stock now so another terminal cannot sell it meanwhile */
+        if (stock_reserve_item(mi->id, qty, &res) != 0) {
+            printf("Not enough stock for %s x%d.\n", mi->name, qty);
+            free(mi);
+            continue;
+        }
+
         /* add to order */
         OrderItem oi;
+        memset(&oi, 0, sizeof(oi));
         oi.item_id = mi->id;
         oi.qty = qty;
-        oi.item_price = mi->price;
         strncpy(oi.item_name, mi->name, MAX_NAME_LEN);
+        free(mi);
 
         order.items[order.num_items] = oi;
         order.num_items++;
@@ -491,55 +1448,168 @@ void customer_place_order(void) {
 
     if (order.num_items == 0) {
         printf("No items in order. Cancelled.\n");
+        stock_release(&res);
         free(items);
         return;
     }
 
-    /* calculate totals carefully, step-by-step */
-    double subtotal = 0.0;
-    for (int i = 0; i < order.num_items; ++i) {
-        double line = order.items[i].item_price * (double)order.items[i].qty;
-        subtotal += line;
-    }
-    /* Round to cents for subtotal */
-    subtotal = ((long long) (subtotal * 100.0 + 0.5)) / 100.0;
+    customer_checkout(&order, &res);
+    free(items);
+}
 
-    double tax = subtotal * TAX_RATE;
-    tax = ((long long) (tax * 100.0 + 0.5)) / 100.0;
-    double total = subtotal + tax;
-    total = ((long long) (total * 100.0 + 0.5)) / 100.0;
+/* price every line and the totals with the current menu and pricing rules (0 on success) */
+int price_order(Order *order) {
+    PricingEngine *pe = pricing_shared();
+    return pe ? pricing_quote(pe, order, order->timestamp) : -1;
+}
 
-    order.subtotal = subtotal;
-    order.tax = tax;
-    order.total = total;
+/* price the order, show the invoice and save it (the stock is released if saving fails) */
+void customer_checkout(Order *order, StockReservation *res) {
+    if (price_order(order) != 0) {
+        printf("The order could not be priced (an item left the menu?). Cancelled.\n");
+        stock_release(res);
+        return;
+    }
 
     /* Show invoice */
     printf("\n--- INVOICE ---\n");
-    printf("Order ID: %d\n", order.order_id);
-    printf("Customer: %s\n", order.customer_name);
+    printf("Order ID: %d\n", order->order_id);
+    printf("Customer: %s\n", order->customer_name);
     char tbuf[64];
-    struct tm *tm_info = localtime(&order.timestamp);
+    struct tm *tm_info = localtime(&order->timestamp);
     strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", tm_info);
     printf("Date: %s\n", tbuf);
     printf("\nItems:\n");
-    for (int i = 0; i < order.num_items; ++i) {
-        double line_total = order.items[i].item_price * (double)order.items[i].qty;
-        printf(" - %-25s x%d @ %.2f => %.2f\n",
-               order.items[i].item_name,
-               order.items[i].qty,
-               order.items[i].item_price,
-               line_total);
+    for (int i = 0; i < order->num_items; ++i) {
+        const OrderItem *oi = &order->items[i];
+        printf(" - %-25s x%d @ %.2f => %.2f", oi->item_name, oi->qty, money(oi->unit_cents),
+               money(oi->unit_cents * oi->qty));
+        if (oi->unit_cents != oi->list_cents) printf("  (happy hour, was %.2f)", money(oi->list_cents));
+        printf("\n");
     }
-    printf("\nSubtotal: %.2f\nTax (%.2f%%): %.2f\nTotal: %.2f\n", subtotal, TAX_RATE * 100.0, tax, total);
+    printf("\nSubtotal: %.2f\n", money(order->subtotal_cents));
+    if (order->discount_cents != 0) printf("Combo discounts: -%.2f\n", money(order->discount_cents));
+    printf("Tax: %.2f\nTotal: %.2f\n", money(order->tax_cents), money(order->total_cents));
 
     /* Save order */
-    if (append_order(&order) == 0) {
+    if (stock_commit(res) != 0) {
+        printf("Some items sold out while the order was open. Cancelled.\n");
+        return;
+    }
+    int shown_id = order->order_id;
+    if (append_order(order) == 0) {
+        if (order->order_id != shown_id)
+            printf("Order ID %d was taken by another terminal; saved as order %d.\n",
+                   shown_id, order->order_id);
         printf("Order saved. Thank you!\n");
     } else {
         printf("Failed to save order.\n");
+        stock_release(res);
     }
+}
 
-    free(items);
+static void print_order_summary(int number, const Order *order) {
+    char tbuf[64] = "(bad date)";
+    struct tm *tm_info = localtime(&order->timestamp);
+    if (tm_info) strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M", tm_info);
+    printf("%2d. Order %d | %s | Total %.2f\n", number, order->order_id, tbuf, money(order->total_cents));
+    for (int i = 0; i < order->num_items; ++i)
+        printf("      %s x%d\n", order->items[i].item_name, order->items[i].qty);
+}
+
+/* ask for a name and fetch that customer's latest orders; returns how many (0 = none shown) */
+static int customer_prompt_history(const char *title, Order *recent, CustomerSlot *info) {
+    char name[MAX_NAME_LEN];
+    printf("\n--- %s ---\n", title);
+    printf("Customer name: ");
+    safe_input(name, sizeof(name));
+
+    int n = customer_recent_orders(name, recent, CUSTOMER_RECENT_ORDERS, info);
+    if (n < 0) {
+        printf("Order history is unavailable.\n");
+        return 0;
+    }
+    if (n == 0) {
+        printf("No orders found for '%s'.\n", name);
+        return 0;
+    }
+    printf("Orders placed: %u | Lifetime spend: %.2f\n", (unsigned)info->order_count,
+           money(info->total_spent_cents));
+    printf("\nLast %d order(s):\n", n);
+    for (int i = 0; i < n; ++i) print_order_summary(i + 1, &recent[i]);
+    return n;
+}
+
+void customer_order_history(void) {
+    Order recent[CUSTOMER_RECENT_ORDERS];
+    CustomerSlot info;
+    customer_prompt_history("My Past Orders", recent, &info);
+}
+
+/* place a previous order again at today's prices, skipping what cannot be served */
+void customer_reorder(void) {
+    Order recent[CUSTOMER_RECENT_ORDERS];
+    CustomerSlot info;
+    int n = customer_prompt_history("Reorder", recent, &info);
+    if (n == 0) return;
+
+    int pick;
+    printf("\nReorder which one? (1-%d, 0 to cancel): ", n);
+    if (scanf("%d", &pick) != 1) {
+        while (getchar() != '\n');
+        printf("Invalid input.\n");
+        return;
+    }
+    while (getchar() != '\n');
+    if (pick == 0) return;
+    if (pick < 1 || pick > n) {
+        printf("Invalid choice.\n");
+        return;
+    }
+    const Order *prev = &recent[pick - 1];
+
+    Order order;
+    memset(&order, 0, sizeof(order));
+    order.order_id = get_next_order_id();
+    order.timestamp = time(NULL);
+    memcpy(order.customer_name, prev->customer_name, MAX_NAME_LEN);
+
+    StockReservation res;
+    res.count = 0;
+    /* one menu store for every item, so its index and pages are read once */
+    RecordStore *menu = datafile_store_open(&MENU_SPEC, MENU_INDEX_FILE, offsetof(MenuItem, id), 0);
+    for (int i = 0; i < prev->num_items; ++i) {
+        const OrderItem *old = &prev->items[i];
+        MenuItem *mi = menu_store_get(menu, old->item_id);
+        if (!mi || !mi->available) {
+            printf("Skipping %s: no longer available.\n", old->item_name);
+            free(mi);
+            continue;
+        }
+        if (stock_reserve_item(mi->id, old->qty, &res) != 0) {
+            printf("Skipping %s x%d: not enough stock.\n", mi->name, old->qty);
+            free(mi);
+            continue;
+        }
+        if (mi->price_cents != old->list_cents)
+            printf("Note: %s is now %.2f (was %.2f).\n", mi->name, money(mi->price_cents), money(old->list_cents));
+
+        OrderItem oi;
+        memset(&oi, 0, sizeof(oi));
+        oi.item_id = mi->id;
+        oi.qty = old->qty;
+        memcpy(oi.item_name, mi->name, MAX_NAME_LEN);
+        free(mi);
+        order.items[order.num_items++] = oi;
+    }
+    rs_close(menu);
+
+    if (order.num_items == 0) {
+        printf("Nothing from that order can be served right now.\n");
+        stock_release(&res);
+        return;
+    }
+    customer_checkout(&order, &res);
 }
 
 /* ---------- File / Data helpers ---------- */
@@ -556,6 +1626,12 @@ int get_next_menu_id(void) {
 }
 
 int get_next_order_id(void) {
+    /* ids only ever grow, so the last order holds the largest one */
+    int64_t n = datafile_record_count(&ORDER_SPEC);
+    Order last;
+    if (n > 0 && datafile_read_record(&ORDER_SPEC, (uint64_t)n - 1, &last) == 0)
+        return last.order_id + 1;
+
     size_t count;
     Order *orders = load_all_orders(&count);
     int max = 0;
@@ -567,111 +1643,3832 @@ int get_next_order_id(void) {
 }
 
 MenuItem* load_all_menu_items(size_t *count) {
-    *count = 0;
-    FILE *f = fopen(MENU_FILE, "rb");
-    if (!f) return NULL;
-    fseek(f, 0, SEEK_END);
-    long sz = ftell(f);
-    if (sz <= 0) { fclose(f); return NULL; }
-    rewind(f);
-    size_t n = sz / sizeof(MenuItem);
-    MenuItem *arr = malloc(n * sizeof(MenuItem));
-    if (!arr) { fclose(f); return NULL; }
-    if (fread(arr, sizeof(MenuItem), n, f) != n) {
-        free(arr); fclose(f); return NULL;
-    }
-    fclose(f);
-    *count = n;
-    return arr;
+    INSTR_BEGIN(span, "load_all_menu_items");
+    MenuItem *items = datafile_load(&MENU_SPEC, count);
+    for (size_t i = 0; i < *count; ++i) sanitize_menu_item(&items[i]);
+    INSTR_BYTES_READ(span, *count * sizeof(MenuItem));
+    INSTR_END(span);
+    return items;
 }
 
-/* rewrite menu file with array (returns 0 on success) */
-int save_all_menu_items(MenuItem *items, size_t count) {
-    FILE *f = fopen(MENU_FILE, "wb");
-    if (!f) return -1;
-    if (count > 0) {
-        if (fwrite(items, sizeof(MenuItem), count, f) != count) {
-            fclose(f); return -1;
+/*
+ * Write one menu item in place (returns 0 on success). A new item gets the
+ * next id here, under the menu lock, so two admins never share one.
+ */
+int save_menu_item(MenuItem *item, int is_new) {
+    INSTR_BEGIN(span, "save_menu_item");
+    int lock = lock_file(MENU_LOCK_FILE);
+    if (is_new) item->id = get_next_menu_id();
+    RecordStore *rs = datafile_store_open(&MENU_SPEC, MENU_INDEX_FILE, offsetof(MenuItem, id), RS_WRITE);
+    int ok = rs && rs_put(rs, item) == 0;
+    if (rs) INSTR_BYTES_WRITTEN(span, rs->bytes_written);
+    if (rs_close(rs) != 0) ok = 0;
+    unlock_file(lock);
+    INSTR_END(span);
+    return ok ? 0 : -1;
+}
+
+Order* load_all_orders(size_t *count) {
+    INSTR_BEGIN(span, "load_all_orders");
+    Order *orders = datafile_load(&ORDER_SPEC, count);
+    for (size_t i = 0; i < *count; ++i) sanitize_order(&orders[i]);
+    INSTR_BYTES_READ(span, *count * sizeof(Order));
+    INSTR_END(span);
+    return orders;
+}
+
+static int customer_index_lock(void);
+static void customer_index_unlock(int fd);
+static int customer_index_sync(const Order *fresh, size_t n_fresh);
+
+/* append to orders.dat and file the new order under its customer */
+int append_order(Order *order) {
+    return append_orders(order, 1) == 1 ? 0 : -1;
+}
+
+/*
+ * Append a batch of orders with one lock, one write-back and one customer
+ * index update. An order with id 0, or whose id another terminal has used
+ * since it was picked, gets the next free id rather than overwriting that
+ * order. Returns how many orders (from the start) were saved.
+ */
+size_t append_orders(Order *orders, size_t n) {
+    INSTR_BEGIN(span, "append_orders");
+    int lock = customer_index_lock();
+    RecordStore *rs = datafile_store_open(&ORDER_SPEC, ORDER_INDEX_FILE, offsetof(Order, order_id), RS_WRITE);
+    Order taken;
+    int next_on_disk = 0, max_put = 0;
+    size_t saved = 0;
+    while (rs && saved < n) {
+        Order *order = &orders[saved];
+        if (order->order_id <= 0 || rs_get(rs, &order->order_id, &taken) != 0) {
+            /* the file's last order predates this batch, so also stay above the batch */
+            if (next_on_disk == 0) next_on_disk = get_next_order_id();
+            order->order_id = next_on_disk > max_put ? next_on_disk : max_put + 1;
+            if (rs_get(rs, &order->order_id, &taken) != 0) break;
         }
+        if (rs_put(rs, order) != 0) break;
+        if (order->order_id > max_put) max_put = order->order_id;
+        saved++;
     }
-    fclose(f);
-    return 0;
+    if (rs) INSTR_BYTES_WRITTEN(span, rs->bytes_written);
+    if (rs_close(rs) != 0) saved = 0;
+    INSTR_BEGIN(index, "append_orders.customer_index");
+    if (saved > 0 && customer_index_sync(orders, saved) != 0)
+        printf("Warning: customer order index could not be updated.\n");
+    INSTR_END(index);
+    customer_index_unlock(lock);
+    INSTR_END(span);
+    return saved;
 }
 
-Order* load_all_orders(size_t *count) {
-    *count = 0;
-    FILE *f = fopen(ORDER_FILE, "rb");
-    if (!f) return NULL;
-    fseek(f, 0, SEEK_END);
-    long sz = ftell(f);
-    if (sz <= 0) { fclose(f); return NULL; }
-    rewind(f);
-    size_t n = sz / sizeof(Order);
-    Order *arr = malloc(n * sizeof(Order));
-    if (!arr) { fclose(f); return NULL; }
-    if (fread(arr, sizeof(Order), n, f) != n) {
-        free(arr); fclose(f); return NULL;
+/* heap copy of one menu item (caller frees) from an open menu store; keep it open for many lookups */
+static MenuItem* menu_store_get(RecordStore *rs, int id) {
+    MenuItem *res = rs ? malloc(sizeof(MenuItem)) : NULL;
+    if (res && rs_get(rs, &id, res) != 1) {
+        free(res);
+        res = NULL;
     }
-    fclose(f);
-    *count = n;
-    return arr;
+    if (res) sanitize_menu_item(res);
+    return res;
 }
 
-int append_order(const Order *order) {
-    FILE *f = fopen(ORDER_FILE, "ab");
-    if (!f) return -1;
-    if (fwrite(order, sizeof(Order), 1, f) != 1) {
+/* heap copy of one menu item (caller frees), read through menu.idx */
+MenuItem* find_menu_item_by_id(int id) {
+    INSTR_BEGIN(span, "find_menu_item_by_id");
+    RecordStore *rs = datafile_store_open(&MENU_SPEC, MENU_INDEX_FILE, offsetof(MenuItem, id), 0);
+    MenuItem *res = menu_store_get(rs, id);
+    if (rs) INSTR_BYTES_READ(span, rs->bytes_read);
+    rs_close(rs);
+    INSTR_END(span);
+    return res;
+}
+
+/* Ensure admin file exists; if not, create with default password */
+int ensure_admin_file(void) {
+    FILE *f = fopen(ADMIN_FILE, "rb");
+    if (f) {
         fclose(f);
-        return -1;
+        return 0;
     }
+    AdminCred cred;
+    memset(&cred, 0, sizeof(cred));
+    if (admin_set_password(&cred, ADMIN_DEFAULT_PASS) != 0) return -1;
+    return save_admin_cred(&cred);
+}
+
+/*
+ * Read the admin record, creating the default one if missing (0 on success).
+ * A plaintext admin.dat from older versions is returned through `legacy`
+ * with *is_legacy set; admin_login() upgrades it.
+ */
+int load_admin_cred(AdminCred *cred, LegacyAdminCred *legacy, int *is_legacy) {
+    if (ensure_admin_file() != 0) return -1;
+    *is_legacy = 0;
+
+    DataFileHeader h;
+    int hashed = 0;
+    FILE *f = fopen(ADMIN_FILE, "rb");
+    if (!f) return -1;
+    if (fread(&h, sizeof(h), 1, f) == 1 && h.magic == DATAFILE_MAGIC &&
+        h.kind == DATAFILE_KIND_ADMIN_HASH) hashed = 1;
     fclose(f);
+
+    const DataFileSpec *spec = hashed ? &ADMIN_SPEC : &LEGACY_ADMIN_SPEC;
+    size_t count;
+    void *arr = datafile_load(spec, &count);
+    if (!arr) return -1;
+    if (count != 1) {
+        free(arr);
+        return -1;
+    }
+    if (hashed) {
+        memcpy(cred, arr, sizeof(*cred));
+    } else {
+        memcpy(legacy, arr, sizeof(*legacy));
+        secure_zero(arr, sizeof(*legacy));
+        *is_legacy = 1;
+    }
+    free(arr);
     return 0;
 }
 
-MenuItem* find_menu_item_by_id(int id) {
-    size_t count;
-    MenuItem *items = load_all_menu_items(&count);
-    if (!items) return NULL;
-    MenuItem *res = NULL;
-    for (size_t i = 0; i < count; ++i) {
-        if (items[i].id == id) {
-            /* copy to heap so caller can free it independently */
-            res = malloc(sizeof(MenuItem));
-            if (res) memcpy(res, &items[i], sizeof(MenuItem));
+int save_admin_cred(const AdminCred *cred) {
+    return datafile_save(&ADMIN_SPEC, cred, 1);
+}
+
+/*
+ * Fresh salt + scrypt hash with the configured cost; throttle state
+ * untouched. On failure *cred is left exactly as it was.
+ */
+int admin_set_password(AdminCred *cred, const char *password) {
+    AdminCred next = *cred;
+    next.kdf_log2_n = ADMIN_KDF_LOG2_N;
+    next.kdf_r = ADMIN_KDF_R;
+    next.kdf_p = ADMIN_KDF_P;
+    int rc = random_bytes(next.salt, sizeof(next.salt)) != 0 ? -1 :
+             scrypt_kdf((const unsigned char *)password, strlen(password),
+                        next.salt, sizeof(next.salt),
+                        next.kdf_log2_n, next.kdf_r, next.kdf_p,
+                        next.hash, sizeof(next.hash));
+    if (rc == 0) *cred = next;
+    secure_zero(&next, sizeof(next));
+    return rc;
+}
+
+/* returns 1 if password matches the stored hash (constant-time compare) */
+int admin_check_password(const AdminCred *cred, const char *password) {
+    unsigned char derived[ADMIN_HASH_LEN];
+    if (scrypt_kdf((const unsigned char *)password, strlen(password),
+                   cred->salt, sizeof(cred->salt),
+                   cred->kdf_log2_n, cred->kdf_r, cred->kdf_p,
+                   derived, sizeof(derived)) != 0) return 0;
+    int ok = ct_equal(derived, cred->hash, sizeof(derived));
+    secure_zero(derived, sizeof(derived));
+    return ok;
+}
+
+/* time one KDF evaluation per cost level and suggest a compile-time setting */
+void bench_kdf(double target_ms) {
+    unsigned char salt[ADMIN_SALT_LEN] = {0};
+    unsigned char out[ADMIN_HASH_LEN];
+    uint32_t best = 0;
+    printf("scrypt r=%d p=%d, target %.0f ms per login\n", ADMIN_KDF_R, ADMIN_KDF_P, target_ms);
+    printf("%-10s %-12s %-10s\n", "log2(N)", "Memory(MiB)", "Time(ms)");
+    for (uint32_t log2_n = 10; log2_n <= 22; ++log2_n) {
+        clock_t start = clock();
+        if (scrypt_kdf((const unsigned char *)"benchmark", 9, salt, sizeof(salt),
+                       log2_n, ADMIN_KDF_R, ADMIN_KDF_P, out, sizeof(out)) != 0) {
+            printf("%-10u (out of memory)\n", (unsigned)log2_n);
             break;
         }
+        double ms = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+        printf("%-10u %-12.1f %-10.1f\n", (unsigned)log2_n,
+               128.0 * ADMIN_KDF_R * ((double)(1u << log2_n)) / (1024.0 * 1024.0), ms);
+        if (ms > target_ms) break;
+        best = log2_n;
     }
-    free(items);
-    return res;
+    if (best)
+        printf("Suggested: -DADMIN_KDF_LOG2_N=%u (current %d)\n", (unsigned)best, ADMIN_KDF_LOG2_N);
+    else
+        printf("Even the smallest cost exceeds the target.\n");
 }
 
-/* Ensure admin file exists; if not, create with default password */
-int ensure_admin_file(void) {
-    FILE *f = fopen(ADMIN_FILE, "rb");
-    if (!f) {
-        AdminCred cred;
-        strncpy(cred.password, ADMIN_DEFAULT_PASS, sizeof(cred.password));
-        f = fopen(ADMIN_FILE, "wb");
-        if (!f) return -1;
-        fwrite(&cred, sizeof(AdminCred), 1, f);
-        fclose(f);
+/* ---------- Password hashing (SHA-256 / PBKDF2 / scrypt, RFC 7914) ---------- */
+
+typedef struct {
+    uint32_t state[8];
+    uint64_t bytes;
+    unsigned char buf[64];
+    size_t buflen;
+} Sha256;
+
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+
+static void sha256_block(uint32_t st[8], const unsigned char *p) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i)
+        w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 |
+               (uint32_t)p[4 * i + 2] << 8 | (uint32_t)p[4 * i + 3];
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = ROTR32(w[i - 15], 7) ^ ROTR32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ROTR32(w[i - 2], 17) ^ ROTR32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = st[0], b = st[1], c = st[2], d = st[3];
+    uint32_t e = st[4], f = st[5], g = st[6], h = st[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t t1 = h + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25)) +
+                      ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+        uint32_t t2 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) +
+                      ((a & b) ^ (a & c) ^ (b & c));
+        h = g; g = f; f = e; e = d + t1;
+        d = c; c = b; b = a; a = t1 + t2;
+    }
+    st[0] += a; st[1] += b; st[2] += c; st[3] += d;
+    st[4] += e; st[5] += f; st[6] += g; st[7] += h;
+}
+
+static void sha256_init(Sha256 *s) {
+    static const uint32_t iv[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(s->state, iv, sizeof(iv));
+    s->bytes = 0;
+    s->buflen = 0;
+}
+
+static void sha256_update(Sha256 *s, const unsigned char *p, size_t len) {
+    s->bytes += len;
+    if (s->buflen) {
+        size_t take = 64 - s->buflen < len ? 64 - s->buflen : len;
+        memcpy(s->buf + s->buflen, p, take);
+        s->buflen += take;
+        p += take;
+        len -= take;
+        if (s->buflen < 64) return;
+        sha256_block(s->state, s->buf);
+        s->buflen = 0;
+    }
+    for (; len >= 64; p += 64, len -= 64) sha256_block(s->state, p);
+    memcpy(s->buf, p, len);
+    s->buflen = len;
+}
+
+static void sha256_final(Sha256 *s, unsigned char out[32]) {
+    uint64_t bits = s->bytes * 8;
+    unsigned char pad[72] = {0x80};
+    size_t padlen = (s->buflen < 56 ? 56 : 120) - s->buflen;
+    for (int i = 0; i < 8; ++i) pad[padlen + i] = (unsigned char)(bits >> (56 - 8 * i));
+    sha256_update(s, pad, padlen + 8);
+    for (int i = 0; i < 8; ++i) {
+        out[4 * i] = (unsigned char)(s->state[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(s->state[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(s->state[i] >> 8);
+        out[4 * i + 3] = (unsigned char)s->state[i];
+    }
+}
+
+/* PBKDF2-HMAC-SHA256 with a single iteration, as used inside scrypt */
+static void pbkdf2_sha256_1(const unsigned char *pass, size_t passlen,
+                            const unsigned char *salt, size_t saltlen,
+                            unsigned char *out, size_t outlen) {
+    unsigned char key[64] = {0}, ipad[64], opad[64], digest[32];
+    if (passlen > 64) {
+        Sha256 k;
+        sha256_init(&k);
+        sha256_update(&k, pass, passlen);
+        sha256_final(&k, key);
     } else {
-        fclose(f);
+        memcpy(key, pass, passlen);
+    }
+    for (int i = 0; i < 64; ++i) {
+        ipad[i] = key[i] ^ 0x36;
+        opad[i] = key[i] ^ 0x5c;
+    }
+    Sha256 inner0, outer0;
+    sha256_init(&inner0);
+    sha256_update(&inner0, ipad, 64);
+    sha256_update(&inner0, salt, saltlen);
+    sha256_init(&outer0);
+    sha256_update(&outer0, opad, 64);
+
+    for (uint32_t block = 1; outlen > 0; ++block) {
+        unsigned char ctr[4] = {
+            (unsigned char)(block >> 24), (unsigned char)(block >> 16),
+            (unsigned char)(block >> 8), (unsigned char)block
+        };
+        Sha256 inner = inner0, outer = outer0;
+        sha256_update(&inner, ctr, 4);
+        sha256_final(&inner, digest);
+        sha256_update(&outer, digest, 32);
+        sha256_final(&outer, digest);
+        size_t take = outlen < 32 ? outlen : 32;
+        memcpy(out, digest, take);
+        out += take;
+        outlen -= take;
+    }
+    secure_zero(key, sizeof(key));
+    secure_zero(ipad, sizeof(ipad));
+    secure_zero(opad, sizeof(opad));
+    secure_zero(digest, sizeof(digest));
+}
+
+static void salsa20_8(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+        x[4] ^= ROTL32(x[0] + x[12], 7);   x[8] ^= ROTL32(x[4] + x[0], 9);
+        x[12] ^= ROTL32(x[8] + x[4], 13);  x[0] ^= ROTL32(x[12] + x[8], 18);
+        x[9] ^= ROTL32(x[5] + x[1], 7);    x[13] ^= ROTL32(x[9] + x[5], 9);
+        x[1] ^= ROTL32(x[13] + x[9], 13);  x[5] ^= ROTL32(x[1] + x[13], 18);
+        x[14] ^= ROTL32(x[10] + x[6], 7);  x[2] ^= ROTL32(x[14] + x[10], 9);
+        x[6] ^= ROTL32(x[2] + x[14], 13);  x[10] ^= ROTL32(x[6] + x[2], 18);
+        x[3] ^= ROTL32(x[15] + x[11], 7);  x[7] ^= ROTL32(x[3] + x[15], 9);
+        x[11] ^= ROTL32(x[7] + x[3], 13);  x[15] ^= ROTL32(x[11] + x[7], 18);
+        x[1] ^= ROTL32(x[0] + x[3], 7);    x[2] ^= ROTL32(x[1] + x[0], 9);
+        x[3] ^= ROTL32(x[2] + x[1], 13);   x[0] ^= ROTL32(x[3] + x[2], 18);
+        x[6] ^= ROTL32(x[5] + x[4], 7);    x[7] ^= ROTL32(x[6] + x[5], 9);
+        x[4] ^= ROTL32(x[7] + x[6], 13);   x[5] ^= ROTL32(x[4] + x[7], 18);
+        x[11] ^= ROTL32(x[10] + x[9], 7);  x[8] ^= ROTL32(x[11] + x[10], 9);
+        x[9] ^= ROTL32(x[8] + x[11], 13);  x[10] ^= ROTL32(x[9] + x[8], 18);
+        x[12] ^= ROTL32(x[15] + x[14], 7); x[13] ^= ROTL32(x[12] + x[15], 9);
+        x[14] ^= ROTL32(x[13] + x[12], 13); x[15] ^= ROTL32(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; ++i) b[i] += x[i];
+}
+
+/* scrypt BlockMix: in and out are 2r 64-byte blocks; out must not alias in */
+static void scrypt_blockmix(const uint32_t *in, uint32_t *out, uint32_t r) {
+    uint32_t x[16];
+    memcpy(x, in + (2 * r - 1) * 16, 64);
+    for (uint32_t i = 0; i < 2 * r; ++i) {
+        for (int k = 0; k < 16; ++k) x[k] ^= in[i * 16 + k];
+        salsa20_8(x);
+        /* even blocks go to the first half, odd blocks to the second */
+        memcpy(out + ((i & 1) * r + i / 2) * 16, x, 64);
+    }
+}
+
+static void scrypt_romix(uint32_t *x, uint32_t *v, uint32_t *tmp, uint64_t n, uint32_t r) {
+    size_t words = 32 * (size_t)r;
+    for (uint64_t i = 0; i < n; ++i) {
+        memcpy(v + i * words, x, words * 4);
+        scrypt_blockmix(x, tmp, r);
+        memcpy(x, tmp, words * 4);
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t j = x[(2 * r - 1) * 16] & (n - 1);
+        for (size_t k = 0; k < words; ++k) x[k] ^= v[j * words + k];
+        scrypt_blockmix(x, tmp, r);
+        memcpy(x, tmp, words * 4);
+    }
+}
+
+/* scrypt(pass, salt, N = 2^log2_n, r, p) -> out; returns 0 on success */
+int scrypt_kdf(const unsigned char *pass, size_t passlen, const unsigned char *salt, size_t saltlen,
+               uint32_t log2_n, uint32_t r, uint32_t p, unsigned char *out, size_t outlen) {
+    if (log2_n == 0 || log2_n > 30 || r == 0 || p == 0 || r > 1024 || p > 64) return -1;
+    uint64_t n = (uint64_t)1 << log2_n;
+    size_t block_bytes = 128 * (size_t)r;
+    unsigned char *b = malloc(block_bytes * p);
+    uint32_t *x = malloc(block_bytes);
+    uint32_t *tmp = malloc(block_bytes);
+    uint32_t *v = malloc(block_bytes * (size_t)n);
+    int rc = -1;
+    if (!b || !x || !tmp || !v) goto done;
+
+    pbkdf2_sha256_1(pass, passlen, salt, saltlen, b, block_bytes * p);
+    for (uint32_t i = 0; i < p; ++i) {
+        unsigned char *bi = b + i * block_bytes;
+        for (size_t k = 0; k < block_bytes / 4; ++k)
+            x[k] = (uint32_t)bi[4 * k] | (uint32_t)bi[4 * k + 1] << 8 |
+                   (uint32_t)bi[4 * k + 2] << 16 | (uint32_t)bi[4 * k + 3] << 24;
+        scrypt_romix(x, v, tmp, n, r);
+        for (size_t k = 0; k < block_bytes / 4; ++k) {
+            bi[4 * k] = (unsigned char)x[k];
+            bi[4 * k + 1] = (unsigned char)(x[k] >> 8);
+            bi[4 * k + 2] = (unsigned char)(x[k] >> 16);
+            bi[4 * k + 3] = (unsigned char)(x[k] >> 24);
+        }
+    }
+    pbkdf2_sha256_1(pass, passlen, b, block_bytes * p, out, outlen);
+    rc = 0;
+
+done:
+    if (b) { secure_zero(b, block_bytes * p); free(b); }
+    if (x) { secure_zero(x, block_bytes); free(x); }
+    free(tmp);
+    free(v);
+    return rc;
+}
+
+/* 1 if equal; runtime depends only on len */
+int ct_equal(const void *a, const void *b, size_t len) {
+    const volatile unsigned char *pa = a, *pb = b;
+    unsigned char diff = 0;
+    for (size_t i = 0; i < len; ++i) diff |= pa[i] ^ pb[i];
+    return diff == 0;
+}
+
+/* memset that the optimiser may not drop */
+void secure_zero(void *p, size_t len) {
+    volatile unsigned char *q = p;
+    while (len--) *q++ = 0;
+}
+
+/* fill buf from the OS random source (returns 0 on success) */
+int random_bytes(unsigned char *buf, size_t len) {
+#ifdef _WIN32
+    for (size_t i = 0; i < len; ++i) {
+        unsigned int v;
+        if (rand_s(&v) != 0) return -1;
+        buf[i] = (unsigned char)v;
     }
     return 0;
+#else
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (!f) return -1;
+    size_t got = fread(buf, 1, len, f);
+    fclose(f);
+    return got == len ? 0 : -1;
+#endif
 }
 
-/* ---------- Utility helpers ---------- */
+/* ---------- Shared stock counters ---------- */
 
-void safe_input(char *buffer, size_t size) {
-    if (!fgets(buffer, (int)size, stdin)) {
-        /* input error, ensure empty string */
-        buffer[0] = '\0';
-        return;
+static StockSlot *stock_slots = NULL;
+static StockTerminal *stock_terminals = NULL;
+static int64_t *stock_held = NULL;      /* [terminal * STOCK_MAX_SLOTS + slot] */
+static int stock_unavailable = 0;
+static int stock_me = -1;               /* our terminal, -1 until we first hold stock */
+static uint64_t stock_my_lease = 0;
+static uint32_t stock_epoch = 0;        /* bumped each time another terminal handed our holds back */
+
+/*
+ * Map stock.dat (creating it on first use) and return its slot array.
+ * The mapping is MAP_SHARED, so every terminal sees the same counters.
+ * Stock still held by terminals that have since died is put back.
+ */
+StockSlot* stock_table(size_t *capacity) {
+    *capacity = STOCK_MAX_SLOTS;
+    if (stock_slots || stock_unavailable) return stock_slots;
+#ifdef _WIN32
+    stock_unavailable = 1;
+    return NULL;
+#else
+    size_t v1_bytes = sizeof(StockFileHeader) + STOCK_MAX_SLOTS * sizeof(StockSlot);
+    size_t bytes = v1_bytes + STOCK_MAX_TERMINALS * (sizeof(StockTerminal) + STOCK_MAX_SLOTS * sizeof(int64_t));
+    int fd = open(STOCK_FILE, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        stock_unavailable = 1;
+        return NULL;
     }
-    /* strip newline if present */
-    size_t len = strlen(buffer);
-    if (len > 0 && buffer[len - 1] == '\n') buffer[len - 1] = '\0';
+    /* only the terminal holding the lock may size and stamp a new file */
+    flock(fd, LOCK_EX);
+    struct stat st;
+    int ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size == 0) {
+        ok = ftruncate(fd, (off_t)bytes) == 0;
+        if (ok) {
+            StockFileHeader h;
+            memset(&h, 0, sizeof(h));
+            h.magic = STOCK_MAGIC;
+            h.version = STOCK_VERSION;
+            h.capacity = STOCK_MAX_SLOTS;
+            ok = pwrite(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);
+        }
+    } else if (ok && (size_t)st.st_size == v1_bytes) {
+        /* version 1: the counters stay, the lease tables are added empty */
+        StockFileHeader h;
+        ok = pread(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) && h.magic == STOCK_MAGIC && h.version == 1;
+        if (ok) {
+            h.version = STOCK_VERSION;
+            ok = ftruncate(fd, (off_t)bytes) == 0 && pwrite(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);
+        }
+    } else if (ok && (size_t)st.st_size != bytes) {
+        ok = 0;
+    }
+    void *map = ok ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    flock(fd, LOCK_UN);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printf("Warning: %s is unusable; stock is not being tracked.\n", STOCK_FILE);
+        stock_unavailable = 1;
+        return NULL;
+    }
+    const StockFileHeader *h = map;
+    if (h->magic != STOCK_MAGIC || h->version != STOCK_VERSION || h->capacity != STOCK_MAX_SLOTS) {
+        printf("Warning: %s has an unknown layout; stock is not being tracked.\n", STOCK_FILE);
+        munmap(map, bytes);
+        stock_unavailable = 1;
+        return NULL;
+    }
+    stock_slots = (StockSlot *)((char *)map + sizeof(StockFileHeader));
+    stock_terminals = (StockTerminal *)(stock_slots + STOCK_MAX_SLOTS);
+    stock_held = (int64_t *)(stock_terminals + STOCK_MAX_TERMINALS);
+    stock_reclaim();
+    return stock_slots;
+#endif
 }
 
+static size_t stock_hash(int kind, int id) {
+    uint32_t h = (uint32_t)id * 2654435761u ^ (uint32_t)kind * 0x9E3779B9u;
+    return (h ^ (h >> 15)) % STOCK_MAX_SLOTS;
+}
+
+/* open addressing with linear probing; slots are never freed, so an empty slot ends the probe */
+static StockSlot* stock_lookup(int kind, int id, int create) {
+    size_t capacity;
+    StockSlot *slots = stock_table(&capacity);
+    if (!slots) return NULL;
+    size_t start = stock_hash(kind, id);
+    for (size_t n = 0; n < capacity; ++n) {
+        StockSlot *slot = &slots[(start + n) % capacity];
+        int32_t k = __atomic_load_n(&slot->kind, __ATOMIC_ACQUIRE);
+        if (k == 0) {
+            if (!create) return NULL;
+            int32_t expected = 0;
+            if (__atomic_compare_exchange_n(&slot->kind, &expected, STOCK_SLOT_CLAIMED, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                slot->id = id;
+                slot->on_hand = 0;
+                slot->low_mark = 0;
+                memset(slot->name, 0, sizeof(slot->name));
+                __atomic_store_n(&slot->kind, kind, __ATOMIC_RELEASE);
+                return slot;
+            }
+            k = expected;
+        }
+        /* another terminal is filling this slot in; wait until it is published */
+        while (k == STOCK_SLOT_CLAIMED) k = __atomic_load_n(&slot->kind, __ATOMIC_ACQUIRE);
+        if (k == kind && slot->id == id) return slot;
+    }
+    return NULL;
+}
+
+StockSlot* stock_find(int kind, int id) {
+    return stock_lookup(kind, id, 0);
+}
+
+StockSlot* stock_get_or_create(int kind, int id) {
+    return stock_lookup(kind, id, 1);
+}
+
+/* atomically take qty units if that many are on hand (returns 1 on success) */
+static int stock_take(StockSlot *slot, int64_t qty) {
+    int64_t cur = __atomic_load_n(&slot->on_hand, __ATOMIC_ACQUIRE);
+    do {
+        if (cur < qty) return 0;
+    } while (!__atomic_compare_exchange_n(&slot->on_hand, &cur, cur - qty, 1,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    if (cur - qty <= __atomic_load_n(&slot->low_mark, __ATOMIC_ACQUIRE)) {
+        printf("Low stock alert: %s %d has %lld left.\n",
+               slot->kind == STOCK_KIND_ITEM ? "menu item" : slot->name, slot->id,
+               (long long)(cur - qty));
+    }
+    return 1;
+}
+
+static void stock_put_back(StockSlot *slot, int64_t qty) {
+    __atomic_add_fetch(&slot->on_hand, qty, __ATOMIC_ACQ_REL);
+}
+
+#ifndef _WIN32
+static uint64_t stock_lease_word(int64_t expires) {
+    return (uint64_t)getpid() << 32 | (uint32_t)expires;
+}
+
+/* has the terminal holding this lease died or let it run out? */
+static int stock_lease_lapsed(uint64_t lease, time_t now) {
+    if ((int64_t)(uint32_t)lease <= (int64_t)now) return 1;
+    return kill((pid_t)(lease >> 32), 0) != 0 && errno == ESRCH;
+}
+#endif
+
+/*
+ * Put back the held stock of every terminal that died or whose lease ran
+ * out. A terminal is taken over with an already expired lease of our own,
+ * so if we die half way another terminal finishes the job.
+ */
+void stock_reclaim(void) {
+#ifndef _WIN32
+    time_t now = time(NULL);
+    for (int t = 0; t < STOCK_MAX_TERMINALS; ++t) {
+        uint64_t lease = __atomic_load_n(&stock_terminals[t].lease, __ATOMIC_ACQUIRE);
+        if (lease == 0 || t == stock_me || !stock_lease_lapsed(lease, now)) continue;
+        if (!__atomic_compare_exchange_n(&stock_terminals[t].lease, &lease, stock_lease_word(0), 0,
+                                         __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            continue;
+        int64_t *held = &stock_held[(size_t)t * STOCK_MAX_SLOTS];
+        for (size_t i = 0; i < STOCK_MAX_SLOTS; ++i) {
+            if (__atomic_load_n(&held[i], __ATOMIC_ACQUIRE) == 0) continue;
+            int64_t qty = __atomic_exchange_n(&held[i], 0, __ATOMIC_ACQ_REL);
+            if (qty != 0) stock_put_back(&stock_slots[i], qty);
+        }
+        __atomic_store_n(&stock_terminals[t].lease, 0, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+/*
+ * Extend our lease, claiming a free terminal first if we have none.
+ * Finding the lease taken over means our holds were handed back, which
+ * stock_epoch records. Returns 0 if we may hold stock.
+ */
+static int stock_lease_renew(void) {
+#ifdef _WIN32
+    return -1;
+#else
+    uint64_t next = stock_lease_word((int64_t)time(NULL) + STOCK_LEASE_SECONDS);
+    if (stock_me >= 0) {
+        uint64_t cur = stock_my_lease;
+        if (__atomic_compare_exchange_n(&stock_terminals[stock_me].lease, &cur, next, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            stock_my_lease = next;
+            return 0;
+        }
+        stock_me = -1;
+        stock_epoch++;
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        for (int t = 0; t < STOCK_MAX_TERMINALS; ++t) {
+            uint64_t cur = 0;
+            if (__atomic_compare_exchange_n(&stock_terminals[t].lease, &cur, next, 0,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                stock_me = t;
+                stock_my_lease = next;
+                return 0;
+            }
+        }
+        stock_reclaim();
+    }
+    printf("Warning: %d terminals already hold stock; try again shortly.\n", STOCK_MAX_TERMINALS);
+    return -1;
+#endif
+}
+
+static int64_t* stock_my_held(const StockSlot *slot) {
+    return &stock_held[(size_t)stock_me * STOCK_MAX_SLOTS + (size_t)(slot - stock_slots)];
+}
+
+/* take qty from slot and record it under our lease (returns 1 on success) */
+static int stock_hold(StockReservation *res, StockSlot *slot, int64_t qty) {
+    if (!stock_take(slot, qty)) {
+        stock_reclaim();    /* some of it may sit with a dead terminal */
+        if (!stock_take(slot, qty)) return 0;
+    }
+    __atomic_add_fetch(stock_my_held(slot), qty, __ATOMIC_ACQ_REL);
+    res->holds[res->count].slot = slot;
+    res->holds[res->count].qty = qty;
+    res->holds[res->count].epoch = stock_epoch;
+    res->count++;
+    return 1;
+}
+
+/* give back holds from..count-1 (those another terminal already put back are skipped) */
+static void stock_unhold(StockReservation *res, int from) {
+    while (res->count > from) {
+        res->count--;
+        StockSlot *slot = res->holds[res->count].slot;
+        int64_t qty = res->holds[res->count].qty;
+        uint32_t epoch = res->holds[res->count].epoch;
+        if (epoch == STOCK_EPOCH_SOLD) {
+            stock_put_back(slot, qty);
+        } else if (epoch == stock_epoch && stock_me >= 0) {
+            __atomic_sub_fetch(stock_my_held(slot), qty, __ATOMIC_ACQ_REL);
+            stock_put_back(slot, qty);
+        }
+    }
+}
+
+/*
+ * Reserve qty of a menu item plus every ingredient its recipe uses, all or
+ * nothing. Successful holds are appended to res and stay ours while the
+ * lease is renewed, which every reserve, commit and release does. Returns 0
+ * on success.
+ */
+int stock_reserve_item(int item_id, int qty, StockReservation *res) {
+    int first = res->count;
+    size_t nlines;
+    RecipeLine *recipe = load_recipe(item_id, &nlines);
+    int ok = 1;
+
+    StockSlot *slot = stock_find(STOCK_KIND_ITEM, item_id);
+    int leased = -1;
+    if (slot) {
+        leased = stock_lease_renew();
+        ok = leased == 0 && stock_hold(res, slot, qty);
+    }
+    for (size_t i = 0; ok && i < nlines; ++i) {
+        StockSlot *ing = stock_find(STOCK_KIND_INGREDIENT, recipe[i].ingredient_id);
+        if (!ing) continue;
+        if (leased != 0) leased = stock_lease_renew();
+        ok = leased == 0 && stock_hold(res, ing, (int64_t)recipe[i].qty * qty);
+    }
+    free(recipe);
+    if (!ok) {
+        /* undo the part of this line that did succeed */
+        stock_unhold(res, first);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * The order is about to be saved: its holds stop being held and count as
+ * sold, so a crash from here on loses sight of that stock rather than
+ * selling it twice. Stock another terminal handed back meanwhile is taken
+ * again; if it has gone, everything is given back and -1 returned.
+ * stock_release() afterwards (the save failed) returns the stock.
+ */
+int stock_commit(StockReservation *res) {
+    if (res->count == 0) return 0;
+    stock_lease_renew();
+    for (int i = 0; i < res->count; ++i) {
+        StockSlot *slot = res->holds[i].slot;
+        int64_t qty = res->holds[i].qty;
+        if (res->holds[i].epoch == stock_epoch && stock_me >= 0) {
+            __atomic_sub_fetch(stock_my_held(slot), qty, __ATOMIC_ACQ_REL);
+        } else if (res->holds[i].epoch != STOCK_EPOCH_SOLD && !stock_take(slot, qty)) {
+            /* this one is neither held nor sold: drop it, then undo the rest */
+            res->holds[i] = res->holds[--res->count];
+            stock_unhold(res, 0);
+            return -1;
+        }
+        res->holds[i].epoch = STOCK_EPOCH_SOLD;
+    }
+    return 0;
+}
+
+/* give back everything held for a cancelled or failed order */
+void stock_release(StockReservation *res) {
+    if (res->count > 0) stock_lease_renew();    /* learns whether our holds were handed back */
+    stock_unhold(res, 0);
+}
+
+/* 1 if at least one unit of the item (and its ingredients) can be sold; recipes from load_all_recipes() */
+int stock_item_available(int item_id, const RecipeLine *recipes, size_t n_recipes) {
+    StockSlot *slot = stock_find(STOCK_KIND_ITEM, item_id);
+    if (slot && __atomic_load_n(&slot->on_hand, __ATOMIC_ACQUIRE) <= 0) return 0;
+    for (size_t i = 0; i < n_recipes; ++i) {
+        if (recipes[i].item_id != item_id) continue;
+        StockSlot *ing = stock_find(STOCK_KIND_INGREDIENT, recipes[i].ingredient_id);
+        if (ing && __atomic_load_n(&ing->on_hand, __ATOMIC_ACQUIRE) < recipes[i].qty) return 0;
+    }
+    return 1;
+}
+
+/* every recipe line, for listings that check many items (malloc'd, may be NULL with count 0) */
+RecipeLine* load_all_recipes(size_t *count) {
+    return datafile_load(&RECIPE_SPEC, count);
+}
+
+/* recipe lines of one menu item (malloc'd, may be NULL with count 0) */
+RecipeLine* load_recipe(int item_id, size_t *count) {
+    size_t n;
+    *count = 0;
+    RecipeLine *all = datafile_load(&RECIPE_SPEC, &n);
+    if (!all) return NULL;
+    size_t k = 0;
+    for (size_t i = 0; i < n; ++i) if (all[i].item_id == item_id) all[k++] = all[i];
+    *count = k;
+    return all;
+}
+
+/* ---------- Pricing engine ---------- */
+
+/*
+ * Every amount is an int64_t count of cents; no floating point touches a
+ * price. A quote runs in this order:
+ *   1. unit price = menu price less the best happy-hour discount in force
+ *      for the item (discounts do not stack);
+ *   2. combo rules, in rule order, are applied as many times as the basket
+ *      still holds their items; each combo's discount is split across its
+ *      items in proportion to their value (largest remainder gets the odd
+ *      cents) and never exceeds what it covers;
+ *   3. tax is charged per rate on the discounted amount, rounded half up
+ *      once per rate.
+ * Lines are priced in (item, qty) order, so a basket entered in any order
+ * gets the same quote, and the quote is memoized under that order.
+ */
+
+/* for display only: "%.2f" of cents / 100.0 always prints the exact cents */
+double money(int64_t cents) {
+    return (double)cents / 100.0;
+}
+
+/* "12", "12.5" or "12.50" -> 1250; returns -1 for anything else */
+int parse_money(const char *text, int64_t *cents) {
+    int64_t whole = 0, frac = 0;
+    int digits = 0, frac_digits = 0;
+    while (isspace((unsigned char)*text)) text++;
+    for (; isdigit((unsigned char)*text); ++text) {
+        if (++digits > 15) return -1;
+        whole = whole * 10 + (*text - '0');
+    }
+    if (*text == '.') {
+        for (++text; isdigit((unsigned char)*text); ++text) {
+            if (++frac_digits > 2) return -1;
+            frac = frac * 10 + (*text - '0');
+        }
+    }
+    while (isspace((unsigned char)*text)) text++;
+    if (*text != '\0' || digits + frac_digits == 0) return -1;
+    if (frac_digits == 1) frac *= 10;
+    *cents = whole * 100 + frac;
+    return 0;
+}
+
+/* cents * bp / 10000, rounded half up (cents >= 0) */
+static int64_t pricing_percent(int64_t cents, int32_t bp) {
+    return (cents * bp + 5000) / 10000;
+}
+
+static int pricing_same_category(const char *a, const char *b) {
+    for (size_t i = 0; i < MAX_CATEGORY_LEN; ++i) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return 0;
+        if (a[i] == '\0') return 1;
+    }
+    return 1;
+}
+
+static int compare_priced_items(const void *a, const void *b) {
+    const PricedItem *x = a, *y = b;
+    return (x->item.id > y->item.id) - (x->item.id < y->item.id);
+}
+
+static const PricedItem* pricing_find(const PricingEngine *pe, int id) {
+    size_t lo = 0, hi = pe->item_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (pe->items[mid].item.id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < pe->item_count && pe->items[lo].item.id == id ? &pe->items[lo] : NULL;
+}
+
+/* a rule that could overflow a quote or run past an array is ignored */
+static int price_rule_valid(const PriceRule *r) {
+    if (r->kind == PRICE_RULE_TAX) return r->rate_bp >= 0 && r->rate_bp <= 10000;
+    if (r->kind == PRICE_RULE_HAPPY_HOUR)
+        return r->rate_bp >= 0 && r->rate_bp <= 10000 && r->start_minute >= 0 && r->start_minute <= 24 * 60 &&
+               r->end_minute >= 0 && r->end_minute <= 24 * 60;
+    if (r->kind != PRICE_RULE_COMBO || r->amount_cents < 0 || r->amount_cents > PRICE_MAX_CENTS) return 0;
+    for (int c = 0; c < PRICE_COMBO_MAX; ++c) {
+        if (r->combo_item[c] == 0) continue;
+        if (r->combo_qty[c] <= 0 || r->combo_qty[c] > PRICE_COMBO_MAX_QTY) return 0;
+        for (int d = 0; d < c; ++d) if (r->combo_item[d] == r->combo_item[c]) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Take a copy of the menu and rules, resolve each item's tax rate and
+ * happy-hour rules, and invalidate every memoized quote. Items priced
+ * outside 0..PRICE_MAX_CENTS are left out, so orders for them fail.
+ */
+int pricing_load(PricingEngine *pe, const MenuItem *menu, size_t n, const PriceRule *rules, size_t n_rules) {
+    PricedItem *items = malloc((n ? n : 1) * sizeof(PricedItem));
+    if (!items) return -1;
+    if (!pe->cache) pe->cache = calloc(QUOTE_CACHE_SLOTS, sizeof(QuoteCacheEntry));
+    if (!pe->cache) {
+        free(items);
+        return -1;
+    }
+    size_t kept = 0;
+    for (size_t r = 0; r < n_rules && kept < PRICE_MAX_RULES; ++r)
+        if (price_rule_valid(&rules[r])) pe->rules[kept++] = rules[r];
+    n_rules = pe->rule_count = kept;
+
+    kept = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (menu[i].price_cents < 0 || menu[i].price_cents > PRICE_MAX_CENTS) continue;
+        PricedItem *p = &items[kept++];
+        p->item = menu[i];
+        p->tax_bp = TAX_RATE_BP;
+        p->happy_rules = 0;
+        int specific = 0;               /* a category's own rate beats a catch-all one */
+        for (size_t r = 0; r < n_rules; ++r) {
+            const PriceRule *rule = &pe->rules[r];
+            int in_category = rule->category[0] == '\0' ||
+                              pricing_same_category(rule->category, p->item.category);
+            if (rule->kind == PRICE_RULE_TAX && in_category && !specific) {
+                p->tax_bp = rule->rate_bp;
+                specific = rule->category[0] != '\0';
+            } else if (rule->kind == PRICE_RULE_HAPPY_HOUR &&
+                       (rule->item_id ? rule->item_id == p->item.id : in_category)) {
+                p->happy_rules |= (uint64_t)1 << r;
+            }
+        }
+    }
+    qsort(items, kept, sizeof(PricedItem), compare_priced_items);
+    free(pe->items);
+    pe->items = items;
+    pe->item_count = kept;
+    pe->generation++;
+    if (pe->generation == 0) pe->generation = 1;
+    pe->happy_minute = -1;
+    return 0;
+}
+
+void pricing_free(PricingEngine *pe) {
+    free(pe->items);
+    free(pe->cache);
+    memset(pe, 0, sizeof(*pe));
+}
+
+/* happy-hour rules in force at `when` (recomputed once a minute) */
+static uint64_t pricing_happy_active(PricingEngine *pe, time_t when) {
+    int64_t minute = (int64_t)when / 60;
+    if (minute == pe->happy_minute) return pe->happy_active;
+    struct tm *tm_info = localtime(&when);
+    int now = tm_info ? tm_info->tm_hour * 60 + tm_info->tm_min : 0;
+    int day = tm_info ? tm_info->tm_wday : 0;
+    uint64_t active = 0;
+    for (size_t r = 0; r < pe->rule_count; ++r) {
+        const PriceRule *rule = &pe->rules[r];
+        if (rule->kind != PRICE_RULE_HAPPY_HOUR) continue;
+        /* a window that wraps midnight belongs to the day it starts on */
+        int wraps = rule->start_minute > rule->end_minute;
+        int start_day = wraps && now < rule->end_minute ? (day + 6) % 7 : day;
+        int in_window = wraps ? now >= rule->start_minute || now < rule->end_minute
+                              : now >= rule->start_minute && now < rule->end_minute;
+        if (in_window && (rule->days & (1 << start_day))) active |= (uint64_t)1 << r;
+    }
+    pe->happy_minute = minute;
+    pe->happy_active = active;
+    return active;
+}
+
+/*
+ * Apply combo rule `rule` to the sorted lines as often as it fits, taking
+ * units from left[] and adding its discount to disc[]. Returns the discount.
+ */
+static int64_t pricing_apply_combo(const PriceRule *rule, int n, const int *item_id, const int64_t *unit,
+                                   int *left, int64_t *disc) {
+    int64_t value[PRICE_COMBO_MAX], share[PRICE_COMBO_MAX], rem[PRICE_COMBO_MAX];
+    int64_t times = -1, combo_value = 0;
+    int comps = 0;
+    for (int c = 0; c < PRICE_COMBO_MAX; ++c) {
+        value[c] = 0;
+        if (rule->combo_item[c] == 0 || rule->combo_qty[c] <= 0) continue;
+        int64_t have = 0, price = -1;
+        for (int k = 0; k < n; ++k)
+            if (item_id[k] == rule->combo_item[c]) {
+                have += left[k];
+                price = unit[k];
+            }
+        if (price < 0) return 0;
+        int64_t fits = have / rule->combo_qty[c];
+        if (times < 0 || fits < times) times = fits;
+        value[c] = price * rule->combo_qty[c];
+        combo_value += value[c];
+        comps++;
+    }
+    if (comps == 0 || times <= 0 || combo_value == 0) return 0;
+
+    /* split one combo's discount by value; the largest remainders take the odd cents */
+    int64_t d = rule->amount_cents < combo_value ? rule->amount_cents : combo_value;
+    int64_t given = 0;
+    for (int c = 0; c < PRICE_COMBO_MAX; ++c) {
+        share[c] = value[c] ? d * value[c] / combo_value : 0;
+        rem[c] = value[c] ? d * value[c] % combo_value : -1;
+        given += share[c];
+    }
+    for (; given < d; ++given) {
+        int best = 0;
+        for (int c = 1; c < PRICE_COMBO_MAX; ++c) if (rem[c] > rem[best]) best = c;
+        share[best]++;
+        rem[best] = -1;
+    }
+
+    for (int c = 0; c < PRICE_COMBO_MAX; ++c) {
+        if (value[c] == 0) continue;
+        int64_t units = (int64_t)rule->combo_qty[c] * times;
+        int64_t owed = share[c] * times;
+        /* every line of one item has the same price and tax rate, so any split among them is equal */
+        for (int k = 0; k < n && units > 0; ++k) {
+            if (item_id[k] != rule->combo_item[c] || left[k] == 0) continue;
+            int64_t take = left[k] < units ? left[k] : units;
+            int64_t part = owed < unit[k] * take ? owed : unit[k] * take;
+            left[k] -= (int)take;
+            units -= take;
+            disc[k] += part;
+            owed -= part;
+        }
+    }
+    return d * times;
+}
+
+/*
+ * Price every line of `order` as of `when`: fills list_cents, unit_cents and
+ * discount_cents of each line and the order's totals. Returns -1 if a line
+ * is not on the menu or its quantity is out of range.
+ */
+int pricing_quote(PricingEngine *pe, Order *order, time_t when) {
+    int n = order->num_items;
+    if (n <= 0 || n > MAX_ITEMS_PER_ORDER) return -1;
+
+    int perm[MAX_ITEMS_PER_ORDER], item_id[MAX_ITEMS_PER_ORDER], qty[MAX_ITEMS_PER_ORDER];
+    for (int i = 0; i < n; ++i) {
+        int j = i;
+        const OrderItem *oi = &order->items[i];
+        if (oi->qty <= 0 || oi->qty > PRICE_MAX_QTY) return -1;
+        while (j > 0 && (item_id[j - 1] > oi->item_id ||
+                         (item_id[j - 1] == oi->item_id && qty[j - 1] > oi->qty))) {
+            perm[j] = perm[j - 1];
+            item_id[j] = item_id[j - 1];
+            qty[j] = qty[j - 1];
+            j--;
+        }
+        perm[j] = i;
+        item_id[j] = oi->item_id;
+        qty[j] = oi->qty;
+    }
+
+    uint64_t active = pricing_happy_active(pe, when);
+    uint64_t hash = 14695981039346656037ull ^ active;   /* FNV-1a over the sorted basket */
+    for (int k = 0; k < n; ++k) {
+        hash = (hash ^ (uint32_t)item_id[k]) * 1099511628211ull;
+        hash = (hash ^ (uint32_t)qty[k]) * 1099511628211ull;
+    }
+    QuoteCacheEntry *e = pe->cache && n <= QUOTE_CACHE_LINES ? &pe->cache[hash & (QUOTE_CACHE_SLOTS - 1)] : NULL;
+    int64_t list[MAX_ITEMS_PER_ORDER], unit[MAX_ITEMS_PER_ORDER], disc[MAX_ITEMS_PER_ORDER];
+    int64_t subtotal = 0, discount = 0, tax = 0;
+
+    int hit = e && e->generation == pe->generation && e->hash == hash && e->lines == n &&
+              e->happy_active == active && memcmp(e->item_id, item_id, n * sizeof(int)) == 0 &&
+              memcmp(e->qty, qty, n * sizeof(int)) == 0;
+    if (hit) {
+        pe->hits++;
+        memcpy(list, e->list, n * sizeof(int64_t));
+        memcpy(unit, e->unit, n * sizeof(int64_t));
+        memcpy(disc, e->discount, n * sizeof(int64_t));
+        subtotal = e->subtotal;
+        discount = e->discount_total;
+        tax = e->tax;
+    } else {
+        pe->misses++;
+        int32_t rate[MAX_ITEMS_PER_ORDER];
+        int left[MAX_ITEMS_PER_ORDER];
+        for (int k = 0; k < n; ++k) {
+            const PricedItem *p = pricing_find(pe, item_id[k]);
+            if (!p) return -1;
+            int64_t off = 0;
+            uint64_t happy = p->happy_rules & active;
+            for (size_t r = 0; happy; ++r, happy >>= 1)
+                if (happy & 1) {
+                    int64_t d = pricing_percent(p->item.price_cents, pe->rules[r].rate_bp);
+                    if (d > off) off = d;
+                }
+            list[k] = p->item.price_cents;
+            unit[k] = list[k] - off;
+            disc[k] = 0;
+            rate[k] = p->tax_bp;
+            left[k] = qty[k];
+            subtotal += unit[k] * qty[k];
+        }
+        for (size_t r = 0; r < pe->rule_count; ++r)
+            if (pe->rules[r].kind == PRICE_RULE_COMBO)
+                discount += pricing_apply_combo(&pe->rules[r], n, item_id, unit, left, disc);
+
+        /* one rounding per tax rate: lines at the same rate are summed first */
+        for (int k = 0; k < n; ++k) {
+            int first = 1;
+            for (int j = 0; j < k && first; ++j) first = rate[j] != rate[k];
+            if (!first) continue;
+            int64_t base = 0;
+            for (int j = k; j < n; ++j)
+                if (rate[j] == rate[k]) base += unit[j] * qty[j] - disc[j];
+            tax += pricing_percent(base, rate[k]);
+        }
+
+        if (e) {
+            e->hash = hash;
+            e->generation = pe->generation;
+            e->lines = n;
+            e->happy_active = active;
+            memcpy(e->item_id, item_id, n * sizeof(int));
+            memcpy(e->qty, qty, n * sizeof(int));
+            memcpy(e->list, list, n * sizeof(int64_t));
+            memcpy(e->unit, unit, n * sizeof(int64_t));
+            memcpy(e->discount, disc, n * sizeof(int64_t));
+            e->subtotal = subtotal;
+            e->discount_total = discount;
+            e->tax = tax;
+        }
+    }
+
+    for (int k = 0; k < n; ++k) {
+        OrderItem *oi = &order->items[perm[k]];
+        oi->list_cents = list[k];
+        oi->unit_cents = unit[k];
+        oi->discount_cents = disc[k];
+    }
+    order->subtotal_cents = subtotal;
+    order->discount_cents = discount;
+    order->tax_cents = tax;
+    order->total_cents = subtotal - discount + tax;
+    return 0;
+}
+
+/* pricing.dat as an array (NULL, count 0 when there are no rules; count -1 if unreadable) */
+PriceRule* load_price_rules(size_t *count) {
+    int64_t n = datafile_record_count(&PRICE_RULE_SPEC);
+    if (n < 0) {
+        *count = (size_t)-1;
+        return NULL;
+    }
+    PriceRule *rules = datafile_load(&PRICE_RULE_SPEC, count);
+    for (size_t i = 0; i < *count; ++i) {
+        rules[i].name[MAX_NAME_LEN - 1] = '\0';
+        rules[i].category[MAX_CATEGORY_LEN - 1] = '\0';
+    }
+    return rules;
+}
+
+/* the engine used for real orders, reloaded whenever menu.dat or pricing.dat changes */
+PricingEngine* pricing_shared(void) {
+    static PricingEngine pe;
+    uint64_t menu_size = 0, menu_mtime = 0, rules_size = 0, rules_mtime = 0;
+    rs_stamp(MENU_FILE, &menu_size, &menu_mtime);
+    rs_stamp(PRICING_FILE, &rules_size, &rules_mtime);
+    if (pe.generation != 0 && menu_size == pe.menu_size && menu_mtime == pe.menu_mtime &&
+        rules_size == pe.rules_size && rules_mtime == pe.rules_mtime)
+        return &pe;
+
+    size_t n_items, n_rules;
+    MenuItem *items = load_all_menu_items(&n_items);
+    PriceRule *rules = load_price_rules(&n_rules);
+    int ok = n_rules != (size_t)-1 && pricing_load(&pe, items, items ? n_items : 0, rules, rules ? n_rules : 0) == 0;
+    free(items);
+    free(rules);
+    if (!ok) {
+        printf("Error: menu prices or pricing rules could not be loaded.\n");
+        return NULL;
+    }
+    pe.menu_size = menu_size;
+    pe.menu_mtime = menu_mtime;
+    pe.rules_size = rules_size;
+    pe.rules_mtime = rules_mtime;
+    return &pe;
+}
+
+/* double -> cents, rounded to the nearest cent; nonsense amounts become 0 */
+static int64_t cents_from_double(double v) {
+    if (!(v >= 0.0)) return 0;
+    if (v > (double)PRICE_MAX_CENTS * 1000.0) v = (double)PRICE_MAX_CENTS * 1000.0;
+    return (int64_t)(v * 100.0 + 0.5);
+}
+
+static void convert_legacy_menu(const void *from, void *to) {
+    const LegacyMenuItem *in = from;
+    MenuItem *out = to;
+    memset(out, 0, sizeof(*out));
+    out->id = in->id;
+    memcpy(out->name, in->name, MAX_NAME_LEN);
+    memcpy(out->category, in->category, MAX_CATEGORY_LEN);
+    out->available = in->available;
+    out->price_cents = cents_from_double(in->price);
+}
+
+/* the stored totals are kept as they were charged, not re-priced */
+static void convert_legacy_order(const void *from, void *to) {
+    const LegacyOrder *in = from;
+    Order *out = to;
+    memset(out, 0, sizeof(*out));
+    out->order_id = in->order_id;
+    memcpy(out->customer_name, in->customer_name, MAX_NAME_LEN);
+    out->num_items = in->num_items < 0 ? 0 :
+                     in->num_items > MAX_ITEMS_PER_ORDER ? MAX_ITEMS_PER_ORDER : in->num_items;
+    for (int i = 0; i < out->num_items; ++i) {
+        out->items[i].item_id = in->items[i].item_id;
+        out->items[i].qty = in->items[i].qty;
+        out->items[i].list_cents = out->items[i].unit_cents = cents_from_double(in->items[i].item_price);
+        memcpy(out->items[i].item_name, in->items[i].item_name, MAX_NAME_LEN);
+    }
+    out->subtotal_cents = cents_from_double(in->subtotal);
+    out->tax_cents = cents_from_double(in->tax);
+    out->total_cents = cents_from_double(in->total);
+    out->timestamp = in->timestamp;
+}
+
+/* rewrite one double-priced file as cents, a block at a time, then swap it in */
+static int migrate_price_file(const DataFileSpec *legacy, const DataFileSpec *spec, const char *index_path,
+                              void (*convert)(const void *, void *)) {
+    int kind = datafile_peek_kind(spec->path);
+    if (kind == 0 || kind == (int)spec->kind) return 0;
+    if (kind < 0) {
+        /* headerless: the old loader adds the header first */
+        size_t count;
+        free(datafile_load(legacy, &count));
+    }
+    int64_t n = datafile_record_count(legacy);
+    if (n < 0) return -1;
+
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.cents", spec->path);
+    DataFileSpec out = *spec;
+    out.path = tmp_path;
+    remove(tmp_path);
+    int ok = datafile_save(&out, NULL, 0) == 0;
+    unsigned char *converted = NULL;
+    for (uint64_t next = 0; ok && next < (uint64_t)n;) {
+        uint64_t first;
+        size_t count;
+        unsigned char *block = datafile_read_block(legacy, next, &first, &count);
+        unsigned char *grown = block ? realloc(converted, count * spec->record_size) : NULL;
+        ok = grown != NULL;
+        if (ok) {
+            converted = grown;
+            for (size_t i = 0; i < count; ++i)
+                convert(block + i * legacy->record_size, converted + i * spec->record_size);
+            ok = datafile_append(&out, converted, count) == 0;
+            next = first + count;
+        }
+        free(block);
+    }
+    free(converted);
+    if (!ok) {
+        remove(tmp_path);
+        return -1;
+    }
+#ifdef _WIN32
+    remove(spec->path);                 /* rename() does not replace on Windows */
+#endif
+    if (rename(tmp_path, spec->path) != 0) return -1;
+    remove(index_path);
+    printf("Note: converted %s prices to whole cents (%lld records).\n", spec->label, (long long)n);
+    return 0;
+}
+
+/*
+ * One-time upgrade of menu.dat and orders.dat from double prices to cents.
+ * The customer index also stored doubles; it is dropped and rebuilt from
+ * orders.dat the next time it is used.
+ */
+int migrate_price_files(void) {
+    int menu_lock = lock_file(MENU_LOCK_FILE);
+    int order_lock = lock_file(ORDER_LOCK_FILE);
+    int rc = 0;
+    if (migrate_price_file(&LEGACY_MENU_SPEC, &MENU_SPEC, MENU_INDEX_FILE, convert_legacy_menu) != 0 ||
+        migrate_price_file(&LEGACY_ORDER_SPEC, &ORDER_SPEC, ORDER_INDEX_FILE, convert_legacy_order) != 0)
+        rc = -1;
+    if (datafile_peek_kind(CUSTOMER_INDEX_FILE) == DATAFILE_KIND_CUSTOMER_INDEX) {
+        remove(CUSTOMER_INDEX_FILE);
+        remove(CUSTOMER_LINK_FILE);
+    }
+    unlock_file(order_lock);
+    unlock_file(menu_lock);
+    return rc;
+}
+
+/*
+ * Time the engine on `baskets` lunch-rush baskets: most are repeats of a
+ * few hundred favourites, the rest random. The same baskets are priced a
+ * second time without the quote cache and every total must agree.
+ */
+void bench_pricing(long baskets) {
+    static const char *categories[] = { "Burgers", "Sides", "Drinks", "Salads", "Desserts", "Coffee" };
+    MenuItem menu[48];
+    memset(menu, 0, sizeof(menu));
+    for (int i = 0; i < 48; ++i) {
+        menu[i].id = i + 1;
+        snprintf(menu[i].name, sizeof(menu[i].name), "Item %d", i + 1);
+        snprintf(menu[i].category, sizeof(menu[i].category), "%s", categories[i % 6]);
+        menu[i].available = 1;
+        menu[i].price_cents = 149 + (int64_t)(i * 7919 % 2350);
+    }
+    PriceRule rules[6];
+    memset(rules, 0, sizeof(rules));
+    rules[0].kind = PRICE_RULE_TAX;
+    snprintf(rules[0].category, sizeof(rules[0].category), "Drinks");
+    rules[0].rate_bp = 1000;
+    rules[1].kind = PRICE_RULE_TAX;
+    snprintf(rules[1].category, sizeof(rules[1].category), "Coffee");
+    rules[1].rate_bp = 825;
+    rules[2].kind = PRICE_RULE_COMBO;
+    rules[2].combo_item[0] = 1;         /* burger + side + drink */
+    rules[2].combo_item[1] = 2;
+    rules[2].combo_item[2] = 3;
+    rules[2].combo_qty[0] = rules[2].combo_qty[1] = rules[2].combo_qty[2] = 1;
+    rules[2].amount_cents = 250;
+    rules[3].kind = PRICE_RULE_COMBO;
+    rules[3].combo_item[0] = 6;         /* two coffees and a dessert */
+    rules[3].combo_item[1] = 5;
+    rules[3].combo_qty[0] = 2;
+    rules[3].combo_qty[1] = 1;
+    rules[3].amount_cents = 199;
+    rules[4].kind = PRICE_RULE_HAPPY_HOUR;
+    snprintf(rules[4].category, sizeof(rules[4].category), "Drinks");
+    rules[4].rate_bp = 2000;
+    rules[4].end_minute = 24 * 60;      /* all day, so every run sees the same prices */
+    rules[4].days = 0x7f;
+    rules[5] = rules[4];
+    rules[5].category[0] = '\0';
+    rules[5].item_id = 7;
+    rules[5].rate_bp = 1250;
+
+    PricingEngine pe;
+    memset(&pe, 0, sizeof(pe));
+    Order *favourites = calloc(256, sizeof(Order));
+    Order *scratch = calloc(1, sizeof(Order));
+    if (!favourites || !scratch || pricing_load(&pe, menu, 48, rules, 6) != 0) {
+        printf("Out of memory.\n");
+        free(favourites);
+        free(scratch);
+        return;
+    }
+    uint64_t rng = 88172645463325252ull;
+    for (int f = 0; f < 256; ++f) {
+        favourites[f].num_items = 1 + (int)(f % 5);
+        for (int k = 0; k < favourites[f].num_items; ++k) {
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            favourites[f].items[k].item_id = 1 + (int)(rng % 48);
+            favourites[f].items[k].qty = 1 + (int)((rng >> 32) % 3);
+        }
+    }
+
+    time_t when = time(NULL);
+    int64_t sum[2] = { 0, 0 };
+    double seconds[2], hit_rate = 0.0;
+    QuoteCacheEntry *cache = pe.cache;
+    for (int pass = 0; pass < 2; ++pass) {
+        pe.cache = pass == 0 ? cache : NULL;
+        rng = 2463534242ull;
+        clock_t start = clock();
+        for (long b = 0; b < baskets; ++b) {
+            rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+            Order *o;
+            if (rng % 10 < 8) {
+                o = &favourites[(rng >> 8) % 256];
+            } else {
+                o = scratch;
+                o->num_items = 1 + (int)((rng >> 8) % 6);
+                for (int k = 0; k < o->num_items; ++k) {
+                    rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+                    o->items[k].item_id = 1 + (int)(rng % 48);
+                    o->items[k].qty = 1 + (int)((rng >> 32) % 4);
+                }
+            }
+            if (pricing_quote(&pe, o, when) != 0) {
+                printf("Basket %ld could not be priced.\n", b);
+                break;
+            }
+            sum[pass] += o->total_cents * (int64_t)(b % 7 + 1) + o->discount_cents;
+        }
+        seconds[pass] = (double)(clock() - start) / CLOCKS_PER_SEC;
+        if (pass == 0) hit_rate = 100.0 * (double)pe.hits / (double)(pe.hits + pe.misses);
+    }
+    pe.cache = cache;
+
+    printf("Priced %ld baskets in %.3f s (%.0f ns each), %.1f%% from the quote cache\n", baskets, seconds[0],
+           seconds[0] * 1e9 / (double)baskets, hit_rate);
+    printf("Without the cache: %.3f s (%.0f ns each)\n", seconds[1], seconds[1] * 1e9 / (double)baskets);
+    printf("Cached and fresh quotes %s\n", sum[0] == sum[1] ? "agree to the cent" : "DIFFER");
+    free(favourites);
+    free(scratch);
+    pricing_free(&pe);
+}
+
+/* ---------- Customer order index ---------- */
+
+/*
+ * customers.idx is a power-of-two open-addressing table of CustomerSlot; a
+ * slot holds the customer's order count, lifetime spend and latest order.
+ * customer_orders.dat runs parallel to orders.dat: link i names the previous
+ * order of whoever placed order i, so the newest orders of one customer are
+ * a short walk back from the slot. Both files are derived from orders.dat
+ * and are rebuilt from it when missing, damaged or too far behind.
+ */
+
+/* lower-case, trim and collapse blank runs so "  Ann   LEE " finds "ann lee" */
+void normalize_customer_name(const char *name, char key[MAX_NAME_LEN]) {
+    size_t n = 0;
+    int blank = 0;
+    memset(key, 0, MAX_NAME_LEN);
+    for (size_t i = 0; i < MAX_NAME_LEN && name[i]; ++i) {
+        unsigned char c = (unsigned char)name[i];
+        if (isspace(c)) {
+            blank = n > 0;
+            continue;
+        }
+        if (n + (blank ? 2 : 1) > MAX_NAME_LEN - 1) break;
+        if (blank) key[n++] = ' ';
+        blank = 0;
+        key[n++] = (char)tolower(c);
+    }
+}
+
+static uint32_t customer_hash(const char *key) {
+    uint32_t h = 2166136261u;           /* FNV-1a */
+    for (size_t i = 0; i < MAX_NAME_LEN && key[i]; ++i) {
+        h ^= (unsigned char)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/*
+ * Slot of `key` in an in-memory table, or the free slot where it belongs.
+ * NULL if that is more than CUSTOMER_MAX_PROBE slots from its home, where
+ * customer_find() gives up: the table must grow first.
+ */
+static CustomerSlot* customer_probe(CustomerSlot *slots, size_t capacity, const char *key) {
+    size_t i = customer_hash(key) & (capacity - 1);
+    for (int probe = 0; probe < CUSTOMER_MAX_PROBE; ++probe, i = (i + 1) & (capacity - 1))
+        if (slots[i].last_order == 0 || strncmp(slots[i].key, key, MAX_NAME_LEN) == 0) return &slots[i];
+    return NULL;
+}
+
+/* copy into a table of *new_capacity slots, doubled again until every key is within reach */
+static CustomerSlot* customer_table_resize(const CustomerSlot *slots, size_t capacity, size_t *new_capacity) {
+    while (*new_capacity <= CUSTOMER_INDEX_MAX_SLOTS) {
+        CustomerSlot *grown = calloc(*new_capacity, sizeof(CustomerSlot));
+        if (!grown) return NULL;
+        size_t i = 0;
+        for (; i < capacity; ++i) {
+            if (slots[i].last_order == 0) continue;
+            CustomerSlot *to = customer_probe(grown, *new_capacity, slots[i].key);
+            if (!to) break;
+            *to = slots[i];
+        }
+        if (i == capacity) return grown;
+        free(grown);
+        *new_capacity *= 2;
+    }
+    return NULL;
+}
+
+#ifndef _WIN32
+#define HELD_LOCKS_MAX 8
+
+/* locks this process holds: flock() on a second descriptor would wait for the first forever */
+static struct {
+    char path[64];
+    int fd;
+    int depth;                          /* 0 = entry unused */
+} held_locks[HELD_LOCKS_MAX];
+#endif
+
+/*
+ * Exclusive lock on a lock file, held until the matching unlock_file()
+ * (no-op on Windows). Taking a lock this process already holds just nests.
+ */
+static int lock_file(const char *path) {
+#ifdef _WIN32
+    (void)path;
+    return -1;
+#else
+    int spare = -1;
+    for (int i = 0; i < HELD_LOCKS_MAX; ++i) {
+        if (held_locks[i].depth > 0 && strcmp(held_locks[i].path, path) == 0) {
+            held_locks[i].depth++;
+            return held_locks[i].fd;
+        }
+        if (held_locks[i].depth == 0 && spare < 0) spare = i;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd >= 0) flock(fd, LOCK_EX);
+    if (fd >= 0 && spare >= 0 && strlen(path) < sizeof(held_locks[spare].path)) {
+        strcpy(held_locks[spare].path, path);
+        held_locks[spare].fd = fd;
+        held_locks[spare].depth = 1;
+    }
+    return fd;
+#endif
+}
+
+static void unlock_file(int fd) {
+#ifdef _WIN32
+    (void)fd;
+#else
+    if (fd < 0) return;
+    for (int i = 0; i < HELD_LOCKS_MAX; ++i)
+        if (held_locks[i].depth > 0 && held_locks[i].fd == fd && --held_locks[i].depth > 0) return;
+    flock(fd, LOCK_UN);
+    close(fd);
+#endif
+}
+
+/* only one terminal at a time appends orders or maintains the index */
+static int customer_index_lock(void) {
+    return lock_file(ORDER_LOCK_FILE);
+}
+
+static void customer_index_unlock(int fd) {
+    unlock_file(fd);
+}
+
+/* rewrite both index files from the whole of orders.dat (returns 0 on success) */
+static int customer_index_rebuild(void) {
+    size_t n;
+    Order *orders = load_all_orders(&n);
+    if (!orders && datafile_record_count(&ORDER_SPEC) != 0) return -1;
+
+    size_t capacity = CUSTOMER_INDEX_MIN_SLOTS, used = 0;
+    CustomerSlot *slots = calloc(capacity, sizeof(CustomerSlot));
+    CustomerOrderLink *links = calloc(n ? n : 1, sizeof(CustomerOrderLink));
+    int ok = slots && links;
+    for (size_t i = 0; ok && i < n; ++i) {
+        char key[MAX_NAME_LEN];
+        normalize_customer_name(orders[i].customer_name, key);
+        /* same probe limit as customer_find(), or the customer could not be found again */
+        CustomerSlot *slot = 2 * (used + 1) > capacity ? NULL : customer_probe(slots, capacity, key);
+        while (!slot) {
+            size_t new_capacity = 2 * capacity;
+            CustomerSlot *grown = customer_table_resize(slots, capacity, &new_capacity);
+            if (!grown) break;
+            free(slots);
+            slots = grown;
+            capacity = new_capacity;
+            slot = customer_probe(slots, capacity, key);
+        }
+        if (!slot) { ok = 0; break; }
+        if (slot->last_order == 0) {
+            memcpy(slot->key, key, MAX_NAME_LEN);
+            used++;
+        }
+        links[i].prev_order = slot->last_order;
+        slot->last_order = i + 1;
+        slot->order_count++;
+        slot->total_spent_cents += orders[i].total_cents;
+    }
+    /*
+     * Drop the links first: until both files are written again the index
+     * reads as missing, so a crash in between just causes another rebuild.
+     */
+    remove(CUSTOMER_LINK_FILE);
+    ok = ok && datafile_save(&CUSTOMER_INDEX_SPEC, slots, capacity) == 0 &&
+         datafile_save(&CUSTOMER_LINK_SPEC, links, n) == 0;
+    free(orders);
+    free(slots);
+    free(links);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Look `key` up in customers.idx, reading one block at a time. Returns 1 if
+ * found, 0 if not (*pos is then the free slot for it), -1 on a read error,
+ * -2 if the probe ran past max_probe slots and the table should grow.
+ * Writers pass CUSTOMER_MAX_PROBE; readers pass no limit, since an index
+ * written by an older version may hold keys further out.
+ */
+static int customer_find(const char *key, CustomerSlot *slot, uint64_t *pos, uint64_t max_probe) {
+    int64_t capacity = datafile_record_count(&CUSTOMER_INDEX_SPEC);
+    if (capacity <= 0 || (capacity & (capacity - 1)) != 0) return -1;
+    uint64_t mask = (uint64_t)capacity - 1;
+    uint64_t i = customer_hash(key) & mask;
+    CustomerSlot *block = NULL;
+    uint64_t first = 0;
+    size_t count = 0;
+    int rc = -2;
+    for (uint64_t probe = 0; probe < max_probe && probe <= mask; ++probe, i = (i + 1) & mask) {
+        if (!block || i < first || i >= first + count) {
+            free(block);
+            block = datafile_read_block(&CUSTOMER_INDEX_SPEC, i, &first, &count);
+            if (!block) { rc = -1; break; }
+        }
+        const CustomerSlot *s = &block[i - first];
+        if (s->last_order == 0 || strncmp(s->key, key, MAX_NAME_LEN) == 0) {
+            *slot = *s;
+            *pos = i;
+            rc = s->last_order != 0;
+            break;
+        }
+    }
+    free(block);
+    return rc;
+}
+
+static int customer_index_grow(void) {
+    size_t capacity;
+    CustomerSlot *slots = datafile_load(&CUSTOMER_INDEX_SPEC, &capacity);
+    if (!slots) return -1;
+    size_t new_capacity = 2 * capacity;
+    CustomerSlot *grown = customer_table_resize(slots, capacity, &new_capacity);
+    free(slots);
+    if (!grown) return -1;
+    int rc = datafile_save(&CUSTOMER_INDEX_SPEC, grown, new_capacity);
+    free(grown);
+    return rc;
+}
+
+/*
+ * File order `i` under its customer. The link is appended before the slot
+ * is rewritten. With have_link set nothing is written: the order's link
+ * exists and the call fails unless its slot already counts it, since after
+ * a crash between the two writes the whole batch may be missing.
+ */
+static int customer_index_add(uint64_t i, const Order *order, int have_link) {
+    char key[MAX_NAME_LEN];
+    normalize_customer_name(order->customer_name, key);
+    CustomerSlot slot;
+    uint64_t pos;
+    int found = customer_find(key, &slot, &pos, CUSTOMER_MAX_PROBE);
+    if (found == -2) {
+        if (customer_index_grow() != 0) return -1;
+        found = customer_find(key, &slot, &pos, CUSTOMER_MAX_PROBE);
+    }
+    if (found < 0) return -1;
+    if (have_link) return found && slot.last_order >= i + 1 ? 0 : -1;
+    if (!found) {
+        memset(&slot, 0, sizeof(slot));
+        memcpy(slot.key, key, MAX_NAME_LEN);
+    }
+    CustomerOrderLink link = { slot.last_order };
+    if (datafile_append(&CUSTOMER_LINK_SPEC, &link, 1) != 0) return -1;
+    slot.last_order = i + 1;
+    slot.order_count++;
+    slot.total_spent_cents += order->total_cents;
+    return datafile_write_record(&CUSTOMER_INDEX_SPEC, pos, &slot);
+}
+
+typedef struct {
+    uint64_t first;
+    size_t count;
+    CustomerSlot *slots;
+    int dirty;
+} CustomerBlock;
+
+/* like customer_find(), but through blocks kept in memory for a whole batch */
+static int customer_find_cached(CustomerBlock *cache, size_t *n_cache, uint64_t capacity,
+                                const char *key, CustomerSlot **slot, size_t *block) {
+    uint64_t mask = capacity - 1;
+    uint64_t i = customer_hash(key) & mask;
+    for (int probe = 0; probe < CUSTOMER_MAX_PROBE; ++probe, i = (i + 1) & mask) {
+        size_t b = 0;
+        while (b < *n_cache && (i < cache[b].first || i >= cache[b].first + cache[b].count)) b++;
+        if (b == *n_cache) {
+            cache[b].slots = datafile_read_block(&CUSTOMER_INDEX_SPEC, i, &cache[b].first, &cache[b].count);
+            if (!cache[b].slots) return -1;
+            cache[b].dirty = 0;
+            (*n_cache)++;
+        }
+        CustomerSlot *s = &cache[b].slots[i - cache[b].first];
+        if (s->last_order == 0 || strncmp(s->key, key, MAX_NAME_LEN) == 0) {
+            *slot = s;
+            *block = b;
+            return s->last_order != 0;
+        }
+    }
+    return -2;
+}
+
+/*
+ * File orders first..first+n-1 under their customers with one append to
+ * customer_orders.dat and one write per changed index block. The block
+ * holding the last order's slot goes last, so a crash part way leaves that
+ * slot behind its link, which the next sync detects.
+ */
+static int customer_index_add_batch(uint64_t first, const Order *orders, size_t n) {
+    if (n == 1) return customer_index_add(first, orders, 0);
+    CustomerOrderLink *links = malloc(n * sizeof(CustomerOrderLink));
+    CustomerBlock *cache = calloc(2 * n, sizeof(CustomerBlock));   /* a probe spans two blocks at most */
+    size_t n_cache = 0, last_block = 0;
+    int rc = links && cache ? 0 : -1;
+    for (int attempt = 0; rc == 0 && attempt < 2; ++attempt) {
+        int64_t capacity = datafile_record_count(&CUSTOMER_INDEX_SPEC);
+        if (capacity <= 0 || (capacity & (capacity - 1)) != 0) { rc = -1; break; }
+        for (size_t k = 0; rc == 0 && k < n; ++k) {
+            char key[MAX_NAME_LEN];
+            CustomerSlot *slot;
+            normalize_customer_name(orders[k].customer_name, key);
+            int found = customer_find_cached(cache, &n_cache, (uint64_t)capacity, key, &slot, &last_block);
+            if (found < 0) { rc = found; break; }
+            if (!found) memcpy(slot->key, key, MAX_NAME_LEN);
+            links[k].prev_order = slot->last_order;
+            slot->last_order = first + k + 1;
+            slot->order_count++;
+            slot->total_spent_cents += orders[k].total_cents;
+            cache[last_block].dirty = 1;
+        }
+        if (rc != -2) break;
+        /* crowded run: grow the table and start over with nothing written */
+        while (n_cache > 0) free(cache[--n_cache].slots);
+        rc = customer_index_grow() == 0 ? 0 : -1;
+        if (rc == 0 && attempt == 1) rc = -1;
+    }
+    if (rc == 0) rc = datafile_append(&CUSTOMER_LINK_SPEC, links, n);
+    for (size_t b = 0; rc == 0 && b < n_cache; ++b)
+        if (b != last_block && cache[b].dirty)
+            rc = datafile_write_block(&CUSTOMER_INDEX_SPEC, cache[b].first, cache[b].slots, cache[b].count);
+    if (rc == 0)
+        rc = datafile_write_block(&CUSTOMER_INDEX_SPEC, cache[last_block].first, cache[last_block].slots,
+                                  cache[last_block].count);
+    while (n_cache > 0) free(cache[--n_cache].slots);
+    free(cache);
+    free(links);
+    return rc;
+}
+
+/*
+ * Bring the index up to date with orders.dat: a few new orders are added
+ * one at a time, anything else is rebuilt. `fresh` holds the last n_fresh
+ * orders of the file if the caller just appended them (saves reading them
+ * back). Call with the index locked.
+ */
+static int customer_index_sync(const Order *fresh, size_t n_fresh) {
+    int64_t n_orders = datafile_record_count(&ORDER_SPEC);
+    int64_t n_links = datafile_record_count(&CUSTOMER_LINK_SPEC);
+    int64_t capacity = datafile_record_count(&CUSTOMER_INDEX_SPEC);
+    if (n_orders == 0 && n_links == 0 && capacity > 0) return 0;
+    if (n_orders <= 0 || n_links <= 0 || capacity <= 0 || n_links > n_orders ||
+        n_orders - n_links > CUSTOMER_SYNC_BATCH + (int64_t)n_fresh)
+        return customer_index_rebuild();
+
+    /* the fresh orders still missing their links are added together */
+    int64_t first_fresh = n_orders - (int64_t)n_fresh;
+    int64_t batch = first_fresh > n_links ? first_fresh : n_links;
+    Order order;
+    for (int64_t i = n_links - 1; i < batch; ++i) {
+        if (i >= first_fresh) order = fresh[i - first_fresh];
+        else if (datafile_read_record(&ORDER_SPEC, (uint64_t)i, &order) != 0) return customer_index_rebuild();
+        /* the first one is only re-checked: its link may be all that was written */
+        if (customer_index_add((uint64_t)i, &order, i == n_links - 1) != 0)
+            return customer_index_rebuild();
+    }
+    if (batch < n_orders &&
+        customer_index_add_batch((uint64_t)batch, fresh + (batch - first_fresh), (size_t)(n_orders - batch)) != 0)
+        return customer_index_rebuild();
+    return 0;
+}
+
+/*
+ * Copy up to `max` of a customer's orders into `out`, newest first, and
+ * their index slot into `info` (zeroed for an unknown customer). Returns
+ * the number of orders copied, or -1 if the history cannot be read.
+ */
+int customer_recent_orders(const char *name, Order *out, int max, CustomerSlot *info) {
+    char key[MAX_NAME_LEN];
+    normalize_customer_name(name, key);
+    memset(info, 0, sizeof(*info));
+
+    INSTR_BEGIN(span, "customer_recent_orders");
+    int lock = customer_index_lock();
+    uint64_t pos;
+    int found = customer_index_sync(NULL, 0) == 0 ? customer_find(key, info, &pos, UINT64_MAX) : -1;
+    if (found == -1 && customer_index_rebuild() == 0) found = customer_find(key, info, &pos, UINT64_MAX);
+    if (found == 0) memset(info, 0, sizeof(*info));
+    int n = found < 0 ? -1 : 0;
+    uint64_t next = found > 0 ? info->last_order : 0;
+    while (n >= 0 && n < max && next != 0) {
+        CustomerOrderLink link;
+        if (datafile_read_record(&ORDER_SPEC, next - 1, &out[n]) != 0 ||
+            datafile_read_record(&CUSTOMER_LINK_SPEC, next - 1, &link) != 0) {
+            n = -1;
+            break;
+        }
+        INSTR_BYTES_READ(span, sizeof(Order) + sizeof(link));
+        sanitize_order(&out[n]);
+        n++;
+        next = link.prev_order;
+    }
+    customer_index_unlock(lock);
+    INSTR_END(span);
+    return n;
+}
+
+/* ---------- Server mode ---------- */
+
+#ifdef HAVE_EPOLL_SERVER
+
+/*
+ * One process serves every POS terminal over a UNIX socket. Each
+ * connection is a non-blocking socket in one epoll set; requests are
+ * lines (see the header comment). The menu is loaded once and reloaded
+ * when menu.dat changes; orders are priced and their stock reserved as
+ * they arrive, then every order received in one pass over the ready
+ * connections is written by a single append_orders() call before any of
+ * them is answered, so a busy server writes large batches and an idle one
+ * answers at once. A connection has at most one order in the batch; its
+ * later requests wait in its input buffer until that order is answered.
+ */
+
+typedef struct ServerConn {
+    int fd;                             /* -1 once closed; freed at the end of the pass */
+    int waiting;                        /* order in the batch: input paused until it is answered */
+    int queued;                         /* on the ready list */
+    int eof;                            /* peer has shut down its side */
+    int closing;                        /* close once the output is sent */
+    struct ServerConn *next;            /* ready list or closed list */
+    struct ServerConn *prev_open, *next_open;
+    uint32_t events;                    /* epoll interest currently registered */
+    size_t in_len;
+    char in[SERVER_LINE_MAX];
+    char *out;
+    size_t out_len, out_sent, out_cap;
+} ServerConn;
+
+typedef struct {
+    int epfd;
+    int listen_fd;
+    int accept_paused;                  /* out of descriptors: listener removed from epoll */
+    size_t connections;
+    ServerConn *open;                   /* every connection not yet closed */
+    MenuItem *menu;                     /* sorted by id */
+    size_t menu_count;
+    char *menu_reply;                   /* the whole "M" reply, built once per load */
+    size_t menu_reply_len;
+    struct stat menu_stat;
+    time_t menu_checked;
+    size_t pending;                     /* orders in the current batch */
+    Order *batch;
+    StockReservation *holds;
+    ServerConn **waiters;               /* NULL once the connection has gone */
+    ServerConn *ready;                  /* buffered requests left when the batch filled up */
+    ServerConn *closed;                 /* closed this pass, freed after it */
+    uint64_t orders_saved, batches;
+} Server;
+
+static volatile sig_atomic_t server_stop = 0;
+
+static void server_on_signal(int sig) {
+    (void)sig;
+    server_stop = 1;
+}
+
+static int compare_menu_ids(const void *a, const void *b) {
+    const MenuItem *x = a, *y = b;
+    return (x->id > y->id) - (x->id < y->id);
+}
+
+/* reload the menu if menu.dat changed; checked at most once a second */
+static void server_menu_refresh(Server *s) {
+    time_t now = time(NULL);
+    struct stat st;
+    if (s->menu_reply && now == s->menu_checked) return;
+    s->menu_checked = now;
+    if (stat(MENU_FILE, &st) != 0) memset(&st, 0, sizeof(st));
+    if (s->menu_reply && st.st_size == s->menu_stat.st_size &&
+        st.st_mtim.tv_sec == s->menu_stat.st_mtim.tv_sec &&
+        st.st_mtim.tv_nsec == s->menu_stat.st_mtim.tv_nsec)
+        return;
+
+    size_t count;
+    MenuItem *items = load_all_menu_items(&count);
+    if (!items && st.st_size > 0 && s->menu_reply) return;      /* keep serving the old menu */
+    if (items) qsort(items, count, sizeof(MenuItem), compare_menu_ids);
+    size_t cap = 256, len = 0;
+    char *reply = malloc(cap);
+    for (size_t i = 0; reply && i <= count; ++i) {
+        char line[160];
+        int n = i < count ? snprintf(line, sizeof(line), "%d|%.*s|%.*s|%.2f|%d\n", items[i].id,
+                                     MAX_NAME_LEN - 1, items[i].name, MAX_CATEGORY_LEN - 1,
+                                     items[i].category, money(items[i].price_cents), items[i].available)
+                          : snprintf(line, sizeof(line), ".\n");
+        size_t add = n < 0 ? 0 : (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1;
+        if (len + add > cap) {
+            char *grown = realloc(reply, 2 * cap + add);
+            if (!grown) {
+                free(reply);
+                reply = NULL;
+                break;
+            }
+            reply = grown;
+            cap = 2 * cap + add;
+        }
+        memcpy(reply + len, line, add);
+        len += add;
+    }
+    if (!reply) {
+        free(items);
+        return;
+    }
+    free(s->menu);
+    free(s->menu_reply);
+    s->menu = items;
+    s->menu_count = count;
+    s->menu_reply = reply;
+    s->menu_reply_len = len;
+    s->menu_stat = st;
+}
+
+static const MenuItem* server_menu_find(const Server *s, int id) {
+    MenuItem key;
+    key.id = id;
+    return s->menu ? bsearch(&key, s->menu, s->menu_count, sizeof(MenuItem), compare_menu_ids) : NULL;
+}
+
+static void server_set_events(Server *s, ServerConn *c) {
+    uint32_t want = (c->waiting || c->eof || c->closing ? 0 : EPOLLIN) |
+                    (c->out_sent < c->out_len ? EPOLLOUT : 0);
+    if (want == c->events) return;
+    struct epoll_event ev;
+    ev.events = want;
+    ev.data.ptr = c;
+    epoll_ctl(s->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+    c->events = want;
+}
+
+static void server_reply(ServerConn *c, const char *data, size_t len) {
+    if (c->out_len + len > c->out_cap) {
+        size_t cap = c->out_cap ? c->out_cap : 512;
+        while (cap < c->out_len + len) cap *= 2;
+        char *grown = realloc(c->out, cap);
+        if (!grown) {
+            c->closing = 1;
+            return;
+        }
+        c->out = grown;
+        c->out_cap = cap;
+    }
+    memcpy(c->out + c->out_len, data, len);
+    c->out_len += len;
+}
+
+static void server_replyf(ServerConn *c, const char *fmt, ...) {
+    char line[256];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (len > 0) server_reply(c, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+}
+
+static void server_close(Server *s, ServerConn *c) {
+    for (size_t i = 0; i < s->pending; ++i)
+        if (s->waiters[i] == c) s->waiters[i] = NULL;
+    epoll_ctl(s->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    c->fd = -1;
+    if (c->prev_open) c->prev_open->next_open = c->next_open;
+    else s->open = c->next_open;
+    if (c->next_open) c->next_open->prev_open = c->prev_open;
+    free(c->out);
+    c->out = NULL;
+    if (!c->queued) {
+        c->next = s->closed;
+        s->closed = c;
+    }
+    s->connections--;
+    if (s->accept_paused) {
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        if (epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->listen_fd, &ev) == 0) s->accept_paused = 0;
+    }
+}
+
+/* send what the socket takes; returns -1 if the connection is gone */
+static int server_flush_output(Server *s, ServerConn *c) {
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, MSG_NOSIGNAL);
+        if (n > 0) {
+            c->out_sent += (size_t)n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            server_close(s, c);
+            return -1;
+        }
+    }
+    if (c->out_sent == c->out_len) {
+        c->out_sent = c->out_len = 0;
+        if (c->closing) {
+            server_close(s, c);
+            return -1;
+        }
+    }
+    server_set_events(s, c);
+    return 0;
+}
+
+/* "O name|id:qty,id:qty,...": price it and add it to the batch */
+static void server_place_order(Server *s, ServerConn *c, char *args) {
+    char *items = strchr(args, '|');
+    if (!items) {
+        server_replyf(c, "ERR expected O name|id:qty,...\n");
+        return;
+    }
+    *items++ = '\0';
+    while (*args == ' ') args++;
+    if (*args == '\0') {
+        server_replyf(c, "ERR customer name missing\n");
+        return;
+    }
+
+    Order *order = &s->batch[s->pending];
+    StockReservation *res = &s->holds[s->pending];
+    memset(order, 0, sizeof(*order));
+    res->count = 0;
+    snprintf(order->customer_name, sizeof(order->customer_name), "%s", args);
+    order->timestamp = time(NULL);
+
+    for (char *tok = strtok(items, ","); tok; tok = strtok(NULL, ",")) {
+        int id, qty;
+        if (sscanf(tok, "%d:%d", &id, &qty) != 2 || qty <= 0 || qty > PRICE_MAX_QTY) {
+            server_replyf(c, "ERR bad item '%.40s'\n", tok);
+            stock_release(res);
+            return;
+        }
+        const MenuItem *mi = server_menu_find(s, id);
+        if (!mi || !mi->available) {
+            server_replyf(c, "ERR item %d not available\n", id);
+            stock_release(res);
+            return;
+        }
+        if (order->num_items >= MAX_ITEMS_PER_ORDER) {
+            server_replyf(c, "ERR more than %d items\n", MAX_ITEMS_PER_ORDER);
+            stock_release(res);
+            return;
+        }
+        if (stock_reserve_item(id, qty, res) != 0) {
+            server_replyf(c, "ERR not enough stock for item %d\n", id);
+            stock_release(res);
+            return;
+        }
+        OrderItem *oi = &order->items[order->num_items++];
+        oi->item_id = id;
+        oi->qty = qty;
+        memcpy(oi->item_name, mi->name, MAX_NAME_LEN);
+    }
+    if (order->num_items == 0) {
+        server_replyf(c, "ERR no items\n");
+        return;
+    }
+    if (price_order(order) != 0) {
+        server_replyf(c, "ERR order could not be priced\n");
+        stock_release(res);
+        return;
+    }
+    if (stock_commit(res) != 0) {
+        server_replyf(c, "ERR stock ran out while the order was open\n");
+        return;
+    }
+    s->waiters[s->pending++] = c;
+    c->waiting = 1;
+}
+
+/* "H [n]": the newest n orders (default 10, at most 50), newest first */
+static void server_recent_orders(ServerConn *c, const char *args) {
+    int want = 10;
+    if (sscanf(args, "%d", &want) != 1 || want <= 0) want = 10;
+    if (want > 50) want = 50;
+    int64_t n = datafile_record_count(&ORDER_SPEC);
+    int64_t next = n - 1;
+    while (want > 0 && next >= 0) {
+        uint64_t first;
+        size_t count;
+        Order *block = datafile_read_block(&ORDER_SPEC, (uint64_t)next, &first, &count);
+        if (!block) {
+            server_replyf(c, "ERR orders file unreadable\n");
+            return;
+        }
+        for (; want > 0 && next >= (int64_t)first; --next, --want) {
+            const Order *o = &block[next - (int64_t)first];
+            char tbuf[32] = "?";
+            struct tm tm_info;
+            if (localtime_r(&o->timestamp, &tm_info)) strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm_info);
+            server_replyf(c, "%d|%.*s|%s|%d|%.2f\n", o->order_id, MAX_NAME_LEN - 1,
+                          o->customer_name, tbuf, o->num_items, money(o->total_cents));
+        }
+        free(block);
+    }
+    server_replyf(c, ".\n");
+}
+
+/* run the complete lines in c's input buffer (until an order has to wait) */
+static void server_handle_input(Server *s, ServerConn *c) {
+    size_t start = 0;
+    while (!c->waiting && !c->closing) {
+        char *nl = memchr(c->in + start, '\n', c->in_len - start);
+        if (!nl) break;
+        if (s->pending == SERVER_BATCH_MAX) {
+            /* carry on after the batch has been written */
+            if (!c->queued) {
+                c->queued = 1;
+                c->next = s->ready;
+                s->ready = c;
+            }
+            break;
+        }
+        *nl = '\0';
+        char *line = c->in + start;
+        start = (size_t)(nl - c->in) + 1;
+        if (nl > line && nl[-1] == '\r') nl[-1] = '\0';
+
+        switch (line[0]) {
+        case 'M':
+            server_menu_refresh(s);
+            server_reply(c, s->menu_reply, s->menu_reply_len);
+            break;
+        case 'O':
+            server_menu_refresh(s);
+            server_place_order(s, c, line + 1);
+            break;
+        case 'H':
+            server_recent_orders(c, line + 1);
+            break;
+        case 'Q':
+            c->closing = 1;
+            break;
+        case '\0':
+            break;
+        default:
+            server_replyf(c, "ERR unknown request\n");
+        }
+    }
+    memmove(c->in, c->in + start, c->in_len - start);
+    c->in_len -= start;
+    if (c->in_len == sizeof(c->in) && !memchr(c->in, '\n', c->in_len)) {
+        server_replyf(c, "ERR line too long\n");
+        c->closing = 1;
+    }
+}
+
+/* run buffered requests and send the replies */
+static void server_process(Server *s, ServerConn *c) {
+    server_handle_input(s, c);
+    if (c->eof && !c->waiting && !c->queued) c->closing = 1;
+    server_flush_output(s, c);
+}
+
+/* write the batch, answer its orders and resume their connections */
+static void server_flush_orders(Server *s) {
+    size_t n = s->pending;
+    if (n == 0) return;
+    INSTR_BEGIN(span, "server.flush_orders");
+    size_t saved = append_orders(s->batch, n);
+    INSTR_END(span);
+    s->orders_saved += saved;
+    s->batches++;
+    s->pending = 0;
+    for (size_t i = 0; i < n; ++i) {
+        ServerConn *c = s->waiters[i];
+        if (i >= saved) stock_release(&s->holds[i]);
+        if (!c) continue;
+        if (i < saved) server_replyf(c, "OK %d %.2f\n", s->batch[i].order_id,
+                                     money(s->batch[i].total_cents));
+        else server_replyf(c, "ERR order could not be saved\n");
+        c->waiting = 0;
+        s->waiters[i] = NULL;
+        if (!c->queued) {
+            c->queued = 1;
+            c->next = s->ready;
+            s->ready = c;
+        }
+    }
+}
+
+/* write batches until every connection has run out of complete requests */
+static void server_drain(Server *s) {
+    while (s->pending > 0 || s->ready) {
+        server_flush_orders(s);
+        ServerConn *list = s->ready;
+        s->ready = NULL;
+        while (list) {
+            ServerConn *c = list;
+            list = c->next;
+            c->queued = 0;
+            if (c->fd < 0) {
+                c->next = s->closed;
+                s->closed = c;
+            } else {
+                server_process(s, c);
+            }
+        }
+    }
+    while (s->closed) {
+        ServerConn *c = s->closed;
+        s->closed = c->next;
+        free(c);
+    }
+}
+
+static void server_accept(Server *s) {
+    for (;;) {
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EMFILE || errno == ENFILE) {
+                /* stop polling the listener until a connection closes */
+                if (epoll_ctl(s->epfd, EPOLL_CTL_DEL, s->listen_fd, NULL) == 0) s->accept_paused = 1;
+                fprintf(stderr, "Out of file descriptors at %zu connections.\n", s->connections);
+            }
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        ServerConn *c = calloc(1, sizeof(ServerConn));
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (!c || epoll_ctl(s->epfd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->events = EPOLLIN;
+        c->next_open = s->open;
+        if (s->open) s->open->prev_open = c;
+        s->open = c;
+        s->connections++;
+    }
+}
+
+static void server_read(Server *s, ServerConn *c) {
+    for (;;) {
+        if (c->in_len == sizeof(c->in)) break;
+        ssize_t n = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+        if (n > 0) {
+            c->in_len += (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) {
+            server_close(s, c);
+            return;
+        }
+        c->eof = 1;                     /* answer what was sent, then close */
+        break;
+    }
+    server_process(s, c);
+}
+
+static int server_listen(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* a socket file nobody answers on is left over from a crash */
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 && connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "A server is already listening on %s.\n", path);
+        close(probe);
+        return -1;
+    }
+    if (probe >= 0) close(probe);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror("server socket");
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* as many descriptors as the hard limit allows: one per terminal */
+static void raise_fd_limit(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+}
+
+int run_server(const char *path) {
+    Server s;
+    memset(&s, 0, sizeof(s));
+    s.batch = calloc(SERVER_BATCH_MAX, sizeof(Order));
+    s.holds = calloc(SERVER_BATCH_MAX, sizeof(StockReservation));
+    s.waiters = calloc(SERVER_BATCH_MAX, sizeof(ServerConn *));
+    if (!s.batch || !s.holds || !s.waiters) return 1;
+    raise_fd_limit();
+    s.listen_fd = server_listen(path);
+    if (s.listen_fd < 0) return 1;
+    s.epfd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (s.epfd < 0 || epoll_ctl(s.epfd, EPOLL_CTL_ADD, s.listen_fd, &ev) != 0) {
+        perror("epoll");
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = server_on_signal;   /* no SA_RESTART: epoll_wait returns EINTR */
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    server_menu_refresh(&s);
+    printf("Serving %zu menu items on %s (Ctrl+C to stop).\n", s.menu_count, path);
+    fflush(stdout);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server_stop) {
+        int n = epoll_wait(s.epfd, events, SERVER_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            ServerConn *c = events[i].data.ptr;
+            if (!c) {
+                server_accept(&s);
+                continue;
+            }
+            if (c->fd < 0) continue;    /* closed earlier in this pass */
+            uint32_t ev_bits = events[i].events;
+            if (ev_bits & EPOLLOUT && server_flush_output(&s, c) != 0) continue;
+            if (ev_bits & EPOLLIN) server_read(&s, c);
+            else if (ev_bits & (EPOLLERR | EPOLLHUP)) server_close(&s, c);
+        }
+        /* everything ready has been read: write the batch and answer it */
+        server_drain(&s);
+    }
+
+    server_drain(&s);
+    while (s.open) server_close(&s, s.open);
+    server_drain(&s);
+    close(s.listen_fd);
+    close(s.epfd);
+    unlink(path);
+    printf("Server stopped: %llu orders saved in %llu batches.\n",
+           (unsigned long long)s.orders_saved, (unsigned long long)s.batches);
+    free(s.menu);
+    free(s.menu_reply);
+    free(s.batch);
+    free(s.holds);
+    free(s.waiters);
+    return 0;
+}
+
+/* ---------- Load test client ---------- */
+
+typedef struct {
+    int fd;
+    int busy;                           /* request sent, reply not yet read */
+    double sent_at;
+    size_t in_len;
+    char in[256];
+} LoadClient;
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int load_connect(const char *path, int nonblocking) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (nonblocking) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    return fd;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Open `idle` connections that never send anything and `clients` busy
+ * ones, each placing random one-to-three item orders back to back until
+ * `orders` have been answered. Prints throughput and latency percentiles.
+ */
+int run_load_test(const char *path, int clients, long orders, int idle) {
+    raise_fd_limit();
+    signal(SIGPIPE, SIG_IGN);
+
+    /* the menu, fetched over a plain blocking connection */
+    int ids[256], n_ids = 0;
+    int fd = load_connect(path, 0);
+    FILE *f = fd >= 0 ? fdopen(fd, "r+") : NULL;
+    if (!f) {
+        fprintf(stderr, "Cannot connect to %s.\n", path);
+        return 1;
+    }
+    char line[SERVER_LINE_MAX];
+    fputs("M\n", f);
+    fflush(f);
+    while (fgets(line, sizeof(line), f) && strcmp(line, ".\n") != 0) {
+        int id, available;
+        char *last = strrchr(line, '|');
+        if (n_ids < 256 && sscanf(line, "%d|", &id) == 1 && last && sscanf(last + 1, "%d", &available) == 1 &&
+            available)
+            ids[n_ids++] = id;
+    }
+    fclose(f);
+    if (n_ids == 0) {
+        fprintf(stderr, "The server has no available menu items.\n");
+        return 1;
+    }
+
+    int *idle_fds = calloc(idle > 0 ? (size_t)idle : 1, sizeof(int));
+    int opened = 0;
+    while (idle_fds && opened < idle && (idle_fds[opened] = load_connect(path, 0)) >= 0) opened++;
+    if (opened < idle) fprintf(stderr, "Only %d of %d idle connections could be opened.\n", opened, idle);
+
+    LoadClient *lc = calloc((size_t)clients, sizeof(LoadClient));
+    double *latency = malloc((size_t)orders * sizeof(double));
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!lc || !latency || epfd < 0) return 1;
+    for (int i = 0; i < clients; ++i) {
+        struct epoll_event ev;
+        lc[i].fd = load_connect(path, 1);
+        ev.events = EPOLLIN;
+        ev.data.ptr = &lc[i];
+        if (lc[i].fd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, lc[i].fd, &ev) != 0) {
+            fprintf(stderr, "Busy connection %d failed.\n", i);
+            return 1;
+        }
+    }
+
+    long sent = 0, answered = 0, failed = 0;
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+    double start = monotonic_seconds();
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (answered < orders) {
+        for (int i = 0; i < clients && sent < orders; ++i) {
+            if (lc[i].busy) continue;
+            char req[128];
+            int len = snprintf(req, sizeof(req), "O sim%d|", i % 97);
+            int items = 1 + (int)(rng % 3);
+            for (int k = 0; k < items; ++k) {
+                rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+                len += snprintf(req + len, sizeof(req) - (size_t)len, "%s%d:%d", k ? "," : "",
+                                ids[rng % (uint64_t)n_ids], 1 + (int)(rng >> 60) % 3);
+            }
+            len += snprintf(req + len, sizeof(req) - (size_t)len, "\n");
+            if (send(lc[i].fd, req, (size_t)len, MSG_NOSIGNAL) != len) {
+                fprintf(stderr, "Connection %d lost.\n", i);
+                return 1;
+            }
+            lc[i].busy = 1;
+            lc[i].sent_at = monotonic_seconds();
+            sent++;
+        }
+        int n = epoll_wait(epfd, events, SERVER_MAX_EVENTS, 10000);
+        if (n <= 0) {
+            fprintf(stderr, "No reply from the server for 10 seconds.\n");
+            return 1;
+        }
+        double now = monotonic_seconds();
+        for (int e = 0; e < n; ++e) {
+            LoadClient *c = events[e].data.ptr;
+            ssize_t got = recv(c->fd, c->in + c->in_len, sizeof(c->in) - 1 - c->in_len, 0);
+            if (got <= 0) {
+                fprintf(stderr, "Server closed a connection.\n");
+                return 1;
+            }
+            c->in_len += (size_t)got;
+            char *nl;
+            while ((nl = memchr(c->in, '\n', c->in_len)) != NULL) {
+                if (strncmp(c->in, "OK", 2) != 0) failed++;
+                latency[answered++] = now - c->sent_at;
+                c->busy = 0;
+                c->in_len -= (size_t)(nl + 1 - c->in);
+                memmove(c->in, nl + 1, c->in_len);
+            }
+        }
+    }
+    double elapsed = monotonic_seconds() - start;
+
+    qsort(latency, (size_t)answered, sizeof(double), compare_doubles);
+    printf("%ld orders over %d connections (+%d idle) in %.3f s: %.0f orders/s, %ld rejected\n",
+           answered, clients, opened, elapsed, (double)answered / elapsed, failed);
+    printf("latency p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", latency[answered / 2] * 1e3,
+           latency[answered * 99 / 100] * 1e3, latency[answered - 1] * 1e3);
+    for (int i = 0; i < clients; ++i) close(lc[i].fd);
+    for (int i = 0; i < opened; ++i) close(idle_fds[i]);
+    free(lc);
+    free(latency);
+    free(idle_fds);
+    close(epfd);
+    return 0;
+}
+
+#endif /* HAVE_EPOLL_SERVER */
+
+/* ---------- Data file format helpers ---------- */
+
+static uint32_t crc32c_table[8][256];
+static int crc32c_table_ready = 0;
+
+static void crc32c_init_table(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1u)));
+        crc32c_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t) {
+            uint32_t prev = crc32c_table[t - 1][i];
+            crc32c_table[t][i] = (prev >> 8) ^ crc32c_table[0][prev & 0xFF];
+        }
+    }
+    crc32c_table_ready = 1;
+}
+
+/* slicing-by-8 fallback; operates on the raw (non-inverted) register */
+static uint32_t crc32c_sw(uint32_t c, const unsigned char *p, size_t len) {
+    if (!crc32c_table_ready) crc32c_init_table();
+    while (len >= 8) {
+        uint32_t lo = c ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+                           (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+        c = crc32c_table[7][lo & 0xFF] ^ crc32c_table[6][(lo >> 8) & 0xFF] ^
+            crc32c_table[5][(lo >> 16) & 0xFF] ^ crc32c_table[4][lo >> 24] ^
+            crc32c_table[3][p[4]] ^ crc32c_table[2][p[5]] ^
+            crc32c_table[1][p[6]] ^ crc32c_table[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+    while (len--) c = (c >> 8) ^ crc32c_table[0][(c ^ *p++) & 0xFF];
+    return c;
+}
+
+#ifdef HAVE_SSE42_CRC
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t c, const unsigned char *p, size_t len) {
+#ifdef __x86_64__
+    uint64_t c64 = c;
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c64 = _mm_crc32_u64(c64, v);
+        p += 8;
+        len -= 8;
+    }
+    c = (uint32_t)c64;
+#endif
+    while (len >= 4) {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        c = _mm_crc32_u32(c, v);
+        p += 4;
+        len -= 4;
+    }
+    while (len--) c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+
+/*
+ * CRC three equally sized blocks at once. The crc32 instruction has a
+ * latency of 3 cycles but a throughput of 1 per cycle, so interleaving
+ * three independent streams keeps the unit busy.
+ */
+__attribute__((target("sse4.2")))
+static void crc32c_hw_x3(const unsigned char *a, const unsigned char *b,
+                         const unsigned char *c, size_t len, uint32_t out[3]) {
+    uint32_t ca = 0xFFFFFFFFu, cb = 0xFFFFFFFFu, cc = 0xFFFFFFFFu;
+#ifdef __x86_64__
+    uint64_t ra = ca, rb = cb, rc = cc;
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t va, vb, vc;
+        memcpy(&va, a + i, 8);
+        memcpy(&vb, b + i, 8);
+        memcpy(&vc, c + i, 8);
+        ra = _mm_crc32_u64(ra, va);
+        rb = _mm_crc32_u64(rb, vb);
+        rc = _mm_crc32_u64(rc, vc);
+    }
+    ca = (uint32_t)ra;
+    cb = (uint32_t)rb;
+    cc = (uint32_t)rc;
+    a += i; b += i; c += i;
+    len -= i;
+#endif
+    out[0] = ~crc32c_hw(ca, a, len);
+    out[1] = ~crc32c_hw(cb, b, len);
+    out[2] = ~crc32c_hw(cc, c, len);
+}
+
+static int crc32c_use_hw(void) {
+    static int cached = -1;
+    if (cached < 0) {
+        __builtin_cpu_init();
+        cached = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+    }
+    return cached;
+}
+#endif
+
+/* zlib-style running CRC32C: crc32c_update(crc32c_update(0, a), b) == crc of a||b */
+uint32_t crc32c_update(uint32_t crc, const void *data, size_t len) {
+    const unsigned char *p = data;
+#ifdef HAVE_SSE42_CRC
+    if (crc32c_use_hw()) return ~crc32c_hw(~crc, p, len);
+#endif
+    return ~crc32c_sw(~crc, p, len);
+}
+
+/*
+ * Compute CRCs for `nblocks` consecutive blocks of `block_len` bytes.
+ * Uses the three-stream hardware path when available.
+ */
+static void crc32c_blocks(const unsigned char *data, size_t block_len,
+                          size_t nblocks, uint32_t *out) {
+    size_t i = 0;
+#ifdef HAVE_SSE42_CRC
+    if (crc32c_use_hw()) {
+        for (; i + 3 <= nblocks; i += 3) {
+            crc32c_hw_x3(data + i * block_len, data + (i + 1) * block_len,
+                         data + (i + 2) * block_len, block_len, out + i);
+        }
+    }
+#endif
+    for (; i < nblocks; ++i) out[i] = crc32c_update(0, data + i * block_len, block_len);
+}
+
+static uint32_t datafile_header_crc(const DataFileHeader *h) {
+    return crc32c_update(0, h, offsetof(DataFileHeader, header_crc));
+}
+
+static uint32_t datafile_records_per_block(size_t record_size) {
+    size_t n = DATAFILE_BLOCK_BYTES / record_size;
+    return (uint32_t)(n > 0 ? n : 1);
+}
+
+/* total file size implied by a header (header + block headers + records) */
+static uint64_t datafile_expected_size(const DataFileHeader *h) {
+    uint64_t nblocks = (h->record_count + h->records_per_block - 1) / h->records_per_block;
+    return sizeof(DataFileHeader) + nblocks * sizeof(DataBlockHeader) +
+           h->record_count * (uint64_t)h->record_size;
+}
+
+static long datafile_size(FILE *f) {
+    if (fseek(f, 0, SEEK_END) != 0) return -1;
+    long sz = ftell(f);
+    rewind(f);
+    return sz;
+}
+
+/*
+ * Returns 0 for a usable header, 1 if the file is longer than the header
+ * says (an update in progress, or one cut short; see datafile_recover()),
+ * -1 (after printing why) otherwise.
+ */
+static int datafile_check_header(const DataFileSpec *spec, const DataFileHeader *h, long sz) {
+    if (datafile_header_crc(h) != h->header_crc) {
+        printf("Error: %s file header is corrupted (checksum mismatch).\n", spec->label);
+        return -1;
+    }
+    if (h->version != DATAFILE_VERSION) {
+        printf("Error: %s file has unsupported format version %u.\n",
+               spec->label, (unsigned)h->version);
+        return -1;
+    }
+    if (h->kind != spec->kind) {
+        printf("Error: %s is not a %s file.\n", spec->path, spec->label);
+        return -1;
+    }
+    if (h->record_size != spec->record_size || h->records_per_block == 0) {
+        printf("Error: %s file record size %u does not match this program (%zu).\n",
+               spec->label, (unsigned)h->record_size, spec->record_size);
+        return -1;
+    }
+    /* a huge record_count could wrap the expected size around to the real one */
+    if (h->record_count > (uint64_t)sz / h->record_size || (uint64_t)sz < datafile_expected_size(h)) {
+        printf("Error: %s file is truncated.\n", spec->label);
+        return -1;
+    }
+    return (uint64_t)sz > datafile_expected_size(h) ? 1 : 0;
+}
+
+/* offset of the block that holds (or will hold) record `index` */
+static long datafile_block_pos(const DataFileHeader *h, uint64_t index) {
+    uint64_t block_index = index / h->records_per_block;
+    return (long)(sizeof(DataFileHeader) +
+                  block_index * (sizeof(DataBlockHeader) +
+                                 (uint64_t)h->records_per_block * h->record_size));
+}
+
+static int datafile_truncate(FILE *f, uint64_t size) {
+    if (fflush(f) != 0) return -1;
+#ifdef _WIN32
+    return _chsize_s(_fileno(f), (__int64)size) == 0 ? 0 : -1;
+#else
+    return ftruncate(fileno(f), (off_t)size) == 0 ? 0 : -1;
+#endif
+}
+
+/*
+ * Undo an append that stopped before the file header was rewritten: the
+ * bytes past the records the header counts are cut off, and if the last
+ * block's header had already been extended over the new records (its CRC
+ * must still match them) it is put back to cover the old ones only.
+ * Call with spec->lock_path held and the file opened "rb+".
+ */
+static int datafile_trim_tail(const DataFileSpec *spec, FILE *f, const DataFileHeader *h) {
+    uint64_t in_last = h->record_count % h->records_per_block;
+    int ok = 1;
+    if (in_last != 0) {
+        long block_pos = datafile_block_pos(h, h->record_count);
+        unsigned char *buf = malloc((size_t)h->records_per_block * spec->record_size);
+        DataBlockHeader bh;
+        ok = buf && fseek(f, block_pos, SEEK_SET) == 0 && fread(&bh, sizeof(bh), 1, f) == 1;
+        if (ok && bh.count != in_last) {
+            ok = bh.count > in_last && bh.count <= h->records_per_block &&
+                 fread(buf, spec->record_size, bh.count, f) == bh.count &&
+                 crc32c_update(0, buf, bh.count * spec->record_size) == bh.crc;
+            if (ok) {
+                bh.count = (uint32_t)in_last;
+                bh.crc = crc32c_update(0, buf, (size_t)in_last * spec->record_size);
+                ok = fseek(f, block_pos, SEEK_SET) == 0 && fwrite(&bh, sizeof(bh), 1, f) == 1;
+            }
+        }
+        free(buf);
+    }
+    ok = ok && datafile_truncate(f, datafile_expected_size(h)) == 0;
+    if (!ok) printf("Error: %s file ends in an unfinished update that cannot be undone.\n", spec->label);
+    return ok ? 0 : -1;
+}
+
+/*
+ * Called when a file is longer than its header says. Once the file's lock
+ * is ours no update can be in progress, so anything still past the end is
+ * left over from a crash and is trimmed. Returns 0 if the file is whole.
+ */
+static int datafile_recover(const DataFileSpec *spec) {
+    if (!spec->lock_path) {
+        printf("Error: %s file has trailing bytes.\n", spec->label);
+        return -1;
+    }
+    int lock = lock_file(spec->lock_path);
+    FILE *f = fopen(spec->path, "rb+");
+    long sz = f ? datafile_size(f) : -1;
+    DataFileHeader h;
+    int rc = -1;
+    if (sz >= (long)sizeof(h) && fread(&h, sizeof(h), 1, f) == 1 && h.magic == DATAFILE_MAGIC) {
+        rc = datafile_check_header(spec, &h, sz);
+        if (rc == 1) rc = datafile_trim_tail(spec, f, &h);
+    }
+    if (f && fclose(f) != 0) rc = -1;
+    unlock_file(lock);
+    return rc;
+}
+
+/*
+ * Open a data file and validate its header. Returns NULL if the file is
+ * missing or empty (*missing = 1), or if it is legacy or damaged.
+ */
+static FILE* datafile_open(const DataFileSpec *spec, const char *mode, DataFileHeader *h, int *missing) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        *missing = 0;
+        FILE *f = fopen(spec->path, mode);
+        long sz = f ? datafile_size(f) : 0;
+        if (sz <= 0) {
+            if (f) fclose(f);
+            *missing = 1;
+            return NULL;
+        }
+        int rc = -1;
+        if ((size_t)sz >= sizeof(*h) && fread(h, sizeof(*h), 1, f) == 1 && h->magic == DATAFILE_MAGIC)
+            rc = datafile_check_header(spec, h, sz);
+        if (rc == 0) return f;
+        fclose(f);
+        if (rc < 0 || attempt > 0 || datafile_recover(spec) != 0) return NULL;
+    }
+    return NULL;
+}
+
+/* read and verify the block holding record `index` into buf; returns its record count or 0 */
+static size_t datafile_fetch_block(const DataFileSpec *spec, FILE *f, const DataFileHeader *h,
+                                   uint64_t index, DataBlockHeader *bh, unsigned char *buf) {
+    uint64_t left = h->record_count - (index - index % h->records_per_block);
+    size_t in_block = left < h->records_per_block ? (size_t)left : h->records_per_block;
+    if (fseek(f, datafile_block_pos(h, index), SEEK_SET) != 0 ||
+        fread(bh, sizeof(*bh), 1, f) != 1 || bh->count != in_block ||
+        fread(buf, spec->record_size, in_block, f) != in_block) {
+        printf("Error: %s file block %llu is damaged.\n", spec->label,
+               (unsigned long long)(index / h->records_per_block));
+        return 0;
+    }
+    if (crc32c_update(0, buf, in_block * spec->record_size) != bh->crc) {
+        printf("Error: %s file block %llu failed its checksum.\n", spec->label,
+               (unsigned long long)(index / h->records_per_block));
+        return 0;
+    }
+    return in_block;
+}
+
+/* read a pre-header file (raw records only) and rewrite it with a header */
+static void* datafile_migrate_legacy(const DataFileSpec *spec, FILE *f, long sz, size_t *count) {
+    if ((size_t)sz % spec->record_size != 0) {
+        printf("Error: %s file is corrupted (unrecognised format).\n", spec->label);
+        fclose(f);
+        return NULL;
+    }
+    size_t n = (size_t)sz / spec->record_size;
+    unsigned char *arr = malloc(n * spec->record_size);
+    if (!arr) { fclose(f); return NULL; }
+    if (fread(arr, spec->record_size, n, f) != n) {
+        free(arr); fclose(f); return NULL;
+    }
+    fclose(f);
+    for (size_t i = 0; i < n; ++i) spec->normalize(arr + i * spec->record_size);
+    if (datafile_save(spec, arr, n) != 0) {
+        printf("Error: could not migrate legacy %s file.\n", spec->label);
+        free(arr);
+        return NULL;
+    }
+    printf("Note: migrated legacy %s file to format version %d.\n", spec->label, DATAFILE_VERSION);
+    *count = n;
+    return arr;
+}
+
+/*
+ * Load every record of a data file into one malloc'd array.
+ * Returns NULL (count 0) for a missing/empty file or on any validation error.
+ */
+void* datafile_load(const DataFileSpec *spec, size_t *count) {
+    *count = 0;
+    int recovered = 0;
+reopen:;
+    FILE *f = fopen(spec->path, "rb");
+    if (!f) return NULL;
+    long sz = datafile_size(f);
+    if (sz <= 0) { fclose(f); return NULL; }
+
+    DataFileHeader h;
+    if ((size_t)sz < sizeof(h) || fread(&h, sizeof(h), 1, f) != 1 || h.magic != DATAFILE_MAGIC) {
+        if ((size_t)sz >= sizeof(h) && h.magic == DATAFILE_MAGIC_SWAPPED) {
+            printf("Error: %s file was written on a machine with different byte order.\n",
+                   spec->label);
+            fclose(f);
+            return NULL;
+        }
+        rewind(f);
+        return datafile_migrate_legacy(spec, f, sz, count);
+    }
+    int rc = datafile_check_header(spec, &h, sz);
+    if (rc != 0) {
+        fclose(f);
+        if (rc < 0 || recovered || datafile_recover(spec) != 0) return NULL;
+        recovered = 1;
+        goto reopen;
+    }
+    if (h.record_count == 0) { fclose(f); return NULL; }
+
+    size_t n = (size_t)h.record_count;
+    size_t per_block = h.records_per_block;
+    size_t nblocks = (n + per_block - 1) / per_block;
+    unsigned char *arr = malloc(n * spec->record_size);
+    uint32_t *stored = malloc(nblocks * sizeof(uint32_t));
+    uint32_t *actual = malloc(nblocks * sizeof(uint32_t));
+    if (!arr || !stored || !actual) goto fail;
+
+    /* read straight into the destination array, then verify in one pass */
+    for (size_t b = 0; b < nblocks; ++b) {
+        size_t first = b * per_block;
+        size_t in_block = (n - first < per_block) ? n - first : per_block;
+        DataBlockHeader bh;
+        if (fread(&bh, sizeof(bh), 1, f) != 1 || bh.count != in_block ||
+            fread(arr + first * spec->record_size, spec->record_size, in_block, f) != in_block) {
+            printf("Error: %s file block %zu is damaged.\n", spec->label, b);
+            goto fail;
+        }
+        stored[b] = bh.crc;
+    }
+    fclose(f);
+    f = NULL;
+
+    size_t full = n / per_block;
+    size_t block_len = per_block * spec->record_size;
+    crc32c_blocks(arr, block_len, full, actual);
+    if (full < nblocks) {
+        actual[full] = crc32c_update(0, arr + full * block_len, (n - full * per_block) * spec->record_size);
+    }
+    for (size_t b = 0; b < nblocks; ++b) {
+        if (actual[b] != stored[b]) {
+            printf("Error: %s file block %zu failed its checksum.\n", spec->label, b);
+            goto fail;
+        }
+    }
+    free(stored);
+    free(actual);
+    *count = n;
+    return arr;
+
+fail:
+    if (f) fclose(f);
+    free(arr);
+    free(stored);
+    free(actual);
+    return NULL;
+}
+
+/* write records to <path>.tmp and rename over the original (returns 0 on success) */
+int datafile_save(const DataFileSpec *spec, const void *records, size_t count) {
+    char tmp[256];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", spec->path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+
+    DataFileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = DATAFILE_MAGIC;
+    h.version = DATAFILE_VERSION;
+    h.kind = spec->kind;
+    h.record_size = (uint32_t)spec->record_size;
+    h.records_per_block = datafile_records_per_block(spec->record_size);
+    h.record_count = count;
+    h.header_crc = datafile_header_crc(&h);
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+
+    const unsigned char *p = records;
+    for (size_t first = 0; ok && first < count; first += h.records_per_block) {
+        size_t in_block = count - first < h.records_per_block ? count - first : h.records_per_block;
+        DataBlockHeader bh;
+        bh.count = (uint32_t)in_block;
+        bh.crc = crc32c_update(0, p + first * spec->record_size, in_block * spec->record_size);
+        ok = fwrite(&bh, sizeof(bh), 1, f) == 1 &&
+             fwrite(p + first * spec->record_size, spec->record_size, in_block, f) == in_block;
+    }
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) { remove(tmp); return -1; }
+#ifdef _WIN32
+    remove(spec->path);                 /* rename() does not replace on Windows */
+#endif
+    return rename(tmp, spec->path) == 0 ? 0 : -1;
+}
+
+/*
+ * Append n records without rewriting the file: the records go at the end,
+ * then the last block's count/CRC (CRC32C extends incrementally) and finally
+ * the file header are updated in place. Until the header is written the
+ * file is longer than it says, and an append cut short there is undone by
+ * datafile_trim_tail() the next time the file is opened.
+ */
+static int datafile_append_locked(const DataFileSpec *spec, const void *records, size_t n) {
+    FILE *f = fopen(spec->path, "rb+");
+    if (!f) return datafile_save(spec, records, n);
+    long sz = datafile_size(f);
+
+    DataFileHeader h;
+    if (sz <= 0 || (size_t)sz < sizeof(h) || fread(&h, sizeof(h), 1, f) != 1 ||
+        h.magic != DATAFILE_MAGIC) {
+        /* empty or legacy file: load (migrating if needed) and rewrite */
+        fclose(f);
+        if (sz <= 0) return datafile_save(spec, records, n);
+        size_t have;
+        unsigned char *arr = datafile_load(spec, &have);
+        if (!arr) return -1;            /* never overwrite a file we could not read */
+        unsigned char *grown = realloc(arr, (have + n) * spec->record_size);
+        if (!grown) { free(arr); return -1; }
+        memcpy(grown + have * spec->record_size, records, n * spec->record_size);
+        int rc = datafile_save(spec, grown, have + n);
+        free(grown);
+        return rc;
+    }
+    int rc = datafile_check_header(spec, &h, sz);
+    if (rc == 1) rc = datafile_trim_tail(spec, f, &h);
+    if (rc != 0) { fclose(f); return -1; }
+
+    const unsigned char *p = records;
+    size_t done = 0;
+    int ok = fseek(f, 0, SEEK_END) == 0;
+    uint64_t in_last = h.record_count % h.records_per_block;
+    if (ok && in_last != 0) {
+        /* top up the last block, then fix its header */
+        long block_pos = datafile_block_pos(&h, h.record_count);
+        DataBlockHeader bh;
+        done = h.records_per_block - in_last < n ? (size_t)(h.records_per_block - in_last) : n;
+        ok = fwrite(p, spec->record_size, done, f) == done &&
+             fseek(f, block_pos, SEEK_SET) == 0 && fread(&bh, sizeof(bh), 1, f) == 1;
+        if (ok) {
+            bh.count += (uint32_t)done;
+            bh.crc = crc32c_update(bh.crc, p, done * spec->record_size);
+            ok = fseek(f, block_pos, SEEK_SET) == 0 && fwrite(&bh, sizeof(bh), 1, f) == 1 &&
+                 fseek(f, 0, SEEK_END) == 0;
+        }
+    }
+    while (ok && done < n) {
+        DataBlockHeader bh;
+        size_t in_block = n - done < h.records_per_block ? n - done : h.records_per_block;
+        bh.count = (uint32_t)in_block;
+        bh.crc = crc32c_update(0, p + done * spec->record_size, in_block * spec->record_size);
+        ok = fwrite(&bh, sizeof(bh), 1, f) == 1 &&
+             fwrite(p + done * spec->record_size, spec->record_size, in_block, f) == in_block;
+        done += in_block;
+    }
+    if (ok) {
+        h.record_count += n;
+        h.header_crc = datafile_header_crc(&h);
+        ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+    }
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/* append under the file's lock, so two terminals never write the same tail */
+int datafile_append(const DataFileSpec *spec, const void *records, size_t n) {
+    if (n == 0) return 0;
+    int lock = spec->lock_path ? lock_file(spec->lock_path) : -1;
+    int rc = datafile_append_locked(spec, records, n);
+    unlock_file(lock);
+    return rc;
+}
+
+/* number of records: 0 for a missing or empty file, -1 for a legacy or damaged one */
+int64_t datafile_record_count(const DataFileSpec *spec) {
+    DataFileHeader h;
+    int missing;
+    FILE *f = datafile_open(spec, "rb", &h, &missing);
+    if (!f) return missing ? 0 : -1;
+    fclose(f);
+    return (int64_t)h.record_count;
+}
+
+/* kind of a data file: 0 if missing or empty, -1 if it has no (or an unreadable) header */
+int datafile_peek_kind(const char *path) {
+    DataFileHeader h;
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    long sz = datafile_size(f);
+    int kind = sz <= 0 ? 0 : (size_t)sz >= sizeof(h) && fread(&h, sizeof(h), 1, f) == 1 &&
+                             h.magic == DATAFILE_MAGIC ? h.kind : -1;
+    fclose(f);
+    return kind;
+}
+
+/*
+ * Read only the block that holds record `index`, checking its CRC.
+ * Returns a malloc'd array of *count records starting at record *first,
+ * or NULL if the file cannot be read or is shorter than that.
+ */
+void* datafile_read_block(const DataFileSpec *spec, uint64_t index, uint64_t *first, size_t *count) {
+    DataFileHeader h;
+    int missing;
+    FILE *f = datafile_open(spec, "rb", &h, &missing);
+    if (!f) return NULL;
+    unsigned char *buf = NULL;
+    DataBlockHeader bh;
+    size_t n = 0;
+    if (index < h.record_count && (buf = malloc((size_t)h.records_per_block * spec->record_size)))
+        n = datafile_fetch_block(spec, f, &h, index, &bh, buf);
+    fclose(f);
+    if (n == 0) {
+        free(buf);
+        return NULL;
+    }
+    *first = index - index % h.records_per_block;
+    *count = n;
+    return buf;
+}
+
+/* copy out record `index` (returns 0 on success) */
+int datafile_read_record(const DataFileSpec *spec, uint64_t index, void *record) {
+    uint64_t first;
+    size_t count;
+    unsigned char *block = datafile_read_block(spec, index, &first, &count);
+    if (!block) return -1;
+    memcpy(record, block + (index - first) * spec->record_size, spec->record_size);
+    free(block);
+    return 0;
+}
+
+/*
+ * Overwrite record `index` in place: the record is written, then its
+ * block's CRC, which is recomputed over the whole (verified) block.
+ */
+int datafile_write_record(const DataFileSpec *spec, uint64_t index, const void *record) {
+    DataFileHeader h;
+    int missing;
+    FILE *f = datafile_open(spec, "rb+", &h, &missing);
+    if (!f) return -1;
+    unsigned char *buf = index < h.record_count ?
+                         malloc((size_t)h.records_per_block * spec->record_size) : NULL;
+    DataBlockHeader bh;
+    size_t n = buf ? datafile_fetch_block(spec, f, &h, index, &bh, buf) : 0;
+    int ok = n > 0;
+    if (ok) {
+        size_t at = (size_t)(index % h.records_per_block) * spec->record_size;
+        memcpy(buf + at, record, spec->record_size);
+        bh.crc = crc32c_update(0, buf, n * spec->record_size);
+        long block_pos = datafile_block_pos(&h, index);
+        ok = fseek(f, block_pos + (long)(sizeof(bh) + at), SEEK_SET) == 0 &&
+             fwrite(record, spec->record_size, 1, f) == 1 &&
+             fseek(f, block_pos, SEEK_SET) == 0 &&
+             fwrite(&bh, sizeof(bh), 1, f) == 1;
+    }
+    free(buf);
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/*
+ * Overwrite a whole block, starting at record `first`, with `count`
+ * records read earlier by datafile_read_block() and changed in memory.
+ */
+int datafile_write_block(const DataFileSpec *spec, uint64_t first, const void *records, size_t count) {
+    DataFileHeader h;
+    int missing;
+    FILE *f = datafile_open(spec, "rb+", &h, &missing);
+    if (!f) return -1;
+    uint64_t left = first < h.record_count ? h.record_count - first : 0;
+    int ok = count > 0 && first % h.records_per_block == 0 &&
+             count == (left < h.records_per_block ? left : h.records_per_block);
+    if (ok) {
+        DataBlockHeader bh;
+        bh.count = (uint32_t)count;
+        bh.crc = crc32c_update(0, records, count * spec->record_size);
+        ok = fseek(f, datafile_block_pos(&h, first), SEEK_SET) == 0 &&
+             fwrite(&bh, sizeof(bh), 1, f) == 1 &&
+             fwrite(records, spec->record_size, count, f) == count;
+    }
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/*
+ * Record store framing: a store page is one data file block, and these
+ * hooks keep the block headers and the file header exactly as
+ * datafile_save() writes them, so every datafile_* reader still works.
+ */
+static int store_read_count(FILE *f, uint64_t *count, const void *ctx) {
+    const DataFileSpec *spec = ctx;
+    DataFileHeader h;
+    long sz = datafile_size(f);
+    if (sz == 0) {                      /* created by the store just now */
+        *count = 0;
+        return 0;
+    }
+    if (sz < 0 || (size_t)sz < sizeof(h) || fread(&h, sizeof(h), 1, f) != 1 || h.magic != DATAFILE_MAGIC)
+        return -1;
+    int rc = datafile_check_header(spec, &h, sz);
+    if (rc == 1 && datafile_recover(spec) == 0) {
+        /* trimmed through another descriptor; read the header again */
+        sz = datafile_size(f);
+        rc = sz >= (long)sizeof(h) && fread(&h, sizeof(h), 1, f) == 1 ? datafile_check_header(spec, &h, sz) : -1;
+    }
+    if (rc != 0) return -1;
+    if (h.records_per_block != datafile_records_per_block(spec->record_size)) {
+        printf("Error: %s file uses a block size this program cannot update.\n", spec->label);
+        return -1;
+    }
+    *count = h.record_count;
+    return 0;
+}
+
+static int store_write_count(FILE *f, uint64_t count, const void *ctx) {
+    const DataFileSpec *spec = ctx;
+    DataFileHeader h;
+    memset(&h, 0, sizeof(h));
+    h.magic = DATAFILE_MAGIC;
+    h.version = DATAFILE_VERSION;
+    h.kind = spec->kind;
+    h.record_size = (uint32_t)spec->record_size;
+    h.records_per_block = datafile_records_per_block(spec->record_size);
+    h.record_count = count;
+    h.header_crc = datafile_header_crc(&h);
+    return fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1 ? 0 : -1;
+}
+
+static int store_check_page(const void *header, const void *records, size_t n, const void *ctx) {
+    const DataFileSpec *spec = ctx;
+    const DataBlockHeader *bh = header;
+    if (bh->count != n || crc32c_update(0, records, n * spec->record_size) != bh->crc) {
+        printf("Error: %s file has a damaged block.\n", spec->label);
+        return -1;
+    }
+    return 0;
+}
+
+static void store_seal_page(void *header, const void *records, size_t n, const void *ctx) {
+    const DataFileSpec *spec = ctx;
+    DataBlockHeader *bh = header;
+    bh->count = (uint32_t)n;
+    bh->crc = crc32c_update(0, records, n * spec->record_size);
+}
+
+/* the lock the file's writers hold, so a reader may rebuild a stale index under it */
+static int store_lock(const void *ctx) {
+    const DataFileSpec *spec = ctx;
+    return lock_file(spec->lock_path);
+}
+
+static void store_unlock(int lock, const void *ctx) {
+    (void)ctx;
+    unlock_file(lock);
+}
+
+/*
+ * Open a data file as a record store keyed by the int at key_offset.
+ * Legacy headerless files are migrated by one full load first. Returns
+ * NULL if the file is damaged, or missing and flags lacks RS_WRITE.
+ */
+RecordStore* datafile_store_open(const DataFileSpec *spec, const char *index_path,
+                                 size_t key_offset, int flags) {
+    if (datafile_record_count(spec) < 0) {
+        size_t n;
+        free(datafile_load(spec, &n));
+        if (datafile_record_count(spec) < 0) return NULL;
+    }
+    RsLayout layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.record_size = spec->record_size;
+    layout.key_offset = key_offset;
+    layout.key_size = sizeof(int);
+    layout.data_offset = sizeof(DataFileHeader);
+    layout.page_header = sizeof(DataBlockHeader);
+    layout.records_per_page = datafile_records_per_block(spec->record_size);
+    layout.read_count = store_read_count;
+    layout.write_count = store_write_count;
+    layout.check_page = store_check_page;
+    layout.seal_page = store_seal_page;
+    layout.ctx = spec;
+    if (spec->lock_path) {
+        layout.lock = store_lock;
+        layout.unlock = store_unlock;
+    }
+    return rs_open(spec->path, index_path, &layout, flags);
+}
+
+/* ---------- Data file self-test ---------- */
+
+static uint64_t selftest_next(uint64_t *rng) {
+    *rng ^= *rng << 13; *rng ^= *rng >> 7; *rng ^= *rng << 17;
+    return *rng;
+}
+
+static void selftest_fill(uint64_t *rng, void *buf, size_t len) {
+    unsigned char *p = buf;
+    for (size_t i = 0; i < len; ++i) p[i] = (unsigned char)(selftest_next(rng) >> 24);
+}
+
+/* 1 unless selftest.dat loads back as exactly the n records in model */
+static int selftest_differs(const DataFileSpec *spec, const unsigned char *model, size_t n) {
+    size_t count;
+    unsigned char *back = datafile_load(spec, &count);
+    int differs = count != n || (n > 0 && (!back || memcmp(back, model, n * spec->record_size) != 0));
+    free(back);
+    return differs || datafile_record_count(spec) != (int64_t)n;
+}
+
+/*
+ * Append n_extra records, then undo part of the append as a crash would
+ * have left it: only the file header (header_only), or everything before
+ * the new records with the file cut somewhere inside them. 0 on success.
+ */
+static int selftest_torn_append(const DataFileSpec *spec, const unsigned char *extra, size_t n_extra,
+                                int header_only, uint64_t *rng) {
+    FILE *f = fopen(spec->path, "rb");
+    long old_size = f ? datafile_size(f) : -1;
+    unsigned char *old = old_size > 0 ? malloc((size_t)old_size) : NULL;
+    int ok = old && fread(old, 1, (size_t)old_size, f) == (size_t)old_size;
+    if (f) fclose(f);
+    ok = ok && datafile_append(spec, extra, n_extra) == 0;
+    f = ok ? fopen(spec->path, "rb+") : NULL;
+    long new_size = f ? datafile_size(f) : -1;
+    ok = ok && f && new_size > old_size;
+    if (ok && header_only) {
+        /* died just before the file header: the last block already covers the new records */
+        ok = fwrite(old, sizeof(DataFileHeader), 1, f) == 1;
+    } else if (ok) {
+        /* died while writing the records: nothing before them was touched yet */
+        long cut = old_size + (long)(selftest_next(rng) % (uint64_t)(new_size - old_size));
+        ok = fwrite(old, 1, (size_t)old_size, f) == (size_t)old_size && datafile_truncate(f, (uint64_t)cut) == 0;
+    }
+    if (f && fclose(f) != 0) ok = 0;
+    free(old);
+    return ok ? 0 : -1;
+}
+
+/* random records of one kind through save, chunked appends and record/block rewrites */
+static long selftest_datafile(const DataFileSpec *real, uint64_t *rng) {
+    DataFileSpec spec = *real;
+    spec.path = "selftest.dat";
+    spec.lock_path = "selftest.lock";
+    size_t rs = spec.record_size, per_block = datafile_records_per_block(rs);
+    size_t sizes[6] = { 0, 1, per_block - 1, per_block, per_block + 1,
+                        2 * per_block + (size_t)(selftest_next(rng) % per_block) };
+    size_t n = sizes[selftest_next(rng) % 6];
+    unsigned char *model = malloc((n ? n : 1) * rs), *rec = malloc(rs);
+    long errors = 0;
+    if (!model || !rec) {
+        free(model);
+        free(rec);
+        return 1;
+    }
+    selftest_fill(rng, model, n * rs);
+
+    remove(spec.path);
+    if (datafile_save(&spec, model, n) != 0 || selftest_differs(&spec, model, n)) errors++;
+
+    remove(spec.path);
+    for (size_t done = 0; done < n;) {
+        size_t chunk = 1 + (size_t)(selftest_next(rng) % (per_block + 2));
+        if (chunk > n - done) chunk = n - done;
+        if (datafile_append(&spec, model + done * rs, chunk) != 0) {
+            errors++;
+            break;
+        }
+        done += chunk;
+    }
+    if (selftest_differs(&spec, model, n)) errors++;
+
+    /* an append cut short must read back as if it never happened, and not block the next one */
+    if (n > 0) {
+        size_t extra = 1 + (size_t)(selftest_next(rng) % (per_block + 2));
+        unsigned char *junk = malloc(extra * rs);
+        if (junk) selftest_fill(rng, junk, extra * rs);
+        if (!junk || selftest_torn_append(&spec, junk, extra, (int)(selftest_next(rng) & 1), rng) != 0 ||
+            selftest_differs(&spec, model, n))
+            errors++;
+        free(junk);
+        if (datafile_append(&spec, model + (n - 1) * rs, 1) != 0 || datafile_record_count(&spec) != (int64_t)n + 1 ||
+            datafile_save(&spec, model, n) != 0)
+            errors++;
+    }
+
+    if (n > 0) {
+        uint64_t i = selftest_next(rng) % n, first;
+        size_t count;
+        selftest_fill(rng, model + i * rs, rs);
+        if (datafile_write_record(&spec, i, model + i * rs) != 0 || datafile_read_record(&spec, i, rec) != 0 ||
+            memcmp(rec, model + i * rs, rs) != 0)
+            errors++;
+        unsigned char *block = datafile_read_block(&spec, selftest_next(rng) % n, &first, &count);
+        if (!block || first % per_block != 0 || first + count > n ||
+            memcmp(block, model + first * rs, count * rs) != 0) {
+            errors++;
+        } else {
+            selftest_fill(rng, block, count * rs);
+            memcpy(model + first * rs, block, count * rs);
+            if (datafile_write_block(&spec, first, block, count) != 0) errors++;
+        }
+        free(block);
+        if (selftest_differs(&spec, model, n)) errors++;
+    }
+    free(model);
+    free(rec);
+    remove(spec.path);
+    remove(spec.lock_path);
+    return errors;
+}
+
+/* double-priced menu and order records, with and without a header, must convert to exact cents */
+static long selftest_migration(uint64_t *rng, int headerless) {
+    DataFileSpec legacy_menu = LEGACY_MENU_SPEC, menu = MENU_SPEC;
+    DataFileSpec legacy_orders = LEGACY_ORDER_SPEC, orders = ORDER_SPEC;
+    legacy_menu.path = menu.path = legacy_orders.path = orders.path = "selftest.dat";
+    legacy_menu.lock_path = menu.lock_path = legacy_orders.lock_path = orders.lock_path = "selftest.lock";
+    size_t n = 1 + (size_t)(selftest_next(rng) % 40), count;
+    LegacyMenuItem *old_items = calloc(n, sizeof(LegacyMenuItem));
+    LegacyOrder *old_orders = calloc(n, sizeof(LegacyOrder));
+    int64_t *cents = malloc(n * (MAX_ITEMS_PER_ORDER + 1) * sizeof(int64_t));
+    long errors = 0;
+    if (!old_items || !old_orders || !cents) {
+        free(old_items);
+        free(old_orders);
+        free(cents);
+        return 1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        int64_t *c = &cents[i * (MAX_ITEMS_PER_ORDER + 1)];
+        c[0] = (int64_t)(selftest_next(rng) % (PRICE_MAX_CENTS + 1));
+        old_items[i].id = (int)i + 1;
+        snprintf(old_items[i].name, MAX_NAME_LEN, "Item %zu", i);
+        old_items[i].price = (double)c[0] / 100.0;
+        old_items[i].available = (int)(selftest_next(rng) & 1);
+        old_orders[i].order_id = (int)i + 1;
+        old_orders[i].num_items = (int)(selftest_next(rng) % 60) - 5;
+        for (int k = 0; k < MAX_ITEMS_PER_ORDER; ++k) {
+            c[k + 1] = (int64_t)(selftest_next(rng) % (PRICE_MAX_CENTS + 1));
+            old_orders[i].items[k].item_id = k + 1;
+            old_orders[i].items[k].qty = 1;
+            old_orders[i].items[k].item_price = (double)c[k + 1] / 100.0;
+        }
+        old_orders[i].total = old_items[i].price;
+    }
+
+    for (int pass = 0; pass < 2; ++pass) {
+        const DataFileSpec *legacy = pass == 0 ? &legacy_menu : &legacy_orders;
+        const void *records = pass == 0 ? (const void *)old_items : (const void *)old_orders;
+        remove(legacy->path);
+        if (headerless) {
+            FILE *f = fopen(legacy->path, "wb");
+            if (!f || fwrite(records, legacy->record_size, n, f) != n) errors++;
+            if (f) fclose(f);
+        } else if (datafile_save(legacy, records, n) != 0) {
+            errors++;
+        }
+        if (pass == 0 ? migrate_price_file(legacy, &menu, "selftest.idx", convert_legacy_menu) != 0
+                      : migrate_price_file(legacy, &orders, "selftest.idx", convert_legacy_order) != 0)
+            errors++;
+        void *back = datafile_load(pass == 0 ? &menu : &orders, &count);
+        if (!back || count != n) {
+            errors++;
+        } else if (pass == 0) {
+            const MenuItem *m = back;
+            for (size_t i = 0; i < n; ++i)
+                if (m[i].id != old_items[i].id || m[i].price_cents != cents[i * (MAX_ITEMS_PER_ORDER + 1)] ||
+                    m[i].available != old_items[i].available || strcmp(m[i].name, old_items[i].name) != 0)
+                    errors++;
+        } else {
+            const Order *o = back;
+            for (size_t i = 0; i < n; ++i) {
+                int want = old_orders[i].num_items < 0 ? 0 : old_orders[i].num_items > MAX_ITEMS_PER_ORDER ?
+                           MAX_ITEMS_PER_ORDER : old_orders[i].num_items;
+                if (o[i].order_id != old_orders[i].order_id || o[i].num_items != want ||
+                    o[i].total_cents != cents[i * (MAX_ITEMS_PER_ORDER + 1)])
+                    errors++;
+                for (int k = 0; k < o[i].num_items; ++k)
+                    if (o[i].items[k].unit_cents != cents[i * (MAX_ITEMS_PER_ORDER + 1) + k + 1]) errors++;
+            }
+        }
+        free(back);
+    }
+    free(old_items);
+    free(old_orders);
+    free(cents);
+    remove("selftest.dat");
+    remove("selftest.idx");
+    remove("selftest.lock");
+    return errors;
+}
+
+/* menu items put and read back through the record store on the data file framing */
+static long selftest_store(uint64_t *rng, long ops) {
+    DataFileSpec spec = MENU_SPEC;
+    spec.path = "selftest.dat";
+    spec.lock_path = "selftest.lock";
+    enum { KEYS = 700 };                /* a little over one block */
+    MenuItem *model = calloc(KEYS + 1, sizeof(MenuItem));   /* id 0 = never stored */
+    MenuItem item;
+    long errors = 0, live = 0;
+    remove(spec.path);
+    remove("selftest.idx");
+    RecordStore *rs = model ? datafile_store_open(&spec, "selftest.idx", offsetof(MenuItem, id), RS_WRITE) : NULL;
+    for (long i = 0; rs && i < ops; ++i) {
+        int key = 1 + (int)(selftest_next(rng) % KEYS);
+        if (selftest_next(rng) & 1) {
+            selftest_fill(rng, &item, sizeof(item));
+            item.id = key;
+            if (rs_put(rs, &item) != 0) errors++;
+            live += model[key].id == 0;
+            model[key] = item;
+        } else {
+            int rc = rs_get(rs, &key, &item);
+            if (rc != (model[key].id != 0) || (rc == 1 && memcmp(&item, &model[key], sizeof(item)) != 0)) errors++;
+        }
+        if (i % 512 == 511) {
+            if (rs_close(rs) != 0) errors++;
+            rs = datafile_store_open(&spec, "selftest.idx", offsetof(MenuItem, id), RS_WRITE);
+        }
+    }
+    if (!rs || rs_close(rs) != 0) errors++;
+
+    size_t count;
+    MenuItem *back = datafile_load(&spec, &count);
+    if (count != (size_t)live) errors++;
+    for (size_t i = 0; back && i < count; ++i)
+        if (back[i].id < 1 || back[i].id > KEYS || memcmp(&back[i], &model[back[i].id], sizeof(MenuItem)) != 0)
+            errors++;
+    free(back);
+    free(model);
+    remove(spec.path);
+    remove("selftest.idx");
+    remove(spec.lock_path);
+    return errors;
+}
+
+/* a random menu, rule set and baskets: quotes must add up and not depend on line order or the cache */
+static long selftest_pricing(uint64_t *rng, PricingEngine *cached, PricingEngine *fresh, Order *a, Order *b) {
+    static const char *categories[] = { "Mains", "Drinks", "drinks", "" };
+    enum { ITEMS = 24 };
+    MenuItem menu[ITEMS];
+    PriceRule rules[10];
+    size_t n_rules = (size_t)(selftest_next(rng) % 11);
+    long errors = 0;
+    memset(menu, 0, sizeof(menu));
+    memset(rules, 0, sizeof(rules));
+    for (int i = 0; i < ITEMS; ++i) {
+        menu[i].id = i + 1;
+        snprintf(menu[i].category, MAX_CATEGORY_LEN, "%s", categories[selftest_next(rng) % 4]);
+        menu[i].price_cents = (int64_t)(selftest_next(rng) % 100000);
+    }
+    for (size_t r = 0; r < n_rules; ++r) {
+        rules[r].kind = 1 + (int)(selftest_next(rng) % 3);
+        snprintf(rules[r].category, MAX_CATEGORY_LEN, "%s", categories[selftest_next(rng) % 4]);
+        rules[r].rate_bp = (int32_t)(selftest_next(rng) % 10500);    /* a few out of range */
+        rules[r].start_minute = (int16_t)(selftest_next(rng) % 1441);
+        rules[r].end_minute = (int16_t)(selftest_next(rng) % 1441);
+        rules[r].days = (int32_t)(selftest_next(rng) & 0x7f);
+        rules[r].item_id = selftest_next(rng) % 3 == 0 ? 1 + (int)(selftest_next(rng) % ITEMS) : 0;
+        rules[r].amount_cents = (int64_t)(selftest_next(rng) % 5000);
+        for (int c = 0; c < PRICE_COMBO_MAX; ++c) {
+            rules[r].combo_item[c] = (int)(selftest_next(rng) % (ITEMS / 3));
+            rules[r].combo_qty[c] = 1 + (int)(selftest_next(rng) % 3);
+        }
+    }
+    if (pricing_load(cached, menu, ITEMS, rules, n_rules) != 0 || pricing_load(fresh, menu, ITEMS, rules, n_rules) != 0)
+        return 1;
+    QuoteCacheEntry *cache = fresh->cache;
+    fresh->cache = NULL;
+
+    for (int basket = 0; basket < 50; ++basket) {
+        time_t when = (time_t)(1700000000 + selftest_next(rng) % (7 * 24 * 3600));
+        memset(a, 0, sizeof(*a));
+        a->num_items = 1 + (int)(selftest_next(rng) % 12);
+        for (int k = 0; k < a->num_items; ++k) {
+            a->items[k].item_id = 1 + (int)(selftest_next(rng) % (ITEMS / 2));
+            a->items[k].qty = 1 + (int)(selftest_next(rng) % 5);
+        }
+        *b = *a;
+        for (int k = b->num_items - 1; k > 0; --k) {
+            int j = (int)(selftest_next(rng) % (uint64_t)(k + 1));
+            OrderItem t = b->items[k];
+            b->items[k] = b->items[j];
+            b->items[j] = t;
+        }
+        if (pricing_quote(cached, a, when) != 0 || pricing_quote(cached, a, when) != 0 ||
+            pricing_quote(fresh, b, when) != 0) {
+            errors++;
+            continue;
+        }
+        int64_t sub = 0, disc = 0;
+        for (int k = 0; k < a->num_items; ++k) {
+            const OrderItem *oi = &a->items[k];
+            sub += oi->unit_cents * oi->qty;
+            disc += oi->discount_cents;
+            if (oi->unit_cents < 0 || oi->unit_cents > oi->list_cents || oi->discount_cents < 0 ||
+                oi->discount_cents > oi->unit_cents * oi->qty)
+                errors++;
+        }
+        if (sub != a->subtotal_cents || disc != a->discount_cents || a->tax_cents < 0 ||
+            a->total_cents != a->subtotal_cents - a->discount_cents + a->tax_cents ||
+            a->subtotal_cents != b->subtotal_cents || a->discount_cents != b->discount_cents ||
+            a->tax_cents != b->tax_cents || a->total_cents != b->total_cents)
+            errors++;
+    }
+    fresh->cache = cache;
+    return errors;
+}
+
+/*
+ * Property checks of everything that reads or writes the data files, on
+ * scratch files (selftest.dat/.idx) in the working directory: `rounds`
+ * rounds of random records for each file kind, the cents migration, the
+ * record store hooks, money formatting, the pricing engine and the
+ * sanitizers. Returns 0 if every property held.
+ */
+int datafile_selftest(long rounds) {
+    const DataFileSpec *kinds[] = { &MENU_SPEC, &ORDER_SPEC, &PRICE_RULE_SPEC, &CUSTOMER_INDEX_SPEC };
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+    PricingEngine cached, fresh;
+    Order *a = malloc(sizeof(Order)), *b = malloc(sizeof(Order));
+    long errors = 0;
+    memset(&cached, 0, sizeof(cached));
+    memset(&fresh, 0, sizeof(fresh));
+    if (!a || !b) {
+        free(a);
+        free(b);
+        printf("file self-test: out of memory\n");
+        return 1;
+    }
+    for (long r = 0; r < rounds && errors < 10; ++r) {
+        for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); ++k) errors += selftest_datafile(kinds[k], &rng);
+        if (r < 2) errors += selftest_migration(&rng, r == 0);
+
+        for (int i = 0; i < 100; ++i) {
+            char text[32];
+            int64_t c = (int64_t)(selftest_next(&rng) % (i < 50 ? 100000 : 10000000000000ull)), back;
+            snprintf(text, sizeof(text), "%.2f", money(c));
+            if (parse_money(text, &back) != 0 || back != c) errors++;
+        }
+        errors += selftest_pricing(&rng, &cached, &fresh, a, b);
+
+        selftest_fill(&rng, a, sizeof(*a));
+        sanitize_order(a);
+        if (a->num_items < 0 || a->num_items > MAX_ITEMS_PER_ORDER ||
+            memchr(a->customer_name, '\0', MAX_NAME_LEN) == NULL)
+            errors++;
+        for (int k = 0; k < a->num_items; ++k)
+            if (memchr(a->items[k].item_name, '\0', MAX_NAME_LEN) == NULL) errors++;
+    }
+    errors += selftest_store(&rng, rounds * 50);
+    printf("file self-test: %ld rounds, %s\n", rounds, errors ? "FAILED" : "ok");
+    pricing_free(&cached);
+    pricing_free(&fresh);
+    free(a);
+    free(b);
+    return errors ? 1 : 0;
+}
+
+/* copy a legacy record field by field so padding bytes end up zeroed */
+void normalize_legacy_menu_item(void *record) {
+    LegacyMenuItem in, out;
+    memcpy(&in, record, sizeof(in));
+    memset(&out, 0, sizeof(out));
+    out.id = in.id;
+    memcpy(out.name, in.name, MAX_NAME_LEN - 1);
+    memcpy(out.category, in.category, MAX_CATEGORY_LEN - 1);
+    out.price = in.price;
+    out.available = in.available ? 1 : 0;
+    memcpy(record, &out, sizeof(out));
+}
+
+void normalize_legacy_order(void *record) {
+    LegacyOrder in, out;
+    memcpy(&in, record, sizeof(in));
+    memset(&out, 0, sizeof(out));
+    out.order_id = in.order_id;
+    memcpy(out.customer_name, in.customer_name, MAX_NAME_LEN - 1);
+    out.num_items = in.num_items < 0 ? 0 :
+                    in.num_items > MAX_ITEMS_PER_ORDER ? MAX_ITEMS_PER_ORDER : in.num_items;
+    for (int i = 0; i < out.num_items; ++i) {
+        out.items[i].item_id = in.items[i].item_id;
+        out.items[i].qty = in.items[i].qty;
+        out.items[i].item_price = in.items[i].item_price;
+        memcpy(out.items[i].item_name, in.items[i].item_name, MAX_NAME_LEN - 1);
+    }
+    out.subtotal = in.subtotal;
+    out.tax = in.tax;
+    out.total = in.total;
+    out.timestamp = in.timestamp;
+    memcpy(record, &out, sizeof(out));
+}
+
+/*
+ * Records read back from disk: strings end inside their fields and
+ * num_items fits items[], whatever the file holds. Amounts are left alone;
+ * the pricing engine ignores menu prices outside 0..PRICE_MAX_CENTS.
+ */
+void sanitize_menu_item(MenuItem *item) {
+    item->name[MAX_NAME_LEN - 1] = '\0';
+    item->category[MAX_CATEGORY_LEN - 1] = '\0';
+}
+
+void sanitize_order(Order *order) {
+    order->customer_name[MAX_NAME_LEN - 1] = '\0';
+    if (order->num_items < 0) order->num_items = 0;
+    if (order->num_items > MAX_ITEMS_PER_ORDER) order->num_items = MAX_ITEMS_PER_ORDER;
+    for (int i = 0; i < order->num_items; ++i) order->items[i].item_name[MAX_NAME_LEN - 1] = '\0';
+}
+
+void normalize_cents_record(void *record) {
+    (void)record;                       /* cent-priced files always had a header */
+}
+
+void normalize_admin_cred(void *record) {
+    (void)record;                       /* hashed records never existed headerless */
+}
+
+void normalize_recipe_line(void *record) {
+    (void)record;                       /* recipes.dat always had a header */
+}
+
+void normalize_customer_record(void *record) {
+    (void)record;                       /* the customer index files always had a header */
+}
+
+void normalize_legacy_admin_cred(void *record) {
+    LegacyAdminCred *cred = record;
+    cred->password[sizeof(cred->password) - 1] = '\0';
+    size_t len = strlen(cred->password);
+    memset(cred->password + len, 0, sizeof(cred->password) - len);
+}
+
+/* ---------- Utility helpers ---------- */
+
+void safe_input(char *buffer, size_t size) {
+    if (!fgets(buffer, (int)size, stdin)) {
+        /* input error, ensure empty string */
+        buffer[0] = '\0';
+        return;
+    }
+    /* strip newline if present */
+    size_t len = strlen(buffer);
+    if (len > 0 && buffer[len - 1] == '\n') buffer[len - 1] = '\0';
+}
+
+/* ---------- Fuzz targets ---------- */
+
+#ifdef LAB_FUZZ
+
+/*
+ * The first input byte picks how the rest becomes a data file: even, the
+ * bytes are the file as they are; odd, they are records, saved with a
+ * valid header and checksums so the fuzzer reaches the code behind them.
+ */
+static void fuzz_write_file(const DataFileSpec *spec, const uint8_t *data, size_t size) {
+    if (size == 0 || data[0] % 2 == 0) {
+        lab_fuzz_write(spec->path, size ? data + 1 : data, size ? size - 1 : 0);
+        return;
+    }
+    size_t count = (size - 1 + spec->record_size - 1) / spec->record_size;
+    unsigned char *records = calloc(count ? count : 1, spec->record_size);
+    if (!records) return;
+    memcpy(records, data + 1, size - 1);
+    remove(spec->path);
+    datafile_save(spec, records, count);
+    free(records);
+}
+
+/* one basket of the first items of `menu`, priced with and without rules */
+static void fuzz_quote(const MenuItem *menu, size_t n, const PriceRule *rules, size_t n_rules) {
+    static Order order;
+    PricingEngine pe;
+    memset(&pe, 0, sizeof(pe));
+    memset(&order, 0, sizeof(order));
+    if (pricing_load(&pe, menu, n, rules, n_rules) != 0) return;
+    for (size_t i = 0; i < n && i < 8; ++i) {
+        order.items[order.num_items].item_id = menu[i].id;
+        order.items[order.num_items++].qty = 1 + (int)(i % 3);
+    }
+    if (order.num_items > 0 && pricing_quote(&pe, &order, (time_t)1700000000) == 0)
+        print_order_summary(1, &order);
+    pricing_free(&pe);
+}
+
+int lab_fuzz_one(const char *target, const uint8_t *data, size_t size) {
+    static const char *scratch[] = {
+        MENU_FILE, MENU_INDEX_FILE, ORDER_FILE, ORDER_INDEX_FILE, PRICING_FILE, ADMIN_FILE,
+        CUSTOMER_INDEX_FILE, CUSTOMER_LINK_FILE, MENU_FILE ".cents", ORDER_FILE ".cents"
+    };
+    static Order recent[CUSTOMER_RECENT_ORDERS];
+    CustomerSlot info;
+    size_t count;
+    for (size_t i = 0; i < sizeof(scratch) / sizeof(scratch[0]); ++i) remove(scratch[i]);
+
+    if (strcmp(target, "menu") == 0) {
+        fuzz_write_file(&MENU_SPEC, data, size);
+        if (migrate_price_files() != 0) return 0;
+        admin_view_menu();
+        MenuItem *menu = load_all_menu_items(&count);
+        if (menu) {
+            free(find_menu_item_by_id(menu[count - 1].id));
+            fuzz_quote(menu, count, NULL, 0);
+        }
+        free(menu);
+    } else if (strcmp(target, "orders") == 0) {
+        fuzz_write_file(&ORDER_SPEC, data, size);
+        if (migrate_price_files() != 0) return 0;
+        admin_view_orders();
+        Order *orders = load_all_orders(&count);
+        int n = orders ? customer_recent_orders(orders[0].customer_name, recent, CUSTOMER_RECENT_ORDERS, &info) : 0;
+        for (int i = 0; i < n; ++i) print_order_summary(i + 1, &recent[i]);
+        free(orders);
+    } else if (strcmp(target, "pricing") == 0) {
+        static const MenuItem menu[3] = {
+            { 1, "Burger", "Mains", 1, 899 }, { 2, "Fries", "Sides", 1, 349 }, { 3, "Cola", "Drinks", 1, 199 }
+        };
+        fuzz_write_file(&PRICE_RULE_SPEC, data, size);
+        PriceRule *rules = load_price_rules(&count);
+        if (count == (size_t)-1) return 0;
+        admin_list_price_rules(rules, count);
+        fuzz_quote(menu, 3, rules, count);
+        free(rules);
+    } else if (strcmp(target, "customers") == 0) {
+        static Order orders[3];
+        const uint8_t *slots, *links;
+        size_t slots_size, links_size;
+        memset(orders, 0, sizeof(orders));
+        for (int i = 0; i < 3; ++i) {
+            orders[i].order_id = i + 1;
+            snprintf(orders[i].customer_name, MAX_NAME_LEN, "%s", i == 1 ? "Bob" : "Ann");
+            orders[i].num_items = 1;
+            orders[i].items[0].item_id = 1;
+            orders[i].items[0].qty = 1;
+        }
+        datafile_save(&ORDER_SPEC, orders, 3);
+        lab_fuzz_split(data, size, &slots, &slots_size, &links, &links_size);
+        fuzz_write_file(&CUSTOMER_INDEX_SPEC, slots, slots_size);
+        fuzz_write_file(&CUSTOMER_LINK_SPEC, links, links_size);
+        int n = customer_recent_orders("ann", recent, CUSTOMER_RECENT_ORDERS, &info);
+        for (int i = 0; i < n; ++i) print_order_summary(i + 1, &recent[i]);
+    } else if (strcmp(target, "admin") == 0) {
+        AdminCred cred;
+        LegacyAdminCred legacy;
+        int is_legacy;
+        fuzz_write_file(&ADMIN_SPEC, data, size);
+        if (load_admin_cred(&cred, &legacy, &is_legacy) == 0 && is_legacy)
+            printf("legacy password of %zu characters\n", strlen(legacy.password));
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+#endif /* LAB_FUZZ */
+
 /* ---------- End of File ---------- */
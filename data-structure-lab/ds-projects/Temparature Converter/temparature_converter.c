@@ -3,17 +3,104 @@
 *   Language Used: C
 *   Author       : Md. Shahat Akash
 *   Date         : 26 January, 2023
+*
+*   Batch mode   : temparature_converter --batch PAIRS [options] [input [output]]
+*                  PAIRS is one pair for every value, or a comma separated list
+*                  with one pair per column (e.g. "C:F,F:K,-"). A pair is
+*                  FROM:TO with scales C F K R Re De N Ro, one of c2f c2k f2c
+*                  f2k k2c k2f (or the menu number 1-6), or "-" for unchanged.
+*                  With several columns text output keeps the lines, values
+*                  tab separated; binary input is read as records of one
+*                  value per column.
+*                  Input/output default to stdin/stdout ("-" also means stdin/stdout).
+*                  --in  text|f64|f32   input format (default text, whitespace separated)
+*                  --out text|f64|f32   output format (default text, one "%.2f" per line)
+*                  --isa auto|avx2|sse2|scalar   force a kernel (default auto)
+*                  --threads N          convert a file input on N threads (0 = all
+*                                       CPUs); the file is mmap'ed, split into
+*                                       chunks and written back in order
+*
+*   CSV mode     : temparature_converter --csv COL=PAIR[,COL=PAIR...] [options] [input [output]]
+*                  Converts only the listed columns (counted from 1) of each
+*                  CSV/TSV row and copies every other byte through unchanged,
+*                  so timestamps, IDs, quoting and line endings survive as is.
+*                  Fields that are not numbers (a header row, empty readings)
+*                  and quoted fields are left alone. Same --isa and --threads
+*                  options; --threads assumes no newlines inside quotes.
+*                  --delim C            field delimiter (default ",", "tab" for TSV)
+*
+*   Compile      : gcc -O2 temparature_converter.c -o temparature_converter -pthread
+*                  add -DLAB_INSTRUMENT to time the read, parse, convert,
+*                  format and write stages of batch/CSV mode; the figures go to
+*                  temparature_converter.instr.json on exit
+*
+*   Self-checks  : --selftest-engine [N]   compare the conversion engine with the
+*                                          six menu formulas on N values each
+*                  --selftest-numfmt [N]   compare the fast parser/formatter with
+*                                          strtod/printf on N random values
+*                  --bench-numfmt [N]      time fscanf/fprintf against the fast
+*                                          path on N values (default 100M)
 */
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAVE_PARALLEL 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#endif
+
+// Every kernel rounds x * a and then the sum, so all of them (and every CPU)
+// give the same bits. Keep the compiler from fusing the two into an FMA,
+// which it may do even to intrinsics once -march enables FMA.
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#define NO_FP_CONTRACT
+#elif defined(__GNUC__)
+#define NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define NO_FP_CONTRACT
+#endif
+
+#include "../Instrumentation/lab_instrument.h"
+
+#define BATCH_VALUES   65536            // values converted per kernel call
+#define IO_BUFFER_SIZE (1 << 20)        // bytes per fread/fwrite
+#define FIXED2_MAX_LEN 320              // longest "%.2f" of a double (-1.8e308)
+#define CHUNK_BYTES    (8 << 20)        // input bytes per parallel work item
+#define CHUNKS_PER_THREAD 2             // chunks in flight per worker (reorder window)
+
+enum { FMT_TEXT, FMT_F64, FMT_F32 };
+
+// Reference formulas; the conversion engine is checked against these.
+static double c_to_f(double c) { return (c * 9.0 / 5.0) + 32.0; }
+static double c_to_k(double c) { return c + 273.15; }
+static double f_to_c(double f) { return (f - 32.0) * 5.0 / 9.0; }
+static double f_to_k(double f) { return (f - 32.0) * 5.0 / 9.0 + 273.15; }
+static double k_to_c(double k) { return k - 273.15; }
+static double k_to_f(double k) { return (k - 273.15) * 9.0 / 5.0 + 32.0; }
 
 // 1. Celsius to Fahrenheit
 void celsius_to_fahrenheit() {
     double C, F;
     printf("Enter Celsius Temperature: ");
     scanf("%lf", &C);
-    F = (C * 9.0 / 5.0) + 32.0;
+    F = c_to_f(C);
     printf("\n%.2lf C = %.2lf F\n", C, F);
 }
 
@@ -22,7 +109,7 @@ void celsius_to_kelvin() {
     double C, K;
     printf("Enter Celsius Temperature: ");
     scanf("%lf", &C);
-    K = C + 273.15;
+    K = c_to_k(C);
     printf("\n%.2lf C = %.2lf K\n", C, K);
 }
 
@@ -31,7 +118,7 @@ void fahrenheit_to_celsius() {
     double F, C;
     printf("Enter Fahrenheit Temperature: ");
     scanf("%lf", &F);
-    C = (F - 32.0) * 5.0 / 9.0;
+    C = f_to_c(F);
     printf("\n%.2lf F = %.2lf C\n", F, C);
 }
 
@@ -40,7 +127,7 @@ void fahrenheit_to_kelvin() {
     double F, K;
     printf("Enter Fahrenheit Temperature: ");
     scanf("%lf", &F);
-    K = (F - 32.0) * 5.0 / 9.0 + 273.15;
+    K = f_to_k(F);
     printf("\n%.2lf F = %.2lf K\n", F, K);
 }
 
@@ -49,7 +136,7 @@ void kelvin_to_celsius() {
     double K, C;
     printf("Enter Kelvin Temperature: ");
     scanf("%lf", &K);
-    C = K - 273.15;
+    C = k_to_c(K);
     printf("\n%.2lf K = %.2lf C\n", K, C);
 }
 
@@ -58,12 +145,1420 @@ void kelvin_to_fahrenheit() {
     double K, F;
     printf("Enter Kelvin Temperature: ");
     scanf("%lf", &K);
-    F = (K - 273.15) * 9.0 / 5.0 + 32.0;
+    F = k_to_f(K);
     printf("\n%.2lf K = %.2lf F\n", K, F);
 }
 
+// ---------------------------------------------------------------------------
+// Number parsing and formatting
+// ---------------------------------------------------------------------------
+
+// Powers of ten that are exact in a double.
+static const double POW10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Parse a plain decimal number ([+-]digits[.digits][e[+-]digits]) starting at p.
+// Uses Clinger's fast path: when the significand fits in 53 bits and the power
+// of ten is exact, a single multiply/divide is correctly rounded, i.e. the same
+// result strtod gives. Returns the end of the number, or NULL when the text is
+// not in that form or needs strtod's slow path (inf/nan, hex, >19 digits, ...).
+// Locale independent: '.' is always the decimal point.
+static const char *fast_parse_double(const char *p, const char *end, double *out) {
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+    uint64_t mant = 0;
+    int digits = 0, frac_digits = 0, seen = 0;
+    while (p < end && (unsigned)(*p - '0') < 10) {
+        if (digits || *p != '0') {
+            if (++digits > 19) return NULL;
+            mant = mant * 10 + (uint64_t)(*p - '0');
+        }
+        seen = 1;
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && (unsigned)(*p - '0') < 10) {
+            if (digits || *p != '0') {
+                if (++digits > 19) return NULL;
+                mant = mant * 10 + (uint64_t)(*p - '0');
+            }
+            frac_digits++;
+            seen = 1;
+            p++;
+        }
+    }
+    if (!seen) return NULL;
+
+    int exp10 = 0;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char *q = p + 1;
+        int eneg = 0;
+        if (q < end && (*q == '-' || *q == '+')) eneg = *q++ == '-';
+        if (q >= end || (unsigned)(*q - '0') >= 10) return NULL;
+        while (q < end && (unsigned)(*q - '0') < 10) {
+            if (exp10 < 10000) exp10 = exp10 * 10 + (*q - '0');
+            q++;
+        }
+        if (eneg) exp10 = -exp10;
+        p = q;
+    }
+    exp10 -= frac_digits;
+
+    double v;
+    if (mant == 0) {
+        v = 0.0;
+    } else if (mant > ((uint64_t)1 << 53)) {
+        return NULL;
+    } else if (exp10 >= 0 && exp10 <= 22) {
+        v = (double)mant * POW10[exp10];
+    } else if (exp10 < 0 && exp10 >= -22) {
+        v = (double)mant / POW10[-exp10];
+    } else if (exp10 > 22 && exp10 <= 22 + 15) {
+        // move the extra power into the significand if that stays exact
+        uint64_t scaled = mant;
+        for (int i = 22; i < exp10; i++) {
+            if (scaled > ((uint64_t)1 << 53) / 10) return NULL;
+            scaled *= 10;
+        }
+        v = (double)scaled * 1e22;
+    } else {
+        return NULL;
+    }
+    *out = neg ? -v : v;
+    return p;
+}
+
+// Write x with exactly two decimals, byte-for-byte what printf("%.2f") prints,
+// and return the length. The double's exact binary value is rounded to cents
+// in integer arithmetic (ties to even, like glibc). Values that are not finite
+// or too large for that fall back to snprintf. `out` needs FIXED2_MAX_LEN bytes.
+static size_t format_fixed2(double x, char *out) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int neg = (int)(bits >> 63);
+    int bexp = (int)((bits >> 52) & 0x7FF);
+    uint64_t frac = bits & (((uint64_t)1 << 52) - 1);
+    if (bexp == 0x7FF || bexp >= 1023 + 50)    // non-finite or >= 2^50
+        return (size_t)snprintf(out, FIXED2_MAX_LEN, "%.2f", x);
+
+    // x = m * 2^e exactly
+    uint64_t m = bexp ? frac | ((uint64_t)1 << 52) : frac;
+    int e = bexp ? bexp - 1075 : -1074;
+    uint64_t p = m * 100;                      // < 2^60, no overflow
+    uint64_t cents;
+    if (e >= 0) {
+        cents = p << e;                        // e < 0 here unless x >= 2^52
+    } else if (-e >= 62) {
+        cents = 0;                             // below half a cent
+    } else {
+        int sh = -e;
+        uint64_t q = p >> sh, rem = p & (((uint64_t)1 << sh) - 1);
+        uint64_t half = (uint64_t)1 << (sh - 1);
+        if (rem > half || (rem == half && (q & 1))) q++;
+        cents = q;
+    }
+
+    char tmp[24];
+    int n = 0;
+    uint64_t whole = cents / 100;
+    unsigned c = (unsigned)(cents % 100);
+    tmp[n++] = (char)('0' + c % 10);
+    tmp[n++] = (char)('0' + c / 10);
+    tmp[n++] = '.';
+    do {
+        tmp[n++] = (char)('0' + whole % 10);
+        whole /= 10;
+    } while (whole);
+    size_t len = 0;
+    if (neg) out[len++] = '-';
+    while (n) out[len++] = tmp[--n];
+    return len;
+}
+
+// Small deterministic generator for the self-test and benchmark corpora.
+static uint64_t rng_state = 0x9E3779B97F4A7C15ull;
+
+static uint64_t rng_next(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+static double rng_uniform(double lo, double hi) {
+    return lo + (hi - lo) * (double)(rng_next() >> 11) / 9007199254740992.0;
+}
+
+// A random double drawn from the shapes that matter for the two routines:
+// typical readings, exact binary ties (k/8), arbitrary bit patterns.
+static double rng_test_value(void) {
+    uint64_t bits;
+    double v;
+    switch (rng_next() % 5) {
+    case 0:  return rng_uniform(-500.0, 5000.0);
+    case 1:  return (double)((int64_t)(rng_next() % 200001) - 100000) / 8.0;
+    case 2:  return rng_uniform(-1e-3, 1e-3);
+    case 3:  return rng_uniform(-1e16, 1e16);
+    default:
+        do {
+            bits = rng_next();
+            memcpy(&v, &bits, sizeof(v));
+        } while (v != v || v - v != 0.0);       // skip NaN and infinities
+        return v;
+    }
+}
+
+// Compare fast_parse_double/format_fixed2 with strtod/snprintf on n random
+// inputs. Returns the number of mismatches.
+static long selftest_numfmt(long n) {
+    long parse_bad = 0, fmt_bad = 0, slow = 0;
+    char text[128], mine[FIXED2_MAX_LEN], ref[FIXED2_MAX_LEN];
+    for (long i = 0; i < n; i++) {
+        double v = rng_test_value();
+
+        // parser: print v in a random style, read it back both ways
+        int prec = (int)(rng_next() % 18);
+        switch (rng_next() % 4) {
+        case 0:  snprintf(text, sizeof(text), "%.*f", prec % 7, v); break;
+        case 1:  snprintf(text, sizeof(text), "%.*e", prec, v); break;
+        case 2:  snprintf(text, sizeof(text), "%.*g", prec + 1, v); break;
+        default:
+            snprintf(text, sizeof(text), "%lldE%d", (long long)(rng_next() % 100000000000ull),
+                     (int)(rng_next() % 80) - 40);
+        }
+        size_t tlen = strlen(text);
+        double fast, slowv = strtod(text, NULL);
+        const char *end = fast_parse_double(text, text + tlen, &fast);
+        if (!end) {
+            slow++;
+        } else if (end != text + tlen || memcmp(&fast, &slowv, sizeof(double)) != 0) {
+            if (parse_bad++ < 10) fprintf(stderr, "parse mismatch: \"%s\"\n", text);
+        }
+
+        // formatter
+        size_t len = format_fixed2(v, mine);
+        mine[len] = '\0';
+        snprintf(ref, sizeof(ref), "%.2f", v);
+        if (strcmp(mine, ref) != 0 && fmt_bad++ < 10)
+            fprintf(stderr, "format mismatch: %.17g -> \"%s\" vs \"%s\"\n", v, mine, ref);
+    }
+    printf("%ld values: %ld parse mismatches (%ld left to strtod), %ld format mismatches\n",
+           n, parse_bad, slow, fmt_bad);
+    return parse_bad + fmt_bad;
+}
+
+static double seconds_since(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+// Time the interactive path's fscanf("%lf")/fprintf("%.2lf") against
+// fast_parse_double/format_fixed2 on n readings, 1M at a time.
+static int bench_numfmt(long n) {
+    const long chunk = 1000000;
+    char *text = malloc((size_t)chunk * 32), *outbuf = malloc((size_t)chunk * 32);
+    double *vals = malloc((size_t)chunk * sizeof(double));
+    FILE *tin = tmpfile(), *tout = tmpfile();
+    if (!text || !outbuf || !vals || !tin || !tout) {
+        fprintf(stderr, "Cannot set up benchmark.\n");
+        return 1;
+    }
+    size_t tlen = 0;
+    for (long i = 0; i < chunk; i++)
+        tlen += (size_t)sprintf(text + tlen, "%.2f\n", rng_uniform(-50.0, 150.0));
+    fwrite(text, 1, tlen, tin);
+
+    double t_scanf = 0, t_printf = 0, t_parse = 0, t_format = 0;
+    double check = 0;
+    for (long done = 0; done < n; done += chunk) {
+        long m = n - done < chunk ? n - done : chunk;
+
+        rewind(tin);
+        clock_t t = clock();
+        for (long i = 0; i < m; i++)
+            if (fscanf(tin, "%lf", &vals[i]) != 1) break;
+        t_scanf += seconds_since(t);
+        check += vals[m - 1];
+
+        rewind(tout);
+        t = clock();
+        for (long i = 0; i < m; i++) fprintf(tout, "%.2lf\n", vals[i]);
+        t_printf += seconds_since(t);
+
+        t = clock();
+        const char *p = text, *end = text + tlen;
+        for (long i = 0; i < m; i++) {
+            p = fast_parse_double(p, end, &vals[i]);
+            if (!p) break;
+            p++;                               // the newline
+        }
+        t_parse += seconds_since(t);
+        check += vals[m - 1];
+
+        rewind(tout);
+        t = clock();
+        size_t olen = 0;
+        for (long i = 0; i < m; i++) {
+            olen += format_fixed2(vals[i], outbuf + olen);
+            outbuf[olen++] = '\n';
+        }
+        fwrite(outbuf, 1, olen, tout);
+        t_format += seconds_since(t);
+    }
+    double bytes = (double)tlen * ((double)n / chunk);
+    printf("%ld values (checksum %.2f)\n", n, check);
+    printf("%-22s %10s %10s %10s\n", "", "seconds", "ns/value", "MB/s");
+    printf("%-22s %10.3f %10.1f %10.1f\n", "fscanf(\"%lf\")", t_scanf, t_scanf * 1e9 / n, bytes / t_scanf / 1e6);
+    printf("%-22s %10.3f %10.1f %10.1f\n", "fast_parse_double", t_parse, t_parse * 1e9 / n, bytes / t_parse / 1e6);
+    printf("%-22s %10.3f %10.1f %10.1f\n", "fprintf(\"%.2lf\")", t_printf, t_printf * 1e9 / n, bytes / t_printf / 1e6);
+    printf("%-22s %10.3f %10.1f %10.1f\n", "format_fixed2", t_format, t_format * 1e9 / n, bytes / t_format / 1e6);
+    printf("parse speedup %.1fx, format speedup %.1fx\n", t_scanf / t_parse, t_printf / t_format);
+    free(text);
+    free(outbuf);
+    free(vals);
+    fclose(tin);
+    fclose(tout);
+    return 0;
+}
+
+// ---------------------------------------------------------------------------
+// Conversion engine
+// ---------------------------------------------------------------------------
+
+// Every scale is an affine map to Kelvin: K = (x + OFF) * NUM / DEN.
+#define SCALE_C_OFF   273.15L
+#define SCALE_C_NUM   1.0L
+#define SCALE_C_DEN   1.0L
+#define SCALE_F_OFF   459.67L
+#define SCALE_F_NUM   5.0L
+#define SCALE_F_DEN   9.0L
+#define SCALE_K_OFF   0.0L
+#define SCALE_K_NUM   1.0L
+#define SCALE_K_DEN   1.0L
+#define SCALE_R_OFF   0.0L              // Rankine
+#define SCALE_R_NUM   5.0L
+#define SCALE_R_DEN   9.0L
+#define SCALE_RE_OFF  218.52L           // Reaumur: C = Re * 5/4
+#define SCALE_RE_NUM  5.0L
+#define SCALE_RE_DEN  4.0L
+#define SCALE_DE_OFF  (-559.725L)       // Delisle: C = 100 - De * 2/3
+#define SCALE_DE_NUM  (-2.0L)
+#define SCALE_DE_DEN  3.0L
+#define SCALE_N_OFF   90.1395L          // Newton: C = N * 100/33
+#define SCALE_N_NUM   100.0L
+#define SCALE_N_DEN   33.0L
+#define SCALE_RO_OFF  135.90375L        // Romer: C = (Ro - 7.5) * 40/21
+#define SCALE_RO_NUM  40.0L
+#define SCALE_RO_DEN  21.0L
+
+enum { SCALE_C, SCALE_F, SCALE_K, SCALE_R, SCALE_RE, SCALE_DE, SCALE_N, SCALE_RO, SCALE_COUNT };
+
+static const struct {
+    const char *code;                   // used in batch specs, e.g. "C:F"
+    const char *name;
+    const char *symbol;
+} SCALES[SCALE_COUNT] = {
+    { "C",  "Celsius",    "\xB0" "C"      },
+    { "F",  "Fahrenheit", "\xB0" "F"      },
+    { "K",  "Kelvin",     "K"             },
+    { "R",  "Rankine",    "\xB0" "R"      },
+    { "Re", "Reaumur",    "\xB0" "R\xE9"  },
+    { "De", "Delisle",    "\xB0" "De"     },
+    { "N",  "Newton",     "\xB0" "N"      },
+    { "Ro", "Romer",      "\xB0" "R\xF8"  },
+};
+
+// y = x * a + b
+typedef struct {
+    double a, b;
+} AffinePair;
+
+// Composition f -> Kelvin -> t folded into one affine map:
+//   a = (NUM_f * DEN_t) / (DEN_f * NUM_t),   b = OFF_f * a - OFF_t
+// The compiler evaluates these constant expressions in long double, so the
+// whole table below is generated at compile time.
+#define PAIR_A(f, t) ((SCALE_##f##_NUM * SCALE_##t##_DEN) / (SCALE_##f##_DEN * SCALE_##t##_NUM))
+#define PAIR(f, t)   { (double)PAIR_A(f, t), (double)(SCALE_##f##_OFF * PAIR_A(f, t) - SCALE_##t##_OFF) }
+#define PAIR_ROW(f)  { PAIR(f, C), PAIR(f, F), PAIR(f, K), PAIR(f, R), \
+                       PAIR(f, RE), PAIR(f, DE), PAIR(f, N), PAIR(f, RO) }
+
+static const AffinePair PAIRS[SCALE_COUNT][SCALE_COUNT] = {
+    PAIR_ROW(C), PAIR_ROW(F), PAIR_ROW(K), PAIR_ROW(R),
+    PAIR_ROW(RE), PAIR_ROW(DE), PAIR_ROW(N), PAIR_ROW(RO),
+};
+
+static const AffinePair IDENTITY_PAIR = { 1.0, 0.0 };
+
+// The six conversions of the menu, by their batch names.
+static const struct {
+    const char *name;
+    int from, to;
+    double (*reference)(double);
+} LEGACY_PAIRS[6] = {
+    { "c2f", SCALE_C, SCALE_F, c_to_f },
+    { "c2k", SCALE_C, SCALE_K, c_to_k },
+    { "f2c", SCALE_F, SCALE_C, f_to_c },
+    { "f2k", SCALE_F, SCALE_K, f_to_k },
+    { "k2c", SCALE_K, SCALE_C, k_to_c },
+    { "k2f", SCALE_K, SCALE_F, k_to_f },
+};
+
+// y[i] = x[i] * a[i] + b[i]; coefficients are per value so one call can mix
+// columns with different pairs without branching. No kernel uses FMA: a
+// fused result differs in the last bit often enough to change "%.2f" output.
+typedef void (*AffineKernel)(const double *x, const double *a, const double *b, double *y, size_t n);
+
+NO_FP_CONTRACT
+static void kernel_scalar(const double *x, const double *a, const double *b, double *y, size_t n) {
+    for (size_t i = 0; i < n; i++) y[i] = x[i] * a[i] + b[i];
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2"))) NO_FP_CONTRACT
+static void kernel_sse2(const double *x, const double *a, const double *b, double *y, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128d r0 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(a + i)), _mm_loadu_pd(b + i));
+        __m128d r1 = _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(a + i + 2)),
+                                _mm_loadu_pd(b + i + 2));
+        _mm_storeu_pd(y + i, r0);
+        _mm_storeu_pd(y + i + 2, r1);
+    }
+    kernel_scalar(x + i, a + i, b + i, y + i, n - i);
+}
+
+__attribute__((target("avx2"))) NO_FP_CONTRACT
+static void kernel_avx2(const double *x, const double *a, const double *b, double *y, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256d r0 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(a + i)),
+                                   _mm256_loadu_pd(b + i));
+        __m256d r1 = _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(a + i + 4)),
+                                   _mm256_loadu_pd(b + i + 4));
+        _mm256_storeu_pd(y + i, r0);
+        _mm256_storeu_pd(y + i + 4, r1);
+    }
+    kernel_scalar(x + i, a + i, b + i, y + i, n - i);
+}
+#endif
+
+// Pick the widest kernel the CPU supports, or the one named by --isa.
+static AffineKernel select_kernel(const char *isa) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    int avx2 = __builtin_cpu_supports("avx2");
+    if (strcmp(isa, "avx2") == 0 || (strcmp(isa, "auto") == 0 && avx2))
+        return kernel_avx2;
+    if (strcmp(isa, "sse2") == 0 || (strcmp(isa, "auto") == 0 && __builtin_cpu_supports("sse2")))
+        return kernel_sse2;
+#else
+    (void)isa;
+#endif
+    return kernel_scalar;
+}
+
+static int same_text_nocase(const char *a, const char *b, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char ca = a[i], cb = b[i];
+        if (ca >= 'A' && ca <= 'Z') ca = (char)(ca - 'A' + 'a');
+        if (cb >= 'A' && cb <= 'Z') cb = (char)(cb - 'A' + 'a');
+        if (ca != cb) return 0;
+    }
+    return 1;
+}
+
+static int find_scale(const char *s, size_t len) {
+    for (int i = 0; i < SCALE_COUNT; i++)
+        if (strlen(SCALES[i].code) == len && same_text_nocase(s, SCALES[i].code, len)) return i;
+    return -1;
+}
+
+// One pair: "FROM:TO" (e.g. "De:K"), a menu name ("c2f") or number ("1"-"6"),
+// or "-" for unchanged. Returns 0 on success.
+static int parse_pair(const char *s, size_t len, AffinePair *out) {
+    if (len == 1 && s[0] == '-') {
+        *out = IDENTITY_PAIR;
+        return 0;
+    }
+    for (int i = 0; i < 6; i++) {
+        if ((len == 3 && same_text_nocase(s, LEGACY_PAIRS[i].name, 3)) ||
+            (len == 1 && s[0] == '1' + i)) {
+            *out = PAIRS[LEGACY_PAIRS[i].from][LEGACY_PAIRS[i].to];
+            return 0;
+        }
+    }
+    const char *colon = memchr(s, ':', len);
+    if (!colon) return -1;
+    int from = find_scale(s, (size_t)(colon - s));
+    int to = find_scale(colon + 1, len - (size_t)(colon - s) - 1);
+    if (from < 0 || to < 0) return -1;
+    *out = PAIRS[from][to];
+    return 0;
+}
+
+// Compare the engine with the menu's formulas on n readings per pair (half of
+// them on a 0.001 grid like typical sensor data), and every scale pair on the
+// freezing/boiling points of water. A "%.2f" difference is only accepted when
+// the exact result is a tie (x.xx5), which the two formulas may round either
+// way, or when it is the sign of a result that rounds to zero. Every kernel
+// the CPU runs must also match the scalar one bit for bit.
+static int selftest_engine(long n) {
+    static const double freezing[SCALE_COUNT] = { 0.0, 32.0, 273.15, 491.67, 0.0, 150.0, 0.0, 7.5 };
+    static const double boiling[SCALE_COUNT] = { 100.0, 212.0, 373.15, 671.67, 80.0, 0.0, 33.0, 60.0 };
+    AffineKernel kernel = select_kernel("auto");
+    enum { BLOCK = 4096 };
+    double x[BLOCK], a[BLOCK], b[BLOCK], y[BLOCK], y2[BLOCK];
+    double worst = 0.0;
+    long ties = 0, text_bad = 0, fixed_bad = 0, kernel_bad = 0;
+    AffineKernel others[2];
+    int n_others = 0;
+#ifdef HAVE_X86_SIMD
+    if (__builtin_cpu_supports("sse2")) others[n_others++] = kernel_sse2;
+    if (__builtin_cpu_supports("avx2")) others[n_others++] = kernel_avx2;
+#endif
+    char s1[FIXED2_MAX_LEN], s2[FIXED2_MAX_LEN];
+
+    for (int p = 0; p < 6; p++) {
+        AffinePair pair = PAIRS[LEGACY_PAIRS[p].from][LEGACY_PAIRS[p].to];
+        for (long done = 0; done < n; done += BLOCK) {
+            size_t m = n - done < BLOCK ? (size_t)(n - done) : BLOCK;
+            for (size_t i = 0; i < m; i++) {
+                x[i] = (i & 1) ? rng_uniform(-1e6, 1e6) : (double)(long)rng_uniform(-5e5, 5e6) / 1000.0;
+                a[i] = pair.a;
+                b[i] = pair.b;
+            }
+            for (int k = 0; k < n_others; k++) {
+                kernel_scalar(x, a, b, y, m);
+                others[k](x, a, b, y2, m);
+                kernel_bad += memcmp(y, y2, m * sizeof(double)) != 0;
+            }
+            kernel(x, a, b, y, m);
+            for (size_t i = 0; i < m; i++) {
+                double ref = LEGACY_PAIRS[p].reference(x[i]);
+                double scale = ref < 0 ? -ref : ref;
+                double err = (y[i] > ref ? y[i] - ref : ref - y[i]) / (scale > 1.0 ? scale : 1.0);
+                if (err > worst) worst = err;
+                s1[format_fixed2(y[i], s1)] = '\0';
+                s2[format_fixed2(ref, s2)] = '\0';
+                if (strcmp(s1, s2) != 0) {
+                    double hundredths = ref * 100.0, frac = hundredths - (double)(long long)hundredths;
+                    if (frac < 0) frac = -frac;
+                    if (frac > 0.4999 && frac < 0.5001) ties++;
+                    else if (strcmp(s1 + (s1[0] == '-'), s2 + (s2[0] == '-')) == 0) ties++;   // -0.00
+                    else text_bad++;
+                }
+            }
+        }
+    }
+    for (int f = 0; f < SCALE_COUNT; f++) {
+        for (int t = 0; t < SCALE_COUNT; t++) {
+            const AffinePair *pr = &PAIRS[f][t];
+            double e1 = freezing[f] * pr->a + pr->b - freezing[t];
+            double e2 = boiling[f] * pr->a + pr->b - boiling[t];
+            if (e1 > 1e-9 || e1 < -1e-9 || e2 > 1e-9 || e2 < -1e-9) {
+                fprintf(stderr, "%s -> %s is off at a fixed point\n", SCALES[f].name, SCALES[t].name);
+                fixed_bad++;
+            }
+        }
+    }
+    printf("%ld values per menu conversion: max relative error %.3g, \"%%.2f\" output "
+           "differs on %ld ties and %ld other values\n", n, worst, ties, text_bad);
+    printf("%d scale pairs checked at freezing/boiling point: %ld wrong\n",
+           SCALE_COUNT * SCALE_COUNT, fixed_bad);
+    printf("%d SIMD kernels compared with the scalar one: %ld blocks differ\n", n_others, kernel_bad);
+    return worst > 1e-12 || text_bad || fixed_bad || kernel_bad ? 1 : 0;
+}
+
+// 8. Any scale to any scale
+void any_scale_to_any_scale() {
+    int from, to;
+    double x;
+    printf("\n");
+    for (int i = 0; i < SCALE_COUNT; i++) printf("%d. %s\n", i + 1, SCALES[i].name);
+    printf("\nConvert From: ");
+    if (scanf("%d", &from) != 1 || from < 1 || from > SCALE_COUNT) {
+        printf("Enter a valid scale (1-%d).\n", SCALE_COUNT);
+        return;
+    }
+    printf("Convert To: ");
+    if (scanf("%d", &to) != 1 || to < 1 || to > SCALE_COUNT) {
+        printf("Enter a valid scale (1-%d).\n", SCALE_COUNT);
+        return;
+    }
+    printf("Enter %s Temperature: ", SCALES[from - 1].name);
+    scanf("%lf", &x);
+    const AffinePair *p = &PAIRS[from - 1][to - 1];
+    double y;
+    kernel_scalar(&x, &p->a, &p->b, &y, 1);    // same rounding as batch mode
+    printf("\n%.2lf %s = %.2lf %s\n", x, SCALES[from - 1].symbol, y, SCALES[to - 1].symbol);
+}
+
+// ---------------------------------------------------------------------------
+// Batch mode
+// ---------------------------------------------------------------------------
+
+#define MAX_COLUMNS 256
+
+// Bitmask of the CSV structural characters in 64 bytes.
+typedef uint64_t (*MaskKernel)(const char *p, char delim);
+
+// Settings shared by every block of one batch run. With ncols == 1 every value
+// uses cols[0]; otherwise value k of a line (or of a binary record) uses
+// cols[k], and values past the last spec are left unchanged. In CSV mode
+// (delim != 0) only the fields of columns marked in `convert` are touched.
+typedef struct {
+    int ncols;
+    AffinePair cols[MAX_COLUMNS];
+    int in_fmt, out_fmt;
+    AffineKernel kernel;
+    char delim;
+    unsigned char convert[MAX_COLUMNS];
+    MaskKernel mask;
+} BatchJob;
+
+// Per-thread working arrays for one block of values.
+typedef struct {
+    double *x, *a, *b, *y;
+    unsigned short *col;                // column of each value within its line
+    unsigned char *eol;                 // value is the last on its line
+    const char **span;                  // CSV mode: input bytes of each value
+} Scratch;
+
+static int scratch_alloc(Scratch *s) {
+    s->x = malloc(BATCH_VALUES * sizeof(double));
+    s->a = malloc(BATCH_VALUES * sizeof(double));
+    s->b = malloc(BATCH_VALUES * sizeof(double));
+    s->y = malloc(BATCH_VALUES * sizeof(double));
+    s->col = malloc(BATCH_VALUES * sizeof(unsigned short));
+    s->eol = malloc(BATCH_VALUES);
+    s->span = malloc(2 * BATCH_VALUES * sizeof(const char *));
+    return s->x && s->a && s->b && s->y && s->col && s->eol && s->span ? 0 : -1;
+}
+
+static void scratch_free(Scratch *s) {
+    free(s->x);
+    free(s->a);
+    free(s->b);
+    free(s->y);
+    free(s->col);
+    free(s->eol);
+    free(s->span);
+}
+
+// Look up each value's pair and run the kernel over the block.
+static void job_convert(const BatchJob *job, Scratch *s, size_t n) {
+    INSTR_BEGIN(span, "job_convert");
+    for (size_t i = 0; i < n; i++) {
+        const AffinePair *p = job->ncols == 1 ? &job->cols[0] :
+                              s->col[i] < job->ncols ? &job->cols[s->col[i]] : &IDENTITY_PAIR;
+        s->a[i] = p->a;
+        s->b[i] = p->b;
+    }
+    job->kernel(s->x, s->a, s->b, s->y, n);
+    INSTR_END(span);
+}
+
+// Output buffer flushed with large fwrite() calls. With f == NULL it grows in
+// memory instead (used for a parallel chunk's output).
+typedef struct {
+    FILE *f;
+    char *buf;
+    size_t len;
+    int failed;
+    size_t cap;
+} OutBuf;
+
+static void out_flush(OutBuf *o) {
+    INSTR_BEGIN(span, "out_flush");
+    INSTR_BYTES_WRITTEN(span, o->len);
+    if (o->len && fwrite(o->buf, 1, o->len, o->f) != o->len) o->failed = 1;
+    o->len = 0;
+    INSTR_END(span);
+}
+
+// Make room for at least `need` more bytes.
+static char *out_reserve(OutBuf *o, size_t need) {
+    if (!o->f) {
+        if (o->len + need > o->cap) {
+            size_t cap = o->cap ? o->cap * 2 : IO_BUFFER_SIZE;
+            while (cap < o->len + need) cap *= 2;
+            char *grown = realloc(o->buf, cap);
+            if (!grown) {
+                o->failed = 1;
+                o->len = 0;                     // keep going, result is discarded
+                return o->buf;
+            }
+            o->buf = grown;
+            o->cap = cap;
+        }
+    } else if (o->len + need > IO_BUFFER_SIZE) {
+        out_flush(o);
+    }
+    return o->buf + o->len;
+}
+
+// Append raw bytes, in pieces no larger than the buffer.
+static void out_copy(OutBuf *o, const char *p, size_t len) {
+    while (len > 0) {
+        size_t step = len < IO_BUFFER_SIZE ? len : IO_BUFFER_SIZE;
+        memcpy(out_reserve(o, step), p, step);
+        o->len += step;
+        p += step;
+        len -= step;
+    }
+}
+
+// Text output keeps the line structure: values of one line are separated by
+// tabs (or each goes on its own line when a single pair is used).
+static void out_write_values(OutBuf *o, const BatchJob *job, const Scratch *s, size_t n) {
+    INSTR_BEGIN(span, "out_write_values");      // includes any out_flush() it triggers
+    for (size_t i = 0; i < n; i++) {
+        if (job->out_fmt == FMT_TEXT) {
+            char *p = out_reserve(o, FIXED2_MAX_LEN + 1);
+            size_t len = format_fixed2(s->y[i], p);
+            p[len] = job->ncols == 1 || s->eol[i] ? '\n' : '\t';
+            o->len += len + 1;
+        } else if (job->out_fmt == FMT_F64) {
+            memcpy(out_reserve(o, sizeof(double)), &s->y[i], sizeof(double));
+            o->len += sizeof(double);
+        } else {
+            float f = (float)s->y[i];
+            memcpy(out_reserve(o, sizeof(float)), &f, sizeof(float));
+            o->len += sizeof(float);
+        }
+    }
+    INSTR_END(span);
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v';
+}
+
+// Parse numbers from text[0..len) into s->x with their column and end-of-line
+// flag; *col carries the column across calls. A token is only consumed once
+// the whitespace after it shows whether its line ends, so unless `last` is
+// set, parsing stops before anything touching the end of the buffer.
+// Invalid tokens are counted in *bad but still occupy their column.
+// Returns bytes consumed.
+static size_t parse_text_values(const char *text, size_t len, int last, Scratch *s,
+                                size_t max_vals, size_t *nvals, size_t *bad, int *col) {
+    const char *p = text, *end = text + len;
+    size_t n = 0;
+    int c = *col;
+    while (p < end && is_space(*p)) p++;
+    while (n < max_vals && p < end) {
+        const char *start = p;
+        double v;
+        const char *q = fast_parse_double(p, end, &v);
+        int valid = q && (q == end || is_space(*q));
+        if (!valid) q = p;
+        while (q < end && !is_space(*q)) q++;   // end of the token
+        if (q == end && !last) break;
+        if (!valid) {
+            // inf, nan, hex, long digit strings: let strtod decide
+            char token[128];
+            size_t tlen = (size_t)(q - start);
+            if (tlen < sizeof(token)) {
+                memcpy(token, start, tlen);
+                token[tlen] = '\0';
+                char *tend;
+                v = strtod(token, &tend);
+                valid = *tend == '\0';
+            }
+        }
+        const char *r = q;
+        int newline = 0;
+        while (r < end && is_space(*r)) newline |= *r++ == '\n';
+        if (r == end && !last && !newline) break;
+
+        int eol = newline || r == end;
+        if (valid) {
+            s->x[n] = v;
+            s->col[n] = (unsigned short)(c < 0xFFFF ? c : 0xFFFF);
+            s->eol[n] = (unsigned char)eol;
+            n++;
+        } else {
+            (*bad)++;
+        }
+        c = eol ? 0 : c + 1;
+        p = r;
+    }
+    *nvals = n;
+    *col = c;
+    return (size_t)(p - text);
+}
+
+static int parse_format(const char *s) {
+    if (strcmp(s, "text") == 0) return FMT_TEXT;
+    if (strcmp(s, "f64") == 0) return FMT_F64;
+    if (strcmp(s, "f32") == 0) return FMT_F32;
+    return -1;
+}
+
+// "C:F,F:K,-" -> one pair per column. Returns 0 on success.
+static int parse_column_spec(const char *spec, BatchJob *job) {
+    job->ncols = 0;
+    for (const char *p = spec; ; ) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        if (job->ncols == MAX_COLUMNS || parse_pair(p, len, &job->cols[job->ncols]) != 0) return -1;
+        job->ncols++;
+        if (!comma) return 0;
+        p = comma + 1;
+    }
+}
+
+static size_t format_width(int fmt) {
+    return fmt == FMT_F64 ? sizeof(double) : sizeof(float);
+}
+
+// Widen n raw binary values to doubles; value k of each record is column k.
+static void decode_binary(const BatchJob *job, const char *p, size_t n, Scratch *s, int *col) {
+    int c = *col;
+    for (size_t i = 0; i < n; i++) {
+        if (job->in_fmt == FMT_F64) {
+            memcpy(&s->x[i], p + i * sizeof(double), sizeof(double));
+        } else {
+            float f;
+            memcpy(&f, p + i * sizeof(float), sizeof(float));
+            s->x[i] = f;
+        }
+        s->col[i] = (unsigned short)c;
+        s->eol[i] = (unsigned char)(c == job->ncols - 1);
+        c = c == job->ncols - 1 ? 0 : c + 1;
+    }
+    *col = c;
+}
+
+// --- CSV mode: convert selected columns, copy everything else as is ---
+
+// Bit i of the result is set when p[i] is the delimiter, '\n' or '"'.
+static uint64_t mask_scalar(const char *p, char delim) {
+    uint64_t m = 0;
+    for (int i = 0; i < 64; i++)
+        if (p[i] == delim || p[i] == '\n' || p[i] == '"') m |= (uint64_t)1 << i;
+    return m;
+}
+
+#ifdef HAVE_X86_SIMD
+__attribute__((target("sse2")))
+static uint64_t mask_sse2(const char *p, char delim) {
+    __m128i d = _mm_set1_epi8(delim), nl = _mm_set1_epi8('\n'), q = _mm_set1_epi8('"');
+    uint64_t m = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(p + 16 * i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, d), _mm_cmpeq_epi8(v, nl)),
+                                   _mm_cmpeq_epi8(v, q));
+        m |= (uint64_t)(unsigned)_mm_movemask_epi8(hit) << (16 * i);
+    }
+    return m;
+}
+
+__attribute__((target("avx2")))
+static uint64_t mask_avx2(const char *p, char delim) {
+    __m256i d = _mm256_set1_epi8(delim), nl = _mm256_set1_epi8('\n'), q = _mm256_set1_epi8('"');
+    __m256i lo = _mm256_loadu_si256((const __m256i *)p);
+    __m256i hi = _mm256_loadu_si256((const __m256i *)(p + 32));
+    __m256i hit_lo = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lo, d), _mm256_cmpeq_epi8(lo, nl)),
+                                     _mm256_cmpeq_epi8(lo, q));
+    __m256i hit_hi = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(hi, d), _mm256_cmpeq_epi8(hi, nl)),
+                                     _mm256_cmpeq_epi8(hi, q));
+    return (uint64_t)(unsigned)_mm256_movemask_epi8(hit_lo) |
+           (uint64_t)(unsigned)_mm256_movemask_epi8(hit_hi) << 32;
+}
+#endif
+
+static MaskKernel select_mask_kernel(const char *isa) {
+#ifdef HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (strcmp(isa, "avx2") == 0 || (strcmp(isa, "auto") == 0 && __builtin_cpu_supports("avx2")))
+        return mask_avx2;
+    if (strcmp(isa, "sse2") == 0 || (strcmp(isa, "auto") == 0 && __builtin_cpu_supports("sse2")))
+        return mask_sse2;
+#else
+    (void)isa;
+#endif
+    return mask_scalar;
+}
+
+// Walks the structural characters of a buffer 64 bytes at a time, so the
+// bytes between delimiters are never looked at one by one.
+typedef struct {
+    const char *base, *end;
+    size_t block;                       // offset of the block `bits` describes
+    uint64_t bits;                      // specials of that block not yet passed
+    MaskKernel mask;
+    char delim;
+} CsvScanner;
+
+static void scanner_load(CsvScanner *sc, size_t block) {
+    sc->block = block;
+    if (block + 64 <= (size_t)(sc->end - sc->base)) {
+        sc->bits = sc->mask(sc->base + block, sc->delim);
+    } else {
+        char tail[64] = { 0 };                  // NUL is never special
+        memcpy(tail, sc->base + block, (size_t)(sc->end - sc->base) - block);
+        sc->bits = sc->mask(tail, sc->delim);
+    }
+}
+
+// First delimiter, '\n' or '"' at or after p, or sc->end.
+static const char *scanner_next(CsvScanner *sc, const char *p) {
+    size_t off = (size_t)(p - sc->base), block = off & ~(size_t)63;
+    if (block != sc->block) scanner_load(sc, block);
+    uint64_t bits = sc->bits & (~(uint64_t)0 << (off - block));
+    while (bits == 0) {
+        block += 64;
+        if (block >= (size_t)(sc->end - sc->base)) return sc->end;
+        scanner_load(sc, block);
+        bits = sc->bits;
+    }
+    return sc->base + block + __builtin_ctzll(bits);
+}
+
+// Parse a targeted field [p, end). Surrounding blanks and a '\r' before the
+// newline are kept; only the number itself is replaced. Returns 0 when the
+// field is not a number (empty, header text, ...) and is passed through.
+static int csv_parse_field(const char *p, const char *end, double *v, const char **span) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) end--;
+    if (p == end) return 0;
+    const char *q = fast_parse_double(p, end, v);
+    if (q != end) {
+        char token[128];
+        size_t len = (size_t)(end - p);
+        char *tend;
+        if (len >= sizeof(token)) return 0;
+        memcpy(token, p, len);
+        token[len] = '\0';
+        *v = strtod(token, &tend);
+        if (*tend != '\0') return 0;
+    }
+    span[0] = p;
+    span[1] = end;
+    return 1;
+}
+
+// Convert the targeted columns of the complete lines in text[0..len) and
+// append the lines to o; every other byte is copied through unchanged.
+// Without `last`, a final line that has no '\n' yet is left for the next
+// call. Quoted fields are passed through (they may contain the delimiter or
+// newlines). Returns bytes consumed.
+static size_t csv_convert(const BatchJob *job, const char *text, size_t len, int last,
+                          Scratch *s, OutBuf *o) {
+    CsvScanner sc = { text, text + len, (size_t)-1, 0, job->mask, job->delim };
+    const char *p = text, *end = text + len;
+    while (p < end) {
+        const char *batch = p;
+        size_t n = 0;
+        // each line yields at most MAX_COLUMNS values, so a started line always fits
+        while (p < end && n + MAX_COLUMNS <= BATCH_VALUES) {
+            const char *line = p;
+            size_t line_n = n;
+            int col = 0, complete = 0;
+            for (;;) {
+                const char *q = p;
+                int quoted = p < end && *p == '"';
+                if (quoted) {                           // find the closing quote; "" is a quote
+                    for (q = scanner_next(&sc, p + 1); q < end; q = scanner_next(&sc, q + 1)) {
+                        if (*q != '"') continue;
+                        if (q + 1 < end && q[1] == '"') q++;
+                        else break;
+                    }
+                    if (q < end) q++;
+                }
+                q = scanner_next(&sc, q);
+                while (q < end && *q == '"') q = scanner_next(&sc, q + 1);  // stray quote
+                if (q == end && !last) break;
+                if (!quoted && col < MAX_COLUMNS && job->convert[col] &&
+                    csv_parse_field(p, q, &s->x[n], &s->span[2 * n])) {
+                    s->a[n] = job->cols[col].a;
+                    s->b[n] = job->cols[col].b;
+                    n++;
+                }
+                if (q == end || *q == '\n') {
+                    p = q == end ? end : q + 1;
+                    complete = 1;
+                    break;
+                }
+                p = q + 1;
+                col++;
+                if (col >= job->ncols) {                // nothing left to convert on this line
+                    const char *nl = memchr(p, '\n', (size_t)(end - p));
+                    if (nl && !memchr(p, '"', (size_t)(nl - p))) {
+                        p = nl + 1;
+                        complete = 1;
+                        break;
+                    }
+                }
+            }
+            if (!complete) {                            // wait for the rest of the line
+                p = line;
+                n = line_n;
+                break;
+            }
+        }
+        if (p == batch) break;
+
+        job->kernel(s->x, s->a, s->b, s->y, n);
+        const char *copied = batch;
+        for (size_t i = 0; i < n; i++) {
+            out_copy(o, copied, (size_t)(s->span[2 * i] - copied));
+            o->len += format_fixed2(s->y[i], out_reserve(o, FIXED2_MAX_LEN));
+            copied = s->span[2 * i + 1];
+        }
+        out_copy(o, copied, (size_t)(p - copied));
+    }
+    return (size_t)(p - text);
+}
+
+// "3=C:F,5=F:K" -> convert column 3 from Celsius and column 5 from
+// Fahrenheit (columns count from 1). Returns 0 on success.
+static int parse_csv_spec(const char *spec, BatchJob *job) {
+    memset(job->convert, 0, sizeof(job->convert));
+    job->ncols = 0;
+    for (const char *p = spec; ; ) {
+        const char *comma = strchr(p, ',');
+        size_t len = comma ? (size_t)(comma - p) : strlen(p);
+        char *eq;
+        long col = strtol(p, &eq, 10);
+        if (eq == p || *eq != '=' || col < 1 || col > MAX_COLUMNS ||
+            parse_pair(eq + 1, len - (size_t)(eq + 1 - p), &job->cols[col - 1]) != 0)
+            return -1;
+        job->convert[col - 1] = 1;
+        if (col > job->ncols) job->ncols = (int)col;
+        if (!comma) return 0;
+        p = comma + 1;
+    }
+}
+
+// Convert a block that holds only whole values (text split at line or
+// whitespace boundaries, binary at record boundaries) and append to o.
+static void convert_block(const BatchJob *job, const char *p, size_t len,
+                          Scratch *s, OutBuf *o, size_t *bad) {
+    int col = 0;
+    INSTR_BEGIN(span, "convert_block");
+    INSTR_BYTES_READ(span, len);
+    if (job->delim) {
+        csv_convert(job, p, len, 1, s, o);
+        INSTR_BYTES_WRITTEN(span, o->len);
+        INSTR_END(span);
+        return;
+    }
+    while (len > 0) {
+        size_t n, used;
+        if (job->in_fmt == FMT_TEXT) {
+            used = parse_text_values(p, len, 1, s, BATCH_VALUES, &n, bad, &col);
+        } else {
+            n = len / format_width(job->in_fmt);
+            if (n > BATCH_VALUES) n = BATCH_VALUES;
+            decode_binary(job, p, n, s, &col);
+            used = n * format_width(job->in_fmt);
+        }
+        if (used == 0) break;                  // only a partial binary value left
+        job_convert(job, s, n);
+        out_write_values(o, job, s, n);
+        p += used;
+        len -= used;
+    }
+    INSTR_BYTES_WRITTEN(span, o->len);          // a chunk's output buffer starts empty
+    INSTR_END(span);
+}
+
+// Stream `in` through the job into `out`. Returns 0 on success.
+static int run_batch(FILE *in, FILE *out, const BatchJob *job) {
+    char *inbuf = malloc(IO_BUFFER_SIZE);
+    Scratch s;
+    OutBuf o = { out, malloc(IO_BUFFER_SIZE), 0, 0, IO_BUFFER_SIZE };
+    size_t bad = 0, have = 0;
+    int eof = 0, rc = 0, col = 0;
+    if (scratch_alloc(&s) != 0 || !inbuf || !o.buf) {
+        fprintf(stderr, "Out of memory.\n");
+        rc = 1;
+        goto done;
+    }
+
+    while (!eof || have > 0) {
+        if (!eof && have < IO_BUFFER_SIZE) {
+            INSTR_BEGIN(rd, "run_batch.fread");
+            size_t got = fread(inbuf + have, 1, IO_BUFFER_SIZE - have, in);
+            INSTR_BYTES_READ(rd, got);
+            INSTR_END(rd);
+            if (got == 0) eof = 1;
+            have += got;
+        }
+        size_t n = 0, used;
+        INSTR_BEGIN(parse, "run_batch.parse");
+        if (job->in_fmt == FMT_TEXT) {
+            used = parse_text_values(inbuf, have, eof, &s, BATCH_VALUES, &n, &bad, &col);
+            if (used == 0 && n == 0 && !eof) {
+                if (have == IO_BUFFER_SIZE) {           // one giant token: skip it
+                    bad++;
+                    used = have;
+                } else {
+                    continue;                           // need more input
+                }
+            }
+        } else {
+            size_t width = format_width(job->in_fmt);
+            n = have / width;
+            if (n > BATCH_VALUES) n = BATCH_VALUES;
+            if (n == 0 && eof) {
+                if (have) fprintf(stderr, "Ignoring %zu trailing bytes.\n", have);
+                break;
+            }
+            decode_binary(job, inbuf, n, &s, &col);
+            used = n * width;
+        }
+        INSTR_BYTES_READ(parse, used);
+        INSTR_END(parse);
+        memmove(inbuf, inbuf + used, have - used);
+        have -= used;
+        if (eof && job->in_fmt == FMT_TEXT && n == 0 && used == 0) break;
+
+        job_convert(job, &s, n);
+        out_write_values(&o, job, &s, n);
+    }
+    out_flush(&o);
+    if (ferror(in)) {
+        fprintf(stderr, "Read error.\n");
+        rc = 1;
+    }
+    if (o.failed || fflush(out) != 0) {
+        fprintf(stderr, "Write error.\n");
+        rc = 1;
+    }
+    if (bad) fprintf(stderr, "Skipped %zu invalid tokens.\n", bad);
+
+done:
+    free(inbuf);
+    scratch_free(&s);
+    free(o.buf);
+    return rc;
+}
+
+// CSV counterpart of run_batch(). The input buffer grows when a single line
+// does not fit, so lines of any length keep their columns.
+static int run_csv(FILE *in, FILE *out, const BatchJob *job) {
+    size_t cap = IO_BUFFER_SIZE, have = 0;
+    char *inbuf = malloc(cap);
+    Scratch s;
+    OutBuf o = { out, malloc(IO_BUFFER_SIZE), 0, 0, IO_BUFFER_SIZE };
+    int eof = 0, rc = 0;
+    if (scratch_alloc(&s) != 0 || !inbuf || !o.buf) {
+        fprintf(stderr, "Out of memory.\n");
+        rc = 1;
+        goto done;
+    }
+
+    while (!eof || have > 0) {
+        if (!eof) {
+            if (have == cap) {
+                char *grown = realloc(inbuf, cap * 2);
+                if (!grown) {
+                    fprintf(stderr, "Out of memory.\n");
+                    rc = 1;
+                    goto done;
+                }
+                inbuf = grown;
+                cap *= 2;
+            }
+            INSTR_BEGIN(rd, "run_csv.fread");
+            size_t got = fread(inbuf + have, 1, cap - have, in);
+            INSTR_BYTES_READ(rd, got);
+            INSTR_END(rd);
+            if (got == 0) eof = 1;
+            have += got;
+        }
+        INSTR_BEGIN(conv, "run_csv.convert");
+        size_t used = csv_convert(job, inbuf, have, eof, &s, &o);
+        INSTR_BYTES_READ(conv, used);
+        INSTR_END(conv);
+        memmove(inbuf, inbuf + used, have - used);
+        have -= used;
+    }
+    out_flush(&o);
+    if (ferror(in)) {
+        fprintf(stderr, "Read error.\n");
+        rc = 1;
+    }
+    if (o.failed || fflush(out) != 0) {
+        fprintf(stderr, "Write error.\n");
+        rc = 1;
+    }
+
+done:
+    free(inbuf);
+    scratch_free(&s);
+    free(o.buf);
+    return rc;
+}
+
+#ifdef HAVE_PARALLEL
+// One slot of the reorder window: holds the output of chunk `index` until
+// the writer reaches it.
+typedef struct {
+    size_t index;
+    int ready;
+    OutBuf out;
+    size_t bad;
+} ChunkSlot;
+
+typedef struct {
+    const BatchJob *job;
+    const char *data;
+    size_t size, chunk_bytes, nchunks;
+    ChunkSlot *slots;
+    size_t window;
+    size_t next;                                // next chunk to hand out
+    size_t written;                             // chunks already written
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t slot_free, chunk_done;
+} Pipeline;
+
+// Start of chunk i: its nominal offset moved forward to a value boundary, so
+// neighbouring chunks agree on the split without talking to each other.
+static size_t chunk_start(const Pipeline *pl, size_t i) {
+    size_t pos = i * pl->chunk_bytes;
+    if (i == 0) return 0;
+    if (pos >= pl->size) return pl->size;
+    if (pl->job->in_fmt != FMT_TEXT) return pos;   // chunk_bytes is a multiple of a record
+    if (pl->job->ncols > 1 || pl->job->delim) {     // keep lines whole so columns line up
+        while (pos < pl->size && pl->data[pos - 1] != '\n') pos++;
+        return pos;
+    }
+    while (pos < pl->size && !is_space(pl->data[pos - 1])) pos++;
+    return pos;
+}
+
+// Stop the pipeline, waking the writer and every worker whichever condition
+// they wait on. Called with pl->lock held.
+static void pipeline_fail(Pipeline *pl) {
+    pl->failed = 1;
+    pthread_cond_broadcast(&pl->slot_free);
+    pthread_cond_broadcast(&pl->chunk_done);
+}
+
+static void *pipeline_worker(void *arg) {
+    Pipeline *pl = arg;
+    Scratch s;
+    int ok = scratch_alloc(&s) == 0;
+    if (!ok) {
+        pthread_mutex_lock(&pl->lock);
+        pipeline_fail(pl);
+        pthread_mutex_unlock(&pl->lock);
+    }
+    for (;;) {
+        pthread_mutex_lock(&pl->lock);
+        // a chunk may only start once the one `window` places earlier is written
+        while (!pl->failed && pl->next < pl->nchunks && pl->next >= pl->written + pl->window)
+            pthread_cond_wait(&pl->slot_free, &pl->lock);
+        if (pl->failed || pl->next >= pl->nchunks || !ok) {
+            pthread_mutex_unlock(&pl->lock);
+            break;
+        }
+        size_t i = pl->next++;
+        ChunkSlot *slot = &pl->slots[i % pl->window];
+        pthread_mutex_unlock(&pl->lock);
+
+        size_t begin = chunk_start(pl, i), end = chunk_start(pl, i + 1);
+        slot->out.len = 0;
+        slot->out.failed = 0;
+        slot->bad = 0;
+        convert_block(pl->job, pl->data + begin, end - begin, &s, &slot->out, &slot->bad);
+
+        pthread_mutex_lock(&pl->lock);
+        slot->index = i;
+        slot->ready = 1;
+        pthread_cond_broadcast(&pl->chunk_done);
+        pthread_mutex_unlock(&pl->lock);
+    }
+    scratch_free(&s);
+    return NULL;
+}
+
+// Convert a regular file on `threads` workers. Output is written in input
+// order by this thread; memory use is bounded by the reorder window, not by
+// the file size. Returns 0 on success, -1 if the file cannot be mapped.
+static int run_parallel(const char *path, FILE *out, const BatchJob *job, int threads) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    Pipeline pl;
+    memset(&pl, 0, sizeof(pl));
+    pl.job = job;
+    pl.data = data;
+    pl.size = size;
+    pl.chunk_bytes = CHUNK_BYTES - CHUNK_BYTES % (format_width(job->in_fmt) * (size_t)job->ncols);
+    if (job->in_fmt == FMT_TEXT) pl.chunk_bytes = CHUNK_BYTES;
+    pl.nchunks = (size + pl.chunk_bytes - 1) / pl.chunk_bytes;
+    pl.window = (size_t)threads * CHUNKS_PER_THREAD;
+    pl.slots = calloc(pl.window, sizeof(ChunkSlot));
+    pthread_mutex_init(&pl.lock, NULL);
+    pthread_cond_init(&pl.slot_free, NULL);
+    pthread_cond_init(&pl.chunk_done, NULL);
+
+    pthread_t *tids = malloc((size_t)threads * sizeof(pthread_t));
+    int started = 0, rc = 0;
+    size_t bad = 0;
+    for (int t = 0; pl.slots && tids && t < threads; t++) {
+        if (pthread_create(&tids[t], NULL, pipeline_worker, &pl) != 0) break;
+        started++;
+    }
+    if (started == 0) pl.failed = 1;                // no worker to race with
+
+    size_t page = (size_t)sysconf(_SC_PAGESIZE), released = 0;
+    for (size_t w = 0; w < pl.nchunks; w++) {
+        ChunkSlot *slot = &pl.slots[w % pl.window];
+        pthread_mutex_lock(&pl.lock);
+        while (!(slot->ready && slot->index == w) && !pl.failed)
+            pthread_cond_wait(&pl.chunk_done, &pl.lock);
+        int failed = pl.failed;
+        if (failed) pipeline_fail(&pl);             // workers may be waiting on the window
+        pthread_mutex_unlock(&pl.lock);
+        if (failed) break;
+
+        INSTR_BEGIN(wr, "run_parallel.fwrite");
+        INSTR_BYTES_WRITTEN(wr, slot->out.len);
+        if (slot->out.failed || (slot->out.len &&
+            fwrite(slot->out.buf, 1, slot->out.len, out) != slot->out.len)) {
+            INSTR_END(wr);
+            pthread_mutex_lock(&pl.lock);
+            pipeline_fail(&pl);
+            pthread_mutex_unlock(&pl.lock);
+            break;
+        }
+        INSTR_END(wr);
+        bad += slot->bad;
+
+        // drop input pages that are finished with so resident memory stays flat
+        size_t done_to = chunk_start(&pl, w + 1) / page * page;
+        if (done_to > released) {
+            madvise(data + released, done_to - released, MADV_DONTNEED);
+            released = done_to;
+        }
+
+        pthread_mutex_lock(&pl.lock);
+        slot->ready = 0;
+        pl.written = w + 1;
+        pthread_cond_broadcast(&pl.slot_free);
+        pthread_mutex_unlock(&pl.lock);
+    }
+    for (int t = 0; t < started; t++) pthread_join(tids[t], NULL);
+
+    if (pl.failed) {
+        fprintf(stderr, "Parallel conversion failed (out of memory or write error).\n");
+        rc = 1;
+    } else if (fflush(out) != 0) {
+        fprintf(stderr, "Write error.\n");
+        rc = 1;
+    }
+    if (bad) fprintf(stderr, "Skipped %zu invalid tokens.\n", bad);
+    if (job->in_fmt != FMT_TEXT && size % format_width(job->in_fmt))
+        fprintf(stderr, "Ignoring %zu trailing bytes.\n", size % format_width(job->in_fmt));
+
+    for (size_t k = 0; pl.slots && k < pl.window; k++) free(pl.slots[k].out.buf);
+    free(pl.slots);
+    free(tids);
+    pthread_mutex_destroy(&pl.lock);
+    pthread_cond_destroy(&pl.slot_free);
+    pthread_cond_destroy(&pl.chunk_done);
+    munmap(data, size);
+    return rc;
+}
+#endif
+
+static int batch_main(int argc, char **argv) {
+    const char *isa = "auto", *in_path = NULL, *out_path = NULL;
+    int in_fmt = FMT_TEXT, out_fmt = FMT_TEXT, threads = 1;
+    BatchJob job;
+    int csv = strcmp(argv[1], "--csv") == 0;
+    memset(&job, 0, sizeof(job));
+    if (argc < 3 || (csv ? parse_csv_spec(argv[2], &job) : parse_column_spec(argv[2], &job)) != 0) {
+        fprintf(stderr, "Usage: %s --batch PAIR[,PAIR...] [--in FMT] [--out FMT] "
+                        "[--isa auto|avx2|sse2|scalar] [--threads N] [input [output]]\n"
+                        "       %s --csv COL=PAIR[,COL=PAIR...] [--delim C] "
+                        "[--isa auto|avx2|sse2|scalar] [--threads N] [input [output]]\n"
+                        "PAIR is FROM:TO (C F K R Re De N Ro), c2f|c2k|f2c|f2k|k2c|k2f, "
+                        "1-6, or - to leave a column as is; COL counts from 1\n", argv[0], argv[0]);
+        return 2;
+    }
+    job.delim = csv ? ',' : 0;
+    for (int i = 3; i < argc; i++) {
+        if (csv && strcmp(argv[i], "--delim") == 0 && i + 1 < argc) {
+            const char *d = argv[++i];
+            job.delim = strcmp(d, "tab") == 0 || strcmp(d, "\\t") == 0 ? '\t' : d[0];
+        } else if (strcmp(argv[i], "--in") == 0 && i + 1 < argc) in_fmt = parse_format(argv[++i]);
+        else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) out_fmt = parse_format(argv[++i]);
+        else if (strcmp(argv[i], "--isa") == 0 && i + 1 < argc) isa = argv[++i];
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (!in_path) in_path = argv[i];
+        else out_path = argv[i];
+    }
+    if (in_fmt < 0 || out_fmt < 0) {
+        fprintf(stderr, "Format must be text, f64 or f32.\n");
+        return 2;
+    }
+    if (csv && (in_fmt != FMT_TEXT || out_fmt != FMT_TEXT || job.delim == '\0' ||
+                job.delim == '\n' || job.delim == '"')) {
+        fprintf(stderr, "CSV mode reads and writes text with a single-character delimiter.\n");
+        return 2;
+    }
+
+    FILE *in = stdin, *out = stdout;
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);        // raw f64/f32 and no CRLF translation
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    if (in_path && strcmp(in_path, "-") != 0 && !(in = fopen(in_path, "rb"))) {
+        perror(in_path);
+        return 1;
+    }
+    if (out_path && strcmp(out_path, "-") != 0 && !(out = fopen(out_path, "wb"))) {
+        perror(out_path);
+        if (in != stdin) fclose(in);
+        return 1;
+    }
+    job.in_fmt = in_fmt;
+    job.out_fmt = out_fmt;
+    job.kernel = select_kernel(isa);
+    job.mask = select_mask_kernel(isa);
+    int rc = -1;
+#ifdef HAVE_PARALLEL
+    if (threads <= 0) threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > 1 && in != stdin) rc = run_parallel(in_path, out, &job, threads);
+#endif
+    if (rc < 0) rc = csv ? run_csv(in, out, &job) : run_batch(in, out, &job);   // stdin, pipes, or one thread
+    if (in != stdin) fclose(in);
+    if (out != stdout && fclose(out) != 0) rc = 1;
+    return rc;
+}
+
 // Main menu
-int main() {
+int main(int argc, char **argv) {
+    INSTR_INIT("temparature_converter");
+    if (argc > 1 && (strcmp(argv[1], "--batch") == 0 || strcmp(argv[1], "--csv") == 0))
+        return batch_main(argc, argv);
+    if (argc > 1 && strcmp(argv[1], "--selftest-numfmt") == 0)
+        return selftest_numfmt(argc > 2 ? atol(argv[2]) : 5000000L) ? 1 : 0;
+    if (argc > 1 && strcmp(argv[1], "--bench-numfmt") == 0)
+        return bench_numfmt(argc > 2 ? atol(argv[2]) : 100000000L);
+    if (argc > 1 && strcmp(argv[1], "--selftest-engine") == 0)
+        return selftest_engine(argc > 2 ? atol(argv[2]) : 1000000L);
+
     printf("\t\t_____ TEMPERATURE CONVERTER _____\n");
 
     while (1) {
@@ -74,6 +1569,7 @@ int main() {
         printf("\n5. Kelvin to Celsius");
         printf("\n6. Kelvin to Fahrenheit");
         printf("\n7. Exit");
+        printf("\n8. Any scale to any scale");
 
         int choice;
         printf("\n\nEnter Your Choice: ");
@@ -87,7 +1583,8 @@ int main() {
             case 5: kelvin_to_celsius(); break;
             case 6: kelvin_to_fahrenheit(); break;
             case 7: exit(0);
-            default: printf("Enter a valid choice (1-7).\n");
+            case 8: any_scale_to_any_scale(); break;
+            default: printf("Enter a valid choice (1-8).\n");
         }
     }
 